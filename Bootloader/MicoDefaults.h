@@ -39,6 +39,10 @@ extern "C"
 
 #define NO_MICO_RTOS
 
+/* Holds a whole YMODEM packet, so the next one is received while the last one
+   is written to flash */
+#define STDIO_BUFFER_SIZE   2048
+
 #ifdef __cplusplus
 } /*extern "C" */
 #endif
@@ -32,6 +32,10 @@
 
 #include "MicoPlatform.h"
 #include "debug.h"
+#include "LZUtils.h"
+#include "DeltaUtils.h"
+#include "CheckSumUtils.h"
+#include "OTAUtils.h"
 
 typedef int Log_Status;					
 #define Log_NotExist				1
@@ -44,14 +48,29 @@ typedef int Log_Status;
 
 #define SizePerRW 4096   /* Bootloader need 2xSizePerRW RAM heap size to operate, 
                             but it can boost the setup. */
+#define SizePerPatchRead 256
+#define PatchStageAlign  0x1000  /* The new image is made after the patch, from a sector boundary */
 
 #ifdef MICO_FLASH_FOR_UPDATE
 static uint8_t data[SizePerRW];
 static uint8_t newData[SizePerRW];
 static uint8_t paraSaveInRam[PARA_FLASH_SIZE];
+static uint8_t oldData[SizePerPatchRead];
 
 static uint32_t destStartAddress, destEndAddress;
 static mico_flash_t destFlashType;
+/* Destination sectors are erased when the copy reaches them */
+static uint32_t destErasedEnd;
+
+/* Where decoded data is programmed */
+static mico_flash_t streamFlashType;
+static uint32_t streamAddress, streamEndAddress, streamCRC;
+static bool streamToDest;
+
+/* newData is the window of the LZ decoder */
+#if ( SizePerRW < kLZWindowSize )
+#error "SizePerRW is smaller than the LZ window"
+#endif
 #endif
 
 /* Upgrade iamge should save this table to flash */
@@ -60,13 +79,18 @@ typedef struct  _boot_table_t {
   uint32_t length; // file real length
   uint8_t version[8];
   uint8_t type; // B:bootloader, P:boot_table, A:application, D: 8782 driver
-  uint8_t upgrade_type; //u:upgrade, 
+  uint8_t upgrade_type; //U:upgrade, Z:upgrade from an LZ stream, P:patch the current image
   uint8_t reserved[6];
 }boot_table_t;
 
 #define update_log(M, ...) custom_log("UPDATE", M, ##__VA_ARGS__)
 #define update_log_trace() custom_log_trace("UPDATE")
 
+/* Copy and clear times are only measured when update_log() prints them */
+#if DEBUG && !defined(MICO_DISABLE_STDIO)
+#define UPDATE_LOG_TIME
+#endif
+
 #ifndef MICO_FLASH_FOR_UPDATE
 OSStatus update(void)
 {
@@ -84,7 +108,7 @@ Log_Status updateLogCheck(boot_table_t *updateLog)
   if(i == sizeof(boot_table_t))
     return Log_NotExist;
   
-  if(updateLog->upgrade_type == 'U'){
+  if(updateLog->upgrade_type == 'U' || updateLog->upgrade_type == 'Z' || updateLog->upgrade_type == 'P'){
     if(updateLog->start_address != UPDATE_START_ADDRESS)
       return Log_StartAddressERROR;
     if(updateLog->type == 'B'){
@@ -117,16 +141,280 @@ Log_Status updateLogCheck(boot_table_t *updateLog)
     return Log_UpdateTagNotExist;
 }
 
+/* Erase the destination sectors up to the end of the next write. The sectors
+   behind the new image keep the old one, nothing reads them. */
+static OSStatus destErase(uint32_t address, uint32_t length)
+{
+  OSStatus err = kNoErr;
+  uint32_t sectorStart, sectorEnd;
+  
+  while(destErasedEnd < address + length - 1){
+    err = MicoFlashGetSector(destFlashType, destErasedEnd + 1, &sectorStart, &sectorEnd);
+    require_noerr(err, exit);
+    err = MicoFlashErase(destFlashType, sectorStart, sectorEnd);
+    require_noerr(err, exit);
+    destErasedEnd = sectorEnd;
+  }
+  
+exit:
+  return err;
+}
+
+static OSStatus streamOutput(void *inContext, const uint8_t *inData, size_t inLen)
+{
+  OSStatus err;
+  UNUSED_PARAMETER(inContext);
+  
+  require_action(streamAddress + inLen - 1 <= streamEndAddress, exit, err = kSizeErr);
+  if(streamToDest){
+    err = destErase(streamAddress, inLen);
+    require_noerr(err, exit);
+  }
+  streamCRC = CRC32_Update(streamCRC, inData, inLen);
+  err = MicoFlashWrite(streamFlashType, &streamAddress, (uint8_t *)inData, inLen);
+  
+exit:
+  return err;
+}
+
+/* CRC32 of a flash range, read through data */
+static OSStatus flashCRC(mico_flash_t flash, uint32_t address, uint32_t length, uint32_t *crc)
+{
+  OSStatus err = kNoErr;
+  uint32_t size;
+  
+  *crc = 0;
+  for(; length > 0; length -= size){
+    size = Min(length, SizePerRW);
+    err = MicoFlashRead(flash, &address, data, size);
+    require_noerr(err, exit);
+    *crc = CRC32_Update(*crc, data, size);
+  }
+  
+exit:
+  return err;
+}
+
+/* Decompress the LZ stream in the update partition while programming the
+   destination, then check the CRC of what was decoded and of what was
+   programmed. */
+OSStatus updateFromLZStream(boot_table_t *updateLog)
+{
+  lz_stream_header_t header;
+  lz_decoder_t decoder;
+  uint32_t updateStartAddress = UPDATE_START_ADDRESS;
+  uint32_t left, size;
+  uint32_t crc;
+  OSStatus err;
+  
+  err = MicoFlashRead(MICO_FLASH_FOR_UPDATE, &updateStartAddress, (uint8_t *)&header, sizeof(lz_stream_header_t));
+  require_noerr(err, exit);
+  require_action(header.magic == kLZStreamMagic, exit, err = kFormatErr);
+  require_action(header.packedLength + sizeof(lz_stream_header_t) == updateLog->length, exit, err = kFormatErr);
+  require_action(header.length <= destEndAddress - destStartAddress + 1, exit, err = kSizeErr);
+  update_log("Decompress %d bytes to %d bytes", updateLog->length, header.length);
+  
+  streamFlashType = destFlashType;
+  streamAddress = destStartAddress;
+  streamEndAddress = destEndAddress;
+  streamCRC = 0;
+  streamToDest = true;
+  LZ_DecodeInit(&decoder, newData, streamOutput, NULL);
+  for(left = header.packedLength; left > 0; left -= size){
+    size = Min(left, SizePerRW);
+    err = MicoFlashRead(MICO_FLASH_FOR_UPDATE, &updateStartAddress, data, size);
+    require_noerr(err, exit);
+    err = LZ_DecodeUpdate(&decoder, data, size);
+    require_noerr(err, exit);
+  }
+  err = LZ_DecodeFinal(&decoder);
+  require_noerr(err, exit);
+  require_action(decoder.outLength == header.length && streamCRC == header.crc, exit, err = kChecksumErr);
+  
+  err = flashCRC(destFlashType, destStartAddress, header.length, &crc);
+  require_noerr(err, exit);
+  require_action(crc == header.crc, exit, err = kWriteErr);
+  
+exit:
+  return err;
+}
+
+static OSStatus patchReadOld(void *inContext, uint32_t inOffset, uint8_t *outData, size_t inLen)
+{
+  uint32_t address = destStartAddress + inOffset;
+  UNUSED_PARAMETER(inContext);
+  
+  return MicoFlashRead(destFlashType, &address, outData, inLen);
+}
+
+static OSStatus patchInput(void *inContext, const uint8_t *inData, size_t inLen)
+{
+  return Delta_PatchUpdate((delta_patcher_t *)inContext, inData, inLen);
+}
+
+/* Make the new image from the destination and the delta patch in the update
+   partition. It is programmed behind the patch, so the destination is only
+   read, and is checked before the caller copies it over. Returns kMismatchErr
+   if the destination is not the image the patch was made for. */
+OSStatus updateStageFromPatch(boot_table_t *updateLog, uint32_t *stageAddress)
+{
+  delta_patch_header_t header;
+  delta_patcher_t patcher;
+  lz_decoder_t decoder;
+  uint32_t updateStartAddress = UPDATE_START_ADDRESS;
+  uint32_t stage, left, size, i;
+  uint32_t crc;
+  bool blank;
+  OSStatus err;
+  
+  err = MicoFlashRead(MICO_FLASH_FOR_UPDATE, &updateStartAddress, (uint8_t *)&header, sizeof(delta_patch_header_t));
+  require_noerr(err, exit);
+  require_action(header.magic == kDeltaPatchMagic, exit, err = kFormatErr);
+  require_action(header.packedLength + sizeof(delta_patch_header_t) == updateLog->length, exit, err = kFormatErr);
+  require_action(header.oldLength <= destEndAddress - destStartAddress + 1, exit, err = kSizeErr);
+  require_action(header.newLength <= destEndAddress - destStartAddress + 1, exit, err = kSizeErr);
+  
+  stage = (UPDATE_START_ADDRESS + updateLog->length + PatchStageAlign - 1) & ~(PatchStageAlign - 1);
+  require_action(stage + header.newLength - 1 < OTA_CHECKPOINT_START_ADDRESS, exit, err = kNoSpaceErr);
+  *stageAddress = stage;
+  updateLog->length = header.newLength;
+  
+  err = MicoFlashInitialize( destFlashType );
+  require_noerr(err, exit);
+  
+  /* The download erased the whole partition. Something is already there if a
+     try before was cut, and if power was lost while the made image was being
+     copied, it is complete. */
+  crc = 0;
+  blank = true;
+  for(left = header.newLength, updateStartAddress = stage; left > 0; left -= size){
+    size = Min(left, SizePerRW);
+    err = MicoFlashRead(MICO_FLASH_FOR_UPDATE, &updateStartAddress, data, size);
+    require_noerr(err, exit);
+    crc = CRC32_Update(crc, data, size);
+    for(i = 0; blank && i < size; i++)
+      if(data[i] != 0xFF) blank = false;
+  }
+  if(crc == header.newCRC){
+    update_log("Patched image is already made at 0x%08x", stage);
+    goto exit;
+  }
+  
+  err = flashCRC(destFlashType, destStartAddress, header.oldLength, &crc);
+  require_noerr(err, exit);
+  require_action(crc == header.oldCRC, exit, err = kMismatchErr);
+  update_log("Patch %d bytes to %d bytes at 0x%08x", header.packedLength, header.newLength, stage);
+  
+  if(!blank){
+    err = MicoFlashErase(MICO_FLASH_FOR_UPDATE, stage, stage + header.newLength - 1);
+    require_noerr(err, exit);
+  }
+  
+  streamFlashType = MICO_FLASH_FOR_UPDATE;
+  streamAddress = stage;
+  streamEndAddress = OTA_CHECKPOINT_START_ADDRESS - 1;
+  streamCRC = 0;
+  streamToDest = false;
+  Delta_PatchInit(&patcher, header.oldLength, header.newLength, oldData, SizePerPatchRead, patchReadOld, streamOutput, NULL);
+  LZ_DecodeInit(&decoder, newData, patchInput, &patcher);
+  updateStartAddress = UPDATE_START_ADDRESS + sizeof(delta_patch_header_t);
+  for(left = header.packedLength; left > 0; left -= size){
+    size = Min(left, SizePerRW);
+    err = MicoFlashRead(MICO_FLASH_FOR_UPDATE, &updateStartAddress, data, size);
+    require_noerr(err, exit);
+    err = LZ_DecodeUpdate(&decoder, data, size);
+    require_noerr(err, exit);
+  }
+  err = LZ_DecodeFinal(&decoder);
+  require_noerr(err, exit);
+  err = Delta_PatchFinal(&patcher);
+  require_noerr(err, exit);
+  require_action(streamCRC == header.newCRC, exit, err = kChecksumErr);
+  
+  err = flashCRC(MICO_FLASH_FOR_UPDATE, stage, header.newLength, &crc);
+  require_noerr(err, exit);
+  require_action(crc == header.newCRC, exit, err = kWriteErr);
+  
+exit:
+  return err;
+}
+
+/* The partition is blank from now on, so the next boots need not check it */
+static OSStatus markUpdateErased(void)
+{
+  uint32_t address = OTA_ERASED_MARKER_ADDRESS;
+  uint8_t marker[sizeof(uint32_t)];
+  
+  WriteLittle32(marker, kOTAErasedMagic);
+  return MicoFlashWrite(MICO_FLASH_FOR_UPDATE, &address, marker, sizeof(marker));
+}
+
+/* The bootloader's raw writers of the update partition call it first, like
+   OTAClearErasedMarker() in the application */
+OSStatus updateClearErasedMarker(void)
+{
+  OSStatus err;
+  uint32_t address = OTA_ERASED_MARKER_ADDRESS;
+  uint8_t marker[sizeof(uint32_t)];
+  
+  err = MicoFlashRead(MICO_FLASH_FOR_UPDATE, &address, marker, sizeof(marker));
+  require_noerr(err, exit);
+  if(ReadLittle32(marker) == kOTAErasedMagic){
+    /* Programming 0 over it needs no erase */
+    address = OTA_ERASED_MARKER_ADDRESS;
+    memset(marker, 0x0, sizeof(marker));
+    err = MicoFlashWrite(MICO_FLASH_FOR_UPDATE, &address, marker, sizeof(marker));
+  }
+  
+exit:
+  return err;
+}
+
+/* Erase what the download and the update used: the image or the patch and the
+   image made from it, which start at UPDATE_START_ADDRESS, and the checkpoint
+   log. The rest of the partition was erased before the download. */
+static OSStatus eraseUpdateUsed(uint32_t usedEndAddress)
+{
+  OSStatus err;
+  uint32_t sectorStart, sectorEnd;
+  
+  err = MicoFlashGetSector(MICO_FLASH_FOR_UPDATE, usedEndAddress, &sectorStart, &sectorEnd);
+  require_noerr(err, exit);
+  if(sectorEnd + 1 >= OTA_CHECKPOINT_START_ADDRESS){
+    err = MicoFlashErase(MICO_FLASH_FOR_UPDATE, UPDATE_START_ADDRESS, UPDATE_END_ADDRESS);
+    require_noerr(err, exit);
+  }else{
+    err = MicoFlashErase(MICO_FLASH_FOR_UPDATE, UPDATE_START_ADDRESS, sectorEnd);
+    require_noerr(err, exit);
+    err = MicoFlashErase(MICO_FLASH_FOR_UPDATE, OTA_CHECKPOINT_START_ADDRESS, UPDATE_END_ADDRESS);
+    require_noerr(err, exit);
+  }
+  err = markUpdateErased();
+  
+exit:
+  return err;
+}
 
 OSStatus update(void)
 {
   boot_table_t updateLog;
-  uint32_t i, j, size;
+  uint32_t i, size, left;
   uint32_t updateStartAddress;
+  uint32_t updateUsedEnd;
   uint32_t destStartAddress_tmp;
   uint32_t paraStartAddress;
+  uint32_t sessionAddress;
+  uint32_t crc, destCRC;
+#ifdef UPDATE_LOG_TIME
+  uint32_t startTime, copyTime;
+#endif
+  uint32_t sectorStart, checkEnd;
+  bool blank, marked;
   OSStatus err = kNoErr;
  
+#ifdef UPDATE_LOG_TIME
+  startTime = mico_get_time_no_os();
+#endif
   MicoFlashInitialize( (mico_flash_t)MICO_FLASH_FOR_UPDATE );
   memset(data, 0xFF, SizePerRW);
   memset(newData, 0xFF, SizePerRW);
@@ -140,71 +428,96 @@ OSStatus update(void)
 
   /*Not a correct record*/
   if(updateLogCheck(&updateLog) != Log_NeedUpdate){
-    size = UPDATE_FLASH_SIZE/SizePerRW;
-    for(i = 0; i <= size; i++){
-      if( i==size ){
-        err = MicoFlashRead(MICO_FLASH_FOR_UPDATE, &updateStartAddress, data , UPDATE_FLASH_SIZE%SizePerRW);
-        require_noerr(err, exit);
-      }
-      else{
-        err = MicoFlashRead(MICO_FLASH_FOR_UPDATE, &updateStartAddress, data , SizePerRW);
-        require_noerr(err, exit);
-      }
-      
-      for(j=0; j<SizePerRW; j++){
-        if(data[j] != 0xFF){
-          update_log("Update data need to be erased");
-          err = MicoFlashInitialize( MICO_FLASH_FOR_UPDATE );
-          require_noerr(err, exit);
-          err = MicoFlashErase( MICO_FLASH_FOR_UPDATE, UPDATE_START_ADDRESS, UPDATE_END_ADDRESS );
-          require_noerr(err, exit);
-          err = MicoFlashFinalize( MICO_FLASH_FOR_UPDATE );
-          require_noerr(err, exit);
-          break;
-        }
-      }
+    /*Keep an unfinished download, it is resumed by the application*/
+    sessionAddress = OTA_CHECKPOINT_START_ADDRESS;
+    err = MicoFlashRead(MICO_FLASH_FOR_UPDATE, &sessionAddress, data, sizeof(uint32_t));
+    require_noerr(err, exit);
+    if(ReadLittle32(data) == kOTASessionMagic){
+      update_log("Keep OTA session");
+      goto exit;
+    }
+
+    /*Erased since it was used, and nothing was written. Writers that do not
+      know the marker leave it set, so the first sector is still checked*/
+    sessionAddress = OTA_ERASED_MARKER_ADDRESS;
+    err = MicoFlashRead(MICO_FLASH_FOR_UPDATE, &sessionAddress, data, sizeof(uint32_t));
+    require_noerr(err, exit);
+    marked = (ReadLittle32(data) == kOTAErasedMagic);
+    checkEnd = UPDATE_END_ADDRESS;
+    if(marked){
+      err = MicoFlashGetSector(MICO_FLASH_FOR_UPDATE, UPDATE_START_ADDRESS, &sectorStart, &checkEnd);
+      require_noerr(err, exit);
+    }
+
+    blank = true;
+    for(left = checkEnd + 1 - UPDATE_START_ADDRESS; left > 0 && blank; left -= size){
+      size = Min(left, SizePerRW);
+      err = MicoFlashRead(MICO_FLASH_FOR_UPDATE, &updateStartAddress, data, size);
+      require_noerr(err, exit);
+      for(i = 0; blank && i < size; i++)
+        if(data[i] != 0xFF) blank = false;
+    }
+    if(blank && marked)
+      goto exit;
+    if(!blank){
+      update_log("Update data need to be erased");
+      err = MicoFlashErase( MICO_FLASH_FOR_UPDATE, UPDATE_START_ADDRESS, UPDATE_END_ADDRESS );
+      require_noerr(err, exit);
     }
+    err = markUpdateErased();
+    require_noerr(err, exit);
+    update_log("Update data checked in %d ms", mico_get_time_no_os() - startTime);
     goto exit;
   }
   
   update_log("Write OTA data to destination, type:%d, from 0x%08x to 0x%08x, length 0x%x", destFlashType, destStartAddress, destEndAddress, updateLog.length);
   
   destStartAddress_tmp = destStartAddress;
+  destErasedEnd = destStartAddress - 1;
   updateStartAddress = UPDATE_START_ADDRESS;
+  updateUsedEnd = UPDATE_START_ADDRESS + updateLog.length - 1;
+  
+  /* Make the new image first, then copy it like a 'U' image */
+  if(updateLog.upgrade_type == 'P'){
+    err = updateStageFromPatch(&updateLog, &updateStartAddress);
+    if(err == kMismatchErr){
+      update_log("Patch is not made for the current image, drop it");
+      updateUsedEnd = updateStartAddress + updateLog.length - 1;
+      goto clear;
+    }
+    require_noerr(err, exit);
+    updateUsedEnd = updateStartAddress + updateLog.length - 1;
+  }
   
   err = MicoFlashInitialize( destFlashType );
   require_noerr(err, exit);
-  err = MicoFlashErase( destFlashType, destStartAddress, destEndAddress );
+  if(updateLog.upgrade_type == 'Z'){
+    err = updateFromLZStream(&updateLog);
+    require_noerr(err, exit);
+    goto clear;
+  }
+  
+  /* Program the image while its CRC is computed, then check the CRC of what
+     was programmed */
+  crc = 0;
+  for(left = updateLog.length; left > 0; left -= size){
+    size = Min(left, SizePerRW);
+    err = MicoFlashRead(MICO_FLASH_FOR_UPDATE, &updateStartAddress, data, size);
+    require_noerr(err, exit);
+    err = destErase(destStartAddress_tmp, size);
+    require_noerr(err, exit);
+    err = MicoFlashWrite(destFlashType, &destStartAddress_tmp, data, size);
+    require_noerr(err, exit);
+    crc = CRC32_Update(crc, data, size);
+  }
+  err = flashCRC(destFlashType, destStartAddress, updateLog.length, &destCRC);
   require_noerr(err, exit);
-  size = (updateLog.length)/SizePerRW;
-  for(i = 0; i <= size; i++){
-    if( i==size && (updateLog.length)%SizePerRW){
-      err = MicoFlashRead(MICO_FLASH_FOR_UPDATE, &updateStartAddress, data , (updateLog.length)%SizePerRW);
-      require_noerr(err, exit);
-      err = MicoFlashInitialize( destFlashType );
-      require_noerr(err, exit);
-      err = MicoFlashWrite(destFlashType, &destStartAddress_tmp, data, (updateLog.length)%SizePerRW);
-      require_noerr(err, exit);
-      destStartAddress_tmp -= (updateLog.length)%SizePerRW;
-      err = MicoFlashRead(destFlashType, &destStartAddress_tmp, newData , (updateLog.length)%SizePerRW);
-      require_noerr(err, exit);
-      err = memcmp(data, newData, (updateLog.length)%SizePerRW);
-      require_noerr_action(err, exit, err = kWriteErr);
-    }
-    else{
-      err = MicoFlashRead(MICO_FLASH_FOR_UPDATE, &updateStartAddress, data , SizePerRW);
-      require_noerr(err, exit);
-      err = MicoFlashInitialize( destFlashType );
-      require_noerr(err, exit);
-      err = MicoFlashWrite(destFlashType, &destStartAddress_tmp, data, SizePerRW);
-      require_noerr(err, exit);
-      destStartAddress_tmp -= SizePerRW;
-      err = MicoFlashRead(destFlashType, &destStartAddress_tmp, newData , SizePerRW);
-      require_noerr(err, exit);
-      err = memcmp(data, newData, SizePerRW);
-      require_noerr_action(err, exit, err = kWriteErr); 
-    }
-  } 
+  require_action(destCRC == crc, exit, err = kWriteErr);
+  
+clear:
+#ifdef UPDATE_LOG_TIME
+  copyTime = mico_get_time_no_os();
+#endif
   update_log("Update start to clear data...");
     
   paraStartAddress = PARA_START_ADDRESS;
@@ -219,12 +532,16 @@ OSStatus update(void)
   err = MicoFlashWrite(MICO_FLASH_FOR_PARA, &paraStartAddress, paraSaveInRam, PARA_FLASH_SIZE);
   require_noerr(err, exit);
   
-  err = MicoFlashErase(MICO_FLASH_FOR_UPDATE, UPDATE_START_ADDRESS, UPDATE_END_ADDRESS);
+  err = eraseUpdateUsed(updateUsedEnd);
   require_noerr(err, exit);
-  update_log("Update success");
+  update_log("Update success: copy %d ms with %d of %d destination bytes erased, clear %d ms",
+             copyTime - startTime, destErasedEnd + 1 - destStartAddress, destEndAddress + 1 - destStartAddress,
+             mico_get_time_no_os() - copyTime);
   
 exit:
-  if(err != kNoErr) update_log("Update exit with err = %d", err);
+  if(err != kNoErr){
+    update_log("Update exit with err = %d", err);
+  }
   MicoFlashFinalize(MICO_FLASH_FOR_UPDATE);
   MicoFlashFinalize(destFlashType);
   return err;
@@ -95,8 +95,12 @@ extern const char menu[];
 extern void getline (char *line, int n);          /* input line               */
 extern void startApplication(void);
 
+#ifdef MICO_FLASH_FOR_UPDATE
+extern OSStatus updateClearErasedMarker(void);
+#endif
+
 /* Private function prototypes -----------------------------------------------*/
-void SerialDownload(mico_flash_t flash, uint32_t flashdestination, int32_t maxRecvSize);
+void SerialDownload(mico_flash_t flash, uint32_t flashdestination, int32_t maxRecvSize, bool streaming);
 void SerialUpload(mico_flash_t flash, uint32_t flashdestination, char * fileName, int32_t maxRecvSize);
 
 /* Private functions ---------------------------------------------------------*/
@@ -152,16 +156,25 @@ exit:
 
 /**
   * @brief  Download a file via serial port
-  * @param  None
+  * @param  streaming: Receive with YMODEM-G
   * @retval None
   */
-void SerialDownload(mico_flash_t flash, uint32_t flashdestination, int32_t maxRecvSize)
+void SerialDownload(mico_flash_t flash, uint32_t flashdestination, int32_t maxRecvSize, bool streaming)
 {
   char Number[10] = "          ";
   int32_t Size = 0;
 
+#ifdef MICO_FLASH_FOR_UPDATE
+  /* The partition is no longer blank, the next OTA session must erase it */
+  if(flash == MICO_FLASH_FOR_UPDATE && flashdestination <= UPDATE_END_ADDRESS
+     && flashdestination + maxRecvSize - 1 >= UPDATE_START_ADDRESS){
+    MicoFlashInitialize(MICO_FLASH_FOR_UPDATE);
+    updateClearErasedMarker();
+  }
+#endif
+
   printf("Waiting for the file to be sent ... (press 'a' to abort)\n\r");
-  Size = Ymodem_Receive(&tab_1024[0], flash, flashdestination, maxRecvSize);
+  Size = Ymodem_Receive(&tab_1024[0], flash, flashdestination, maxRecvSize, streaming);
   if (Size > 0)
   {
     printf("\n\n\r Programming Completed Successfully!\n\r--------------------------------\r\n Name: ");
@@ -233,6 +246,7 @@ void Main_Menu(void)
   char startAddressStr[10], endAddressStr[10];
   int32_t startAddress, endAddress;
   bool inputFlashArea = false;
+  bool streaming;
 
   while (1)  {                                    /* loop forever                */
     printf ("\n\rMXCHIP> ");
@@ -248,6 +262,7 @@ void Main_Menu(void)
       cmdname[j] = cmdbuf[i];
     }
     cmdname[j] = '\0';
+    streaming = (findCommandPara(cmdbuf, "g", NULL, 0) != -1);  /* YMODEM-G download */
 
     /***************** Command "0" or "BOOTUPDATE": Update the application  *************************/
     if(strcmp(cmdname, "BOOTUPDATE") == 0 || strcmp(cmdname, "0") == 0) {
@@ -259,7 +274,7 @@ void Main_Menu(void)
         continue;
       }
       printf ("\n\rUpdating Bootloader......\n\r");
-      SerialDownload(MICO_FLASH_FOR_BOOT, BOOT_START_ADDRESS, BOOT_FLASH_SIZE);
+      SerialDownload(MICO_FLASH_FOR_BOOT, BOOT_START_ADDRESS, BOOT_FLASH_SIZE, streaming);
     }
 
     /***************** Command "1" or "FWUPDATE": Update the MICO application  *************************/
@@ -272,7 +287,7 @@ void Main_Menu(void)
         continue;
       }
       printf ("\n\rUpdating MICO application......\n\r");
-      SerialDownload(MICO_FLASH_FOR_APPLICATION, APPLICATION_START_ADDRESS, APPLICATION_FLASH_SIZE); 							   	
+      SerialDownload(MICO_FLASH_FOR_APPLICATION, APPLICATION_START_ADDRESS, APPLICATION_FLASH_SIZE, streaming); 							   	
     }
 
     /***************** Command "2" or "DRIVERUPDATE": Update the RF driver  *************************/
@@ -287,7 +302,7 @@ void Main_Menu(void)
         continue;
       }
       printf ("\n\rUpdating RF driver......\n\r");
-      SerialDownload(MICO_FLASH_FOR_DRIVER, DRIVER_START_ADDRESS, DRIVER_FLASH_SIZE);  
+      SerialDownload(MICO_FLASH_FOR_DRIVER, DRIVER_START_ADDRESS, DRIVER_FLASH_SIZE, streaming);  
 #else
       printf ("\n\rNo independ flash memory for RF driver, exiting...\n\r");
 #endif
@@ -303,7 +318,7 @@ void Main_Menu(void)
         continue;
       }
       printf ("\n\rUpdating MICO settings......\n\r");
-      SerialDownload(MICO_FLASH_FOR_PARA, PARA_START_ADDRESS, PARA_FLASH_SIZE);                        
+      SerialDownload(MICO_FLASH_FOR_PARA, PARA_START_ADDRESS, PARA_FLASH_SIZE, streaming);                        
     }
 
     /***************** Command "4" or "FLASHUPDATE": : Update the Flash  *************************/
@@ -374,7 +389,7 @@ void Main_Menu(void)
       }
 
       printf ("\n\rUpdating flash content From 0x%x to 0x%x\n\r", startAddress, endAddress);
-      SerialDownload((mico_flash_t)targetFlash, startAddress, endAddress-startAddress+1);                           
+      SerialDownload((mico_flash_t)targetFlash, startAddress, endAddress-startAddress+1, streaming);                           
     }
 
     /***************** Command: Reboot *************************/
@@ -27,6 +27,7 @@
 #include "MICOSocket.h"
 #include "platform_common_config.h"
 #include "SocketUtils.h"
+#include "OTAUtils.h"
 #include "MICOCrypto/crypto_aead_chacha20poly1305.h"
 
 #define min(a,b) ((a) < (b) ? (a) : (b))
@@ -71,100 +72,107 @@ int HKSecureSocketSend( int sockfd, void *buf, size_t len, security_session_t *s
     return sentLength;
 }
 
-int HKSecureRead(security_session_t *session, int sockfd, void *buf, size_t len)
+void HKSFreeSecuritySession(security_session_t *session)
 {
-  OSStatus    err = kNoErr;
-  int         packageLength;
-  uint32_t         length = 0;
-  uint32_t         recvLength = 0;
-  uint32_t         recvLengthTmp = 0;
-  uint8_t*       *encryptedData = NULL;
-  uint64_t           decryptedDataLen = 0;
+  if(session == NULL) return;
+  if(session->recvedDataBuffer) free(session->recvedDataBuffer);
+  if(session->frameBuffer) free(session->frameBuffer);
+  free(session);
+}
 
+/* 1: readable, 0: timeout or error, -1: no data on a non-blocking session */
+static int _HKSecureWaitReadable(security_session_t *session, int sockfd)
+{
   fd_set      readfds;
-  int         returnLength = 0;
-  int         selectResult;
-  bool        moreData;
   struct      timeval_t t;
-  t.tv_sec  =  20;
-  t.tv_usec =  0;
-
-  if(session->established == true){
-    if(session->recvedDataLen){
-      returnLength += min(len, session->recvedDataLen);
-      memcpy(buf, session->recvedDataBuffer, returnLength);
-      session->recvedDataLen -= returnLength;
-      if(session->recvedDataLen)
-        memmove(session->recvedDataBuffer, session->recvedDataBuffer+returnLength, session->recvedDataLen);
-      else
-        free(session->recvedDataBuffer);
-      goto exit;
-    }else{
-      while( recvLengthTmp < sizeof(int)){
-        FD_ZERO( &readfds );
-        FD_SET( sockfd, &readfds );
-        selectResult = select( sockfd + 1, &readfds, NULL, NULL, &t );
-        require(selectResult >= 1, exit);
-        length = read( sockfd, (uint8_t *)&packageLength + recvLengthTmp, sizeof(int) - recvLengthTmp);
-        if( length > 0 ) recvLengthTmp += length;
-        else return 0;
-      }
 
-      recvLength = packageLength + crypto_aead_chacha20poly1305_ABYTES;
-      recvLengthTmp = 0;
-
-      encryptedData = malloc(recvLength);
-      require(encryptedData, exit);
-
-      while( recvLengthTmp < recvLength){
-        FD_ZERO( &readfds );
-        FD_SET( sockfd, &readfds );
-        selectResult = select( sockfd + 1, &readfds, NULL, NULL, &t );
-        require(selectResult >= 1, exit);
-
-        length = read( sockfd, encryptedData + recvLengthTmp, recvLength - recvLengthTmp );
-        if( length > 0 ) recvLengthTmp += length;
-        else return 0;
-      }
+  t.tv_sec  =  session->nonBlocking? 0 : 20;
+  t.tv_usec =  0;
+  FD_ZERO( &readfds );
+  FD_SET( sockfd, &readfds );
+  if( select( sockfd + 1, &readfds, NULL, NULL, &t ) >= 1 ) return 1;
+  return session->nonBlocking? -1 : 0;
+}
 
-      session->recvedDataBuffer = malloc(packageLength);
-      require(session->recvedDataBuffer, exit);
+int HKSecureRead(security_session_t *session, int sockfd, void *buf, size_t len)
+{
+  OSStatus    err = kNoErr;
+  int         length;
+  uint32_t    recvLength;
+  unsigned long long decryptedDataLen = 0;
+  int         returnLength = 0;
+  int         readable;
 
+  if(session->established == false){
+    if(session->nonBlocking && _HKSecureWaitReadable(session, sockfd) < 0) return -1;
+    return read( sockfd, buf, len);
+  }
 
-      err =  crypto_aead_chacha20poly1305_decrypt(session->recvedDataBuffer, &session->recvedDataLen, NULL, 
-                                                     (const unsigned char *)encryptedData, recvLength, (uint8_t *)&packageLength, 4,  
-                                                     (uint8_t *)(&session->inputSeqNo), (const unsigned char *)session->InputKey);
+  if(session->recvedDataLen == 0){
+    /*Length field, then the encrypted frame, either may arrive in pieces*/
+    while( session->frameRecvedLen < sizeof(int)){
+      readable = _HKSecureWaitReadable(session, sockfd);
+      if(readable < 0) return -1;
+      require_action(readable == 1, exit, err = kTimeoutErr);
+      length = read( sockfd, (uint8_t *)&session->frameLength + session->frameRecvedLen, sizeof(int) - session->frameRecvedLen);
+      require_action(length > 0, exit, err = kConnectionErr);
+      session->frameRecvedLen += length;
+    }
 
-      session->inputSeqNo++;
+    require_action(session->frameLength > 0 && session->frameLength <= 1024, exit, err = kMalformedErr);
+    recvLength = session->frameLength + crypto_aead_chacha20poly1305_ABYTES;
 
-      require_noerr(err, exit);
-      require(session->recvedDataLen == recvLength - crypto_aead_chacha20poly1305_ABYTES, exit);
+    if(session->frameBuffer == NULL){
+      session->frameBuffer = malloc(recvLength);
+      require_action(session->frameBuffer, exit, err = kNoMemoryErr);
+    }
 
-      free(encryptedData);
-      encryptedData = NULL;
+    while( session->frameRecvedLen < sizeof(int) + recvLength){
+      readable = _HKSecureWaitReadable(session, sockfd);
+      if(readable < 0) return -1;
+      require_action(readable == 1, exit, err = kTimeoutErr);
+      length = read( sockfd, session->frameBuffer + session->frameRecvedLen - sizeof(int), sizeof(int) + recvLength - session->frameRecvedLen );
+      require_action(length > 0, exit, err = kConnectionErr);
+      session->frameRecvedLen += length;
+    }
 
-      returnLength += min(len, session->recvedDataLen);
-      memcpy(buf, session->recvedDataBuffer, returnLength);
-      session->recvedDataLen -= returnLength;
-      if(session->recvedDataLen)
-        memmove(session->recvedDataBuffer, session->recvedDataBuffer+returnLength, session->recvedDataLen);
-      else
-        free(session->recvedDataBuffer);
+    session->recvedDataBuffer = malloc(session->frameLength);
+    require_action(session->recvedDataBuffer, exit, err = kNoMemoryErr);
 
-      goto exit;
+    err =  crypto_aead_chacha20poly1305_decrypt(session->recvedDataBuffer, &decryptedDataLen, NULL, 
+                                                (const unsigned char *)session->frameBuffer, recvLength, (uint8_t *)&session->frameLength, 4,  
+                                                (uint8_t *)(&session->inputSeqNo), (const unsigned char *)session->InputKey);
+    session->inputSeqNo++;
+    require_noerr(err, exit);
+    require_action(decryptedDataLen == recvLength - crypto_aead_chacha20poly1305_ABYTES, exit, err = kMalformedErr);
 
-    }
+    session->recvedDataLen = decryptedDataLen;
+    free(session->frameBuffer);
+    session->frameBuffer = NULL;
+    session->frameRecvedLen = 0;
+  }
 
-    exit:
-      if(err == kNoErr)
-        return returnLength;
-      else{
-        if(encryptedData) free(encryptedData);
-        return 0;
-      }
+  returnLength = min(len, session->recvedDataLen);
+  memcpy(buf, session->recvedDataBuffer, returnLength);
+  session->recvedDataLen -= returnLength;
+  if(session->recvedDataLen)
+    memmove(session->recvedDataBuffer, session->recvedDataBuffer+returnLength, session->recvedDataLen);
+  else{
+    free(session->recvedDataBuffer);
+    session->recvedDataBuffer = NULL;
   }
-  else
-    return read( sockfd, buf, len);
+
+exit:
+  if(err == kNoErr)
+    return returnLength;
+
+  if(session->frameBuffer) free(session->frameBuffer);
+  session->frameBuffer = NULL;
+  session->frameRecvedLen = 0;
+  if(session->recvedDataBuffer) free(session->recvedDataBuffer);
+  session->recvedDataBuffer = NULL;
+  session->recvedDataLen = 0;
+  return 0;
 }
 
 
@@ -199,7 +207,7 @@ int HKSocketReadHTTPHeader( int inSock, HTTPHeader_t *inHeader, security_session
       n = HKSecureRead( session, inSock, dst, (size_t)( lim - dst ) );
       if(      n  > 0 ) len = (size_t) n;
       else if( n == 0 ) { err = kConnectionErr; goto exit; }
-      else goto exit;
+      else { err = EWOULDBLOCK; goto exit; }
     }
     dst += len;
     inHeader->len += len;
@@ -228,6 +236,8 @@ int HKSocketReadHTTPHeader( int inSock, HTTPHeader_t *inHeader, security_session
     hkhttp_utils_log("Receive OTA data!");        
     err = MicoFlashInitialize(MICO_FLASH_FOR_UPDATE);
     require_noerr(err, exit);
+    err = OTAClearErasedMarker();
+    require_noerr(err, exit);
     err = MicoFlashWrite(MICO_FLASH_FOR_UPDATE, &flashStorageAddress, (uint8_t *)end, inHeader->extraDataLen);
     require_noerr(err, exit);
   }else{
@@ -259,7 +269,7 @@ int HKSocketReadHTTPBody  ( int inSock, HTTPHeader_t *inHeader, security_session
   
   while ( inHeader->extraDataLen < inHeader->contentLength )
   {
-    if(session->recvedDataLen == 0){
+    if(session->recvedDataLen == 0 && session->nonBlocking == false){
       FD_ZERO( &readSet );
       FD_SET( inSock, &readSet );
       selectResult = select( inSock + 1, &readSet, NULL, NULL, NULL );
@@ -283,7 +293,7 @@ int HKSocketReadHTTPBody  ( int inSock, HTTPHeader_t *inHeader, security_session
       
       if( readResult  > 0 ) inHeader->extraDataLen += readResult;
       else if( readResult == 0 ) { err = kConnectionErr; goto exit; }
-      else goto exit;
+      else { err = EWOULDBLOCK; goto exit; }
       
       err = MicoFlashWrite(MICO_FLASH_FOR_UPDATE, &flashStorageAddress, (uint8_t *)inHeader->otaDataPtr, readResult);
       require_noerr(err, exit);
@@ -297,7 +307,7 @@ int HKSocketReadHTTPBody  ( int inSock, HTTPHeader_t *inHeader, security_session
       
       if( readResult  > 0 ) inHeader->extraDataLen += readResult;
       else if( readResult == 0 ) { err = kConnectionErr; goto exit; }
-      else goto exit;
+      else { err = EWOULDBLOCK; goto exit; }
     }
   }
   
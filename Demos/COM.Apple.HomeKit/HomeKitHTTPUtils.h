@@ -36,14 +36,24 @@ typedef struct _security_session_t {
   uint8_t*      recvedDataBuffer;
   uint64_t      outputSeqNo;
   uint64_t      inputSeqNo;
+  bool          nonBlocking;    // Reads return -1 instead of waiting for data
+  int           frameLength;    // Encrypted frame being received, kept between non-blocking reads
+  uint32_t      frameRecvedLen;
+  uint8_t*      frameBuffer;
 } security_session_t;
 
 security_session_t *HKSNewSecuritySession(void);
 
 int HKSecureSocketSend( int sockfd, void *buf, size_t len, security_session_t *session);
 
+void HKSFreeSecuritySession(security_session_t *session);
+
+/* Returns 0 if the connection is closed or on error, and -1 if the session is non-blocking and
+   the socket has no data, a partially received frame is kept in the session */
 int HKSecureRead(security_session_t *session, int sockfd, void *buf, size_t len);
 
+/* Return EWOULDBLOCK on a non-blocking session if the request is not complete, call again
+   when the socket is readable */
 int HKSocketReadHTTPHeader( int inSock, HTTPHeader_t *inHeader, security_session_t *session );
 
 int HKSocketReadHTTPBody  ( int inSock, HTTPHeader_t *inHeader, security_session_t *session );
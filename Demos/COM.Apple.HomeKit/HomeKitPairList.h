@@ -1,10 +1,10 @@
 /**
   ******************************************************************************
-  * @file    MICOPARASTORAGE.c 
+  * @file    HomeKitPairList.h
   * @author  William Xu
   * @version V1.0.0
   * @date    05-May-2014
-  * @brief   This file provide operations on nonvolatile memory.
+  * @brief   This file provide operations on HomeKit controllers' pairing records.
   ******************************************************************************
   * @attention
   *
@@ -17,24 +17,19 @@
   *
   * <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
   ******************************************************************************
-  */ 
+  */
 #include "Common.h"
 
 #define MAXPairNumber       50
-/*Pair Info flash content*/
-typedef struct _pair_t {
-  char             controllerName[64];
-  uint8_t          controllerLTPK[32];
-} _pair_t;
-
-typedef struct _pair_list_in_flash_t {
-  _pair_t          pairInfo[MAXPairNumber];
-} pair_list_in_flash_t;
-
 
+/* Pairing records are appended to the EX_PARA sector, the sector is compacted
+   only when it is full. All lookups are served from a RAM index. */
+OSStatus HMPairListInit(void);
 OSStatus HMClearPairList(void);
-OSStatus HMReadPairList(pair_list_in_flash_t *pPairList);
-OSStatus HMUpdatePairList(pair_list_in_flash_t *pPairList);
-uint8_t * HMFindLTPK(char * name);
 
+/* Add or replace a controller's LTPK, return kNoSpaceErr if MAXPairNumber is reached */
+OSStatus HMAddPair(const char * name, const uint8_t * LTPK);
+OSStatus HMRemovePair(const char * name);
 
+/* Returned LTPK is valid until the controller's pairing is removed */
+uint8_t * HMFindLTPK(char * name);
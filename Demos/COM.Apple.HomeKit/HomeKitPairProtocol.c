@@ -16,6 +16,8 @@
 #include "MICOCrypto/crypto_sign.h"
 #include "HMAC_HKDF/sha.h"
 #include "HomeKitPairProtocol.h"
+#include "HomeKitSessionCache.h"
+#include "HomeKitSRPPool.h"
 
 #define pair_log(M, ...) custom_log("HomeKitPair", M, ##__VA_ARGS__)
 #define pair_log_trace() custom_log_trace("HomeKitPair")
@@ -38,10 +40,18 @@ const char * hkdfVerifyInfo =       "Pair-Verify-Encryption-Key";
 const char * hkdfC2AInfo =          "Control-Write-Info";
 const char * hkdfA2CInfo =          "Control-Read-Info";
 
+const char * hkdfSessionIDSalt =    "Pair-Verify-ResumeSessionID-Salt";
+const char * hkdfSessionIDInfo =    "Pair-Verify-ResumeSessionID-Info";
+const char * hkdfResumeRequestInfo =  "Pair-Resume-Request-Info";
+const char * hkdfResumeRespondInfo =  "Pair-Resume-Response-Info";
+const char * hkdfResumeSecretInfo =   "Pair-Resume-Shared-Secret-Info";
+
 const char * AEAD_Nonce_Setup05 =   "PS-Msg05";
 const char * AEAD_Nonce_Setup06 =   "PS-Msg06";
 const char * AEAD_Nonce_Verify02 =  "PV-Msg02";
 const char * AEAD_Nonce_Verify03 =  "PV-Msg03";
+const char * AEAD_Nonce_Resume01 =  "PR-Msg01";
+const char * AEAD_Nonce_Resume02 =  "PR-Msg02";
 
 const char *stateDescription[7] = {"", "kTLVType_State = M1", "kTLVType_State = M2", "kTLVType_State = M3",
                                    "kTLVType_State = M4", "kTLVType_State = M5", "kTLVType_State = M6"};
@@ -64,10 +74,21 @@ OSStatus _HandleState_WaitingForVerifyStartRequest( HTTPHeader_t* inHeader, pair
 OSStatus _HandleState_WaitingForVerifyStartRespond(int inFd, pairVerifyInfo_t* inInfo, mico_Context_t * const inContext);
 OSStatus _HandleState_WaitingForVerifyFinishRequest(HTTPHeader_t* inHeader, pairVerifyInfo_t* inInfo, mico_Context_t * const inContext );
 OSStatus _HandleState_WaitingForVerifyFinishRespond(int inFd, pairVerifyInfo_t* inInfo, mico_Context_t * const inContext);
+OSStatus _HandleState_HandleResumeRespond(int inFd, pairVerifyInfo_t* inInfo, mico_Context_t * const inContext);
+static OSStatus _HKDeriveControlKeys(pairVerifyInfo_t* inInfo);
 
 void HKSetPassword (char * password)
 {
   _password = password;
+  HKSRPPoolSetPassword(password);
+}
+
+/*Copy a TLV value into a new zero terminated buffer, only for values kept after the request is parsed*/
+static char * _HKTLVItemDup(const TLVItem_t *inItem)
+{
+  char *dup = calloc(inItem->len + 1, sizeof(uint8_t));
+  if(dup) TLVItemCopy(inItem, (uint8_t *)dup, inItem->len);
+  return dup;
 }
 
 
@@ -101,9 +122,15 @@ exit:
 void HKCleanPairVerifyInfo(pairVerifyInfo_t **verifyInfo){
     if(*verifyInfo){
     if((*verifyInfo)->pControllerCurve25519PK) free((*verifyInfo)->pControllerCurve25519PK);
+    if((*verifyInfo)->pControllerName) free((*verifyInfo)->pControllerName);
+    if((*verifyInfo)->pResumeSessionID) free((*verifyInfo)->pResumeSessionID);
+    if((*verifyInfo)->pResumeRequest) free((*verifyInfo)->pResumeRequest);
     if((*verifyInfo)->pAccessoryCurve25519PK) free((*verifyInfo)->pAccessoryCurve25519PK);
     if((*verifyInfo)->pAccessoryCurve25519SK) free((*verifyInfo)->pAccessoryCurve25519SK);
-    if((*verifyInfo)->pSharedSecret) free((*verifyInfo)->pSharedSecret);
+    if((*verifyInfo)->pSharedSecret){
+      memset((*verifyInfo)->pSharedSecret, 0x0, 32);
+      free((*verifyInfo)->pSharedSecret);
+    }
     if((*verifyInfo)->pHKDFKey) free((*verifyInfo)->pHKDFKey);
     if((*verifyInfo)->A2CKey) free((*verifyInfo)->A2CKey);
     if((*verifyInfo)->C2AKey) free((*verifyInfo)->C2AKey);
@@ -158,12 +185,8 @@ exit:
 OSStatus _HandleState_WaitingForSRPStartRequest( HTTPHeader_t* inHeader, pairInfo_t** inInfo, mico_Context_t * const inContext )
 {
   pair_log_trace();
-  const uint8_t *             src = (const uint8_t *) inHeader->extraDataPtr;
-  const uint8_t * const       end = src + inHeader->extraDataLen;
-  uint8_t                     eid;
-  const uint8_t *             ptr;
-  size_t                      len;
-  char *                      tmp;
+  TLVReader_t                 reader;
+  TLVItem_t                   item;
 
   OSStatus err = kNoErr;
   pair_log("Free memory1: %d", mico_memory_info()->free_memory);
@@ -181,30 +204,28 @@ OSStatus _HandleState_WaitingForSRPStartRequest( HTTPHeader_t* inHeader, pairInf
   require_action(*inInfo, exit, err = kNoMemoryErr);
   inContext->appStatus.haPairSetupRunning = true;
 
-  while( TLVGetNext( src, end, &eid, &ptr, &len, &src ) == kNoErr )
+  TLVReaderInit( &reader, (const uint8_t *) inHeader->extraDataPtr, inHeader->extraDataLen );
+  while( TLVReaderNext( &reader, &item ) == kNoErr )
   {
-    tmp = calloc( len + 1, sizeof( uint8_t ) );
-    require_action( tmp, exit, err = kNoMemoryErr );
-    memcpy( tmp, ptr, len );
-
-    switch( eid )
+    switch( item.type )
     {
       case kTLVType_State:
-        pair_log("Recv: %s", stateDescription[*(uint8_t *)tmp]);
-        require_action(haPairSetupState == *(uint8_t *)tmp, exit, err = kValueErr);
-        free(tmp);
+        require_action(item.len == sizeof(uint8_t), exit, err = kSizeErr);
+        pair_log("Recv: %s", stateDescription[*item.data]);
+        require_action(haPairSetupState == *item.data, exit, err = kValueErr);
       break;
         case kTLVType_Method:
-        pair_log("Recv: kTLVType_Method: %s", methodDescription[*(uint8_t *)tmp]);
-        free(tmp);
+        require_action(item.len == sizeof(uint8_t), exit, err = kSizeErr);
+        pair_log("Recv: kTLVType_Method: %s", methodDescription[*item.data]);
         break;
       case kTLVType_User:
-        (*inInfo)->SRPUser = tmp;
+        if((*inInfo)->SRPUser) free((*inInfo)->SRPUser);
+        (*inInfo)->SRPUser = _HKTLVItemDup(&item);
+        require_action( (*inInfo)->SRPUser, exit, err = kNoMemoryErr );
         pair_log("Recv: kTLVType_User: %s", (*inInfo)->SRPUser);
         break;
       default:
-        free( tmp );
-        pair_log( "Warning: Ignoring unsupported pair setup EID 0x%02X", eid );
+        pair_log( "Warning: Ignoring unsupported pair setup EID 0x%02X", item.type );
         break;
     }
   }
@@ -221,51 +242,39 @@ exit:
 OSStatus _HandleState_HandleSRPStartRespond(int inFd, pairInfo_t* inInfo, mico_Context_t * const inContext)
 {
   pair_log_trace();
-  OSStatus err;
-  int i, j;
+  OSStatus err = kNoErr;
   uint8_t *outTLVResponse = NULL;
   size_t outTLVResponseLen = 0;
-  uint8_t *tlvPtr;
+  TLVWriter_t writer;
 
   uint8_t *httpResponse = NULL;
   size_t httpResponseLen = 0;
 
-  inInfo->SRPServer = srp_server_setup( SRP_SHA1, SRP_NG_2048, inInfo->SRPUser, (const unsigned char *)_password, strlen(_password),0, 0);
-  require(inInfo->SRPServer, exit);
+  /*Salt, verifier and B are usually ready in the pool, the 2048 bits exponentiation is not on the critical path*/
+  inInfo->SRPServer = HKSRPPoolTake( inInfo->SRPUser );
+  if(inInfo->SRPServer == NULL)
+    inInfo->SRPServer = srp_server_setup( SRP_SHA1, SRP_NG_2048, inInfo->SRPUser, (const unsigned char *)_password, strlen(_password),0, 0);
+  require_action(inInfo->SRPServer, exit, err = kNoMemoryErr);
 
-  outTLVResponseLen += sizeof(uint8_t) + kHATLV_TypeLengthSize;
-  for(i = inInfo->SRPServer->len_B/kHATLV_MaxStringSize; i>0; i--)
-    outTLVResponseLen += kHATLV_MaxStringSize + kHATLV_TypeLengthSize;
-  outTLVResponseLen += inInfo->SRPServer->len_B%kHATLV_MaxStringSize + kHATLV_TypeLengthSize;
-  outTLVResponseLen += inInfo->SRPServer->len_s + kHATLV_TypeLengthSize;
+  outTLVResponseLen += TLVEncodedSize( sizeof(uint8_t) );
+  outTLVResponseLen += TLVEncodedSize( inInfo->SRPServer->len_s );
+  outTLVResponseLen += TLVEncodedSize( inInfo->SRPServer->len_B );
 
   outTLVResponse = calloc( outTLVResponseLen, sizeof( uint8_t ) );
   require_action( outTLVResponse, exit, err = kNoMemoryErr );
+  TLVWriterInit( &writer, outTLVResponse, outTLVResponseLen );
 
-  tlvPtr = outTLVResponse;
-
-  *tlvPtr++ = kTLVType_State;
-  *tlvPtr++ = sizeof(uint8_t);
-  *tlvPtr++ = (uint8_t)eState_M2_SRPStartRespond;
+  err = TLVWriterAppendUInt8( &writer, kTLVType_State, eState_M2_SRPStartRespond );
+  require_noerr( err, exit );
   pair_log("Send: kTLVType_State: %s", stateDescription[eState_M2_SRPStartRespond]);
-  
-  *tlvPtr++ = kTLVType_Salt;
-  *tlvPtr++ = inInfo->SRPServer->len_s;
-  memcpy( tlvPtr, inInfo->SRPServer->bytes_s, inInfo->SRPServer->len_s );
-  tlvPtr += inInfo->SRPServer->len_s;
-
-  j = inInfo->SRPServer->len_B/kHATLV_MaxStringSize;
-  for(i = 0; i < j; i++){
-    *tlvPtr++ = kTLVType_PublicKey;
-    *tlvPtr++ = kHATLV_MaxStringSize;
-    memcpy( tlvPtr, inInfo->SRPServer->bytes_B+i*kHATLV_MaxStringSize, kHATLV_MaxStringSize );
-    tlvPtr += kHATLV_MaxStringSize;
-  }
 
-  *tlvPtr++ = kTLVType_PublicKey;
-  *tlvPtr++ = inInfo->SRPServer->len_B%kHATLV_MaxStringSize;
-  memcpy( tlvPtr, inInfo->SRPServer->bytes_B+kHATLV_MaxStringSize*j, inInfo->SRPServer->len_B%kHATLV_MaxStringSize );
-  tlvPtr += inInfo->SRPServer->len_B%kHATLV_MaxStringSize;
+  err = TLVWriterAppend( &writer, kTLVType_Salt, inInfo->SRPServer->bytes_s, inInfo->SRPServer->len_s );
+  require_noerr( err, exit );
+
+  /*B is 384 bytes, the writer splits it into 255 bytes fragments*/
+  err = TLVWriterAppend( &writer, kTLVType_PublicKey, inInfo->SRPServer->bytes_B, inInfo->SRPServer->len_B );
+  require_noerr( err, exit );
+
   err =  CreateSimpleHTTPMessageNoCopy( kMIMEType_Pairing_TLV8, outTLVResponseLen, &httpResponse, &httpResponseLen );
   require_noerr( err, exit );
   err = SocketSend( inFd, httpResponse, httpResponseLen );
@@ -284,12 +293,8 @@ exit:
 OSStatus _HandleState_WaitingForSRPVerifyRequest( HTTPHeader_t* inHeader, pairInfo_t* inInfo, mico_Context_t * const inContext )
 {
   pair_log_trace();
-  const uint8_t *             src = (const uint8_t *) inHeader->extraDataPtr;
-  const uint8_t * const       end = src + inHeader->extraDataLen;
-  uint8_t                     eid;
-  const uint8_t *             ptr;
-  size_t                      len;
-  char *                      tmp;
+  TLVReader_t                 reader;
+  TLVItem_t                   item;
   OSStatus err = kNoErr;
 
 #ifdef DEBUG
@@ -298,50 +303,37 @@ OSStatus _HandleState_WaitingForSRPVerifyRequest( HTTPHeader_t* inHeader, pairIn
     pair_log("Free memory1: %d", mico_memory_info()->free_memory);
 
 
-  while( TLVGetNext( src, end, &eid, &ptr, &len, &src ) == kNoErr )
+  /*A is 384 bytes and arrives in two fragments, the reader hands it over as one item*/
+  TLVReaderInit( &reader, (const uint8_t *) inHeader->extraDataPtr, inHeader->extraDataLen );
+  while( TLVReaderNext( &reader, &item ) == kNoErr )
   {
-
-    switch( eid )
+    switch( item.type )
     {
       case kTLVType_State:
-        tmp = calloc( len, sizeof( uint8_t ) );
-        require_action( tmp, exit, err = kNoMemoryErr );
-        memcpy( tmp, ptr, len );
-        pair_log("Recv: %s", stateDescription[*(uint8_t *)tmp]);
-        require_action(haPairSetupState == *(uint8_t *)tmp, exit, err = kValueErr);
-        free(tmp);
+        require_action(item.len == sizeof(uint8_t), exit, err = kSizeErr);
+        pair_log("Recv: %s", stateDescription[*item.data]);
+        require_action(haPairSetupState == *item.data, exit, err = kValueErr);
       break;
         case kTLVType_PublicKey:
-        if(inInfo->SRPControllerPublicKey == NULL){
-          inInfo->SRPControllerPublicKey = calloc( len, sizeof( uint8_t ) );
-          require_action( inInfo->SRPControllerPublicKey, exit, err = kNoMemoryErr );
-          memcpy( inInfo->SRPControllerPublicKey, ptr, len );
-          inInfo->SRPControllerPublicKeyLen = len;
-        }else{
-          inInfo->SRPControllerPublicKey = realloc( inInfo->SRPControllerPublicKey, inInfo->SRPControllerPublicKeyLen+len );
-          require_action( inInfo->SRPControllerPublicKey, exit, err = kNoMemoryErr );
-          memcpy( inInfo->SRPControllerPublicKey+inInfo->SRPControllerPublicKeyLen, ptr, len );
-          inInfo->SRPControllerPublicKeyLen += len;
-        }
+        if(inInfo->SRPControllerPublicKey) free(inInfo->SRPControllerPublicKey);
+        inInfo->SRPControllerPublicKey = calloc( item.len, sizeof( uint8_t ) );
+        require_action( inInfo->SRPControllerPublicKey, exit, err = kNoMemoryErr );
+        TLVItemCopy( &item, inInfo->SRPControllerPublicKey, item.len );
+        inInfo->SRPControllerPublicKeyLen = item.len;
         break;
       case kTLVType_Proof:
-        if(inInfo->SRPControllerProof == NULL){
-          inInfo->SRPControllerProof = calloc( len, sizeof( uint8_t ) );
-          require_action( inInfo->SRPControllerProof, exit, err = kNoMemoryErr );
-          memcpy( inInfo->SRPControllerProof, ptr, len );
-          inInfo->SRPControllerProofLen = len;
-        }else{
-          inInfo->SRPControllerProof = realloc( inInfo->SRPControllerProof, inInfo->SRPControllerProofLen+len );
-          require_action( inInfo->SRPControllerProof, exit, err = kNoMemoryErr );
-          memcpy( inInfo->SRPControllerProof+inInfo->SRPControllerProofLen, ptr, len );
-          inInfo->SRPControllerProofLen += len;
-        }
+        if(inInfo->SRPControllerProof) free(inInfo->SRPControllerProof);
+        inInfo->SRPControllerProof = calloc( item.len, sizeof( uint8_t ) );
+        require_action( inInfo->SRPControllerProof, exit, err = kNoMemoryErr );
+        TLVItemCopy( &item, inInfo->SRPControllerProof, item.len );
+        inInfo->SRPControllerProofLen = item.len;
         break;
       default:
-        pair_log( "Warning: Ignoring unsupported pair setup EID 0x%02X", eid );
+        pair_log( "Warning: Ignoring unsupported pair setup EID 0x%02X", item.type );
         break;
     }
   }
+  require_action( inInfo->SRPControllerPublicKey && inInfo->SRPControllerProof, exit, err = kMalformedErr );
 
 #ifdef DEBUG
   tempString = DataToHexString( inInfo->SRPControllerPublicKey, inInfo->SRPControllerPublicKeyLen );
@@ -369,7 +361,7 @@ OSStatus _HandleState_HandleSRPVerifyRespond(int inFd, pairInfo_t* inInfo, mico_
   OSStatus err = kNoErr;
   uint8_t *outTLVResponse = NULL;
   size_t outTLVResponseLen = 0;
-  uint8_t *tlvPtr;
+  TLVWriter_t writer;
 
   uint8_t *httpResponse = NULL;
   size_t httpResponseLen = 0;
@@ -384,35 +376,30 @@ OSStatus _HandleState_HandleSRPVerifyRespond(int inFd, pairInfo_t* inInfo, mico_
 
   if ( !bytes_HAMK ){
     pair_log("User authentication failed!");
-    outTLVResponseLen += sizeof(uint8_t) + kHATLV_TypeLengthSize;
+    outTLVResponseLen += TLVEncodedSize( sizeof(uint8_t) );
 
     outTLVResponse = calloc( outTLVResponseLen, sizeof( uint8_t ) );
     require_action( outTLVResponse, exit, err = kNoMemoryErr );
+    TLVWriterInit( &writer, outTLVResponse, outTLVResponseLen );
 
-    tlvPtr = outTLVResponse;
-    *tlvPtr++ = kTLVType_Status;
-    *tlvPtr++ = sizeof(uint8_t);
-    *tlvPtr++ = kTLVStatus_AuthenticationErr;
+    err = TLVWriterAppendUInt8( &writer, kTLVType_Status, kTLVStatus_AuthenticationErr );
+    require_noerr( err, exit );
     pair_log("Send: kTLVType_Status: 0x%x", kTLVStatus_AuthenticationErr);
     haPairSetupState = eState_M1_SRPStartRequest;
   }
   else{
     pair_log("User authentication success!");
-    outTLVResponseLen += sizeof(uint8_t) + kHATLV_TypeLengthSize;
-    outTLVResponseLen += inInfo->SRPServer->len_AMK + kHATLV_TypeLengthSize;
+    outTLVResponseLen += TLVEncodedSize( sizeof(uint8_t) );
+    outTLVResponseLen += TLVEncodedSize( inInfo->SRPServer->len_AMK );
 
     outTLVResponse = calloc( outTLVResponseLen, sizeof( uint8_t ) );
     require_action( outTLVResponse, exit, err = kNoMemoryErr );
+    TLVWriterInit( &writer, outTLVResponse, outTLVResponseLen );
 
-    tlvPtr = outTLVResponse;
-    *tlvPtr++ = kTLVType_State;
-    *tlvPtr++ = sizeof(uint8_t);
-    *tlvPtr++ = eState_M4_SRPVerifyRespond;
-
-    *tlvPtr++ = kTLVType_Proof;
-    *tlvPtr++ = inInfo->SRPServer->len_AMK;
-    memcpy( tlvPtr, bytes_HAMK, inInfo->SRPServer->len_AMK );
-    tlvPtr += inInfo->SRPServer->len_AMK;
+    err = TLVWriterAppendUInt8( &writer, kTLVType_State, eState_M4_SRPVerifyRespond );
+    require_noerr( err, exit );
+    err = TLVWriterAppend( &writer, kTLVType_Proof, bytes_HAMK, inInfo->SRPServer->len_AMK );
+    require_noerr( err, exit );
 
     haPairSetupState = eState_M5_ExchangeRequest;
   }
@@ -435,22 +422,16 @@ exit:
 OSStatus _HandleState_WaitingForExchangeRequest( HTTPHeader_t* inHeader, pairInfo_t* inInfo, mico_Context_t * const inContext )
 {
   pair_log_trace();
-  const uint8_t *             src = (const uint8_t *) inHeader->extraDataPtr;
-  const uint8_t * const       end = src + inHeader->extraDataLen;
-  uint8_t                     eid;
-  const uint8_t *             ptr;
-  size_t                      len;
-  char *                      tmp;
-  int                         i;
+  TLVReader_t                 reader;
+  TLVItem_t                   item;
+  TLVItem_t                   encryptedItem;
+  const uint8_t *             authTag = NULL;
   OSStatus                    err = kNoErr;
   unsigned char *             encryptedData = NULL;
-  unsigned long               encryptedDataLen;
-  unsigned char *             authTag = NULL;
-  unsigned long long          authTagLen;
+  unsigned long               encryptedDataLen = 0;
 
   unsigned char               decryptedData[32];
   unsigned long long          decryptedDataLen;
-  pair_list_in_flash_t        *pairList = NULL;
   pair_log("Free memory1: %d", mico_memory_info()->free_memory);
 
   inInfo->HKDF_Key = malloc(32);
@@ -460,82 +441,56 @@ OSStatus _HandleState_WaitingForExchangeRequest( HTTPHeader_t* inHeader, pairInf
                             (const unsigned char *)hkdfSetupInfo, strlen(hkdfSetupInfo), inInfo->HKDF_Key, 32);
   require_noerr(err, exit);
 
-  while( TLVGetNext( src, end, &eid, &ptr, &len, &src ) == kNoErr )
+  encryptedItem.len = 0;
+  TLVReaderInit( &reader, (const uint8_t *) inHeader->extraDataPtr, inHeader->extraDataLen );
+  while( TLVReaderNext( &reader, &item ) == kNoErr )
   {
-
-    switch( eid )
+    switch( item.type )
     {
       case kTLVType_State:
-        tmp = calloc( len, sizeof( uint8_t ) );
-        require_action( tmp, exit, err = kNoMemoryErr );
-        memcpy( tmp, ptr, len );
-        pair_log("Recv: %s", stateDescription[*(uint8_t *)tmp]);
-        require_action(haPairSetupState == *(uint8_t *)tmp, exit, err = kValueErr);
-        free(tmp);
+        require_action(item.len == sizeof(uint8_t), exit, err = kSizeErr);
+        pair_log("Recv: %s", stateDescription[*item.data]);
+        require_action(haPairSetupState == *item.data, exit, err = kValueErr);
       break;
         case kTLVType_EncryptedData:
-        encryptedData = calloc( len, sizeof( uint8_t ) );
-        require_action( encryptedData, exit, err = kNoMemoryErr );
-        memcpy( encryptedData, ptr, len );
-        encryptedDataLen = len;
+        encryptedItem = item;
         pair_log("Recv: kTLVType_EncryptedData");
         break;
       case kTLVType_AuthTag:
-        require(len == crypto_aead_chacha20poly1305_ABYTES, exit);
-        authTag = calloc( len, sizeof( uint8_t ) );
-        require_action( authTag, exit, err = kNoMemoryErr );
-        memcpy( authTag, ptr, len );
-        authTagLen = len;
+        require_action(item.len == crypto_aead_chacha20poly1305_ABYTES, exit, err = kSizeErr);
+        authTag = item.data;
         pair_log("Recv: kTLVType_AuthTag");
         break;
       default:
-        pair_log( "Warning: Ignoring unsupported pair setup EID 0x%02X", eid );
+        pair_log( "Warning: Ignoring unsupported pair setup EID 0x%02X", item.type );
         break;
     }
   }
-
-  encryptedData = realloc(encryptedData, encryptedDataLen + authTagLen);
-  memcpy(encryptedData+encryptedDataLen, authTag, authTagLen);
+  require_action( encryptedItem.len && authTag, exit, err = kMalformedErr );
+
+  /*The cipher text and the tag have to be contiguous for the AEAD, copy them once*/
+  encryptedDataLen = encryptedItem.len;
+  encryptedData = malloc( encryptedDataLen + crypto_aead_chacha20poly1305_ABYTES );
+  require_action( encryptedData, exit, err = kNoMemoryErr );
+  TLVItemCopy( &encryptedItem, encryptedData, encryptedDataLen );
+  memcpy( encryptedData + encryptedDataLen, authTag, crypto_aead_chacha20poly1305_ABYTES );
   err =  crypto_aead_chacha20poly1305_decrypt(decryptedData, &decryptedDataLen, NULL, 
-                                              (const unsigned char *)encryptedData, encryptedDataLen + authTagLen,NULL, 0,  
+                                              (const unsigned char *)encryptedData, encryptedDataLen + crypto_aead_chacha20poly1305_ABYTES,NULL, 0,  
                                               (const unsigned char *)AEAD_Nonce_Setup05, (const unsigned char *)inInfo->HKDF_Key);
   require_noerr_action(err, exit, pair_log("crypto_aead_chacha20poly1305_decrypt failed"));
   require_action(decryptedDataLen == 32, exit, pair_log("decryptedDataLen is not properly set"));
   pair_log("crypto_aead_chacha20poly1305 decrypt success");
 
-  pairList = calloc(1, sizeof(pair_list_in_flash_t));
-  require_action(pairList, exit, err = kNoMemoryErr);
-  err = HMReadPairList(pairList);
-  require_noerr(err, exit);
-
-  
   /*Save controller's LTPK*/
-  for(i=0; i<MAXPairNumber; i++){
-    if(strncmp(pairList->pairInfo[i].controllerName, inInfo->SRPUser, 64)==0)
-      break;
-  }
-
-  /*This is a new record*/
-  if(i == MAXPairNumber){
-    for(i=0; i<MAXPairNumber; i++){
-      if(pairList->pairInfo[i].controllerName[0] == 0x0)
-      break;
-    }
-  }
-  
+  err = HMAddPair(inInfo->SRPUser, decryptedData);
   /*No space for new record*/
-  require_action(i < MAXPairNumber, exit, inInfo->pairListFull = true);
-
-  strcpy(pairList->pairInfo[i].controllerName, inInfo->SRPUser);
-  memcpy(pairList->pairInfo[i].controllerLTPK, decryptedData, decryptedDataLen);
-  err = HMUpdatePairList(pairList);
+  require_action(err != kNoSpaceErr, exit, inInfo->pairListFull = true; err = kNoErr);
+  require_noerr(err, exit);
 
   haPairSetupState = eState_M6_ExchangeRespond;
 
 exit:
   if(encryptedData) free(encryptedData);
-  if(authTag) free(authTag);
-  if(pairList) free(pairList);
   return err; 
 }
 
@@ -545,7 +500,7 @@ OSStatus _HandleState_HandleExchangeRespond(int inFd, pairInfo_t** inInfo, mico_
   OSStatus err = kNoErr;
   uint8_t *outTLVResponse = NULL;
   size_t outTLVResponseLen = 0;
-  uint8_t *tlvPtr;
+  TLVWriter_t writer;
 
   uint8_t *httpResponse = NULL;
   size_t httpResponseLen = 0;
@@ -560,14 +515,13 @@ OSStatus _HandleState_HandleExchangeRespond(int inFd, pairInfo_t** inInfo, mico_
   if((*inInfo)->pairListFull == true){
     pair_log("Pair list is full!");
 
-    outTLVResponseLen += sizeof(uint8_t) + kHATLV_TypeLengthSize;
+    outTLVResponseLen += TLVEncodedSize( sizeof(uint8_t) );
     outTLVResponse = calloc( outTLVResponseLen, sizeof( uint8_t ) );
     require_action( outTLVResponse, exit, err = kNoMemoryErr );
+    TLVWriterInit( &writer, outTLVResponse, outTLVResponseLen );
 
-    tlvPtr = outTLVResponse;
-    *tlvPtr++ = kTLVType_Status;
-    *tlvPtr++ = sizeof(uint8_t);
-    *tlvPtr++ = kTLVStatus_MaxPeerErr;
+    err = TLVWriterAppendUInt8( &writer, kTLVType_Status, kTLVStatus_MaxPeerErr );
+    require_noerr( err, exit );
     pair_log("Send: kTLVType_Status: 0x%x", kTLVStatus_MaxPeerErr);
   }else{
 
@@ -579,22 +533,19 @@ OSStatus _HandleState_HandleExchangeRespond(int inFd, pairInfo_t** inInfo, mico_
     }
 
     accessoryName = __strdup_trans_dot(inContext->micoStatus.mac);
-    outTLVResponseLen += strlen(accessoryName) + kHATLV_TypeLengthSize;
-    outTLVResponseLen += 32 + kHATLV_TypeLengthSize;
+    require_action( accessoryName, exit, err = kNoMemoryErr );
+    outTLVResponseLen += TLVEncodedSize( strlen(accessoryName) );
+    outTLVResponseLen += TLVEncodedSize( 32 );
 
     outTLVResponse = calloc( outTLVResponseLen, sizeof( uint8_t ) );
-    require_action( outTLVResponse, exit, err = kNoMemoryErr );
+    require_action( outTLVResponse, exit, free(accessoryName); err = kNoMemoryErr );
+    TLVWriterInit( &writer, outTLVResponse, outTLVResponseLen );
 
-    tlvPtr = outTLVResponse;
-    *tlvPtr++ = kTLVType_User;
-    *tlvPtr++ = strlen(accessoryName);
-    memcpy( tlvPtr, accessoryName, strlen(accessoryName) );
-    tlvPtr += strlen(accessoryName);
+    err = TLVWriterAppend( &writer, kTLVType_User, accessoryName, strlen(accessoryName) );
     free(accessoryName);
-
-    *tlvPtr++ = kTLVType_PublicKey;
-    *tlvPtr++ = 32;
-    memcpy( tlvPtr, LTPK, 32 );
+    require_noerr( err, exit );
+    err = TLVWriterAppend( &writer, kTLVType_PublicKey, LTPK, 32 );
+    require_noerr( err, exit );
 
     require_action((*inInfo)->HKDF_Key, exit, err = kParamErr);
     err =  crypto_aead_chacha20poly1305_encrypt(encryptedData, &encryptedDataLen, outTLVResponse, outTLVResponseLen,
@@ -607,26 +558,21 @@ OSStatus _HandleState_HandleExchangeRespond(int inFd, pairInfo_t** inInfo, mico_
     outTLVResponse = NULL;
 
     outTLVResponseLen = 0;
-    outTLVResponseLen += sizeof(uint8_t) + kHATLV_TypeLengthSize;
-    outTLVResponseLen += encryptedDataLen - crypto_aead_chacha20poly1305_ABYTES + kHATLV_TypeLengthSize;
-    outTLVResponseLen += crypto_aead_chacha20poly1305_ABYTES + kHATLV_TypeLengthSize;
+    outTLVResponseLen += TLVEncodedSize( sizeof(uint8_t) );
+    outTLVResponseLen += TLVEncodedSize( encryptedDataLen - crypto_aead_chacha20poly1305_ABYTES );
+    outTLVResponseLen += TLVEncodedSize( crypto_aead_chacha20poly1305_ABYTES );
 
     outTLVResponse = calloc( outTLVResponseLen, sizeof( uint8_t ) );
     require_action( outTLVResponse, exit, err = kNoMemoryErr );
-
-    tlvPtr = outTLVResponse;
-    *tlvPtr++ = kTLVType_State;
-    *tlvPtr++ = sizeof(uint8_t);
-    *tlvPtr++ = eState_M6_ExchangeRespond;
-
-    *tlvPtr++ = kTLVType_EncryptedData;
-    *tlvPtr++ = encryptedDataLen -  crypto_aead_chacha20poly1305_ABYTES;
-    memcpy( tlvPtr, encryptedData, encryptedDataLen -  crypto_aead_chacha20poly1305_ABYTES);
-    tlvPtr += encryptedDataLen -  crypto_aead_chacha20poly1305_ABYTES;
-
-    *tlvPtr++ = kTLVType_AuthTag;
-    *tlvPtr++ = crypto_aead_chacha20poly1305_ABYTES;
-    memcpy( tlvPtr, encryptedData + encryptedDataLen -  crypto_aead_chacha20poly1305_ABYTES, crypto_aead_chacha20poly1305_ABYTES );
+    TLVWriterInit( &writer, outTLVResponse, outTLVResponseLen );
+
+    err = TLVWriterAppendUInt8( &writer, kTLVType_State, eState_M6_ExchangeRespond );
+    require_noerr( err, exit );
+    err = TLVWriterAppend( &writer, kTLVType_EncryptedData, encryptedData, encryptedDataLen - crypto_aead_chacha20poly1305_ABYTES );
+    require_noerr( err, exit );
+    err = TLVWriterAppend( &writer, kTLVType_AuthTag, encryptedData + encryptedDataLen - crypto_aead_chacha20poly1305_ABYTES,
+                           crypto_aead_chacha20poly1305_ABYTES );
+    require_noerr( err, exit );
   }
 
   haPairSetupState = eState_M1_SRPStartRequest;
@@ -666,6 +612,12 @@ OSStatus HKPairVerifyEngine( int inFd, HTTPHeader_t* inHeader, pairVerifyInfo_t*
     case eState_M1_VerifyStartRequest:
       err = _HandleState_WaitingForVerifyStartRequest( inHeader, inInfo, inContext );
       require_noerr_action( err, exit, inInfo->haPairVerifyState = eState_M1_VerifyStartRequest);
+      /*Try to resume a cached session, fall back to a full pair verify if the controller is known*/
+      if(inInfo->pResumeSessionID){
+        err = _HandleState_HandleResumeRespond( inFd , inInfo, inContext );
+        if(err == kNoErr) break;
+        require_action( err == kNotFoundErr && inInfo->pControllerLTPK, exit, inInfo->haPairVerifyState = eState_M1_VerifyStartRequest);
+      }
       err =  _HandleState_WaitingForVerifyStartRespond( inFd , inInfo, inContext );
       require_noerr_action( err, exit, inInfo->haPairVerifyState = eState_M1_VerifyStartRequest);
       break;
@@ -691,36 +643,72 @@ OSStatus _HandleState_WaitingForVerifyStartRequest( HTTPHeader_t* inHeader, pair
 {
   pair_log_trace();
   OSStatus                    err = kNoErr;
-  const uint8_t *             src = (const uint8_t *) inHeader->extraDataPtr;
-  const uint8_t * const       end = src + inHeader->extraDataLen;
-  uint8_t                     eid;
-  const uint8_t *             ptr;
-  size_t                      len;
-  char *                      tmp = NULL;
-
-  while( TLVGetNext( src, end, &eid, &ptr, &len, &src ) == kNoErr )
-  {
-    tmp = calloc( len+1, sizeof( uint8_t ) );
-    require_action( tmp, exit, err = kNoMemoryErr );
-    memcpy( tmp, ptr, len );
+  TLVReader_t                 reader;
+  TLVItem_t                   item;
+  uint8_t *                   resumeRequest;
+
+  /*Nothing of a previous M1 is kept, a resume request is rebuilt from this one only*/
+  if(inInfo->pResumeSessionID){
+    free(inInfo->pResumeSessionID);
+    inInfo->pResumeSessionID = NULL;
+  }
+  if(inInfo->pResumeRequest){
+    free(inInfo->pResumeRequest);
+    inInfo->pResumeRequest = NULL;
+  }
+  inInfo->resumeRequestLen = 0;
 
-    switch( eid )
+  TLVReaderInit( &reader, (const uint8_t *) inHeader->extraDataPtr, inHeader->extraDataLen );
+  while( TLVReaderNext( &reader, &item ) == kNoErr )
+  {
+    switch( item.type )
     {
       case kTLVType_State:
-        pair_log("Recv: %s", stateDescription[*(uint8_t *)tmp]);
-        require_action(inInfo->haPairVerifyState == *(uint8_t *)tmp, exit, err = kValueErr);
-        free(tmp);
+        require_action(item.len == sizeof(uint8_t), exit, err = kSizeErr);
+        pair_log("Recv: %s", stateDescription[*item.data]);
+        require_action(inInfo->haPairVerifyState == *item.data, exit, err = kValueErr);
       break;
         case kTLVType_User:
-        inInfo->pControllerLTPK =  HMFindLTPK(tmp);
-        free(tmp);
+        if(inInfo->pControllerName) free(inInfo->pControllerName);
+        inInfo->pControllerName = _HKTLVItemDup(&item);
+        require_action(inInfo->pControllerName, exit, err = kNoMemoryErr);
+        inInfo->pControllerLTPK =  HMFindLTPK(inInfo->pControllerName);
         require_action(inInfo->pControllerLTPK, exit, err = kNotFoundErr);
         break;
       case kTLVType_PublicKey:
-        inInfo->pControllerCurve25519PK = (uint8_t *)tmp;
+        require_action(item.len == 32, exit, err = kSizeErr);
+        if(inInfo->pControllerCurve25519PK == NULL){
+          inInfo->pControllerCurve25519PK = malloc(32);
+          require_action(inInfo->pControllerCurve25519PK, exit, err = kNoMemoryErr);
+        }
+        memcpy(inInfo->pControllerCurve25519PK, item.data, 32);
+        break;
+      case kTLVType_Method:
+        require_action(item.len == sizeof(uint8_t), exit, err = kSizeErr);
+        if(*item.data == kTLVMethod_PairResume && inInfo->pResumeSessionID == NULL){
+          inInfo->pResumeSessionID = malloc(HKSessionIDLength);
+          require_action(inInfo->pResumeSessionID, exit, err = kNoMemoryErr);
+          memset(inInfo->pResumeSessionID, 0x0, HKSessionIDLength);
+        }
+        break;
+      case kTLVType_SessionID:
+        require_action(item.len == HKSessionIDLength, exit, err = kSizeErr);
+        if(inInfo->pResumeSessionID == NULL){
+          inInfo->pResumeSessionID = malloc(HKSessionIDLength);
+          require_action(inInfo->pResumeSessionID, exit, err = kNoMemoryErr);
+        }
+        memcpy(inInfo->pResumeSessionID, item.data, HKSessionIDLength);
+        break;
+      case kTLVType_EncryptedData:
+      case kTLVType_AuthTag:
+        resumeRequest = realloc(inInfo->pResumeRequest, inInfo->resumeRequestLen + item.len);
+        require_action(resumeRequest, exit, err = kNoMemoryErr);
+        inInfo->pResumeRequest = resumeRequest;
+        TLVItemCopy(&item, inInfo->pResumeRequest + inInfo->resumeRequestLen, item.len);
+        inInfo->resumeRequestLen += item.len;
         break;
       default:
-        pair_log( "Warning: Ignoring unsupported pair setup EID 0x%02X", eid );
+        pair_log( "Warning: Ignoring unsupported pair setup EID 0x%02X", item.type );
         break;
     }
   }
@@ -736,7 +724,7 @@ OSStatus _HandleState_WaitingForVerifyStartRespond(int inFd, pairVerifyInfo_t* i
   OSStatus            err = kNoErr;
   uint8_t             *outTLVResponse = NULL;
   size_t              outTLVResponseLen = 0;
-  uint8_t             *tlvPtr;
+  TLVWriter_t         writer;
   uint8_t             *httpResponse = NULL;
   size_t              httpResponseLen = 0;
   uint8_t             YX[64];
@@ -759,7 +747,7 @@ OSStatus _HandleState_WaitingForVerifyStartRespond(int inFd, pairVerifyInfo_t* i
   err = PlatformRandomBytes( inInfo->pAccessoryCurve25519SK, 32 );
   require_noerr( err, exit );
 
-  curve25519_donna( inInfo->pAccessoryCurve25519PK, inInfo->pAccessoryCurve25519SK, NULL );
+  curve25519_donna_base( inInfo->pAccessoryCurve25519PK, inInfo->pAccessoryCurve25519SK );
   curve25519_donna( inInfo->pSharedSecret, inInfo->pAccessoryCurve25519SK, inInfo->pControllerCurve25519PK );
 
   memcpy(YX,    inInfo->pAccessoryCurve25519PK,   32);
@@ -779,35 +767,27 @@ OSStatus _HandleState_WaitingForVerifyStartRespond(int inFd, pairVerifyInfo_t* i
   require_noerr_string(err, exit, "crypto_chacha20 failed");
 
   accessoryName = __strdup_trans_dot(inContext->micoStatus.mac);
+  require_action( accessoryName, exit, err = kNoMemoryErr );
 
   outTLVResponseLen = 0;
-  outTLVResponseLen += sizeof(uint8_t) + kHATLV_TypeLengthSize;
-  outTLVResponseLen += strlen(accessoryName) + kHATLV_TypeLengthSize;
-  outTLVResponseLen += 32 + kHATLV_TypeLengthSize;
-  outTLVResponseLen += 64 + kHATLV_TypeLengthSize;
+  outTLVResponseLen += TLVEncodedSize( sizeof(uint8_t) );
+  outTLVResponseLen += TLVEncodedSize( strlen(accessoryName) );
+  outTLVResponseLen += TLVEncodedSize( 32 );
+  outTLVResponseLen += TLVEncodedSize( 64 );
 
   outTLVResponse = calloc( outTLVResponseLen, sizeof( uint8_t ) );
-  require_action( outTLVResponse, exit, err = kNoMemoryErr );
-
-  tlvPtr = outTLVResponse;
-  *tlvPtr++ = kTLVType_State;
-  *tlvPtr++ = sizeof(uint8_t);
-  *tlvPtr++ = eState_M2_VerifyStartRespond;
+  require_action( outTLVResponse, exit, free(accessoryName); err = kNoMemoryErr );
+  TLVWriterInit( &writer, outTLVResponse, outTLVResponseLen );
 
-  *tlvPtr++ = kTLVType_User;
-  *tlvPtr++ = strlen(accessoryName);
-  memcpy( tlvPtr, accessoryName, strlen(accessoryName));
-  tlvPtr += strlen(accessoryName);
+  err = TLVWriterAppendUInt8( &writer, kTLVType_State, eState_M2_VerifyStartRespond );
+  require_noerr_action( err, exit, free(accessoryName) );
+  err = TLVWriterAppend( &writer, kTLVType_User, accessoryName, strlen(accessoryName) );
   free(accessoryName);
-
-  *tlvPtr++ = kTLVType_PublicKey;
-  *tlvPtr++ = 32;
-  memcpy( tlvPtr, inInfo->pAccessoryCurve25519PK, 32 );
-  tlvPtr += 32;
-
-  *tlvPtr++ = kTLVType_Proof;
-  *tlvPtr++ = 64;
-  memcpy( tlvPtr, pAccessoryProof, 64);
+  require_noerr( err, exit );
+  err = TLVWriterAppend( &writer, kTLVType_PublicKey, inInfo->pAccessoryCurve25519PK, 32 );
+  require_noerr( err, exit );
+  err = TLVWriterAppend( &writer, kTLVType_Proof, pAccessoryProof, 64 );
+  require_noerr( err, exit );
 
   err =  CreateSimpleHTTPMessageNoCopy( kMIMEType_Pairing_TLV8, outTLVResponseLen, &httpResponse, &httpResponseLen );
   require_noerr( err, exit );
@@ -829,38 +809,34 @@ OSStatus _HandleState_WaitingForVerifyFinishRequest(HTTPHeader_t* inHeader, pair
   pair_log_trace();
   OSStatus                    err = kNoErr;
   (void)                      inContext;
-  const uint8_t *             src = (const uint8_t *) inHeader->extraDataPtr;
-  const uint8_t * const       end = src + inHeader->extraDataLen;
-  uint8_t                     eid;
-  const uint8_t *             ptr;
-  size_t                      len;
-  char *                      tmp = NULL;
-  uint8_t *                   pControllerProof = NULL;
+  TLVReader_t                 reader;
+  TLVItem_t                   item;
+  const uint8_t *             pControllerProof = NULL;
   uint8_t                     decryptedControllerProof[128]; 
   uint8_t                     XY[128];
   unsigned long long          XYLen;
 
-  while( TLVGetNext( src, end, &eid, &ptr, &len, &src ) == kNoErr )
+  TLVReaderInit( &reader, (const uint8_t *) inHeader->extraDataPtr, inHeader->extraDataLen );
+  while( TLVReaderNext( &reader, &item ) == kNoErr )
   {
-    tmp = calloc( len+1, sizeof( uint8_t ) );
-    require_action( tmp, exit, err = kNoMemoryErr );
-    memcpy( tmp, ptr, len );
-
-    switch( eid )
+    switch( item.type )
     {
       case kTLVType_State:
-        pair_log("Recv: %s", stateDescription[*(uint8_t *)tmp]);
-        require_action(inInfo->haPairVerifyState == *(uint8_t *)tmp, exit, err = kValueErr);
-        free(tmp);
+        require_action(item.len == sizeof(uint8_t), exit, err = kSizeErr);
+        pair_log("Recv: %s", stateDescription[*item.data]);
+        require_action(inInfo->haPairVerifyState == *item.data, exit, err = kValueErr);
         break;
       case kTLVType_Proof:
-        pControllerProof = (uint8_t *)tmp;
+        /*Only the first 64 bytes are used, they are always in the first fragment*/
+        require_action(item.len >= 64, exit, err = kSizeErr);
+        pControllerProof = item.data;
         break;
       default:
-        pair_log( "Warning: Ignoring unsupported pair setup EID 0x%02X", eid );
+        pair_log( "Warning: Ignoring unsupported pair setup EID 0x%02X", item.type );
         break;
     }
   }
+  require_action(pControllerProof, exit, err = kMalformedErr);
 
   err = crypto_stream_chacha20_xor_ic(decryptedControllerProof, pControllerProof, 64, 
                                 (const unsigned char *)AEAD_Nonce_Verify03, 0U, (const unsigned char *)inInfo->pHKDFKey);
@@ -871,7 +847,6 @@ OSStatus _HandleState_WaitingForVerifyFinishRequest(HTTPHeader_t* inHeader, pair
   require_noerr_string(err, exit, "Signature verify failed");
 
 exit:
-  if(pControllerProof) free(pControllerProof);
   return err;
 }
 
@@ -882,22 +857,49 @@ OSStatus _HandleState_WaitingForVerifyFinishRespond(int inFd, pairVerifyInfo_t*
   (void)inContext;
   uint8_t *outTLVResponse = NULL;
   size_t outTLVResponseLen = 0;
-  uint8_t *tlvPtr;
+  TLVWriter_t writer;
 
   uint8_t *httpResponse = NULL;
   size_t httpResponseLen = 0;
+  uint8_t sessionID[HKSessionIDLength];
 
-  outTLVResponseLen += sizeof(uint8_t) + kHATLV_TypeLengthSize;
+  outTLVResponseLen += TLVEncodedSize( sizeof(uint8_t) );
 
   outTLVResponse = calloc( outTLVResponseLen, sizeof( uint8_t ) );
   require_action( outTLVResponse, exit, err = kNoMemoryErr );
+  TLVWriterInit( &writer, outTLVResponse, outTLVResponseLen );
 
-  tlvPtr = outTLVResponse;
-  *tlvPtr++ = kTLVType_State;
-  *tlvPtr++ = sizeof(uint8_t);
-  *tlvPtr++ = eState_M4_SRPVerifyRespond;
+  err = TLVWriterAppendUInt8( &writer, kTLVType_State, eState_M4_SRPVerifyRespond );
+  require_noerr( err, exit );
 
   inInfo->verifySuccess = true;
+  err = _HKDeriveControlKeys(inInfo);
+  require_noerr(err, exit);
+
+  err =  CreateSimpleHTTPMessageNoCopy( kMIMEType_Pairing_TLV8, outTLVResponseLen, &httpResponse, &httpResponseLen );
+  require_noerr( err, exit );
+  err = SocketSend( inFd, httpResponse, httpResponseLen );
+  require_noerr( err, exit );
+  err = SocketSend( inFd, outTLVResponse, outTLVResponseLen );
+  require_noerr( err, exit );
+
+  /*Session can be resumed by this controller later, both sides derive the same session ID*/
+  err = hkdf(SHA512,  (const unsigned char *) hkdfSessionIDSalt, strlen(hkdfSessionIDSalt),
+                            inInfo->pSharedSecret, 32,
+                            (const unsigned char *)hkdfSessionIDInfo, strlen(hkdfSessionIDInfo), sessionID, HKSessionIDLength);
+  require_noerr(err, exit);
+  HKSessionCacheStore(inInfo->pControllerName, sessionID, inInfo->pSharedSecret);
+
+exit:
+  if(outTLVResponse) free(outTLVResponse);
+  if(httpResponse) free(httpResponse);
+  return err;
+}
+
+static OSStatus _HKDeriveControlKeys(pairVerifyInfo_t* inInfo)
+{
+  OSStatus err = kNoErr;
+
   inInfo->A2CKey = malloc(32);
   require_action(inInfo->A2CKey, exit, err = kNoMemoryErr);
   err = hkdf(SHA512,  (const unsigned char *) hkdfA2CKeySalt, strlen(hkdfA2CKeySalt),
@@ -912,6 +914,95 @@ OSStatus _HandleState_WaitingForVerifyFinishRespond(int inFd, pairVerifyInfo_t*
                             (const unsigned char *)hkdfC2AInfo, strlen(hkdfC2AInfo), inInfo->C2AKey, 32);
   require_noerr(err, exit);
 
+exit:
+  return err;
+}
+
+/*Pair resume: M1 carries the cached session ID and an auth tag proving the controller owns the
+  previous shared secret. No Curve25519 or Ed25519 operation is needed, keys come from HKDF only.
+  Returns kNotFoundErr without sending anything if the session can not be resumed.*/
+OSStatus _HandleState_HandleResumeRespond(int inFd, pairVerifyInfo_t* inInfo, mico_Context_t * const inContext)
+{
+  pair_log_trace();
+  OSStatus            err = kNoErr;
+  (void)              inContext;
+  uint8_t             *outTLVResponse = NULL;
+  size_t              outTLVResponseLen = 0;
+  TLVWriter_t         writer;
+  uint8_t             *httpResponse = NULL;
+  size_t              httpResponseLen = 0;
+  uint8_t             salt[32 + HKSessionIDLength];
+  uint8_t             resumeKey[32];
+  uint8_t             previousSecret[HKSharedSecretLength];
+  uint8_t             newSessionID[HKSessionIDLength];
+  uint8_t             authTag[crypto_aead_chacha20poly1305_ABYTES];
+  uint8_t             empty = 0;
+  unsigned long long  outLen;
+  char                controllerName[64];
+
+  require_action(inInfo->pControllerCurve25519PK && inInfo->pResumeRequest, exit, err = kNotFoundErr);
+  require_action(inInfo->resumeRequestLen == crypto_aead_chacha20poly1305_ABYTES, exit, err = kNotFoundErr);
+
+  err = HKSessionCacheFind(inInfo->pResumeSessionID, controllerName, previousSecret);
+  require_noerr_action(err, exit, err = kNotFoundErr);
+
+  /*Verify controller's request*/
+  memcpy(salt, inInfo->pControllerCurve25519PK, 32);
+  memcpy(salt + 32, inInfo->pResumeSessionID, HKSessionIDLength);
+  err = hkdf(SHA512,  salt, sizeof(salt), previousSecret, HKSharedSecretLength,
+                      (const unsigned char *)hkdfResumeRequestInfo, strlen(hkdfResumeRequestInfo), resumeKey, 32);
+  require_noerr(err, exit);
+  err = crypto_aead_chacha20poly1305_decrypt(&empty, &outLen, NULL, inInfo->pResumeRequest, inInfo->resumeRequestLen,
+                                             NULL, 0, (const unsigned char *)AEAD_Nonce_Resume01, resumeKey);
+  require_noerr_action(err, exit, pair_log("Resume request authentication failed"); err = kNotFoundErr);
+
+  /*Only an authenticated request consumes the session ID, anyone can send a forged one*/
+  HKSessionCacheRemove(controllerName);
+
+  /*A resume request has no user TLV, the controller is the one the cached session belongs to*/
+  inInfo->pControllerLTPK = HMFindLTPK(controllerName);
+  require_action(inInfo->pControllerLTPK, exit, err = kNotFoundErr);
+  if(inInfo->pControllerName) free(inInfo->pControllerName);
+  inInfo->pControllerName = __strdup(controllerName);
+  require_action(inInfo->pControllerName, exit, err = kNoMemoryErr);
+
+  /*Derive response and the new shared secret with a fresh session ID*/
+  err = PlatformRandomBytes( newSessionID, HKSessionIDLength );
+  require_noerr( err, exit );
+  memcpy(salt + 32, newSessionID, HKSessionIDLength);
+  err = hkdf(SHA512,  salt, sizeof(salt), previousSecret, HKSharedSecretLength,
+                      (const unsigned char *)hkdfResumeRespondInfo, strlen(hkdfResumeRespondInfo), resumeKey, 32);
+  require_noerr(err, exit);
+  err = crypto_aead_chacha20poly1305_encrypt(authTag, &outLen, &empty, 0, NULL, 0, NULL,
+                                             (const unsigned char *)AEAD_Nonce_Resume02, resumeKey);
+  require_noerr(err, exit);
+
+  if(inInfo->pSharedSecret == NULL){
+    inInfo->pSharedSecret = malloc(32);
+    require_action(inInfo->pSharedSecret, exit, err = kNoMemoryErr);
+  }
+  err = hkdf(SHA512,  salt, sizeof(salt), previousSecret, HKSharedSecretLength,
+                      (const unsigned char *)hkdfResumeSecretInfo, strlen(hkdfResumeSecretInfo), inInfo->pSharedSecret, 32);
+  require_noerr(err, exit);
+
+  outTLVResponseLen += TLVEncodedSize( sizeof(uint8_t) );
+  outTLVResponseLen += TLVEncodedSize( HKSessionIDLength );
+  outTLVResponseLen += TLVEncodedSize( crypto_aead_chacha20poly1305_ABYTES );
+
+  outTLVResponse = calloc( outTLVResponseLen, sizeof( uint8_t ) );
+  require_action( outTLVResponse, exit, err = kNoMemoryErr );
+  TLVWriterInit( &writer, outTLVResponse, outTLVResponseLen );
+
+  err = TLVWriterAppendUInt8( &writer, kTLVType_State, eState_M2_VerifyStartRespond );
+  require_noerr( err, exit );
+  err = TLVWriterAppend( &writer, kTLVType_SessionID, newSessionID, HKSessionIDLength );
+  require_noerr( err, exit );
+  err = TLVWriterAppend( &writer, kTLVType_EncryptedData, authTag, crypto_aead_chacha20poly1305_ABYTES );
+  require_noerr( err, exit );
+
+  err = _HKDeriveControlKeys(inInfo);
+  require_noerr(err, exit);
+
   err =  CreateSimpleHTTPMessageNoCopy( kMIMEType_Pairing_TLV8, outTLVResponseLen, &httpResponse, &httpResponseLen );
   require_noerr( err, exit );
   err = SocketSend( inFd, httpResponse, httpResponseLen );
@@ -919,7 +1010,13 @@ OSStatus _HandleState_WaitingForVerifyFinishRespond(int inFd, pairVerifyInfo_t*
   err = SocketSend( inFd, outTLVResponse, outTLVResponseLen );
   require_noerr( err, exit );
 
+  HKSessionCacheStore(controllerName, newSessionID, inInfo->pSharedSecret);
+  inInfo->verifySuccess = true;
+  pair_log("Pair verify resumed");
+
 exit:
+  memset(previousSecret, 0x0, sizeof(previousSecret));
+  memset(resumeKey, 0x0, sizeof(resumeKey));
   if(outTLVResponse) free(outTLVResponse);
   if(httpResponse) free(httpResponse);
   return err;
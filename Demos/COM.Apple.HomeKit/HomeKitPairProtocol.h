@@ -25,6 +25,10 @@ typedef struct _pairVerifyInfo_t {
   bool                      verifySuccess;
   int                       haPairVerifyState;
   uint8_t                   *pControllerLTPK;
+  char                      *pControllerName;
+  uint8_t                   *pResumeSessionID;
+  uint8_t                   *pResumeRequest;
+  size_t                    resumeRequestLen;
   uint8_t                   *pControllerCurve25519PK;
   uint8_t                   *pAccessoryCurve25519PK;
   uint8_t                   *pAccessoryCurve25519SK;
@@ -1,6 +1,6 @@
 /**
   ******************************************************************************
-  * @file    MICOPARASTORAGE.c 
+  * @file    MICOPARASTORAGE.c
   * @author  William Xu
   * @version V1.0.0
   * @date    05-May-2014
@@ -17,92 +17,380 @@
   *
   * <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
   ******************************************************************************
-  */ 
+  */
 
 #include "HomeKitPairlist.h"
+#include "HomeKitSessionCache.h"
 #include "Debug.h"
+#include "MICORTOS.h"
 #include "MicoPlatform.h"
 #include "platform_common_config.h"
 
-/* Update seed number every time*/
+#define pair_list_log(M, ...) custom_log("HomeKitPairList", M, ##__VA_ARGS__)
 
-OSStatus HMClearPairList(void)
-{ 
+/* Flash layout: one header word followed by a log of pairing records.
+   A record is valid when its magic is written, magic is programmed after the
+   body so a torn write is never taken as valid. Replaced or removed records
+   have their magic cleared to 0 in place. */
+#define kPairLogHeader          0x4C504B48  /* "HKPL" */
+#define kPairRecordMagic        0x52494150  /* "PAIR" */
+#define kPairRecordRemoved      0x00000000
+#define kPairRecordErased       0xFFFFFFFF
+
+#define kPairIndexSize          64          /* Power of 2, bigger than MAXPairNumber */
+
+typedef struct _pair_record_t {
+  uint32_t         magic;
+  char             controllerName[64];
+  uint8_t          controllerLTPK[32];
+} pair_record_t;
+
+/* Pair Info flash content before log-structured storage */
+typedef struct _pair_t {
+  char             controllerName[64];
+  uint8_t          controllerLTPK[32];
+} _pair_t;
+
+typedef struct _pair_index_t {
+  uint32_t         nameHash;
+  uint32_t         recordAddress;
+  char             controllerName[64];
+  uint8_t          controllerLTPK[32];
+} pair_index_t;
+
+static pair_index_t *   pairIndex[kPairIndexSize];
+static int              pairCount = 0;
+static uint32_t         pairLogEnd = EX_PARA_START_ADDRESS + sizeof(uint32_t);
+static mico_mutex_t     pairList_mutex = NULL;
+
+#define pair_list_lock()    do{ if(pairList_mutex) mico_rtos_lock_mutex(&pairList_mutex); }while(0)
+#define pair_list_unlock()  do{ if(pairList_mutex) mico_rtos_unlock_mutex(&pairList_mutex); }while(0)
+
+/* FNV-1a over the controller name */
+static uint32_t _NameHash(const char *name)
+{
+  uint32_t hash = 2166136261U;
+  int i;
+
+  for(i=0; i<64 && name[i]; i++){
+    hash ^= (uint8_t)name[i];
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+static int _IndexFind(const char *name, uint32_t hash)
+{
+  int i, slot;
+
+  for(i=0; i<kPairIndexSize; i++){
+    slot = (hash + i)&(kPairIndexSize-1);
+    if(pairIndex[slot] == NULL)
+      return -1;
+    if(pairIndex[slot]->nameHash == hash && strncmp(pairIndex[slot]->controllerName, name, 64) == 0)
+      return slot;
+  }
+  return -1;
+}
+
+static void _IndexInsert(pair_index_t *entry)
+{
+  int i, slot;
+
+  for(i=0; i<kPairIndexSize; i++){
+    slot = (entry->nameHash + i)&(kPairIndexSize-1);
+    if(pairIndex[slot] == NULL){
+      pairIndex[slot] = entry;
+      return;
+    }
+  }
+}
+
+/* Linear probing removal, re-insert the rest of the cluster */
+static void _IndexRemove(int slot)
+{
+  pair_index_t *entry;
+  int next;
+
+  free(pairIndex[slot]);
+  pairIndex[slot] = NULL;
+  pairCount--;
+
+  for(next = (slot+1)&(kPairIndexSize-1); pairIndex[next]; next = (next+1)&(kPairIndexSize-1)){
+    entry = pairIndex[next];
+    pairIndex[next] = NULL;
+    _IndexInsert(entry);
+  }
+}
+
+static void _IndexClear(void)
+{
+  int i;
+
+  for(i=0; i<kPairIndexSize; i++){
+    if(pairIndex[i]) free(pairIndex[i]);
+    pairIndex[i] = NULL;
+  }
+  pairCount = 0;
+}
+
+static OSStatus _IndexAdd(const char *name, const uint8_t *LTPK, uint32_t recordAddress)
+{
   OSStatus err = kNoErr;
-  uint32_t exParaStartAddress, exParaEndAddress;
- 
-  exParaStartAddress = EX_PARA_START_ADDRESS;
-  exParaEndAddress = EX_PARA_END_ADDRESS;
-  pair_list_in_flash_t *pairList = NULL;
-  pairList = calloc(1, sizeof(pair_list_in_flash_t));
-  require_action(pairList, exit, err = kNoMemoryErr);
+  uint32_t hash = _NameHash(name);
+  int slot;
+  pair_index_t *entry;
 
-  err = MicoFlashInitialize(MICO_FLASH_FOR_EX_PARA);
+  slot = _IndexFind(name, hash);
+  if(slot >= 0){
+    entry = pairIndex[slot];
+  }else{
+    require_action(pairCount < MAXPairNumber, exit, err = kNoSpaceErr);
+    entry = calloc(1, sizeof(pair_index_t));
+    require_action(entry, exit, err = kNoMemoryErr);
+    entry->nameHash = hash;
+    strncpy(entry->controllerName, name, 63);
+    _IndexInsert(entry);
+    pairCount++;
+  }
+  memcpy(entry->controllerLTPK, LTPK, 32);
+  entry->recordAddress = recordAddress;
+
+exit:
+  return err;
+}
+
+static OSStatus _InvalidateRecord(uint32_t recordAddress)
+{
+  uint32_t magic = kPairRecordRemoved;
+  return MicoFlashWrite(MICO_FLASH_FOR_EX_PARA, &recordAddress, (uint8_t *)&magic, sizeof(uint32_t));
+}
+
+static OSStatus _AppendRecord(pair_index_t *entry)
+{
+  OSStatus err = kNoErr;
+  uint32_t bodyAddress = pairLogEnd + sizeof(uint32_t);
+  uint32_t magicAddress = pairLogEnd;
+  uint32_t magic = kPairRecordMagic;
+
+  require_action(pairLogEnd + sizeof(pair_record_t) <= EX_PARA_END_ADDRESS + 1, exit, err = kNoSpaceErr);
+  err = MicoFlashWrite(MICO_FLASH_FOR_EX_PARA, &bodyAddress, (uint8_t *)entry->controllerName, 64);
   require_noerr(err, exit);
-  err = MicoFlashErase(MICO_FLASH_FOR_EX_PARA, exParaStartAddress, exParaEndAddress);
+  err = MicoFlashWrite(MICO_FLASH_FOR_EX_PARA, &bodyAddress, entry->controllerLTPK, 32);
   require_noerr(err, exit);
-  err = MicoFlashWrite(MICO_FLASH_FOR_EX_PARA, &exParaStartAddress, (uint8_t *)pairList, sizeof(pair_list_in_flash_t));
+  err = MicoFlashWrite(MICO_FLASH_FOR_EX_PARA, &magicAddress, (uint8_t *)&magic, sizeof(uint32_t));
+  require_noerr(err, exit);
+
+  entry->recordAddress = pairLogEnd;
+  pairLogEnd += sizeof(pair_record_t);
+
+exit:
+  return err;
+}
+
+/* Erase the sector and write back live records from RAM, only needed when the log is full */
+static OSStatus _CompactPairList(void)
+{
+  OSStatus err = kNoErr;
+  uint32_t address = EX_PARA_START_ADDRESS;
+  uint32_t header = kPairLogHeader;
+  int i;
+
+  pair_list_log("Compact pair list, %d records", pairCount);
+  err = MicoFlashErase(MICO_FLASH_FOR_EX_PARA, EX_PARA_START_ADDRESS, EX_PARA_END_ADDRESS);
   require_noerr(err, exit);
-  err = MicoFlashFinalize(MICO_FLASH_FOR_EX_PARA);
+  err = MicoFlashWrite(MICO_FLASH_FOR_EX_PARA, &address, (uint8_t *)&header, sizeof(uint32_t));
   require_noerr(err, exit);
+  pairLogEnd = address;
+
+  for(i=0; i<kPairIndexSize; i++){
+    if(pairIndex[i] == NULL) continue;
+    err = _AppendRecord(pairIndex[i]);
+    require_noerr(err, exit);
+  }
 
 exit:
-  if(pairList) free(pairList);
   return err;
 }
 
-OSStatus HMReadPairList(pair_list_in_flash_t *pPairList)
+/* Import the fixed table written by firmware before the log format */
+static OSStatus _ImportLegacyPairList(void)
 {
-  uint32_t configInFlash;
   OSStatus err = kNoErr;
-  require(pPairList, exit);
+  uint32_t address = EX_PARA_START_ADDRESS;
+  _pair_t legacyPair;
+  int i;
+
+  for(i=0; i<MAXPairNumber; i++){
+    err = MicoFlashRead(MICO_FLASH_FOR_EX_PARA, &address, (uint8_t *)&legacyPair, sizeof(_pair_t));
+    require_noerr(err, exit);
+    if(legacyPair.controllerName[0] == 0x0 || (uint8_t)legacyPair.controllerName[0] == 0xFF)
+      continue;
+    legacyPair.controllerName[63] = 0x0;
+    _IndexAdd(legacyPair.controllerName, legacyPair.controllerLTPK, 0);
+  }
 
-  configInFlash = EX_PARA_START_ADDRESS;
-  err = MicoFlashRead(MICO_FLASH_FOR_EX_PARA, &configInFlash, (uint8_t *)pPairList, sizeof(pair_list_in_flash_t));
-  //memcpy(pPairList, (void *)configInFlash, sizeof(pair_list_in_flash_t));
+  err = _CompactPairList();
 
-exit: 
+exit:
   return err;
 }
 
-OSStatus HMUpdatePairList(pair_list_in_flash_t *pPairList)
+static bool _RecordErased(uint32_t address)
+{
+  uint32_t word;
+  int i;
+
+  for(i=0; i<sizeof(pair_record_t)/sizeof(uint32_t); i++){
+    MicoFlashRead(MICO_FLASH_FOR_EX_PARA, &address, (uint8_t *)&word, sizeof(uint32_t));
+    if(word != kPairRecordErased) return false;
+  }
+  return true;
+}
+
+OSStatus HMPairListInit(void)
 {
   OSStatus err = kNoErr;
-  uint32_t exParaStartAddress, exParaEndAddress;
- 
-  exParaStartAddress = EX_PARA_START_ADDRESS;
-  exParaEndAddress = EX_PARA_END_ADDRESS;
+  uint32_t address = EX_PARA_START_ADDRESS;
+  uint32_t header;
+  pair_record_t record;
+  uint32_t recordAddress;
+
+  if(pairList_mutex == NULL){
+    err = mico_rtos_init_mutex(&pairList_mutex);
+    require_noerr(err, exit);
+  }
 
+  pair_list_lock();
+  _IndexClear();
+  err = MicoFlashInitialize(MICO_FLASH_FOR_EX_PARA);
+  require_noerr(err, exit_unlock);
+
+  err = MicoFlashRead(MICO_FLASH_FOR_EX_PARA, &address, (uint8_t *)&header, sizeof(uint32_t));
+  require_noerr(err, exit_finalize);
+
+  if(header != kPairLogHeader){
+    if(header == kPairRecordErased && _RecordErased(EX_PARA_START_ADDRESS)){
+      address = EX_PARA_START_ADDRESS;
+      header = kPairLogHeader;
+      err = MicoFlashWrite(MICO_FLASH_FOR_EX_PARA, &address, (uint8_t *)&header, sizeof(uint32_t));
+      pairLogEnd = address;
+    }else{
+      pair_list_log("Import legacy pair list");
+      err = _ImportLegacyPairList();
+    }
+    goto exit_finalize;
+  }
+
+  /*Replay the log, later records replace earlier ones*/
+  while(address + sizeof(pair_record_t) <= EX_PARA_END_ADDRESS + 1){
+    recordAddress = address;
+    err = MicoFlashRead(MICO_FLASH_FOR_EX_PARA, &address, (uint8_t *)&record, sizeof(pair_record_t));
+    require_noerr(err, exit_finalize);
+
+    if(record.magic == kPairRecordMagic){
+      record.controllerName[63] = 0x0;
+      if(_IndexAdd(record.controllerName, record.controllerLTPK, recordAddress) == kNoSpaceErr)
+        pair_list_log("Pair list is full, record dropped: %s", record.controllerName);
+    }else if(record.magic == kPairRecordErased && _RecordErased(recordAddress)){
+      address = recordAddress;
+      break;
+    }
+  }
+  pairLogEnd = address;
+  pair_list_log("Pair list loaded, %d controllers", pairCount);
+
+exit_finalize:
+  MicoFlashFinalize(MICO_FLASH_FOR_EX_PARA);
+exit_unlock:
+  pair_list_unlock();
+exit:
+  return err;
+}
+
+OSStatus HMClearPairList(void)
+{
+  OSStatus err = kNoErr;
+
+  pair_list_lock();
+  _IndexClear();
   err = MicoFlashInitialize(MICO_FLASH_FOR_EX_PARA);
   require_noerr(err, exit);
-  err = MicoFlashErase(MICO_FLASH_FOR_EX_PARA, exParaStartAddress, exParaEndAddress);
-  require_noerr(err, exit);
-  err = MicoFlashWrite(MICO_FLASH_FOR_EX_PARA, &exParaStartAddress, (uint8_t *)pPairList, sizeof(pair_list_in_flash_t));
-  require_noerr(err, exit);
-  err = MicoFlashFinalize(MICO_FLASH_FOR_EX_PARA);
-  require_noerr(err, exit);
+  err = _CompactPairList();
+  MicoFlashFinalize(MICO_FLASH_FOR_EX_PARA);
 
 exit:
+  pair_list_unlock();
   return err;
 }
 
-static uint8_t foundControllerLTPK[32];
-uint8_t * HMFindLTPK(char * name)
+OSStatus HMAddPair(const char * name, const uint8_t * LTPK)
 {
-  int i;
+  OSStatus err = kNoErr;
+  uint32_t oldRecordAddress = 0;
+  uint32_t hash = _NameHash(name);
+  int slot;
 
-  //pair_list_in_flash_t *pairList = (pair_list_in_flash_t *)EX_PARA_START_ADDRESS;
-  pair_list_in_flash_t pairList;
-  HMReadPairList(&pairList);
+  pair_list_lock();
+  slot = _IndexFind(name, hash);
+  if(slot >= 0){
+    if(memcmp(pairIndex[slot]->controllerLTPK, LTPK, 32) == 0) goto exit;
+    oldRecordAddress = pairIndex[slot]->recordAddress;
+  }
 
-  for(i=0; i<MAXPairNumber; i++){
-    if(strncmp(pairList.pairInfo[i].controllerName, name, 64) == 0)
-      memcpy(foundControllerLTPK, pairList.pairInfo[i].controllerLTPK, 32);
-      return foundControllerLTPK;
+  err = _IndexAdd(name, LTPK, 0);
+  require_noerr(err, exit);
+  slot = _IndexFind(name, hash);
+
+  err = MicoFlashInitialize(MICO_FLASH_FOR_EX_PARA);
+  require_noerr(err, exit);
+  if(pairLogEnd + sizeof(pair_record_t) > EX_PARA_END_ADDRESS + 1){
+    err = _CompactPairList();
+  }else{
+    err = _AppendRecord(pairIndex[slot]);
+    if(err == kNoErr && oldRecordAddress)
+      err = _InvalidateRecord(oldRecordAddress);
   }
-  return NULL;
+  MicoFlashFinalize(MICO_FLASH_FOR_EX_PARA);
 
+exit:
+  pair_list_unlock();
+  return err;
 }
 
+OSStatus HMRemovePair(const char * name)
+{
+  OSStatus err = kNoErr;
+  int slot;
+
+  pair_list_lock();
+  slot = _IndexFind(name, _NameHash(name));
+  require_action(slot >= 0, exit, err = kNotFoundErr);
+
+  err = MicoFlashInitialize(MICO_FLASH_FOR_EX_PARA);
+  require_noerr(err, exit);
+  if(pairIndex[slot]->recordAddress)
+    err = _InvalidateRecord(pairIndex[slot]->recordAddress);
+  MicoFlashFinalize(MICO_FLASH_FOR_EX_PARA);
+  require_noerr(err, exit);
 
+  _IndexRemove(slot);
+  HKSessionCacheRemove(name);
 
+exit:
+  pair_list_unlock();
+  return err;
+}
+
+uint8_t * HMFindLTPK(char * name)
+{
+  uint8_t *LTPK = NULL;
+  int slot;
+
+  pair_list_lock();
+  slot = _IndexFind(name, _NameHash(name));
+  if(slot >= 0)
+    LTPK = pairIndex[slot]->controllerLTPK;
+  pair_list_unlock();
+  return LTPK;
+}
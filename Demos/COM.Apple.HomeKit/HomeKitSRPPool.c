@@ -0,0 +1,142 @@
+/**
+******************************************************************************
+* @file    HomeKitSRPPool.c
+* @author  William Xu
+* @version V1.0.0
+* @date    21-Oct-2014
+* @brief   Pool of pre-generated SRP servers, used by pair-setup M2.
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+#include "MICO.h"
+#include "MICOAppDefine.h"
+#include "Debug.h"
+#include "HomeKitSRPPool.h"
+
+#define srp_pool_log(M, ...) custom_log("HKSRPPool", M, ##__VA_ARGS__)
+
+static srp_server_t *         srpPool[HK_SRP_POOL_SIZE];
+static const char *           srpPoolPassword = NULL;
+/*Increased by every password change, a server generated with an old password is dropped*/
+static uint32_t               srpPoolGeneration = 0;
+static mico_mutex_t           srpPool_mutex = NULL;
+static mico_semaphore_t       srpPool_sem = NULL;
+
+static void _SRPPoolFlush(void)
+{
+  int i;
+
+  for(i=0; i<HK_SRP_POOL_SIZE; i++){
+    if(srpPool[i]) srp_server_delete(&srpPool[i]);
+    srpPool[i] = NULL;
+  }
+}
+
+/*Each server is used for one pair-setup attempt only, b must never be reused*/
+static void srpPool_thread(void *arg)
+{
+  (void)arg;
+  int i;
+  srp_server_t *server;
+  const char *password;
+  uint32_t generation;
+
+  while(1){
+    mico_rtos_lock_mutex(&srpPool_mutex);
+    password = srpPoolPassword;
+    generation = srpPoolGeneration;
+    for(i=0; i<HK_SRP_POOL_SIZE; i++)
+      if(srpPool[i] == NULL) break;
+    mico_rtos_unlock_mutex(&srpPool_mutex);
+
+    if(i == HK_SRP_POOL_SIZE || password == NULL){
+      mico_rtos_get_semaphore(&srpPool_sem, MICO_WAIT_FOREVER);
+      continue;
+    }
+
+    server = srp_server_setup( SRP_SHA1, SRP_NG_2048, HK_SRP_POOL_USER, (const unsigned char *)password, strlen(password), 0, 0);
+    if(server == NULL){
+      srp_pool_log("SRP server generate failed");
+      mico_thread_msleep(1000);
+      continue;
+    }
+
+    mico_rtos_lock_mutex(&srpPool_mutex);
+    for(i=0; i<HK_SRP_POOL_SIZE; i++)
+      if(srpPool[i] == NULL) break;
+    if(generation == srpPoolGeneration && i < HK_SRP_POOL_SIZE){
+      srpPool[i] = server;
+      server = NULL;
+    }
+    mico_rtos_unlock_mutex(&srpPool_mutex);
+    if(server) srp_server_delete(&server);
+  }
+}
+
+OSStatus HKSRPPoolInit(void)
+{
+  OSStatus err = kNoErr;
+
+  if(srpPool_mutex == NULL){
+    err = mico_rtos_init_mutex(&srpPool_mutex);
+    require_noerr(err, exit);
+  }
+  err = mico_rtos_init_semaphore(&srpPool_sem, HK_SRP_POOL_SIZE);
+  require_noerr(err, exit);
+
+  /*Below the application threads, only runs when the device is idle*/
+  err = mico_rtos_create_thread(NULL, MICO_APPLICATION_PRIORITY + 1, "HomeKit SRP", srpPool_thread, 0xA00, NULL);
+  require_noerr(err, exit);
+
+exit:
+  return err;
+}
+
+void HKSRPPoolSetPassword(const char *password)
+{
+  if(srpPool_mutex == NULL){
+    srpPoolPassword = password;
+    return;
+  }
+
+  mico_rtos_lock_mutex(&srpPool_mutex);
+  srpPoolPassword = password;
+  srpPoolGeneration++;
+  _SRPPoolFlush();
+  mico_rtos_unlock_mutex(&srpPool_mutex);
+  mico_rtos_set_semaphore(&srpPool_sem);
+}
+
+srp_server_t* HKSRPPoolTake(const char *username)
+{
+  int i;
+  srp_server_t *server = NULL;
+
+  if(srpPool_mutex == NULL || username == NULL) return NULL;
+  if(strcmp(username, HK_SRP_POOL_USER) != 0) return NULL;
+
+  mico_rtos_lock_mutex(&srpPool_mutex);
+  for(i=0; i<HK_SRP_POOL_SIZE; i++){
+    if(srpPool[i]){
+      server = srpPool[i];
+      srpPool[i] = NULL;
+      break;
+    }
+  }
+  mico_rtos_unlock_mutex(&srpPool_mutex);
+
+  mico_rtos_set_semaphore(&srpPool_sem);
+  if(server == NULL) srp_pool_log("SRP pool is empty, generate server in place");
+  return server;
+}
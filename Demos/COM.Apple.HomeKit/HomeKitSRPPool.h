@@ -0,0 +1,40 @@
+/**
+******************************************************************************
+* @file    HomeKitSRPPool.h
+* @author  William Xu
+* @version V1.0.0
+* @date    21-Oct-2014
+* @brief   This header contains function prototypes of the SRP server pool.
+*          Salt, verifier and server ephemeral key are generated by a low
+*          priority thread before a controller starts pair-setup.
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+#ifndef __HOMEKITSRPPOOL_h__
+#define __HOMEKITSRPPOOL_h__
+
+#include "Common.h"
+#include "MICOSRPServer.h"
+
+OSStatus HKSRPPoolInit(void);
+
+/* Drop every pooled server and regenerate them with the new setup code */
+void HKSRPPoolSetPassword(const char *password);
+
+/* Return a ready SRP server for this user and start generating a new one,
+   NULL if the pool is empty or the user is not the pooled one. The caller
+   owns the server and frees it with srp_server_delete */
+srp_server_t* HKSRPPoolTake(const char *username);
+
+#endif // __HOMEKITSRPPOOL_h__
@@ -27,6 +27,8 @@
 #include "HomeKitHTTPUtils.h"
 #include "HomeKitPairProtocol.h"
 #include "HomeKitProfiles.h"
+#include "HomeKitSessionCache.h"
+#include "HomeKitSRPPool.h"
 
 #define ha_log(M, ...) custom_log("HomeKit", M, ##__VA_ARGS__)
 #define ha_log_trace() custom_log_trace("HomeKit")
@@ -36,6 +38,7 @@
 #define kPAIRINGS           "/pairing"
 #define kReadAcc            "/accessories"
 #define kAccessories        "/accessories/"
+#define kCharacteristicsBatch "/characteristics"
 #define kServices           "/services/"
 #define kCharacteristics    "/characteristics/"
 
@@ -43,29 +46,96 @@
 #define min(a,b) ((a) < (b) ? (a) : (b))
 
 static char *password = "12345678";
-extern struct _hapAccessory_t hapObjects[];
+
+/* Rendered /accessories response shared by all sessions, it is rebuilt by the
+   first request after a characteristic value has changed */
+typedef struct _hap_db_cache_t {
+  int                 refCount;
+  printbuf            *buffer;
+} hap_db_cache_t;
+
+static hap_db_cache_t *hapDataBaseCache = NULL;
+static mico_mutex_t   hapDataBaseCache_mutex = NULL;
+
+/* Event subscriptions and pending events, one bit per attribute in
+   HKAttributeIndex order */
+#define HKEventBitmapWords  ((NumberofAccessories*MAXServicePerAccessory*MAXCharacteristicPerService+31)/32)
 
 typedef struct _HK_Context_t {
   pairInfo_t          *pairInfo;
   pairVerifyInfo_t    *pairVerifyInfo;
   security_session_t  *session;
+  uint32_t            eventSubscribed[HKEventBitmapWords];
+  uint32_t            eventPending[HKEventBitmapWords];
+  uint32_t            eventPendingSince;
+  bool                requestBodyPending;
+  uint16_t            wakeupPort;   // Loopback port of the thread waiting for this session
+  struct _HK_Context_t *next;
 } HK_Context_t;
 
+#define HKEventNonePending  0xFFFFFFFFUL
+
+/* Sessions that can receive events, protected by hkSession_mutex, which also
+   serializes the socket that wakes up their waiting threads */
+static HK_Context_t   *hkSessionList = NULL;
+static mico_mutex_t   hkSession_mutex = NULL;
+static int            hkWakeupSendFd = -1;
+
+#ifdef HK_SERVER_EVENT_LOOP
+/* Per-controller state in event loop mode. An idle session costs this struct
+   and its security session, the HTTP header buffer is only kept while a
+   partial request is buffered, and requests run on a worker thread. Socket
+   reads never block, a worker returns a session whose request is incomplete
+   to the event loop. */
+typedef struct _hk_session_t {
+  int                 fd;
+  volatile bool       busy;
+  volatile bool       closed;
+  bool                readRequest;
+  HTTPHeader_t        *httpHeader;
+  HK_Context_t        hkContext;
+} hk_session_t;
+
+static hk_session_t   *hkSessions[HK_MAX_SESSIONS];
+static mico_queue_t   hkWorkerQueue;
+static int            hkWakeupFd = -1;
+
+static void homeKitEventLoop(int listenerFd);
+static void homeKitWorker_thread(void *arg);
+#endif
+
 extern  void HKCharacteristicInit(mico_Context_t * const inContext);
 extern HkStatus HKReadCharacteristicValue(int accessoryID, int serviceID, int characteristicID, value_union *value, mico_Context_t * const inContext);
 extern void HKWriteCharacteristicValue(int accessoryID, int serviceID, int characteristicID, value_union value, bool moreComing, mico_Context_t * const inContext);
 
+#ifndef HK_SERVER_EVENT_LOOP
 static void homeKitClient_thread(void *inFd);
+#endif
+static void _HKSessionRegister(HK_Context_t *inHkContext);
+static void _HKSessionUnregister(HK_Context_t *inHkContext);
 static mico_Context_t *Context;
 static OSStatus HKhandleIncomeingMessage(int clientFd, HTTPHeader_t *httpHeader, HK_Context_t *inHkContext, mico_Context_t * const inContext);
-static OSStatus HKCreateHAPAttriDataBase( struct _hapAccessory_t *inHapObject,  json_object **OutHapObjectJson, mico_Context_t * const inContext);
-static OSStatus HKCreateHAPReadRespond( struct _hapAccessory_t inHapObject[],  json_object **OutHapObjectJson, 
+static OSStatus HKCreateHAPAttriDataBase( json_object **OutHapObjectJson, mico_Context_t * const inContext);
+static hap_db_cache_t *HKDataBaseCacheGet(mico_Context_t * const inContext);
+static void HKDataBaseCacheRelease(hap_db_cache_t *cache);
+void HKDataBaseCacheInvalidate(void);
+void HKNotifyCharacteristicChanged(int accessoryID, int serviceID, int characteristicID);
+static OSStatus HKSendEvents(int sockfd, HK_Context_t *inHkContext, mico_Context_t * const inContext);
+static bool _HKEventBitmapEmpty(const uint32_t *bitmap);
+static uint32_t _HKEventDelay(HK_Context_t *inHkContext);
+static void _HKWakeup(uint16_t port);
+static void _HKEventSubscribe(HK_Context_t *inHkContext, int index, bool enable);
+static void _HKEventClearPending(HK_Context_t *inHkContext, int index);
+static OSStatus HKCreateHAPReadRespond( json_object **OutHapObjectJson, 
                                                 int accessoryID, int serviceID, int characteristicID, mico_Context_t * const inContext);
-static OSStatus HKCreateHAPWriteRespond( struct _hapAccessory_t inHapObject[],  json_object *inputHapObjectJson, json_object **OutHapObjectJson,
+static HkStatus HKCreateHAPBatchReadRespond( HTTPHeader_t *inHeader, json_object **OutHapObjectJson, mico_Context_t * const inContext);
+static HkStatus HKCreateHAPBatchWriteRespond( HK_Context_t *inHkContext, json_object *inputHapObjectJson, json_object **OutHapObjectJson,
+                                              mico_Context_t * const inContext);
+static OSStatus HKCreateHAPWriteRespond( HK_Context_t *inHkContext, json_object *inputHapObjectJson, json_object **OutHapObjectJson,
                                                 int accessoryID, int serviceID, int characteristicID, mico_Context_t * const inContext);
-void _HKReadCharacteristicValue_respond(struct _hapAccessory_t inHapObject[], int accessoryID, int serviceID, 
+void _HKReadCharacteristicValue_respond(int accessoryID, int serviceID, 
                                         int characteristicID, json_object **OutHapObjectJson, mico_Context_t * const inContext);
-void _HKWriteCharacteristicValue_respond(struct _hapAccessory_t inHapObject[], int accessoryID, int serviceID, 
+void _HKWriteCharacteristicValue_respond(int accessoryID, int serviceID, 
                                         int characteristicID, json_object **OutHapObjectJson, mico_Context_t * const inContext);
 
 
@@ -76,14 +146,27 @@ void homeKitListener_thread(void *inContext)
   int j;
   Context = inContext;
   struct sockaddr_t addr;
+#ifndef HK_SERVER_EVENT_LOOP
   int sockaddr_t_size;
   fd_set readfds;
   char ip_address[16];
+#endif
   
   int homeKitlistener_fd = -1;
   HKSetPassword (password);
   Context->appStatus.haPairSetupRunning = false;
+  HKProfilesInit();
+  err = mico_rtos_init_mutex(&hapDataBaseCache_mutex);
+  require_noerr( err, exit );
+  err = mico_rtos_init_mutex(&hkSession_mutex);
+  require_noerr( err, exit );
   HKCharacteristicInit(inContext);
+  err = HKSessionCacheInit();
+  require_noerr( err, exit );
+  err = HMPairListInit();
+  require_noerr( err, exit );
+  err = HKSRPPoolInit();
+  require_noerr( err, exit );
   /*Establish a TCP server fd that accept the tcp clients connections*/ 
   homeKitlistener_fd = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
   require_action(IsValidSocket( homeKitlistener_fd ), exit, err = kNoResourcesErr );
@@ -96,7 +179,26 @@ void homeKitListener_thread(void *inContext)
   require_noerr( err, exit );
 
   ha_log("HomeKit Server established at port: %d, fd: %d", HA_SERVER_PORT, homeKitlistener_fd);
-  
+
+  hkWakeupSendFd = socket( AF_INET, SOCK_DGRM, IPPROTO_UDP );
+  require_action(IsValidSocket( hkWakeupSendFd ), exit, err = kNoResourcesErr );
+
+#ifdef HK_SERVER_EVENT_LOOP
+  hkWakeupFd = socket( AF_INET, SOCK_DGRM, IPPROTO_UDP );
+  require_action(IsValidSocket( hkWakeupFd ), exit, err = kNoResourcesErr );
+  addr.s_ip = IPADDR_LOOPBACK;
+  addr.s_port = HK_WAKEUP_LOOPBACK_PORT;
+  err = bind( hkWakeupFd, &addr, sizeof(addr) );
+  require_noerr( err, exit );
+
+  err = mico_rtos_init_queue(&hkWorkerQueue, "HomeKit Jobs", sizeof(hk_session_t *), HK_MAX_SESSIONS);
+  require_noerr( err, exit );
+  for(j = 0; j < HK_WORKER_NUMBER; j++){
+    err = mico_rtos_create_thread(NULL, MICO_APPLICATION_PRIORITY, "HomeKit Worker", homeKitWorker_thread, 0xA00, NULL);
+    require_noerr( err, exit );
+  }
+  homeKitEventLoop(homeKitlistener_fd);
+#else
   while(1){
     FD_ZERO(&readfds);
     FD_SET(homeKitlistener_fd, &readfds);
@@ -118,6 +220,7 @@ void homeKitListener_thread(void *inContext)
       }
     }
    }
+#endif
 
 exit:
     ha_log("Exit: HomeKit Server exit with err = %d", err);
@@ -125,71 +228,424 @@ exit:
     return;
 }
 
+#ifndef HK_SERVER_EVENT_LOOP
 void homeKitClient_thread(void *inFd)
 {
   ha_log_trace();
   OSStatus err;
   int clientFd = *(int *)inFd;
+  int wakeupFd = -1;
   struct timeval_t t;
+  struct sockaddr_t addr;
   HTTPHeader_t *httpHeader = NULL;
   int selectResult;
   fd_set      readfds;
   HK_Context_t hkContext;
+  uint32_t    delay;
+  uint8_t     signal[16];
 
   memset(&hkContext, 0x0, sizeof(HK_Context_t));
   hkContext.session = HKSNewSecuritySession();
   require_action(hkContext.session, exit, err = kNoMemoryErr);
 
+  /*Loopback fd, a characteristic change wakes up this thread through it*/
+  wakeupFd = socket( AF_INET, SOCK_DGRM, IPPROTO_UDP );
+  require_action(IsValidSocket( wakeupFd ), exit, err = kNoResourcesErr );
+  addr.s_ip = IPADDR_LOOPBACK;
+  addr.s_port = HK_WAKEUP_LOOPBACK_PORT + 1 + clientFd;
+  err = bind( wakeupFd, &addr, sizeof(addr) );
+  require_noerr( err, exit );
+  hkContext.wakeupPort = addr.s_port;
+
   httpHeader = calloc(1, sizeof( HTTPHeader_t ) );
   require_action( httpHeader, exit, err = kNoMemoryErr );
 
-  t.tv_sec = 60;
-  t.tv_usec = 0;
   ha_log("Free memory1: %d", mico_memory_info()->free_memory);
 
+  _HKSessionRegister(&hkContext);
+
   while(1){
     if(hkContext.session->established == true && hkContext.session->recvedDataLen > 0){
        err = HKhandleIncomeingMessage(clientFd, httpHeader, &hkContext, Context);
     }else{
+      /*Wake up when the coalescing window of pending events ends*/
+      delay = _HKEventDelay(&hkContext);
+      if(delay == HKEventNonePending){
+        t.tv_sec = 60;
+        t.tv_usec = 0;
+      }else{
+        t.tv_sec = delay/1000;
+        t.tv_usec = (delay%1000)*1000;
+      }
       FD_ZERO(&readfds);
       FD_SET(clientFd, &readfds);
-      selectResult = select(clientFd + 1, &readfds, NULL, NULL, &t);
+      FD_SET(wakeupFd, &readfds);
+      selectResult = select(((clientFd > wakeupFd)? clientFd : wakeupFd) + 1, &readfds, NULL, NULL, &t);
       require( selectResult >= 0, exit );
+      if(FD_ISSET(wakeupFd, &readfds))
+        recv(wakeupFd, signal, sizeof(signal), 0);
       if(FD_ISSET(clientFd, &readfds)){
         err = HKhandleIncomeingMessage(clientFd, httpHeader, &hkContext, Context);
         require_noerr(err, exit);
       }
     }
+    err = HKSendEvents(clientFd, &hkContext, Context);
+    require_noerr(err, exit);
   }
 
 exit:
+  _HKSessionUnregister(&hkContext);
   SocketClose(&clientFd);
+  if(wakeupFd != -1)
+    SocketClose(&wakeupFd);
   HTTPHeaderClear( httpHeader );
   if(httpHeader)    free(httpHeader);
 
   HKCleanPairSetupInfo(&hkContext.pairInfo, Context);
   HKCleanPairVerifyInfo(&hkContext.pairVerifyInfo);
-  free(hkContext.session);
+  HKSFreeSecuritySession(hkContext.session);
   ha_log("Last Free memory1: %d", mico_memory_info()->free_memory);
   mico_rtos_delete_thread(NULL);
   return;
 }
+#endif
+
+static void _HKSessionRegister(HK_Context_t *inHkContext)
+{
+  mico_rtos_lock_mutex(&hkSession_mutex);
+  inHkContext->next = hkSessionList;
+  hkSessionList = inHkContext;
+  mico_rtos_unlock_mutex(&hkSession_mutex);
+}
+
+static void _HKSessionUnregister(HK_Context_t *inHkContext)
+{
+  HK_Context_t **pSession;
+
+  mico_rtos_lock_mutex(&hkSession_mutex);
+  for(pSession = &hkSessionList; *pSession; pSession = &(*pSession)->next){
+    if(*pSession == inHkContext){
+      *pSession = inHkContext->next;
+      break;
+    }
+  }
+  mico_rtos_unlock_mutex(&hkSession_mutex);
+}
+
+#ifdef HK_SERVER_EVENT_LOOP
+static void _HKSessionClose(int index)
+{
+  hk_session_t *session = hkSessions[index];
+
+  _HKSessionUnregister(&session->hkContext);
+  SocketClose(&session->fd);
+  if(session->httpHeader){
+    HTTPHeaderClear( session->httpHeader );
+    free(session->httpHeader);
+  }
+  HKCleanPairSetupInfo(&session->hkContext.pairInfo, Context);
+  HKCleanPairVerifyInfo(&session->hkContext.pairVerifyInfo);
+  HKSFreeSecuritySession(session->hkContext.session);
+  free(session);
+  hkSessions[index] = NULL;
+}
+
+/* Interrupt the select() of the event loop */
+static void _HKEventLoopWakeup(void)
+{
+  mico_rtos_lock_mutex(&hkSession_mutex);
+  _HKWakeup(HK_WAKEUP_LOOPBACK_PORT);
+  mico_rtos_unlock_mutex(&hkSession_mutex);
+}
+
+/* Queue a job that reads a request, or only sends the pending events */
+static void _HKSessionDispatch(hk_session_t *session, bool readRequest)
+{
+  session->busy = true;
+  session->readRequest = readRequest;
+  if(mico_rtos_push_to_queue(&hkWorkerQueue, &session, 0) != kNoErr)
+    session->busy = false;
+}
+
+/* Run one request of a session, or as much of it as has arrived, then send the
+   events that are due. The event loop skips the session until busy is cleared
+   and is woken up to watch it again. */
+static void homeKitWorker_thread(void *arg)
+{
+  (void)arg;
+  OSStatus err;
+  hk_session_t *session;
+
+  while(1){
+    if(mico_rtos_pop_from_queue(&hkWorkerQueue, &session, MICO_WAIT_FOREVER) != kNoErr)
+      continue;
+
+    err = kNoErr;
+    if(session->readRequest){
+      if(session->httpHeader == NULL)
+        session->httpHeader = calloc(1, sizeof( HTTPHeader_t ) );
+
+      if(session->httpHeader == NULL)
+        err = kNoMemoryErr;
+      else
+        err = HKhandleIncomeingMessage(session->fd, session->httpHeader, &session->hkContext, Context);
+
+      if(err == kNoErr && session->httpHeader->len == 0){
+        /*Nothing of the next request is buffered*/
+        free(session->httpHeader);
+        session->httpHeader = NULL;
+      }
+    }
+
+    if(err == kNoErr)
+      err = HKSendEvents(session->fd, &session->hkContext, Context);
+
+    if(err != kNoErr)
+      session->closed = true;
+    session->busy = false;
+    _HKEventLoopWakeup();
+  }
+}
+
+/* Accept controllers and watch every idle session socket in one select(),
+   readable sessions are handed to the worker pool */
+static void homeKitEventLoop(int listenerFd)
+{
+  int i, clientFd, maxFd, sockaddr_t_size;
+  fd_set readfds;
+  struct timeval_t t;
+  struct sockaddr_t addr;
+  char ip_address[16];
+  uint8_t signal[16];
+  uint32_t wait, delay;
+  hk_session_t *session;
+
+  while(1){
+    FD_ZERO(&readfds);
+    FD_SET(listenerFd, &readfds);
+    FD_SET(hkWakeupFd, &readfds);
+    maxFd = (listenerFd > hkWakeupFd)? listenerFd : hkWakeupFd;
+    wait = 60*1000;
+
+    for(i = 0; i < HK_MAX_SESSIONS; i++){
+      session = hkSessions[i];
+      if(session == NULL) continue;
+      if(session->busy == false && session->closed == true){
+        _HKSessionClose(i);
+        continue;
+      }
+      if(session->busy == true) continue;
+      /*Decrypted data of the next request is buffered already*/
+      if(session->hkContext.session->established == true && session->hkContext.session->recvedDataLen > 0){
+        _HKSessionDispatch(session, true);
+        continue;
+      }
+      /*Wake up when the coalescing window of pending events ends, a characteristic
+        change that starts a window wakes up the loop*/
+      delay = _HKEventDelay(&session->hkContext);
+      if(delay < wait) wait = delay;
+      FD_SET(session->fd, &readfds);
+      if(session->fd > maxFd) maxFd = session->fd;
+    }
+
+    t.tv_sec = wait/1000;
+    t.tv_usec = (wait%1000)*1000;
+    if(select(maxFd + 1, &readfds, NULL, NULL, &t) < 0)
+      continue;
+
+    /*A worker has finished, its session is watched again in the next round*/
+    if(FD_ISSET(hkWakeupFd, &readfds))
+      recv(hkWakeupFd, signal, sizeof(signal), 0);
+
+    for(i = 0; i < HK_MAX_SESSIONS; i++){
+      session = hkSessions[i];
+      if(session == NULL || session->busy == true || session->closed == true) continue;
+      if(FD_ISSET(session->fd, &readfds))
+        _HKSessionDispatch(session, true);
+      else if(_HKEventDelay(&session->hkContext) == 0)
+        _HKSessionDispatch(session, false);
+    }
+
+    /*Check tcp connection requests */
+    if(FD_ISSET(listenerFd, &readfds)){
+      sockaddr_t_size = sizeof(struct sockaddr_t);
+      clientFd = accept(listenerFd, &addr, &sockaddr_t_size);
+      if (clientFd > 0) {
+        inet_ntoa(ip_address, addr.s_ip );
+        for(i = 0; i < HK_MAX_SESSIONS; i++)
+          if(hkSessions[i] == NULL) break;
+        session = (i < HK_MAX_SESSIONS)? calloc(1, sizeof(hk_session_t)) : NULL;
+        if(session) session->hkContext.session = HKSNewSecuritySession();
+        if(session && session->hkContext.session) session->hkContext.session->nonBlocking = true;
+        if(session) session->hkContext.wakeupPort = HK_WAKEUP_LOOPBACK_PORT;
+        if(session == NULL || session->hkContext.session == NULL){
+          ha_log("HomeKit Client %s:%d rejected, no session available", ip_address, addr.s_port);
+          if(session) free(session);
+          SocketClose(&clientFd);
+          continue;
+        }
+        session->fd = clientFd;
+        hkSessions[i] = session;
+        _HKSessionRegister(&session->hkContext);
+        ha_log("HomeKit Client %s:%d connected, fd: %d, session: %d, memory: %d", 
+               ip_address, addr.s_port, clientFd, i, mico_memory_info()->free_memory);
+      }
+    }
+  }
+}
+#endif
+
+static bool _HKEventBitmapEmpty(const uint32_t *bitmap)
+{
+  int i;
+  for(i=0; i<HKEventBitmapWords; i++)
+    if(bitmap[i]) return false;
+  return true;
+}
+
+/* Milliseconds until the pending events of a session are due, 0 if they are due
+   now and HKEventNonePending if nothing is pending */
+static uint32_t _HKEventDelay(HK_Context_t *inHkContext)
+{
+  uint32_t elapsed, delay = HKEventNonePending;
+
+  mico_rtos_lock_mutex(&hkSession_mutex);
+  if(inHkContext->session->established == true && !_HKEventBitmapEmpty(inHkContext->eventPending)){
+    elapsed = mico_get_time() - inHkContext->eventPendingSince;
+    delay = (elapsed < HK_EVENT_COALESCE_WINDOW)? HK_EVENT_COALESCE_WINDOW - elapsed : 0;
+  }
+  mico_rtos_unlock_mutex(&hkSession_mutex);
+  return delay;
+}
+
+/* Wake up the thread waiting on a loopback port, callers hold hkSession_mutex */
+static void _HKWakeup(uint16_t port)
+{
+  struct sockaddr_t addr;
+  uint8_t signal = 0;
+
+  if(port == 0 || hkWakeupSendFd == -1) return;
+  addr.s_ip = IPADDR_LOOPBACK;
+  addr.s_port = port;
+  sendto(hkWakeupSendFd, &signal, 1, 0, &addr, sizeof(addr));
+}
+
+static void _HKEventSubscribe(HK_Context_t *inHkContext, int index, bool enable)
+{
+  if(index < 0) return;
+  mico_rtos_lock_mutex(&hkSession_mutex);
+  if(enable){
+    inHkContext->eventSubscribed[index/32] |= (1UL<<(index%32));
+  }else{
+    inHkContext->eventSubscribed[index/32] &= ~(1UL<<(index%32));
+    inHkContext->eventPending[index/32] &= ~(1UL<<(index%32));
+  }
+  mico_rtos_unlock_mutex(&hkSession_mutex);
+}
+
+static void _HKEventClearPending(HK_Context_t *inHkContext, int index)
+{
+  if(index < 0) return;
+  mico_rtos_lock_mutex(&hkSession_mutex);
+  inHkContext->eventPending[index/32] &= ~(1UL<<(index%32));
+  mico_rtos_unlock_mutex(&hkSession_mutex);
+}
+
+/* Queue an event to every session subscribed to the characteristic, the value
+   is read when the coalescing window of the session expires */
+void HKNotifyCharacteristicChanged(int accessoryID, int serviceID, int characteristicID)
+{
+  HK_Context_t *session;
+  int index = HKAttributeIndex(accessoryID, serviceID, characteristicID);
+
+  if(index < 0 || hkSession_mutex == NULL) return;
+
+  mico_rtos_lock_mutex(&hkSession_mutex);
+  for(session = hkSessionList; session; session = session->next){
+    if((session->eventSubscribed[index/32] & (1UL<<(index%32))) == 0)
+      continue;
+    if(_HKEventBitmapEmpty(session->eventPending)){
+      /*Start of a coalescing window, wake the waiter to sleep until it ends*/
+      session->eventPendingSince = mico_get_time();
+      _HKWakeup(session->wakeupPort);
+    }
+    session->eventPending[index/32] |= (1UL<<(index%32));
+  }
+  mico_rtos_unlock_mutex(&hkSession_mutex);
+}
+
+/* Send all pending events of a session in one EVENT/1.0 frame, once the first
+   pending change is older than HK_EVENT_COALESCE_WINDOW */
+static OSStatus HKSendEvents(int sockfd, HK_Context_t *inHkContext, mico_Context_t * const inContext)
+{
+  OSStatus err = kNoErr;
+  uint32_t pending[HKEventBitmapWords];
+  int index, accessoryID, serviceID, characteristicID;
+  json_object *eventObject = NULL, *characteristics, *characteristic;
+  printbuf *buffer = NULL;
+  char header[100];
+
+  if(inHkContext->session->established == false) return kNoErr;
+
+  mico_rtos_lock_mutex(&hkSession_mutex);
+  if(_HKEventBitmapEmpty(inHkContext->eventPending) || 
+     mico_get_time() - inHkContext->eventPendingSince < HK_EVENT_COALESCE_WINDOW){
+    mico_rtos_unlock_mutex(&hkSession_mutex);
+    return kNoErr;
+  }
+  memcpy(pending, inHkContext->eventPending, sizeof(pending));
+  memset(inHkContext->eventPending, 0x0, sizeof(pending));
+  mico_rtos_unlock_mutex(&hkSession_mutex);
+
+  eventObject = json_object_new_object();
+  require_action(eventObject, exit, err = kNoMemoryErr);
+  characteristics = json_object_new_array();
+  json_object_object_add( eventObject, "characteristics", characteristics);
+
+  for(index = 0; index < HKNumberOfAttributes(); index++){
+    if((pending[index/32] & (1UL<<(index%32))) == 0)
+      continue;
+    if(HKAttributeIDs(index, &accessoryID, &serviceID, &characteristicID) != kNoErr)
+      continue;
+    _HKReadCharacteristicValue_respond(accessoryID, serviceID, characteristicID, &characteristic, inContext);
+    if(characteristic == NULL)
+      continue;
+    json_object_object_add( characteristic, "accessoryID", json_object_new_int(accessoryID));
+    json_object_object_add( characteristic, "serviceID", json_object_new_int(serviceID));
+    json_object_array_add( characteristics, characteristic );
+  }
+
+  buffer = json_object_to_json_string_ex(eventObject);
+  require_action(buffer, exit, err = kNoMemoryErr);
+
+  snprintf( header, sizeof(header), "EVENT/1.0 %d OK\r\nContent-Type: %s\r\nContent-Length: %d\r\n\r\n",
+           kStatusOK, kMIMEType_HAP_JSON, buffer->bpos );
+  err = HKSecureSocketSend( sockfd, header, strlen(header), inHkContext->session );
+  require_noerr( err, exit );
+  err = HKSecureSocketSend( sockfd, buffer->buf, buffer->bpos, inHkContext->session );
+  require_noerr( err, exit );
+
+exit:
+  if(eventObject) json_object_put(eventObject);
+  if(buffer) printbuf_free(buffer);
+  return err;
+}
 
-void _HKWriteCharacteristicValue_respond(struct _hapAccessory_t inHapObject[], int accessoryID, int serviceID, 
+void _HKWriteCharacteristicValue_respond(int accessoryID, int serviceID, 
                                         int characteristicID, json_object **OutHapObjectJson, mico_Context_t * const inContext)
 {
   HkStatus err;
   json_object *characteristic, *errObject;
   value_union value;
-  struct _hapCharacteristic_t  pCharacteristic;
+  const struct _hapCharacteristic_t  *pCharacteristic;
 
   characteristic = json_object_new_object();
   errObject = json_object_new_object();
   *OutHapObjectJson = characteristic;
 
-  pCharacteristic = inHapObject[accessoryID-1].services[serviceID-1].characteristic[characteristicID-1];
+  pCharacteristic = HKCharacteristicGet(accessoryID, serviceID, characteristicID);
 
-  if(pCharacteristic.type==0){
+  if(pCharacteristic == NULL){
     /*Type*/
     json_object_object_add( characteristic, "type", json_object_new_string("public.hap.characteristic.unknown"));
 
@@ -205,13 +661,13 @@ void _HKWriteCharacteristicValue_respond(struct _hapAccessory_t inHapObject[], i
   }
 
   /*Type*/
-  json_object_object_add( characteristic, "type", json_object_new_string(pCharacteristic.type));
+  json_object_object_add( characteristic, "type", json_object_new_string(pCharacteristic->type));
 
   /*Instance ID*/
   json_object_object_add( characteristic, "instanceID", json_object_new_int(characteristicID));
 
   /*Error Code*/
-  if(pCharacteristic.secureWrite == false){
+  if(pCharacteristic->secureWrite == false){
     json_object_object_add( errObject, "developerMessage", json_object_new_string("Write a characteristic that is not writeable") ); 
     json_object_object_add( errObject, "errorCode", json_object_new_int(kHKWriteToROErr)); 
     json_object_object_add( characteristic, "response", errObject);
@@ -231,7 +687,7 @@ void _HKWriteCharacteristicValue_respond(struct _hapAccessory_t inHapObject[], i
     json_object_object_add( errObject, "errorCode", json_object_new_int(err) ); 
     json_object_object_add( characteristic, "response", errObject );
 
-    switch(pCharacteristic.valueType){
+    switch(pCharacteristic->valueType){
       case ValueType_bool:
         json_object_object_add( characteristic, "value", json_object_new_boolean(value.boolValue));
         break;
@@ -256,31 +712,35 @@ void _HKWriteCharacteristicValue_respond(struct _hapAccessory_t inHapObject[], i
   }
 }
 
-static HkStatus _HKReadFromOnecharacteristic( struct _hapAccessory_t inHapObject[], int accessoryID, int serviceID, 
+static HkStatus _HKReadFromOnecharacteristic( int accessoryID, int serviceID, 
                                               int characteristicID, json_object *characteristic, value_union *value, 
-                                              uint32_t *InstanceID )
+                                              uint32_t *InstanceID, bool *hasValue, int *events )
 {
   HkStatus err = kNoErr;
-  json_object *                 valJsonObject;
-  struct _hapCharacteristic_t   pCharacteristic;
+  json_object *                 valJsonObject = NULL;
+  const struct _hapCharacteristic_t   *pCharacteristic;
   int _instanceID = 0;
+  int _events = -1;
 
   json_object_object_foreach(characteristic, key, val) {
     if(!strcmp(key, "instanceID"))
       _instanceID = json_object_get_int(val);
     else if(!strcmp(key, "value"))
       valJsonObject = val;
+    else if(!strcmp(key, "events"))
+      _events = json_object_get_boolean(val);
   }
 
   if(characteristicID) _instanceID = characteristicID;
   if(InstanceID != NULL) *InstanceID = _instanceID;
+  if(hasValue != NULL) *hasValue = (valJsonObject != NULL);
+  if(events != NULL) *events = _events;
 
-  pCharacteristic = inHapObject[accessoryID-1].services[serviceID-1].characteristic[_instanceID-1];
+  pCharacteristic = HKCharacteristicGet(accessoryID, serviceID, _instanceID);
+  require_action(pCharacteristic, exit, err = kHKResourceErr);
 
-  require_action(_instanceID&&pCharacteristic.type, exit, err = kHKResourceErr);
 
-
-  switch(pCharacteristic.valueType){
+  switch(pCharacteristic->valueType){
     case ValueType_bool:
       (*value).boolValue = json_object_get_boolean(valJsonObject);
       break;
@@ -306,6 +766,35 @@ exit:
   return err;
 }
 
+/* Apply one characteristic of a PUT request: "events" updates the session's
+   subscription, "value" is written to the characteristic */
+static HkStatus _HKWriteOnecharacteristic( HK_Context_t *inHkContext, int accessoryID, int serviceID, int characteristicID,
+                                           json_object *characteristic, bool moreComing, uint32_t *InstanceID,
+                                           mico_Context_t * const inContext )
+{
+  HkStatus err = kNoErr;
+  value_union value;
+  uint32_t _instanceID;
+  bool hasValue;
+  int events;
+
+  err = _HKReadFromOnecharacteristic( accessoryID, serviceID, characteristicID, characteristic, &value, &_instanceID, &hasValue, &events );
+  require_noerr(err, exit);
+  if(InstanceID != NULL) *InstanceID = _instanceID;
+
+  if(events >= 0)
+    _HKEventSubscribe(inHkContext, HKAttributeIndex(accessoryID, serviceID, _instanceID), events);
+
+  if(hasValue){
+    HKWriteCharacteristicValue(accessoryID, serviceID, _instanceID, value, moreComing, inContext);
+    /*The writer gets the new value in the response, not by an event*/
+    _HKEventClearPending(inHkContext, HKAttributeIndex(accessoryID, serviceID, _instanceID));
+  }
+
+exit:
+  return err;
+}
+
 static HkStatus _HKReadFromOneService( json_object *inputHapObjectJson, json_object **OutHapObjectJson)
 {
   HkStatus err = kNoErr;
@@ -338,7 +827,7 @@ exit:
   return err;
 }
 
-static HkStatus HKCreateHAPWriteRespond(  struct _hapAccessory_t inHapObject[], json_object *inputHapObjectJson, json_object **OutHapObjectJson,
+static HkStatus HKCreateHAPWriteRespond(  HK_Context_t *inHkContext, json_object *inputHapObjectJson, json_object **OutHapObjectJson,
                                           int accessoryID, int serviceID, int characteristicID, mico_Context_t * const inContext)
 {
   HkStatus err = kNoErr;
@@ -347,6 +836,7 @@ static HkStatus HKCreateHAPWriteRespond(  struct _hapAccessory_t inHapObject[],
   int idx, idxService, length, serviceLength;
   bool moreComing;
   int _serviceID;
+  const struct _hapService_t *pService;
 
   json_object *services = NULL, *service, *characteristics = NULL, *outCharacteristics = NULL, *characteristic, *outCharacteristic;
   json_object *outServices = NULL, *outService = NULL;
@@ -372,9 +862,11 @@ static HkStatus HKCreateHAPWriteRespond(  struct _hapAccessory_t inHapObject[],
           _serviceID = json_object_get_int(val);
       }
       require_action(_serviceID, exit, err = kHKMalformedErr);
+      pService = HKServiceGet(accessoryID, _serviceID);
+      require_action(pService, exit, err = kHKResourceErr);
 
       outService = json_object_new_object();
-      json_object_object_add( outService, "type",        json_object_new_string(inHapObject[accessoryID-1].services[_serviceID-1].type));
+      json_object_object_add( outService, "type",        json_object_new_string(pService->type));
       json_object_object_add( outService, "instanceID",  json_object_new_int(_serviceID));
       outCharacteristics = json_object_new_array();
       json_object_object_add( outService, "characteristics",  outCharacteristics);
@@ -387,19 +879,18 @@ static HkStatus HKCreateHAPWriteRespond(  struct _hapAccessory_t inHapObject[],
       /*Write to characteristics*/
       for(idx = 0; idx < length; idx ++){
         characteristic = json_object_array_get_idx(characteristics, idx);
-        err = _HKReadFromOnecharacteristic( inHapObject, accessoryID, _serviceID, 0, characteristic, &value, &characteristicIndex );
-        require_noerr(err, exit);
         if(idx < length - 1) moreComing = true;
         else moreComing = false;
-        HKWriteCharacteristicValue(accessoryID, _serviceID, characteristicIndex, value, moreComing, inContext);
+        err = _HKWriteOnecharacteristic( inHkContext, accessoryID, _serviceID, 0, characteristic, moreComing, &characteristicIndex, inContext );
+        require_noerr(err, exit);
       }
 
       /*Read operation result*/
       for(idx = 0; idx < length; idx ++){
         characteristic = json_object_array_get_idx(outCharacteristics, idx);
-        err = _HKReadFromOnecharacteristic( inHapObject, accessoryID, _serviceID, 0, characteristic, &value, &characteristicIndex );
+        err = _HKReadFromOnecharacteristic( accessoryID, _serviceID, 0, characteristic, &value, &characteristicIndex, NULL, NULL );
         require_noerr_action(err, exit, json_object_put(outCharacteristics));
-        _HKWriteCharacteristicValue_respond(inHapObject, accessoryID, _serviceID, characteristicIndex, &outCharacteristic, inContext);
+        _HKWriteCharacteristicValue_respond(accessoryID, _serviceID, characteristicIndex, &outCharacteristic, inContext);
         if(outCharacteristic)
           json_object_array_add (outCharacteristics, outCharacteristic);
       }
@@ -415,11 +906,10 @@ static HkStatus HKCreateHAPWriteRespond(  struct _hapAccessory_t inHapObject[],
     /*Write to characteristics*/
     for(idx = 0; idx < length; idx ++){
       characteristic = json_object_array_get_idx(characteristics, idx);
-      err = _HKReadFromOnecharacteristic( inHapObject, accessoryID, serviceID, 0, characteristic, &value, &characteristicIndex );
-      require_noerr(err, exit);
       if(idx < length - 1) moreComing = true;
       else moreComing = false;
-      HKWriteCharacteristicValue(accessoryID, serviceID, characteristicIndex, value, moreComing, inContext);
+      err = _HKWriteOnecharacteristic( inHkContext, accessoryID, serviceID, 0, characteristic, moreComing, &characteristicIndex, inContext );
+      require_noerr(err, exit);
     }
 
     /*Read operation result*/
@@ -428,21 +918,20 @@ static HkStatus HKCreateHAPWriteRespond(  struct _hapAccessory_t inHapObject[],
 
     for(idx = 0; idx < length; idx ++){
       characteristic = json_object_array_get_idx(outCharacteristics, idx);
-      err = _HKReadFromOnecharacteristic( inHapObject, accessoryID, serviceID, 0, characteristic, &value, &characteristicIndex );
+      err = _HKReadFromOnecharacteristic( accessoryID, serviceID, 0, characteristic, &value, &characteristicIndex, NULL, NULL );
       require_noerr_action(err, exit, json_object_put(outCharacteristics));
-      _HKWriteCharacteristicValue_respond(inHapObject, accessoryID, serviceID, characteristicIndex, &outCharacteristic, inContext);
+      _HKWriteCharacteristicValue_respond(accessoryID, serviceID, characteristicIndex, &outCharacteristic, inContext);
       if(outCharacteristic)
         json_object_array_add (outCharacteristics, outCharacteristic);
     }
 
   }
   else{
-    err = _HKReadFromOnecharacteristic( inHapObject, accessoryID, serviceID, characteristicID, inputHapObjectJson, &value, NULL );
-    require_noerr(err, exit);
     /*Write to characteristic*/
-    HKWriteCharacteristicValue(accessoryID, serviceID, characteristicID, value, false, inContext);
+    err = _HKWriteOnecharacteristic( inHkContext, accessoryID, serviceID, characteristicID, inputHapObjectJson, false, NULL, inContext );
+    require_noerr(err, exit);
     /*Read operation result*/
-    _HKWriteCharacteristicValue_respond(inHapObject, accessoryID, serviceID, characteristicID, OutHapObjectJson, inContext);
+    _HKWriteCharacteristicValue_respond(accessoryID, serviceID, characteristicID, OutHapObjectJson, inContext);
 
   }
 
@@ -454,20 +943,20 @@ exit:
   return err;
 }
 
-void _HKReadCharacteristicValue_respond(struct _hapAccessory_t inHapObject[], int accessoryID, int serviceID, 
+void _HKReadCharacteristicValue_respond(int accessoryID, int serviceID, 
                                         int characteristicID, json_object **OutHapObjectJson, mico_Context_t * const inContext)
 {
   json_object *characteristic, *errObject;
   value_union value;
-  struct _hapCharacteristic_t  pCharacteristic;
+  const struct _hapCharacteristic_t  *pCharacteristic;
 
-  pCharacteristic = inHapObject[accessoryID-1].services[serviceID-1].characteristic[characteristicID-1];
-  require_action(pCharacteristic.type, exit, *OutHapObjectJson = NULL);
+  pCharacteristic = HKCharacteristicGet(accessoryID, serviceID, characteristicID);
+  require_action(pCharacteristic, exit, *OutHapObjectJson = NULL);
 
   characteristic = json_object_new_object();
   *OutHapObjectJson = characteristic;
 
-  if(pCharacteristic.secureRead == false){
+  if(pCharacteristic->secureRead == false){
     errObject = json_object_new_object();
     json_object_object_add( errObject, "developerMessage", json_object_new_string("Read a characteristic that is not readable") ); 
     json_object_object_add( errObject, "errorCode", json_object_new_int(kHKWriteToROErr)); 
@@ -476,18 +965,18 @@ void _HKReadCharacteristicValue_respond(struct _hapAccessory_t inHapObject[], in
   }
 
   /*Type*/
-  json_object_object_add( characteristic, "type", json_object_new_string(pCharacteristic.type));
+  json_object_object_add( characteristic, "type", json_object_new_string(pCharacteristic->type));
 
   /*Instance ID*/
   json_object_object_add( characteristic, "instanceID", json_object_new_int(characteristicID));
 
-  if(pCharacteristic.hasStaticValue){
-    value = pCharacteristic.value;
+  if(pCharacteristic->hasStaticValue){
+    value = pCharacteristic->value;
   }
   else
     HKReadCharacteristicValue(accessoryID, serviceID, characteristicID, &value, inContext);
 
-  switch(pCharacteristic.valueType){
+  switch(pCharacteristic->valueType){
     case ValueType_bool:
       json_object_object_add( characteristic, "value", json_object_new_boolean(value.boolValue));
       break;
@@ -514,37 +1003,171 @@ exit:
 
 }
 
-static HkStatus HKCreateHAPReadRespond( struct _hapAccessory_t inHapObject[],  json_object **OutHapObjectJson, 
+static HkStatus HKCreateHAPReadRespond( json_object **OutHapObjectJson, 
                                         int accessoryID, int serviceID, int characteristicID, mico_Context_t * const inContext)
 {
   HkStatus err = kNoErr;
   uint32_t characteristicIndex;
+  const struct _hapService_t *pService;
 
   json_object *characteristics, *characteristic;
 
   if(characteristicID == 0){
+    pService = HKServiceGet(accessoryID, serviceID);
+    require_action(pService, exit, err = kHKResourceErr);
     characteristics = json_object_new_array();
     *OutHapObjectJson = characteristics;
 
-    for(characteristicIndex = 0; characteristicIndex < MAXCharacteristicPerService; characteristicIndex++){
-      _HKReadCharacteristicValue_respond(inHapObject, accessoryID, serviceID, characteristicIndex+1, &characteristic, inContext); 
+    for(characteristicIndex = 0; characteristicIndex < pService->numberOfCharacteristics; characteristicIndex++){
+      _HKReadCharacteristicValue_respond(accessoryID, serviceID, characteristicIndex+1, &characteristic, inContext); 
       require(characteristic, exit);  
       json_object_array_add( characteristics, characteristic ); 
     }
   }
   else
-    _HKReadCharacteristicValue_respond(inHapObject, accessoryID, serviceID, characteristicID, OutHapObjectJson, inContext);   
+    _HKReadCharacteristicValue_respond(accessoryID, serviceID, characteristicID, OutHapObjectJson, inContext);   
 
 exit:
   return err;
 
 }
 
-static HkStatus HKCreateHAPAttriDataBase( struct _hapAccessory_t inHapObject[],  json_object **OutHapObjectJson, mico_Context_t * const inContext)
+/* Read an ID from "1.2.3" style lists, the ID must be followed by one of the separators */
+static HkStatus _HKParseID(char **pos, const char *separators, int *outID)
+{
+  char *end;
+
+  *outID = strtol(*pos, &end, 10);
+  if(end == *pos || strchr(separators, *end) == NULL)
+    return kHKParamErr;
+  *pos = (*end)? end + 1 : end;
+  return kNoErr;
+}
+
+static void _HKReadBatchIDs(json_object *characteristic, int *accessoryID, int *serviceID)
+{
+  *accessoryID = 0;
+  *serviceID = 0;
+  json_object_object_foreach(characteristic, key, val) {
+    if(!strcmp(key, "accessoryID"))
+      *accessoryID = json_object_get_int(val);
+    else if(!strcmp(key, "serviceID"))
+      *serviceID = json_object_get_int(val);
+  }
+}
+
+/* GET /characteristics?id=1.2.1,1.2.3 reads a list of accessory.service.characteristic
+   IDs in one response */
+static HkStatus HKCreateHAPBatchReadRespond( HTTPHeader_t *inHeader, json_object **OutHapObjectJson, mico_Context_t * const inContext)
+{
+  HkStatus err = kNoErr;
+  char *query = NULL, *pos;
+  int accessoryID, serviceID, characteristicID;
+  json_object *characteristics, *characteristic, *errObject;
+
+  *OutHapObjectJson = NULL;
+  require_action(inHeader->url.queryPtr && inHeader->url.queryLen, exit, err = kHKParamErr);
+  query = calloc(inHeader->url.queryLen + 1, sizeof(char));
+  require_action(query, exit, err = kNoMemoryErr);
+  memcpy(query, inHeader->url.queryPtr, inHeader->url.queryLen);
+
+  pos = strstr(query, "id=");
+  require_action(pos, exit, err = kHKParamErr);
+  pos += strlen("id=");
+
+  *OutHapObjectJson = json_object_new_object();
+  characteristics = json_object_new_array();
+  json_object_object_add( *OutHapObjectJson, "characteristics", characteristics);
+
+  while(*pos && *pos != '&'){
+    err = _HKParseID(&pos, ".", &accessoryID);
+    require_noerr(err, exit);
+    err = _HKParseID(&pos, ".", &serviceID);
+    require_noerr(err, exit);
+    err = _HKParseID(&pos, ",&", &characteristicID);
+    require_noerr(err, exit);
+
+    _HKReadCharacteristicValue_respond(accessoryID, serviceID, characteristicID, &characteristic, inContext);
+    if(characteristic == NULL){
+      characteristic = json_object_new_object();
+      json_object_object_add( characteristic, "instanceID", json_object_new_int(characteristicID));
+      errObject = json_object_new_object();
+      json_object_object_add( errObject, "developerMessage", json_object_new_string("Read a characteristic that is not existed") ); 
+      json_object_object_add( errObject, "errorCode", json_object_new_int(kHKResourceErr)); 
+      json_object_object_add( characteristic, "response", errObject);
+    }
+    json_object_object_add( characteristic, "accessoryID", json_object_new_int(accessoryID));
+    json_object_object_add( characteristic, "serviceID", json_object_new_int(serviceID));
+    json_object_array_add( characteristics, characteristic );
+  }
+
+exit:
+  if(query) free(query);
+  if(err!=kNoErr && *OutHapObjectJson){
+    json_object_put(*OutHapObjectJson);
+    *OutHapObjectJson = NULL;
+  }
+  return err;
+}
+
+/* PUT /characteristics writes {"characteristics":[{"accessoryID":1,"serviceID":2,"instanceID":1,"value":..},..]},
+   all values are handed to HKWriteCharacteristicValue before the hardware is operated once */
+static HkStatus HKCreateHAPBatchWriteRespond( HK_Context_t *inHkContext, json_object *inputHapObjectJson, json_object **OutHapObjectJson,
+                                              mico_Context_t * const inContext)
+{
+  HkStatus err = kNoErr;
+  int idx, length, lastWrite = -1;
+  int accessoryID, serviceID;
+  uint32_t characteristicID;
+  value_union value;
+  bool hasValue;
+  json_object *characteristics = NULL, *characteristic, *outCharacteristics, *outCharacteristic;
+
+  *OutHapObjectJson = NULL;
+  err = _HKReadFromOneService( inputHapObjectJson, &characteristics);
+  require_noerr(err, exit);
+  length = json_object_array_length(characteristics);
+
+  /*Find the last valid write, the hardware is operated by that one*/
+  for(idx = 0; idx < length; idx++){
+    characteristic = json_object_array_get_idx(characteristics, idx);
+    _HKReadBatchIDs(characteristic, &accessoryID, &serviceID);
+    if(_HKReadFromOnecharacteristic( accessoryID, serviceID, 0, characteristic, &value, &characteristicID, &hasValue, NULL ) == kNoErr && hasValue)
+      lastWrite = idx;
+  }
+
+  for(idx = 0; idx < length; idx++){
+    characteristic = json_object_array_get_idx(characteristics, idx);
+    _HKReadBatchIDs(characteristic, &accessoryID, &serviceID);
+    _HKWriteOnecharacteristic( inHkContext, accessoryID, serviceID, 0, characteristic, idx < lastWrite, NULL, inContext );
+  }
+
+  /*Read operation result*/
+  *OutHapObjectJson = json_object_new_object();
+  outCharacteristics = json_object_new_array();
+  json_object_object_add( *OutHapObjectJson, "characteristics", outCharacteristics);
+
+  for(idx = 0; idx < length; idx++){
+    characteristic = json_object_array_get_idx(characteristics, idx);
+    _HKReadBatchIDs(characteristic, &accessoryID, &serviceID);
+    characteristicID = 0;
+    _HKReadFromOnecharacteristic( accessoryID, serviceID, 0, characteristic, &value, &characteristicID, NULL, NULL );
+    _HKWriteCharacteristicValue_respond(accessoryID, serviceID, characteristicID, &outCharacteristic, inContext);
+    json_object_object_add( outCharacteristic, "accessoryID", json_object_new_int(accessoryID));
+    json_object_object_add( outCharacteristic, "serviceID", json_object_new_int(serviceID));
+    json_object_array_add( outCharacteristics, outCharacteristic );
+  }
+
+exit:
+  return err;
+}
+
+static HkStatus HKCreateHAPAttriDataBase( json_object **OutHapObjectJson, mico_Context_t * const inContext)
 {
   HkStatus err = kNoErr;
   uint32_t accessoryIndex, serviceIndex, characteristicIndex;
-  struct _hapCharacteristic_t             pCharacteristic;
+  const struct _hapService_t              *pService;
+  const struct _hapCharacteristic_t       *pCharacteristic;
   bool hasConstraint = false;
   value_union value;
 
@@ -564,35 +1187,34 @@ static HkStatus HKCreateHAPAttriDataBase( struct _hapAccessory_t inHapObject[],
     services = json_object_new_array();
     json_object_object_add( accessory, "services", services);
 
-    for(serviceIndex = 0; serviceIndex < MAXServicePerAccessory; serviceIndex++){
-      if(inHapObject[0].services[serviceIndex].type == 0)
-        break;
+    for(serviceIndex = 0; serviceIndex < hapObjects[accessoryIndex].numberOfServices; serviceIndex++){
+      pService = &hapObjects[accessoryIndex].services[serviceIndex];
       service = json_object_new_object();
 
-      json_object_object_add( service, "type",        json_object_new_string(inHapObject[0].services[serviceIndex].type));
+      json_object_object_add( service, "type",        json_object_new_string(pService->type));
       json_object_object_add( service, "instanceID",  json_object_new_int(serviceIndex+1));
 
       characteristics = json_object_new_array();
 
       json_object_object_add( service, "characteristics",  characteristics);
 
-      for(characteristicIndex = 0; characteristicIndex < MAXCharacteristicPerService; characteristicIndex++){
-        pCharacteristic = inHapObject[0].services[serviceIndex].characteristic[characteristicIndex];
-        if(pCharacteristic.type){
+      for(characteristicIndex = 0; characteristicIndex < pService->numberOfCharacteristics; characteristicIndex++){
+        pCharacteristic = &pService->characteristic[characteristicIndex];
+        if(pCharacteristic->type){
           characteristic = json_object_new_object();
           /*Type*/
-          json_object_object_add( characteristic, "type", json_object_new_string(pCharacteristic.type));
+          json_object_object_add( characteristic, "type", json_object_new_string(pCharacteristic->type));
 
           /*Instance ID*/
           json_object_object_add( characteristic, "instanceID", json_object_new_int(characteristicIndex+1));
 
           /*Value*/
-          if(pCharacteristic.hasStaticValue)
-            value = pCharacteristic.value;
+          if(pCharacteristic->hasStaticValue)
+            value = pCharacteristic->value;
           else
             HKReadCharacteristicValue(accessoryIndex+1, serviceIndex+1, characteristicIndex+1, &value, inContext);
 
-          switch(pCharacteristic.valueType){
+          switch(pCharacteristic->valueType){
             case ValueType_bool:
               json_object_object_add( characteristic, "value", json_object_new_boolean(value.boolValue));
               break;
@@ -616,19 +1238,19 @@ static HkStatus HKCreateHAPAttriDataBase( struct _hapAccessory_t inHapObject[],
 
           /*Properties*/
           properties = json_object_new_array();
-          if(pCharacteristic.secureRead)
+          if(pCharacteristic->secureRead)
             json_object_array_add( properties, json_object_new_string("secureRead") ); 
-          if(pCharacteristic.secureWrite)
+          if(pCharacteristic->secureWrite)
             json_object_array_add( properties, json_object_new_string("secureWrite") ); 
           json_object_object_add( characteristic, "properties", properties);
 
           /*Metadata*/
           hasConstraint = false;
-          if(pCharacteristic.hasMinimumValue || pCharacteristic.hasMaximumValue || pCharacteristic.hasMinimumStep ||
-             pCharacteristic.precision || pCharacteristic.maxLength )
+          if(pCharacteristic->hasMinimumValue || pCharacteristic->hasMaximumValue || pCharacteristic->hasMinimumStep ||
+             pCharacteristic->precision || pCharacteristic->maxLength )
             hasConstraint = true;
 
-          if(hasConstraint || pCharacteristic.description || pCharacteristic.format || pCharacteristic.unit){
+          if(hasConstraint || pCharacteristic->description || pCharacteristic->format || pCharacteristic->unit){
             metaData = json_object_new_object();
             json_object_object_add( characteristic, "metaData", metaData);
 
@@ -636,61 +1258,61 @@ static HkStatus HKCreateHAPAttriDataBase( struct _hapAccessory_t inHapObject[],
               constraints = json_object_new_object();
               json_object_object_add( metaData, "constraints",  constraints);
 
-              if(pCharacteristic.hasMinimumValue){
-                switch(pCharacteristic.valueType){
+              if(pCharacteristic->hasMinimumValue){
+                switch(pCharacteristic->valueType){
                   case ValueType_int:
-                  json_object_object_add( constraints, "minimumValue",  json_object_new_int(pCharacteristic.minimumValue.intValue) );
+                  json_object_object_add( constraints, "minimumValue",  json_object_new_int(pCharacteristic->minimumValue.intValue) );
                   break;
                 case ValueType_float:
-                  json_object_object_add( constraints, "minimumValue",  json_object_new_double(pCharacteristic.minimumValue.floatValue) );
+                  json_object_object_add( constraints, "minimumValue",  json_object_new_double(pCharacteristic->minimumValue.floatValue) );
                   break;
                 default:
                   break;
                 }
               }
 
-              if(pCharacteristic.hasMaximumValue){
-                switch(pCharacteristic.valueType){
+              if(pCharacteristic->hasMaximumValue){
+                switch(pCharacteristic->valueType){
                   case ValueType_int:
-                    json_object_object_add( constraints, "maximumValue",  json_object_new_int(pCharacteristic.maximumValue.intValue) );
+                    json_object_object_add( constraints, "maximumValue",  json_object_new_int(pCharacteristic->maximumValue.intValue) );
                     break;
                   case ValueType_float:
-                    json_object_object_add( constraints, "maximumValue",  json_object_new_double(pCharacteristic.maximumValue.floatValue) );
+                    json_object_object_add( constraints, "maximumValue",  json_object_new_double(pCharacteristic->maximumValue.floatValue) );
                     break;
                   default:
                     break;
                 }
               }
 
-              if(pCharacteristic.hasMinimumStep){
-                switch(pCharacteristic.valueType){
+              if(pCharacteristic->hasMinimumStep){
+                switch(pCharacteristic->valueType){
                   case ValueType_int:
-                    json_object_object_add( constraints, "minimumStep",  json_object_new_int(pCharacteristic.minimumStep.intValue) );
+                    json_object_object_add( constraints, "minimumStep",  json_object_new_int(pCharacteristic->minimumStep.intValue) );
                     break;
                   case ValueType_float:
-                    json_object_object_add( constraints, "minimumStep",  json_object_new_double(pCharacteristic.minimumStep.floatValue) );
+                    json_object_object_add( constraints, "minimumStep",  json_object_new_double(pCharacteristic->minimumStep.floatValue) );
                     break;
                   default:
                     break;
                 }
               }
 
-              if(pCharacteristic.hasPrecision)
-                json_object_object_add( constraints, "precision",     json_object_new_double(pCharacteristic.precision)    );
+              if(pCharacteristic->hasPrecision)
+                json_object_object_add( constraints, "precision",     json_object_new_double(pCharacteristic->precision)    );
                 
-              if(pCharacteristic.hasMaxLength){
-                json_object_object_add( constraints, "maxLength",     json_object_new_int(pCharacteristic.maxLength)    );
+              if(pCharacteristic->hasMaxLength){
+                json_object_object_add( constraints, "maxLength",     json_object_new_int(pCharacteristic->maxLength)    );
               }
             }
 
-            if(pCharacteristic.description)
-              json_object_object_add( metaData, "description", json_object_new_string(pCharacteristic.description));
+            if(pCharacteristic->description)
+              json_object_object_add( metaData, "description", json_object_new_string(pCharacteristic->description));
 
-            if(pCharacteristic.format)
-              json_object_object_add( metaData, "format", json_object_new_string(pCharacteristic.format));
+            if(pCharacteristic->format)
+              json_object_object_add( metaData, "format", json_object_new_string(pCharacteristic->format));
 
-            if(pCharacteristic.unit)
-              json_object_object_add( metaData, "unit", json_object_new_string(pCharacteristic.unit));
+            if(pCharacteristic->unit)
+              json_object_object_add( metaData, "unit", json_object_new_string(pCharacteristic->unit));
           } 
 
           json_object_array_add( characteristics, characteristic ); 
@@ -708,6 +1330,63 @@ static HkStatus HKCreateHAPAttriDataBase( struct _hapAccessory_t inHapObject[],
 
 }
 
+static hap_db_cache_t *HKDataBaseCacheGet(mico_Context_t * const inContext)
+{
+  OSStatus err = kNoErr;
+  json_object *hapJsonObject = NULL;
+  hap_db_cache_t *cache = NULL;
+
+  mico_rtos_lock_mutex(&hapDataBaseCache_mutex);
+  if(hapDataBaseCache == NULL){
+    cache = calloc(1, sizeof(hap_db_cache_t));
+    require_action(cache, exit, err = kNoMemoryErr);
+    err = HKCreateHAPAttriDataBase(&hapJsonObject, inContext);
+    require_noerr(err, exit);
+    cache->buffer = json_object_to_json_string_ex(hapJsonObject);
+    require_action(cache->buffer, exit, err = kNoMemoryErr);
+    /*Held by hapDataBaseCache until invalidated*/
+    cache->refCount = 1;
+    hapDataBaseCache = cache;
+    ha_log("Accessory database rendered, %d bytes, memory remains %d", cache->buffer->bpos, mico_memory_info()->free_memory);
+  }
+  cache = hapDataBaseCache;
+  cache->refCount++;
+
+exit:
+  if(hapJsonObject) json_object_put(hapJsonObject);
+  if(err != kNoErr && cache){
+    if(cache->buffer) printbuf_free(cache->buffer);
+    free(cache);
+    cache = NULL;
+  }
+  mico_rtos_unlock_mutex(&hapDataBaseCache_mutex);
+  return cache;
+}
+
+static void HKDataBaseCacheRelease(hap_db_cache_t *cache)
+{
+  mico_rtos_lock_mutex(&hapDataBaseCache_mutex);
+  if(--cache->refCount == 0){
+    printbuf_free(cache->buffer);
+    free(cache);
+  }
+  mico_rtos_unlock_mutex(&hapDataBaseCache_mutex);
+}
+
+/* Called when a characteristic value is changed, sessions still sending the
+   old rendering keep their own reference */
+void HKDataBaseCacheInvalidate(void)
+{
+  hap_db_cache_t *cache;
+
+  if(hapDataBaseCache_mutex == NULL) return;
+  mico_rtos_lock_mutex(&hapDataBaseCache_mutex);
+  cache = hapDataBaseCache;
+  hapDataBaseCache = NULL;
+  mico_rtos_unlock_mutex(&hapDataBaseCache_mutex);
+  if(cache) HKDataBaseCacheRelease(cache);
+}
+
 OSStatus HKSendResponseMessage(int sockfd, HkStatus hkErr, char * errorMessage, uint8_t *payload, int payloadLen, HK_Context_t *inHkContext )
 {
   OSStatus err;
@@ -757,15 +1436,19 @@ OSStatus HKhandleIncomeingMessage(int sockfd, HTTPHeader_t *httpHeader, HK_Conte
   OSStatus err = kNoErr;
   HkStatus hkErr = kNoErr;
   printbuf *buffer = NULL;
+  hap_db_cache_t *dataBase;
   char *pos1, *pos2, *pos3;
-  err = HKSocketReadHTTPHeader( sockfd, httpHeader, inHkContext->session );
+  /*Header of a request whose body is incomplete is parsed already*/
+  err = inHkContext->requestBodyPending? kNoErr : HKSocketReadHTTPHeader( sockfd, httpHeader, inHkContext->session );
   int accessoryID, serviceID, characteristicID;
-  static json_object *outhapJsonObject, *inhapJsonObject;
+  json_object *outhapJsonObject = NULL, *inhapJsonObject = NULL;
 
   switch ( err )
   {
     case kNoErr:
         err = HKSocketReadHTTPBody( sockfd, httpHeader, inHkContext->session );
+        inHkContext->requestBodyPending = (err == EWOULDBLOCK);
+        if(err == EWOULDBLOCK) return kNoErr;
         require_noerr(err, exit);
         /*Pair set engine*/
         if(HTTPHeaderMatchURL( httpHeader, kPAIRSETUP ) == kNoErr) {
@@ -790,13 +1473,32 @@ OSStatus HKhandleIncomeingMessage(int sockfd, HTTPHeader_t *httpHeader, HK_Conte
         }
         /*Read accessories database*/
         else if(HTTPHeaderMatchURL( httpHeader, kReadAcc ) == kNoErr){
-          err = HKCreateHAPAttriDataBase(hapObjects, &outhapJsonObject, inContext);
-          require_noerr( err, exit );
-          buffer = json_object_to_json_string_ex(outhapJsonObject);
-          ha_log("Json cstring generated, memory remains %d, %s", mico_memory_info()->free_memory, buffer->buf);
-          json_object_put(outhapJsonObject);
-          outhapJsonObject = NULL;
-          err = HKSendResponseMessage(sockfd, hkErr, "Read Data base Error", (uint8_t *)buffer->buf, strlen(buffer->buf), inHkContext);
+          dataBase = HKDataBaseCacheGet(inContext);
+          require_action( dataBase, exit, err = kNoMemoryErr );
+          err = HKSendResponseMessage(sockfd, hkErr, "Read Data base Error", (uint8_t *)dataBase->buffer->buf, dataBase->buffer->bpos, inHkContext);
+          HKDataBaseCacheRelease(dataBase);
+          require_noerr(err, exit);
+        }
+        /*Read or write a batch of characteristics*/
+        else if(httpHeader->url.pathLen == strlen(kCharacteristicsBatch) && HTTPHeaderMatchURL( httpHeader, kCharacteristicsBatch ) == kNoErr){
+          if(HTTPHeaderMatchMethod( httpHeader, "GET")!=kNotFoundErr){
+            hkErr = HKCreateHAPBatchReadRespond(httpHeader, &outhapJsonObject, inContext);
+          }else if(HTTPHeaderMatchMethod( httpHeader, "PUT")!=kNotFoundErr){
+            inhapJsonObject = json_tokener_parse(httpHeader->extraDataPtr);
+            require_string(inhapJsonObject, exit, "json_tokener_parse error");
+            hkErr = HKCreateHAPBatchWriteRespond(inHkContext, inhapJsonObject, &outhapJsonObject, inContext);
+            json_object_put(inhapJsonObject);
+            inhapJsonObject = NULL;
+          }else
+            hkErr = kHKMethodErr;
+
+          if(outhapJsonObject){
+            buffer = json_object_to_json_string_ex(outhapJsonObject);
+            json_object_put(outhapJsonObject);
+            outhapJsonObject = NULL;
+            err = HKSendResponseMessage(sockfd, hkErr, "Batch characteristics Error", (uint8_t *)buffer->buf, buffer->bpos, inHkContext);
+          }else
+            err = HKSendResponseMessage(sockfd, hkErr, "Batch characteristics Error", NULL, 0, inHkContext);
           require_noerr(err, exit);
         }
         /*Read or write accessories characteristics*/
@@ -823,7 +1525,7 @@ OSStatus HKhandleIncomeingMessage(int sockfd, HTTPHeader_t *httpHeader, HK_Conte
 
           /*Read characteristic*/
           if(HTTPHeaderMatchMethod( httpHeader, "GET")!=kNotFoundErr){
-            hkErr = HKCreateHAPReadRespond(hapObjects, &outhapJsonObject, accessoryID, serviceID, characteristicID, inContext);
+            hkErr = HKCreateHAPReadRespond(&outhapJsonObject, accessoryID, serviceID, characteristicID, inContext);
             buffer = json_object_to_json_string_ex(outhapJsonObject);
             ha_log("Json cstring generated, memory remains %d", mico_memory_info()->free_memory);
             json_object_put(outhapJsonObject);
@@ -835,7 +1537,7 @@ OSStatus HKhandleIncomeingMessage(int sockfd, HTTPHeader_t *httpHeader, HK_Conte
           else if(HTTPHeaderMatchMethod( httpHeader, "PUT")!=kNotFoundErr){
             inhapJsonObject = json_tokener_parse(httpHeader->extraDataPtr);
             require_string(inhapJsonObject, exit, "json_tokener_parse error");
-            hkErr = HKCreateHAPWriteRespond(hapObjects, inhapJsonObject,  &outhapJsonObject, accessoryID, serviceID, characteristicID, inContext);
+            hkErr = HKCreateHAPWriteRespond(inHkContext, inhapJsonObject,  &outhapJsonObject, accessoryID, serviceID, characteristicID, inContext);
             json_object_put(inhapJsonObject);
             if(outhapJsonObject){
               buffer = json_object_to_json_string_ex(outhapJsonObject);
@@ -863,8 +1565,8 @@ OSStatus HKhandleIncomeingMessage(int sockfd, HTTPHeader_t *httpHeader, HK_Conte
     break;
 
     case EWOULDBLOCK:
-        // NO-OP, keep reading
-    break;
+        // Keep the partial header, the rest is read when the socket is readable again
+        return kNoErr;
 
     case kNoSpaceErr:
       ha_log("ERROR: Cannot fit HTTPHeader.");
@@ -0,0 +1,149 @@
+/**
+******************************************************************************
+* @file    HomeKitSessionCache.c
+* @author  William Xu
+* @version V1.0.0
+* @date    20-Oct-2014
+* @brief   Bounded in-RAM cache of pair-verify session secrets, used by
+*          pair-resume.
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+#include "MICO.h"
+#include "MICOAppDefine.h"
+#include "Debug.h"
+#include "HomeKitSessionCache.h"
+
+#define session_cache_log(M, ...) custom_log("HKSessionCache", M, ##__VA_ARGS__)
+
+typedef struct _session_cache_entry_t {
+  bool              inUse;
+  char              controllerName[64];
+  uint8_t           sessionID[HKSessionIDLength];
+  uint8_t           sharedSecret[HKSharedSecretLength];
+  uint32_t          lastUsed;
+} session_cache_entry_t;
+
+static session_cache_entry_t  sessionCache[HK_SESSION_CACHE_SIZE];
+static mico_mutex_t           sessionCache_mutex = NULL;
+
+static void _SessionCacheClearEntry(session_cache_entry_t *entry)
+{
+  memset(entry, 0x0, sizeof(session_cache_entry_t));
+}
+
+static bool _SessionCacheEntryExpired(session_cache_entry_t *entry, uint32_t now)
+{
+  return (now - entry->lastUsed) > HK_SESSION_CACHE_TIMEOUT*1000;
+}
+
+OSStatus HKSessionCacheInit(void)
+{
+  OSStatus err = kNoErr;
+  int i;
+
+  if(sessionCache_mutex == NULL){
+    err = mico_rtos_init_mutex(&sessionCache_mutex);
+    require_noerr(err, exit);
+  }
+
+  mico_rtos_lock_mutex(&sessionCache_mutex);
+  for(i=0; i<HK_SESSION_CACHE_SIZE; i++)
+    _SessionCacheClearEntry(&sessionCache[i]);
+  mico_rtos_unlock_mutex(&sessionCache_mutex);
+
+exit:
+  return err;
+}
+
+void HKSessionCacheStore(const char *controllerName, const uint8_t *sessionID, const uint8_t *sharedSecret)
+{
+  int i;
+  uint32_t now = mico_get_time();
+  session_cache_entry_t *entry = NULL;
+
+  if(sessionCache_mutex == NULL || controllerName == NULL) return;
+  mico_rtos_lock_mutex(&sessionCache_mutex);
+
+  /*One record per controller, a new verify replaces the old session*/
+  for(i=0; i<HK_SESSION_CACHE_SIZE; i++){
+    if(sessionCache[i].inUse && strncmp(sessionCache[i].controllerName, controllerName, 64) == 0){
+      entry = &sessionCache[i];
+      break;
+    }
+  }
+
+  /*Take a free or expired slot, or evict the least recently used one*/
+  if(entry == NULL){
+    for(i=0; i<HK_SESSION_CACHE_SIZE; i++){
+      if(sessionCache[i].inUse == false || _SessionCacheEntryExpired(&sessionCache[i], now)){
+        entry = &sessionCache[i];
+        break;
+      }
+      if(entry == NULL || (now - sessionCache[i].lastUsed) > (now - entry->lastUsed))
+        entry = &sessionCache[i];
+    }
+  }
+
+  _SessionCacheClearEntry(entry);
+  entry->inUse = true;
+  strncpy(entry->controllerName, controllerName, 63);
+  memcpy(entry->sessionID, sessionID, HKSessionIDLength);
+  memcpy(entry->sharedSecret, sharedSecret, HKSharedSecretLength);
+  entry->lastUsed = now;
+
+  mico_rtos_unlock_mutex(&sessionCache_mutex);
+}
+
+OSStatus HKSessionCacheFind(const uint8_t *sessionID, char *outControllerName, uint8_t *outSharedSecret)
+{
+  OSStatus err = kNotFoundErr;
+  int i;
+  uint32_t now = mico_get_time();
+
+  if(sessionCache_mutex == NULL) return kNotInitializedErr;
+  mico_rtos_lock_mutex(&sessionCache_mutex);
+
+  for(i=0; i<HK_SESSION_CACHE_SIZE; i++){
+    if(sessionCache[i].inUse == false)
+      continue;
+    if(_SessionCacheEntryExpired(&sessionCache[i], now)){
+      _SessionCacheClearEntry(&sessionCache[i]);
+      continue;
+    }
+    if(memcmp(sessionCache[i].sessionID, sessionID, HKSessionIDLength) == 0){
+      if(outControllerName) strncpy(outControllerName, sessionCache[i].controllerName, 64);
+      memcpy(outSharedSecret, sessionCache[i].sharedSecret, HKSharedSecretLength);
+      err = kNoErr;
+      break;
+    }
+  }
+
+  mico_rtos_unlock_mutex(&sessionCache_mutex);
+  if(err != kNoErr) session_cache_log("Session not found in cache, full pair verify required");
+  return err;
+}
+
+void HKSessionCacheRemove(const char *controllerName)
+{
+  int i;
+
+  if(sessionCache_mutex == NULL || controllerName == NULL) return;
+  mico_rtos_lock_mutex(&sessionCache_mutex);
+  for(i=0; i<HK_SESSION_CACHE_SIZE; i++){
+    if(sessionCache[i].inUse && strncmp(sessionCache[i].controllerName, controllerName, 64) == 0)
+      _SessionCacheClearEntry(&sessionCache[i]);
+  }
+  mico_rtos_unlock_mutex(&sessionCache_mutex);
+}
@@ -0,0 +1,45 @@
+/**
+******************************************************************************
+* @file    HomeKitSessionCache.h
+* @author  William Xu
+* @version V1.0.0
+* @date    20-Oct-2014
+* @brief   This header contains function prototypes of the pair-verify
+*          resumption cache. A controller that has finished a full pair-verify
+*          can re-establish its security session with a cheap HKDF step.
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+#ifndef __HOMEKITSESSIONCACHE_h__
+#define __HOMEKITSESSIONCACHE_h__
+
+#include "Common.h"
+
+#define HKSessionIDLength         8
+#define HKSharedSecretLength      32
+
+OSStatus HKSessionCacheInit(void);
+
+/* Remember the shared secret of a verified session, replaces the controller's
+   previous record or the least recently used one if the cache is full */
+void HKSessionCacheStore(const char *controllerName, const uint8_t *sessionID, const uint8_t *sharedSecret);
+
+/* Find a record by session ID without removing it, the caller removes it with
+   HKSessionCacheRemove once the resume request has authenticated, session IDs are one-shot */
+OSStatus HKSessionCacheFind(const uint8_t *sessionID, char *outControllerName, uint8_t *outSharedSecret);
+
+/* Forget every record of a controller, e.g. when its pairing is removed */
+void HKSessionCacheRemove(const char *controllerName);
+
+#endif // __HOMEKITSESSIONCACHE_h__
@@ -47,6 +47,12 @@
 // [null] Zero-length
 #define kWACTLV_Separator               0x0D
 
+// [bytes] 8 bytes identifier of a resumable pair-verify session.
+#define kTLVType_SessionID              0x0E
+
+// Value of kTLVType_Method for resuming a previous pair-verify session
+#define kTLVMethod_PairResume           0x06
+
 #define kHATLV_MaxStringSize           	255
 #define kHATLV_TypeLengthSize          	2
 
@@ -5,6 +5,8 @@
 #include "MDNSUtils.h"
 
 extern void HKBonjourUpdateStateNumber( mico_Context_t * const inContext );
+extern void HKDataBaseCacheInvalidate(void);
+extern void HKNotifyCharacteristicChanged(int accessoryID, int serviceID, int characteristicID);
 
 
 HkStatus HKReadCharacteristicValue(int accessoryID, int serviceID, int characteristicID, value_union *value, mico_Context_t * const inContext)
@@ -246,6 +248,8 @@ void HKWriteCharacteristicValue(int accessoryID, int serviceID, int characterist
 #endif   
   }
     HKBonjourUpdateStateNumber( inContext );
+    HKDataBaseCacheInvalidate();
+    HKNotifyCharacteristicChanged(accessoryID, serviceID, characteristicID);
   return;
 }
 
@@ -2,216 +2,307 @@
 #include "Common.h"
 #include "MICODefine.h"
 
+/* Static attribute metadata, every table is const and lives in flash. Empty
+   slots are not stored, the tables hold exactly the characteristics in use. */
 
+static const struct _hapCharacteristic_t accessoryInformationCharacteristics[] =
+{
+  {
+    .type = "public.hap.characteristic.name",
+    .valueType = ValueType_string,
+    .secureRead = true,
+  },
+  {
+    .type = "public.hap.characteristic.manufacturer",
+    .valueType = ValueType_string,
+    .hasStaticValue = true,
+    .value.stringValue = MANUFACTURER,
+    .secureRead = true,
+  },
+  {
+    .type = "public.hap.characteristic.serial-number",
+    .valueType = ValueType_string,
+    .hasStaticValue = true,
+    .value.stringValue = SERIAL_NUMBER,
+    .secureRead = true,
+  },
+  {
+    .type = "public.hap.characteristic.model",
+    .valueType = ValueType_string,
+    .hasStaticValue = true,
+    .value.stringValue = MODEL,
+    .secureRead = true,
+  },
+  {
+    .type = "public.hap.characteristic.identify",
+    .valueType = ValueType_null,
+    .hasStaticValue = true,
+    .value = NULL,
+    .secureWrite = true,
+  }
+};
 
-const struct _hapAccessory_t hapObjects[NumberofAccessories] = 
+#ifdef lightbulb
+static const struct _hapCharacteristic_t lightbulbCharacteristics[] =
+{
+  {
+    .type = "public.hap.characteristic.on",
+    .valueType = ValueType_bool,
+    .secureRead = true,
+    .secureWrite = true,
+  },
+  {
+    .type = "public.hap.characteristic.brightness",
+    .valueType = ValueType_int,
+    .secureRead = true,
+    .secureWrite = true,
+    .hasMinimumValue = true,
+    .minimumValue = 0,
+    .hasMaximumValue = true,
+    .maximumValue = 100,
+    .hasMinimumStep = true,
+    .minimumStep = 1,
+    .unit = "percentage",
+  },
+  {
+    .type = "public.hap.characteristic.hue",
+    .valueType = ValueType_float,
+    .secureRead = true,
+    .secureWrite = true,
+    .hasMinimumValue = true,
+    .minimumValue.floatValue = 0,
+    .hasMaximumValue = true,
+    .maximumValue.floatValue = 360,
+    .hasMinimumStep = true,
+    .minimumStep.floatValue = 1,
+    .unit = "arcdegrees",
+  },
+  {
+    .type = "public.hap.characteristic.saturation",
+    .valueType = ValueType_float,
+    .secureRead = true,
+    .secureWrite = true,
+    .hasMinimumValue = true,
+    .minimumValue.floatValue = 0,
+    .hasMaximumValue = true,
+    .maximumValue.floatValue = 100,
+    .hasMinimumStep = true,
+    .minimumStep.floatValue = 1,
+    .unit = "percentage",
+  },
+  {
+    .type = "public.hap.characteristic.name",
+    .valueType = ValueType_string,
+    .secureRead = true,
+    .secureWrite = true,
+  }
+};
+#endif
+
+#ifdef thermostat
+static const struct _hapCharacteristic_t thermostatCharacteristics[] =
 {
-  { 
-    .services = {
-      [0] = {
-        .type = "public.hap.service.accessory-information",
-        .characteristic = {
-          [0] = {
-            .type = "public.hap.characteristic.name",
-            .valueType = ValueType_string,
-            .secureRead = true,
-          },
-          [1] = {
-            .type = "public.hap.characteristic.manufacturer",
-            .valueType = ValueType_string,
-            .hasStaticValue = true,
-            .value.stringValue = MANUFACTURER,
-            .secureRead = true,
-          },
-          [2] = {
-            .type = "public.hap.characteristic.serial-number",
-            .valueType = ValueType_string,
-            .hasStaticValue = true,
-            .value.stringValue = SERIAL_NUMBER,
-            .secureRead = true,
-          },	
-          [3] = {
-            .type = "public.hap.characteristic.model",
-            .valueType = ValueType_string,
-            .hasStaticValue = true,
-            .value.stringValue = MODEL,
-            .secureRead = true,
-          },
-          [4] = {
-            .type = "public.hap.characteristic.identify",
-            .valueType = ValueType_null,
-            .hasStaticValue = true,
-            .value = NULL,
-            .secureWrite = true,
-          }	
-        }
-      },
+  {
+    .type = "public.hap.characteristic.heating-cooling.current",
+    .valueType = ValueType_string,
+    .hasStaticValue = false,
+    .value.stringValue = "cool",  //cool, off, heat
+    .secureRead = true,
+  },
+  {
+    .type = "public.hap.characteristic.heating-cooling.target",
+    .valueType = ValueType_string,
+    .hasStaticValue = false,
+    .value.stringValue = "auto", //cool, off, heat, auto
+    .secureRead = true,
+    .secureWrite = true,
+  },
+  {
+    .type = "public.hap.characteristic.temperature.current",
+    .valueType = ValueType_float,
+    .secureRead = true,
+    .hasMinimumValue = true,
+    .minimumValue.floatValue = 0,
+    .hasMaximumValue = true,
+    .maximumValue.floatValue = 100,
+    .hasMinimumStep = true,
+    .minimumStep.floatValue = 0.1,
+  },
+  {
+    .type = "public.hap.characteristic.temperature.target",
+    .valueType = ValueType_float,
+    .secureRead = true,
+    .secureWrite = true,
+    .hasMinimumValue = true,
+    .minimumValue.floatValue = 10,
+    .hasMaximumValue = true,
+    .maximumValue.floatValue = 27,
+    .hasMinimumStep = true,
+    .minimumStep.floatValue = 0.1,
+  },
+  {
+    .type = "public.hap.characteristic.temperature.units",
+    .valueType = ValueType_string,
+    .hasStaticValue = false,
+    .value.stringValue = "celsius", //celsius, fahrenheit, kelvin
+    .secureRead = true,
+    .secureWrite = true,
+  },
+  {
+    .type = "public.hap.characteristic.relative-humidity.current",
+    .valueType = ValueType_float,
+    .secureRead = true,
+    .hasMinimumValue = true,
+    .minimumValue.floatValue = 0,
+    .hasMaximumValue = true,
+    .maximumValue.floatValue = 100,
+    .hasMinimumStep = true,
+    .minimumStep.floatValue = 0.01,
+  },
+  {
+    .type = "public.hap.characteristic.relative-humidity.target",
+    .valueType = ValueType_float,
+    .secureRead = true,
+    .secureWrite = true,
+    .hasMinimumValue = true,
+    .minimumValue.floatValue = 0,
+    .hasMaximumValue = true,
+    .maximumValue.floatValue = 100,
+    .hasMinimumStep = true,
+    .minimumStep.floatValue = 1,
+  },
+  {
+    .type = "public.hap.characteristic.temperature.heating-threshold",
+    .valueType = ValueType_float,
+    .secureRead = true,
+    .secureWrite = true,
+    .hasMinimumValue = true,
+    .minimumValue.floatValue = 0,
+    .hasMaximumValue = true,
+    .maximumValue.floatValue = 25,
+    .hasMinimumStep = true,
+    .minimumStep.floatValue = 0.1
+  },
+  {
+    .type = "public.hap.characteristic.temperature.cooling-threshold",
+    .valueType = ValueType_float,
+    .secureRead = true,
+    .secureWrite = true,
+    .hasMinimumValue = true,
+    .minimumValue.floatValue = 10,
+    .hasMaximumValue = true,
+    .maximumValue.floatValue = 35,
+    .hasMinimumStep = true,
+    .minimumStep.floatValue = 0.1,
+  },
+  {
+    .type = "public.hap.characteristic.name",
+    .valueType = ValueType_string,
+    .hasStaticValue = false,
+    .value.stringValue = "William's thermostat",
+    .secureRead = true,
+    .secureWrite = true,
+  }
+};
+#endif
+
+static const struct _hapService_t accessoryServices[] =
+{
+  {
+    .type = "public.hap.service.accessory-information",
+    .characteristic = accessoryInformationCharacteristics,
+    .numberOfCharacteristics = sizeof(accessoryInformationCharacteristics)/sizeof(struct _hapCharacteristic_t),
+  },
 #ifdef lightbulb
-    [1] = {
-        .type = "public.hap.service.lightbulb",
-        .characteristic = {
-          [0] = {
-            .type = "public.hap.characteristic.on",
-            .valueType = ValueType_bool,
-            .secureRead = true,
-            .secureWrite = true,
-          },
-          [1] = {
-            .type = "public.hap.characteristic.brightness",
-            .valueType = ValueType_int,
-            .secureRead = true,
-            .secureWrite = true,
-            .hasMinimumValue = true,
-            .minimumValue = 0,
-            .hasMaximumValue = true,
-            .maximumValue = 100,
-            .hasMinimumStep = true,
-            .minimumStep = 1,
-            .unit = "percentage",
-          },
-          [2] = {
-            .type = "public.hap.characteristic.hue",
-            .valueType = ValueType_float,
-            .secureRead = true,
-            .secureWrite = true,
-            .hasMinimumValue = true,
-            .minimumValue.floatValue = 0,
-            .hasMaximumValue = true,
-            .maximumValue.floatValue = 360,
-            .hasMinimumStep = true,
-            .minimumStep.floatValue = 1,
-            .unit = "arcdegrees",
-          }, 
-          [3] = {
-            .type = "public.hap.characteristic.saturation",
-            .valueType = ValueType_float,
-            .secureRead = true,
-            .secureWrite = true,
-            .hasMinimumValue = true,
-            .minimumValue.floatValue = 0,
-            .hasMaximumValue = true,
-            .maximumValue.floatValue = 100,
-            .hasMinimumStep = true,
-            .minimumStep.floatValue = 1,
-            .unit = "percentage",
-          }, 
-          [4] = {
-            .type = "public.hap.characteristic.name",
-            .valueType = ValueType_string,
-            .secureRead = true,
-            .secureWrite = true,
-          }
-        }
-      },
+  {
+    .type = "public.hap.service.lightbulb",
+    .characteristic = lightbulbCharacteristics,
+    .numberOfCharacteristics = sizeof(lightbulbCharacteristics)/sizeof(struct _hapCharacteristic_t),
+  },
 #endif
 #ifdef thermostat
-    [1] = {
-        .type = "public.hap.service.thermostat",
-        .characteristic = {
-          [0] = {
-            .type = "public.hap.characteristic.heating-cooling.current",
-            .valueType = ValueType_string,
-            .hasStaticValue = false,
-            .value.stringValue = "cool",  //cool, off, heat
-            .secureRead = true,
-          },
-          [1] = {
-            .type = "public.hap.characteristic.heating-cooling.target",
-            .valueType = ValueType_string,
-            .hasStaticValue = false,
-            .value.stringValue = "auto", //cool, off, heat, auto
-            .secureRead = true,
-            .secureWrite = true,
-          },
-          [2] = {
-            .type = "public.hap.characteristic.temperature.current",
-            .valueType = ValueType_float,
-            .secureRead = true,
-            .hasMinimumValue = true,
-            .minimumValue.floatValue = 0,
-            .hasMaximumValue = true,
-            .maximumValue.floatValue = 100,
-            .hasMinimumStep = true,
-            .minimumStep.floatValue = 0.1,
-          }, 
-          [3] = {
-            .type = "public.hap.characteristic.temperature.target",
-            .valueType = ValueType_float,
-            .secureRead = true,
-            .secureWrite = true,
-            .hasMinimumValue = true,
-            .minimumValue.floatValue = 10,
-            .hasMaximumValue = true,
-            .maximumValue.floatValue = 27,
-            .hasMinimumStep = true,
-            .minimumStep.floatValue = 0.1,
-          }, 
-          [4] = {
-            .type = "public.hap.characteristic.temperature.units",
-            .valueType = ValueType_string,
-            .hasStaticValue = false,
-            .value.stringValue = "celsius", //celsius, fahrenheit, kelvin
-            .secureRead = true,
-            .secureWrite = true,
-          }, 
-          [5] = {
-            .type = "public.hap.characteristic.relative-humidity.current",
-            .valueType = ValueType_float,
-            .secureRead = true,
-            .hasMinimumValue = true,
-            .minimumValue.floatValue = 0,
-            .hasMaximumValue = true,
-            .maximumValue.floatValue = 100,
-            .hasMinimumStep = true,
-            .minimumStep.floatValue = 0.01,
-          }, 
-          [6] = {
-            .type = "public.hap.characteristic.relative-humidity.target",
-            .valueType = ValueType_float,
-            .secureRead = true,
-            .secureWrite = true,
-            .hasMinimumValue = true,
-            .minimumValue.floatValue = 0,
-            .hasMaximumValue = true,
-            .maximumValue.floatValue = 100,
-            .hasMinimumStep = true,
-            .minimumStep.floatValue = 1,
-          }, 
-          [7] = {
-            .type = "public.hap.characteristic.temperature.heating-threshold",
-            .valueType = ValueType_float,
-            .secureRead = true,
-            .secureWrite = true,
-            .hasMinimumValue = true,
-            .minimumValue.floatValue = 0,
-            .hasMaximumValue = true,
-            .maximumValue.floatValue = 25,
-            .hasMinimumStep = true,
-            .minimumStep.floatValue = 0.1
-          }, 
-          [8] = {
-            .type = "public.hap.characteristic.temperature.cooling-threshold",
-            .valueType = ValueType_float,
-            .secureRead = true,
-            .secureWrite = true,
-            .hasMinimumValue = true,
-            .minimumValue.floatValue = 10,
-            .hasMaximumValue = true,
-            .maximumValue.floatValue = 35,
-            .hasMinimumStep = true,
-            .minimumStep.floatValue = 0.1,
-          }, 
-          [9] = {
-            .type = "public.hap.characteristic.name",
-            .valueType = ValueType_string,
-            .hasStaticValue = false,
-            .value.stringValue = "William's thermostat",
-            .secureRead = true,
-            .secureWrite = true,
-          }
-        }
-      }
+  {
+    .type = "public.hap.service.thermostat",
+    .characteristic = thermostatCharacteristics,
+    .numberOfCharacteristics = sizeof(thermostatCharacteristics)/sizeof(struct _hapCharacteristic_t),
+  },
 #endif
-    }
+};
+
+const struct _hapAccessory_t hapObjects[NumberofAccessories] = 
+{
+  {
+    .services = accessoryServices,
+    .numberOfServices = sizeof(accessoryServices)/sizeof(struct _hapService_t),
   }
 };
+
+/* Dense attribute index: position of a service's first characteristic in the
+   flat numbering of all characteristics, built once by HKProfilesInit */
+static uint16_t hapServiceBase[NumberofAccessories][MAXServicePerAccessory];
+static uint16_t hapNumberOfAttributes = 0;
+
+void HKProfilesInit(void)
+{
+  int accessoryIndex, serviceIndex;
+  uint16_t base = 0;
+
+  for(accessoryIndex = 0; accessoryIndex < NumberofAccessories; accessoryIndex++){
+    for(serviceIndex = 0; serviceIndex < hapObjects[accessoryIndex].numberOfServices; serviceIndex++){
+      hapServiceBase[accessoryIndex][serviceIndex] = base;
+      base += hapObjects[accessoryIndex].services[serviceIndex].numberOfCharacteristics;
+    }
+  }
+  hapNumberOfAttributes = base;
+}
+
+const struct _hapService_t *HKServiceGet(int accessoryID, int serviceID)
+{
+  if(accessoryID < 1 || accessoryID > NumberofAccessories)
+    return NULL;
+  if(serviceID < 1 || serviceID > hapObjects[accessoryID-1].numberOfServices)
+    return NULL;
+  return &hapObjects[accessoryID-1].services[serviceID-1];
+}
+
+const struct _hapCharacteristic_t *HKCharacteristicGet(int accessoryID, int serviceID, int characteristicID)
+{
+  const struct _hapService_t *service = HKServiceGet(accessoryID, serviceID);
+
+  if(service == NULL || characteristicID < 1 || characteristicID > service->numberOfCharacteristics)
+    return NULL;
+  return &service->characteristic[characteristicID-1];
+}
+
+int HKAttributeIndex(int accessoryID, int serviceID, int characteristicID)
+{
+  if(HKCharacteristicGet(accessoryID, serviceID, characteristicID) == NULL)
+    return -1;
+  return hapServiceBase[accessoryID-1][serviceID-1] + characteristicID - 1;
+}
+
+int HKNumberOfAttributes(void)
+{
+  return hapNumberOfAttributes;
+}
+
+OSStatus HKAttributeIDs(int index, int *accessoryID, int *serviceID, int *characteristicID)
+{
+  int accessoryIndex, serviceIndex;
+  const struct _hapAccessory_t *accessory;
+
+  for(accessoryIndex = 0; accessoryIndex < NumberofAccessories; accessoryIndex++){
+    accessory = &hapObjects[accessoryIndex];
+    for(serviceIndex = accessory->numberOfServices - 1; serviceIndex >= 0; serviceIndex--){
+      if(index < hapServiceBase[accessoryIndex][serviceIndex])
+        continue;
+      if(index - hapServiceBase[accessoryIndex][serviceIndex] >= accessory->services[serviceIndex].numberOfCharacteristics)
+        break;
+      *accessoryID = accessoryIndex + 1;
+      *serviceID = serviceIndex + 1;
+      *characteristicID = index - hapServiceBase[accessoryIndex][serviceIndex] + 1;
+      return kNoErr;
+    }
+  }
+  return kNotFoundErr;
+}
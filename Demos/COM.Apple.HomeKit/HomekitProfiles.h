@@ -58,35 +58,34 @@ typedef union {
 
 struct _hapCharacteristic_t {
   char   *type;
-
-  bool   hasStaticValue;
   valueType valueType;
   value_union value;
 
+  bool   hasStaticValue;
   bool   secureRead;
   bool   secureWrite;
-
   bool   hasMinimumValue;
+  bool   hasMaximumValue;
+  bool   hasMinimumStep;
+  bool   hasPrecision;
+  bool   hasMaxLength;
+
   union {
     int         intValue;
     float       floatValue;
   }      minimumValue;
 
-  bool   hasMaximumValue;
   union {
     int         intValue;
     float       floatValue;
   }      maximumValue;
 
-  bool   hasMinimumStep;
   union {
     int         intValue;
     float       floatValue;
   }      minimumStep;
 
-  bool   hasPrecision;
   float  precision;
-  bool   hasMaxLength;
   int    maxLength;
   char   *description;
   char   *format;
@@ -95,13 +94,29 @@ struct _hapCharacteristic_t {
 
 struct _hapService_t {
   char    *type;
-  struct  _hapCharacteristic_t                characteristic[MAXCharacteristicPerService];
+  const struct _hapCharacteristic_t           *characteristic;
+  uint8_t numberOfCharacteristics;
 };
 
 struct _hapAccessory_t {
-  struct _hapService_t  services[MAXServicePerAccessory];
+  const struct _hapService_t  *services;
+  uint8_t numberOfServices;
 };
 
+extern const struct _hapAccessory_t hapObjects[NumberofAccessories];
+
+/* Build the dense attribute index, call once before any accessor */
+void HKProfilesInit(void);
+
+/* IDs are the 1-based instance IDs used in HAP URLs, NULL if not existed */
+const struct _hapService_t *HKServiceGet(int accessoryID, int serviceID);
+const struct _hapCharacteristic_t *HKCharacteristicGet(int accessoryID, int serviceID, int characteristicID);
+
+/* Position of a characteristic in 0..HKNumberOfAttributes()-1, -1 if not existed */
+int HKAttributeIndex(int accessoryID, int serviceID, int characteristicID);
+int HKNumberOfAttributes(void);
+OSStatus HKAttributeIDs(int index, int *accessoryID, int *serviceID, int *characteristicID);
+
 
 #endif
 
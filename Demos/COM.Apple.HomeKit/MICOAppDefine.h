@@ -55,6 +55,24 @@
 #define HA_SV               "1.0"
 #define HA_SERVER_PORT      1200  
 
+/*Pair-verify resumption, controllers beyond HK_SESSION_CACHE_SIZE evict the least recently used one*/
+#define HK_SESSION_CACHE_SIZE               4
+#define HK_SESSION_CACHE_TIMEOUT            (60*60) //Seconds
+
+/*Characteristic changes within this window are sent in one event frame*/
+#define HK_EVENT_COALESCE_WINDOW            100 //Milliseconds
+
+/*SRP servers for pair-setup are generated in background, SRP user is always "Pair-Setup"*/
+#define HK_SRP_POOL_SIZE                    1
+#define HK_SRP_POOL_USER                    "Pair-Setup"
+
+/*Serve all controllers from one select() loop with a small worker pool
+  instead of one 0xA00 stack thread per connection, not yet run on an EVB*/
+//#define HK_SERVER_EVENT_LOOP
+#define HK_MAX_SESSIONS                     16
+#define HK_WORKER_NUMBER                    2
+#define HK_WAKEUP_LOOPBACK_PORT             1100 //Workers wake the select() loop through it
+
 typedef enum
 {
     eState_M1_SRPStartRequest      = 1,
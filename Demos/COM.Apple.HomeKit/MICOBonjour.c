@@ -44,6 +44,13 @@ void BonjourNotify_WifiStatusHandler( WiFiEvent event, mico_Context_t * const in
   return;
 }
 
+void BonjourNotify_DHCPCompleteHandler( IPStatusTypedef *pnet, mico_Context_t * const inContext )
+{
+  (void)pnet;
+  (void)inContext;
+  bonjour_update_ip_address();
+}
+
 void BonjourNotify_SYSWillPoerOffHandler( mico_Context_t * const inContext)
 {
   (void)inContext;
@@ -118,6 +125,8 @@ OSStatus MICOStartBonjourService( WiFi_Interface interface, mico_Context_t * con
 
   err = MICOAddNotification( mico_notify_WIFI_STATUS_CHANGED, (void *)BonjourNotify_WifiStatusHandler );
   require_noerr( err, exit );
+  err = MICOAddNotification( mico_notify_DHCP_COMPLETED, (void *)BonjourNotify_DHCPCompleteHandler );
+  require_noerr( err, exit );
   err = MICOAddNotification( mico_notify_SYS_WILL_POWER_OFF, (void *)BonjourNotify_SYSWillPoerOffHandler );
   require_noerr( err, exit ); 
 
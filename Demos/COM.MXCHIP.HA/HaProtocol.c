@@ -6,6 +6,7 @@
 #include "MicoPlatform.h"
 #include "platform_common_config.h"
 #include "MICONotificationCenter.h"
+#include "OTAUtils.h"
 #include <stdio.h>
 
 #define ha_log(M, ...) custom_log("HA Command", M, ##__VA_ARGS__)
@@ -18,7 +19,8 @@ static mico_mutex_t _mutex;
 static int _recved_uart_loopback_fd = -1;
 
 static uint16_t _calc_sum(void *data, uint32_t len);
-static OSStatus _ota_process(uint8_t *inBuf, int inBufLen, int *inSocketFd, mico_Context_t * const inContext);
+static OSStatus _ota_process(uint8_t *inBuf, int inBufLen, int *inSocketFd, bool inResume, mico_Context_t * const inContext);
+static OSStatus _ota_offset_process(uint8_t *inBuf, int inBufLen, int inSocketFd);
 static mico_thread_t    _report_status_thread_handler = NULL;
 static mico_semaphore_t _report_status_sem = NULL;
 static void _report_status_thread(void *inContext);
@@ -169,7 +171,13 @@ OSStatus haWlanCommandProcess(unsigned char *inBuf, int *inBufLen, int inSocketF
         break;
 #ifdef MICO_FLASH_FOR_UPDATE
       case CMD_OTA:
-        err = _ota_process(inBuf+idx, cmdLen, &inSocketFd, inContext);
+        err = _ota_process(inBuf+idx, cmdLen, &inSocketFd, false, inContext);
+        break;
+      case CMD_OTA_OFFSET:
+        err = _ota_offset_process(inBuf+idx, cmdLen, inSocketFd);
+        break;
+      case CMD_OTA_RESUME:
+        err = _ota_process(inBuf+idx, cmdLen, &inSocketFd, true, inContext);
         break;
 #endif
       case CMD_NET2COM:
@@ -193,15 +201,145 @@ exit:
 }
 
 #ifdef MICO_FLASH_FOR_UPDATE
-OSStatus _ota_process(uint8_t *inBuf, int inBufLen, int *inSocketFd, mico_Context_t * const inContext)
+#define OTA_BUFFER_LEN  1024
+#define OTA_BUFFER_NUM  2
+
+typedef struct _ota_chunk_t {
+  uint8_t     *data;
+  int          len;
+  md5_context *hash;  // MD5 state at the end of the chunk to checkpoint, or NULL
+} ota_chunk_t;
+
+static mico_queue_t     _ota_chunk_queue = NULL;
+static mico_semaphore_t _ota_buffer_free_sem = NULL;
+static ota_session_t    _ota_session;
+static OSStatus         _ota_flash_err;
+static uint32_t         _ota_recv_len;
+static uint32_t         _ota_next_snapshot;
+static md5_context      _ota_snapshot[OTA_BUFFER_NUM];
+
+/* Program the received chunks into flash while the next one is received.
+   Every chunk gives its buffer back on _ota_buffer_free_sem, an empty
+   chunk stops the thread. */
+static void _ota_flash_thread(void *arg)
+{
+  ota_chunk_t chunk;
+  (void)arg;
+
+  while(1){
+    if(mico_rtos_pop_from_queue(&_ota_chunk_queue, &chunk, MICO_WAIT_FOREVER) != kNoErr)
+      continue;
+    if(chunk.len > 0 && _ota_flash_err == kNoErr){
+      _ota_flash_err = OTASessionWrite(&_ota_session, chunk.data, chunk.len);
+      if(_ota_flash_err == kNoErr && chunk.hash)
+        _ota_flash_err = OTASessionCheckpoint(&_ota_session, chunk.hash);
+    }
+    mico_rtos_set_semaphore(&_ota_buffer_free_sem);
+    if(chunk.len == 0)
+      break;
+  }
+  mico_rtos_delete_thread(NULL);
+}
+
+static OSStatus _ota_flash_start(void)
+{
+  OSStatus err;
+  int i;
+
+  _ota_flash_err = kNoErr;
+  _ota_recv_len = _ota_session.offset;
+  _ota_next_snapshot = _ota_session.nextCheckpoint;
+  err = mico_rtos_init_queue(&_ota_chunk_queue, "OTA Chunks", sizeof(ota_chunk_t), OTA_BUFFER_NUM);
+  require_noerr(err, exit);
+  err = mico_rtos_init_semaphore(&_ota_buffer_free_sem, OTA_BUFFER_NUM);
+  require_noerr_action(err, exit, mico_rtos_deinit_queue(&_ota_chunk_queue));
+  for(i = 0; i < OTA_BUFFER_NUM; i++)
+    mico_rtos_set_semaphore(&_ota_buffer_free_sem);
+
+  err = mico_rtos_create_thread(NULL, MICO_APPLICATION_PRIORITY, "OTA Flash", _ota_flash_thread, 0x400, NULL);
+  require_noerr_action(err, exit, mico_rtos_deinit_queue(&_ota_chunk_queue); mico_rtos_deinit_semaphore(&_ota_buffer_free_sem));
+
+exit:
+  return err;
+}
+
+/* Hash the chunk while the flash thread programs the previous one, then
+   queue it. The caller owns the buffer by a take on _ota_buffer_free_sem.
+   The MD5 state of a chunk to checkpoint is kept in the slot of its buffer
+   until the chunk is in flash. */
+static void _ota_flash_push(uint8_t *data, int len, md5_context *ctx, int slot)
+{
+  ota_chunk_t chunk;
+
+  Md5Update(ctx, data, len);
+  _ota_recv_len += len;
+  chunk.data = data;
+  chunk.len = len;
+  chunk.hash = NULL;
+  if(_ota_session.interval && _ota_recv_len >= _ota_next_snapshot && _ota_recv_len < _ota_session.length){
+    _ota_snapshot[slot] = *ctx;
+    chunk.hash = &_ota_snapshot[slot];
+    _ota_next_snapshot = _ota_recv_len + _ota_session.interval;
+  }
+  mico_rtos_push_to_queue(&_ota_chunk_queue, &chunk, MICO_WAIT_FOREVER);
+}
+
+/* Wait for all buffers to come back, so every chunk is in flash, then
+   stop the flash thread. Returns the first flash error. */
+static OSStatus _ota_flash_stop(void)
+{
+  ota_chunk_t chunk;
+  int i;
+
+  for(i = 0; i < OTA_BUFFER_NUM; i++)
+    mico_rtos_get_semaphore(&_ota_buffer_free_sem, MICO_WAIT_FOREVER);
+  chunk.data = NULL;
+  chunk.len = 0;
+  mico_rtos_push_to_queue(&_ota_chunk_queue, &chunk, MICO_WAIT_FOREVER);
+  mico_rtos_get_semaphore(&_ota_buffer_free_sem, MICO_WAIT_FOREVER);
+
+  mico_rtos_deinit_queue(&_ota_chunk_queue);
+  mico_rtos_deinit_semaphore(&_ota_buffer_free_sem);
+  return _ota_flash_err;
+}
+
+/* Reply the bytes of the image in CMD_OTA_OFFSET that are already in flash,
+   CMD_OTA_RESUME continues from there. 0 if the session is of another image. */
+static OSStatus _ota_offset_process(uint8_t *inBuf, int inBufLen, int inSocketFd)
+{
+  mxchip_cmd_head_t *p_control_cmd;
+  ota_upgrate_t *p_upgrade;
+  mxchip_ota_offset_t reply;
+  uint32_t length, offset;
+  uint8_t id[16];
+
+  p_control_cmd = (mxchip_cmd_head_t *)inBuf;
+  p_upgrade = (ota_upgrate_t*)(p_control_cmd->data);
+  memset(&reply, 0, sizeof(reply));
+  reply.flag = p_control_cmd->flag;
+  reply.cmd = p_control_cmd->cmd | 0x8000;
+  reply.cmd_status = CMD_OK;
+  reply.datalen = sizeof(uint32_t);
+  if(inBufLen >= HA_CMD_HEAD_SIZE + 16 + 4 && OTASessionQuery(&length, id, &offset) == kNoErr
+     && length == p_upgrade->len && memcmp(id, p_upgrade->md5, 16) == 0)
+    reply.offset = offset;
+  reply.cksum = _calc_sum(&reply, HA_CMD_HEAD_SIZE + sizeof(uint32_t));
+  return SocketSend(inSocketFd, (uint8_t *)&reply, HA_CMD_HEAD_SIZE + sizeof(uint32_t) + 2);
+}
+
+/* CMD_OTA starts the image over, CMD_OTA_RESUME continues the session of
+   the same image at the offset in the command */
+OSStatus _ota_process(uint8_t *inBuf, int inBufLen, int *inSocketFd, bool inResume, mico_Context_t * const inContext)
 {
   OSStatus err = kNoErr;
   mxchip_cmd_head_t *p_control_cmd;
   ota_upgrate_t *p_upgrade;
+  ota_resume_t *p_resume;
   uint8_t * p_bin;
+  uint8_t * buffers = NULL;
+  int cur = 0, i;
   int bin_len, total_len, head_len;
-  uint32_t flash_addr = UPDATE_START_ADDRESS;
-  uint8_t md5_ret[16];
+  uint32_t offset = 0;
   mxchip_cmd_head_t cmd_ack;
   fd_set readfds;
   struct timeval_t t;
@@ -212,20 +350,52 @@ OSStatus _ota_process(uint8_t *inBuf, int inBufLen, int *inSocketFd, mico_Contex
   p_control_cmd = (mxchip_cmd_head_t *)inBuf;
   cmd_ack.flag = p_control_cmd->flag;
   cmd_ack.cmd = p_control_cmd->cmd | 0x8000;
-  head_len = sizeof(mxchip_cmd_head_t) + sizeof(ota_upgrate_t) - 2;
+  p_upgrade = (ota_upgrate_t*)(p_control_cmd->data);
+  p_resume = (ota_resume_t*)(p_control_cmd->data);
+  if(inResume){
+    head_len = sizeof(mxchip_cmd_head_t) + sizeof(ota_resume_t) - 2;
+    p_bin = p_resume->data;
+  }else{
+    head_len = sizeof(mxchip_cmd_head_t) + sizeof(ota_upgrate_t) - 2;
+    p_bin = p_upgrade->data;
+  }
   if (inBufLen < head_len){
     goto CMD_REPLY;
   }
-  MicoFlashInitialize( MICO_FLASH_FOR_UPDATE );
-  p_upgrade = (ota_upgrate_t*)(p_control_cmd->data);
+  if(inResume)
+    offset = p_resume->offset;
+
+  /* The image is hashed as it arrives, so nothing is read back from flash.
+     A resumed session gives back the MD5 state at its offset. */
+  if (OTASessionOpen(&_ota_session, p_upgrade->len, p_upgrade->md5, inResume, &ctx) != kNoErr
+   || _ota_session.offset != offset){
+    MicoFlashFinalize(MICO_FLASH_FOR_UPDATE);
+    goto CMD_REPLY;
+  }
+  buffers = malloc(OTA_BUFFER_LEN * OTA_BUFFER_NUM);
+  if (buffers == NULL){
+    MicoFlashFinalize(MICO_FLASH_FOR_UPDATE);
+    goto CMD_REPLY;
+  }
+  if (_ota_flash_start() != kNoErr){
+    MicoFlashFinalize(MICO_FLASH_FOR_UPDATE);
+    goto CMD_REPLY;
+  }
 
-  p_bin = p_upgrade->data;
-  total_len = p_upgrade->len;
+  total_len = _ota_session.length - _ota_session.offset;
   bin_len = inBufLen - head_len;
   total_len -= bin_len;
 
-  if (bin_len>0)
-    MicoFlashWrite(MICO_FLASH_FOR_UPDATE, &flash_addr, p_bin, bin_len);
+  if (bin_len>0){
+    mico_rtos_get_semaphore(&_ota_buffer_free_sem, MICO_WAIT_FOREVER);
+    _ota_flash_push(p_bin, bin_len, &ctx, cur);
+    /* p_bin is in inBuf and its MD5 state in slot cur, wait until every
+       buffer is back so the chunk is written and checkpointed */
+    for(i = 0; i < OTA_BUFFER_NUM; i++)
+      mico_rtos_get_semaphore(&_ota_buffer_free_sem, MICO_WAIT_FOREVER);
+    for(i = 0; i < OTA_BUFFER_NUM; i++)
+      mico_rtos_set_semaphore(&_ota_buffer_free_sem);
+  }
 
   while (total_len>0) {
     FD_ZERO(&readfds);
@@ -235,37 +405,45 @@ OSStatus _ota_process(uint8_t *inBuf, int inBufLen, int *inSocketFd, mico_Contex
     select(1, &readfds, NULL, NULL, &t);
 
     if (FD_ISSET(*inSocketFd, &readfds)) {
-      bin_len = recv(*inSocketFd, (char*)p_bin, 1024, 0);
-      require_action(bin_len >= 0, exit, err = kConnectionErr);
-      MicoFlashWrite(MICO_FLASH_FOR_UPDATE, &flash_addr, p_bin, bin_len);
+      /* Receive into one buffer while the other one is being programmed */
+      mico_rtos_get_semaphore(&_ota_buffer_free_sem, MICO_WAIT_FOREVER);
+      p_bin = buffers + cur * OTA_BUFFER_LEN;
+      bin_len = recv(*inSocketFd, (char*)p_bin, Min(OTA_BUFFER_LEN, total_len), 0);
+      require_action(bin_len > 0, exit, err = kConnectionErr; mico_rtos_set_semaphore(&_ota_buffer_free_sem));
+      _ota_flash_push(p_bin, bin_len, &ctx, cur);
+      cur = (cur + 1) % OTA_BUFFER_NUM;
       total_len-=bin_len;
     }
   }
 
+  err = _ota_flash_stop();
+  if(err == kNoErr)
+    err = OTASessionFinish(&_ota_session, &ctx);
 
-  InitMd5( &ctx );
-  Md5Update( &ctx, (uint8_t *)UPDATE_START_ADDRESS, flash_addr - UPDATE_START_ADDRESS);
-  Md5Final( &ctx, md5_ret );
-
-  if(memcmp(md5_ret, p_upgrade->md5, 16) != 0) {
+  if(err != kNoErr) {
     MicoFlashFinalize(MICO_FLASH_FOR_UPDATE);
     goto CMD_REPLY;
   }
 
   memset(&inContext->flashContentInRam.bootTable, 0, sizeof(boot_table_t));
-  inContext->flashContentInRam.bootTable.length = flash_addr - UPDATE_START_ADDRESS;
+  inContext->flashContentInRam.bootTable.length = _ota_session.length;
   inContext->flashContentInRam.bootTable.start_address = UPDATE_START_ADDRESS;
   inContext->flashContentInRam.bootTable.type = 'A';
-  inContext->flashContentInRam.bootTable.upgrade_type = 'U';
+  inContext->flashContentInRam.bootTable.upgrade_type = OTAGetUpgradeType();
   MICOUpdateConfiguration(inContext);
   cmd_ack.cmd_status = CMD_OK;
   
 CMD_REPLY:
+  if (buffers) free(buffers);
   err =  SocketSend( *inSocketFd, (uint8_t *)&cmd_ack, sizeof(cmd_ack) + 1 + cmd_ack.datalen );
-  require_noerr(err, exit);
+  require_noerr(err, exit_send);
   return kNoErr;
 
 exit:
+  _ota_flash_stop();
+  MicoFlashFinalize(MICO_FLASH_FOR_UPDATE);
+  free(buffers);
+exit_send:
   SocketClose(inSocketFd);
   inContext->micoStatus.sys_state = eState_Software_Reset;
   mico_rtos_set_semaphore(&inContext->micoStatus.sys_state_change_sem);
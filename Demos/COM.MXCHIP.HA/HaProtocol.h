@@ -23,6 +23,8 @@ enum {
   CMD_GET_STATUS, 
   CMD_CONTROL,    
   CMD_SEARCH, 
+  CMD_OTA_OFFSET,          //Bytes of an OTA image already received, data is ota_upgrate_t without the image
+  CMD_OTA_RESUME,          //Continue an OTA image from the offset read by CMD_OTA_OFFSET
 };
 
 enum {
@@ -47,6 +49,22 @@ typedef struct _upgrade_t {
   uint8_t data[1];
 }ota_upgrate_t;
 
+typedef struct _resume_t {
+  uint8_t md5[16];
+  uint32_t len;
+  uint32_t offset;
+  uint8_t data[1];
+}ota_resume_t;
+
+typedef struct _mxchip_ota_offset_ {
+  uint16_t flag; 
+  uint16_t cmd; 
+  uint16_t cmd_status; 
+  uint16_t datalen; 
+  uint32_t offset;
+  uint16_t cksum;
+}mxchip_ota_offset_t;
+
 typedef struct _current_state_ {
   uint32_t uap_state;
   uint32_t sta_state;
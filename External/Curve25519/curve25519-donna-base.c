@@ -0,0 +1,77 @@
+/**
+******************************************************************************
+* @file    curve25519-donna-base.c
+* @author  William Xu
+* @version V1.0.0
+* @date    22-Oct-2014
+* @brief   Curve25519 public key generation from the Ed25519 fixed-base table.
+*
+*          The Montgomery ladder in curve25519-donna.c takes 255 ladder steps
+*          for any point. For the base point the scalar multiplication is done
+*          on the birationally equivalent Edwards curve instead, where
+*          ge_scalarmult_base uses the precomputed radix-16 table (ref10,
+*          32 x 8 points in flash) that crypto_sign already links in. The table
+*          lookup is a constant-time cmov scan, there is no secret dependent
+*          branch or memory access. The Edwards point (X:Y:Z) maps to the
+*          Montgomery u = (Z + Y) / (Z - Y).
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "curve25519-donna.h"
+
+// Field and group types of the ref10 implementation in MICOCrypto, the header is not exported.
+
+typedef int32_t fe[ 10 ];
+
+typedef struct
+{
+    fe      X;
+    fe      Y;
+    fe      Z;
+    fe      T;
+}   ge_p3;
+
+extern void crypto_sign_ed25519_ref10_ge_scalarmult_base( ge_p3 *h, const unsigned char *a );
+extern void crypto_sign_ed25519_ref10_fe_add( fe h, const fe f, const fe g );
+extern void crypto_sign_ed25519_ref10_fe_sub( fe h, const fe f, const fe g );
+extern void crypto_sign_ed25519_ref10_fe_mul( fe h, const fe f, const fe g );
+extern void crypto_sign_ed25519_ref10_fe_invert( fe out, const fe z );
+extern void crypto_sign_ed25519_ref10_fe_tobytes( unsigned char *s, const fe h );
+
+void curve25519_donna_base( unsigned char *outKey, const unsigned char *inSecret )
+{
+    unsigned char       e[ 32 ];
+    ge_p3               A;
+    fe                  zPlusY, zMinusY, zMinusYInv;
+    int                 i;
+
+    // Same clamping as curve25519_donna, it also keeps e[ 31 ] <= 127 as ge_scalarmult_base requires.
+    for( i = 0; i < 32; ++i ) e[ i ] = inSecret[ i ];
+    e[ 0 ]  &= 248;
+    e[ 31 ] &= 127;
+    e[ 31 ] |= 64;
+
+    crypto_sign_ed25519_ref10_ge_scalarmult_base( &A, e );
+
+    crypto_sign_ed25519_ref10_fe_add( zPlusY, A.Z, A.Y );
+    crypto_sign_ed25519_ref10_fe_sub( zMinusY, A.Z, A.Y );
+    crypto_sign_ed25519_ref10_fe_invert( zMinusYInv, zMinusY );
+    crypto_sign_ed25519_ref10_fe_mul( zPlusY, zPlusY, zMinusYInv );
+    crypto_sign_ed25519_ref10_fe_tobytes( outKey, zPlusY );
+
+    memset( e, 0, sizeof( e ) );
+    memset( &A, 0, sizeof( A ) );
+}
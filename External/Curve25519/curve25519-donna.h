@@ -59,6 +59,9 @@
 
 void curve25519_donna( unsigned char *outKey, const unsigned char *inSecret, const unsigned char *inBasePoint );
 
+// Public key generation, same result as curve25519_donna( outKey, inSecret, NULL ) from a fixed-base table.
+void curve25519_donna_base( unsigned char *outKey, const unsigned char *inSecret );
+
 #ifdef	__cplusplus
 	}
 #endif
@@ -156,6 +156,8 @@ int hkdfExpand(SHAversion whichSha, const uint8_t prk[ ], int prk_len,
   int hash_len, N;
   unsigned char T[USHAMaxHashSize];
   int Tlen, where, i;
+  int ret;
+  HMACKeySchedule *schedule;
 
   if (info == 0) {
     info = (const unsigned char *)"";
@@ -172,23 +174,31 @@ int hkdfExpand(SHAversion whichSha, const uint8_t prk[ ], int prk_len,
   if ((okm_len % hash_len) != 0) N++;
   if (N > 255) return shaBadParam;
 
+  /* every T(i) is keyed with the PRK, hash its pads only once */
+  schedule = malloc(sizeof(HMACKeySchedule));
+  if (!schedule) return shaNull;
+  ret = hmacKeySchedule(schedule, whichSha, prk, prk_len);
+
   Tlen = 0;
   where = 0;
-  for (i = 1; i <= N; i++) {
+  for (i = 1; (i <= N) && (ret == shaSuccess); i++) {
     HMACContext context;
     unsigned char c = i;
-    int ret = hmacReset(&context, whichSha, prk, prk_len) ||
-              hmacInput(&context, T, Tlen) ||
-              hmacInput(&context, info, info_len) ||
-              hmacInput(&context, &c, 1) ||
-              hmacResult(&context, T);
-    if (ret != shaSuccess) return ret;
+    ret = hmacResetWithSchedule(&context, schedule) ||
+          hmacInput(&context, T, Tlen) ||
+          hmacInput(&context, info, info_len) ||
+          hmacInput(&context, &c, 1) ||
+          hmacResult(&context, T);
+    if (ret != shaSuccess) break;
     memcpy(okm + where, T,
            (i != N) ? hash_len : (okm_len - where));
     where += hash_len;
     Tlen = hash_len;
   }
-  return shaSuccess;
+
+  memset(schedule, 0, sizeof(HMACKeySchedule));
+  free(schedule);
+  return ret;
 }
 
 /*
@@ -12,6 +12,7 @@
  */
 
 #include "sha.h"
+#include <string.h>
 
 /*
  *  hmac
@@ -88,6 +89,7 @@ int hmacReset(HMACContext *context, enum SHAversion whichSha,
   if (!context) return shaNull;
   context->Computed = 0;
   context->Corrupted = shaSuccess;
+  context->schedule = 0;
 
   blocksize = context->blockSize = USHABlockSize(whichSha);
   hashsize = context->hashSize = USHAHashSize(whichSha);
@@ -225,6 +227,19 @@ int hmacResult(HMACContext *context, uint8_t *digest)
   if (context->Corrupted) return context->Corrupted;
   if (context->Computed) return context->Corrupted = shaStateError;
 
+  if (context->schedule) {
+    /* finish up 1st pass, then continue from the outer state */
+    /* of the key schedule, its opad block is already hashed */
+    ret = USHAResult(&context->shaContext, digest);
+    if (ret == shaSuccess) {
+      context->shaContext = context->schedule->outerContext;
+      ret = USHAInput(&context->shaContext, digest, context->hashSize) ||
+            USHAResult(&context->shaContext, digest);
+    }
+    context->Computed = 1;
+    return context->Corrupted = ret;
+  }
+
   /* finish up 1st pass */
   /* (Use digest here as a temporary buffer.) */
   ret =
@@ -247,3 +262,113 @@ int hmacResult(HMACContext *context, uint8_t *digest)
   return context->Corrupted = ret;
 }
 
+/*
+ *  hmacKeySchedule
+ *
+ *  Description:
+ *      This function will hash the ipad and opad blocks of a key
+ *      once and keep both hash states, so that every HMAC with this
+ *      key can start from them instead of hashing the pads again.
+ *      This saves two compression function calls per message.
+ *
+ *  Parameters:
+ *      schedule: [out]
+ *          The key schedule to initialize.
+ *      whichSha: [in]
+ *          One of SHA1, SHA224, SHA256, SHA384, SHA512
+ *      key[ ]: [in]
+ *          The secret shared key.
+ *      key_len: [in]
+ *          The length of the secret shared key.
+ *
+ *  Returns:
+ *      sha Error Code.
+ *
+ */
+int hmacKeySchedule(HMACKeySchedule *schedule, enum SHAversion whichSha,
+    const unsigned char *key, int key_len)
+{
+  HMACContext context;
+  int ret;
+
+  if (!schedule) return shaNull;
+
+  ret = hmacReset(&context, whichSha, key, key_len) ||
+        USHAReset(&schedule->outerContext, whichSha) ||
+        USHAInput(&schedule->outerContext, context.k_opad,
+                  context.blockSize);
+  if (ret == shaSuccess) {
+    schedule->whichSha = whichSha;
+    schedule->hashSize = context.hashSize;
+    schedule->blockSize = context.blockSize;
+    schedule->innerContext = context.shaContext;
+  }
+
+  /* the pads are key material */
+  memset(&context, 0, sizeof(context));
+  return schedule->Corrupted = ret;
+}
+
+/*
+ *  hmacResetWithSchedule
+ *
+ *  Description:
+ *      This function will initialize the hmacContext from a key
+ *      schedule made by hmacKeySchedule(). The schedule must stay
+ *      valid until hmacResult() is called.
+ *
+ *  Parameters:
+ *      context: [in/out]
+ *          The context to reset.
+ *      schedule: [in]
+ *          The key schedule of the secret shared key.
+ *
+ *  Returns:
+ *      sha Error Code.
+ *
+ */
+int hmacResetWithSchedule(HMACContext *context,
+    const HMACKeySchedule *schedule)
+{
+  if (!context || !schedule) return shaNull;
+  if (schedule->Corrupted) return schedule->Corrupted;
+
+  context->whichSha = schedule->whichSha;
+  context->hashSize = schedule->hashSize;
+  context->blockSize = schedule->blockSize;
+  context->shaContext = schedule->innerContext;
+  context->schedule = schedule;
+  context->Computed = 0;
+  return context->Corrupted = shaSuccess;
+}
+
+/*
+ *  hmacWithSchedule
+ *
+ *  Description:
+ *      This function will compute an HMAC message digest with a key
+ *      schedule made by hmacKeySchedule().
+ *
+ *  Parameters:
+ *      schedule: [in]
+ *          The key schedule of the secret shared key.
+ *      message_array[ ]: [in]
+ *          An array of octets representing the message.
+ *      length: [in]
+ *          The length of the message in message_array.
+ *      digest[ ]: [out]
+ *          Where the digest is returned.
+ *
+ *  Returns:
+ *      sha Error Code.
+ *
+ */
+int hmacWithSchedule(const HMACKeySchedule *schedule,
+    const unsigned char *message_array, int length,
+    uint8_t digest[USHAMaxHashSize])
+{
+  HMACContext context;
+  return hmacResetWithSchedule(&context, schedule) ||
+         hmacInput(&context, message_array, length) ||
+         hmacResult(&context, digest);
+}
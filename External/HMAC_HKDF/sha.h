@@ -206,6 +206,19 @@ typedef struct USHAContext {
 
 } USHAContext;
 
+/*
+ *  This structure will hold the inner and outer hash states of an
+ *  HMAC key, i.e. the SHA contexts after the ipad and opad blocks.
+ */
+typedef struct HMACKeySchedule {
+    int whichSha;               /* which SHA is being used */
+    int hashSize;               /* hash size of SHA being used */
+    int blockSize;              /* block size of SHA being used */
+    USHAContext innerContext;   /* SHA context after K XOR ipad */
+    USHAContext outerContext;   /* SHA context after K XOR opad */
+    int Corrupted;              /* Cumulative corruption code */
+} HMACKeySchedule;
+
 /*
  *  This structure will hold context information for the HMAC
  *  keyed-hashing operation.
@@ -217,6 +230,8 @@ typedef struct HMACContext {
     USHAContext shaContext;     /* SHA context */
     unsigned char k_opad[USHA_Max_Message_Block_Size];
                         /* outer padding - key XORd with opad */
+    const HMACKeySchedule *schedule;
+                        /* precomputed key states, or 0 */
     int Computed;               /* Is the MAC computed? */
     int Corrupted;              /* Cumulative corruption code */
 
@@ -324,6 +339,19 @@ extern int hmacFinalBits(HMACContext *context, uint8_t bits,
 extern int hmacResult(HMACContext *context,
                       uint8_t digest[USHAMaxHashSize]);
 
+/*
+ * HMAC with a precomputed key schedule, for many messages
+ * authenticated with the same key.
+ */
+extern int hmacKeySchedule(HMACKeySchedule *schedule,
+                           enum SHAversion whichSha,
+                           const unsigned char *key, int key_len);
+extern int hmacResetWithSchedule(HMACContext *context,
+                                 const HMACKeySchedule *schedule);
+extern int hmacWithSchedule(const HMACKeySchedule *schedule,
+                            const unsigned char *text, int text_len,
+                            uint8_t digest[USHAMaxHashSize]);
+
 /*
  * HKDF HMAC-based Extract-and-Expand Key Derivation Function,
  * RFC 5869, for all SHAs.
@@ -0,0 +1,38 @@
+/**
+******************************************************************************
+* @file    CheckSumUtils.h
+* @author  William Xu
+* @version V1.0.0
+* @date    27-Oct-2014
+* @brief   Check sum Utilities
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+
+#ifndef __CheckSumUtils_h_
+#define __CheckSumUtils_h_
+
+#include "Common.h"
+
+
+//===========================================================================================================================
+//  CRC-32 (IEEE 802.3, the one of zip and png)
+//===========================================================================================================================
+
+/* Start with 0 and feed the data in any number of pieces, the result of the
+   last call is the CRC of the whole data. */
+uint32_t CRC32_Update( uint32_t inCRC, const void *inData, size_t inLen );
+
+#endif // __CheckSumUtils_h_
+
@@ -0,0 +1,321 @@
+/**
+******************************************************************************
+* @file    DeltaUtils.c
+* @author  William Xu
+* @version V1.0.0
+* @date    29-Oct-2014
+* @brief   This file contains the delta patch generator and patcher. The
+*          patcher reads the old image and makes the new one in small pieces,
+*          so the bootloader can apply a patch with bounded RAM.
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+#include "DeltaUtils.h"
+
+//===========================================================================================================================
+//  Delta internals
+//===========================================================================================================================
+
+#define kDeltaHashBits          16
+#define kDeltaHashSize          ( 1 << kDeltaHashBits )
+#define kDeltaHashLen           4
+#define kDeltaMaxChain          256
+#define kDeltaNoPosition        ( -1 )
+
+typedef struct
+{
+    uint8_t *       data;
+    size_t          len;
+    size_t          size;
+} delta_buffer_t;
+
+//===========================================================================================================================
+//  Delta_PatchInit
+//===========================================================================================================================
+
+void Delta_PatchInit( delta_patcher_t *inPatcher, uint32_t inOldLength, uint32_t inNewLength, uint8_t *inBuffer,
+                      size_t inBufferSize, delta_read_t inRead, delta_output_t inOutput, void *inContext )
+{
+    memset( inPatcher, 0, sizeof( delta_patcher_t ) );
+    inPatcher->oldLength  = inOldLength;
+    inPatcher->newLength  = inNewLength;
+    inPatcher->buffer     = inBuffer;
+    inPatcher->bufferSize = inBufferSize;
+    inPatcher->read       = inRead;
+    inPatcher->output     = inOutput;
+    inPatcher->context    = inContext;
+}
+
+//===========================================================================================================================
+//  _Delta_PatchControl
+//
+//  Moves the old position by the seek of the record before, then checks that the new record stays inside both images.
+//===========================================================================================================================
+
+static OSStatus _Delta_PatchControl( delta_patcher_t *inPatcher )
+{
+    int64_t         oldPos;
+    uint32_t        diffLen  = ReadLittle32( &inPatcher->control[ 0 ] );
+    uint32_t        extraLen = ReadLittle32( &inPatcher->control[ 4 ] );
+
+    oldPos = (int64_t) inPatcher->oldPos + inPatcher->seek;
+    if( oldPos < 0 || oldPos + diffLen > inPatcher->oldLength ) return( kMalformedErr );
+    if( (uint64_t) inPatcher->newPos + diffLen + extraLen > inPatcher->newLength ) return( kMalformedErr );
+
+    inPatcher->oldPos    = (uint32_t) oldPos;
+    inPatcher->diffLeft  = diffLen;
+    inPatcher->extraLeft = extraLen;
+    inPatcher->seek      = (int32_t) ReadLittle32( &inPatcher->control[ 8 ] );
+    return( kNoErr );
+}
+
+//===========================================================================================================================
+//  Delta_PatchUpdate
+//===========================================================================================================================
+
+OSStatus Delta_PatchUpdate( delta_patcher_t *inPatcher, const void *inData, size_t inLen )
+{
+    OSStatus            err;
+    const uint8_t *     src = (const uint8_t *) inData;
+    const uint8_t *     end = src + inLen;
+    size_t              len, i;
+
+    while( src < end )
+    {
+        if( inPatcher->diffLeft > 0 )
+        {
+            len = Min( (size_t)( end - src ), Min( inPatcher->diffLeft, inPatcher->bufferSize ) );
+            err = inPatcher->read( inPatcher->context, inPatcher->oldPos, inPatcher->buffer, len );
+            if( err ) return( err );
+            for( i = 0; i < len; i++ )
+                inPatcher->buffer[ i ] += src[ i ];
+            err = inPatcher->output( inPatcher->context, inPatcher->buffer, len );
+            if( err ) return( err );
+            inPatcher->oldPos   += len;
+            inPatcher->diffLeft -= len;
+        }
+        else if( inPatcher->extraLeft > 0 )
+        {
+            len = Min( (size_t)( end - src ), inPatcher->extraLeft );
+            err = inPatcher->output( inPatcher->context, src, len );
+            if( err ) return( err );
+            inPatcher->extraLeft -= len;
+        }
+        else
+        {
+            len = Min( (size_t)( end - src ), (size_t)( kDeltaControlSize - inPatcher->controlLen ) );
+            memcpy( &inPatcher->control[ inPatcher->controlLen ], src, len );
+            inPatcher->controlLen += len;
+            src += len;
+            if( inPatcher->controlLen < kDeltaControlSize ) continue;
+
+            inPatcher->controlLen = 0;
+            err = _Delta_PatchControl( inPatcher );
+            if( err ) return( err );
+            continue;
+        }
+        inPatcher->newPos += len;
+        src += len;
+    }
+    return( kNoErr );
+}
+
+//===========================================================================================================================
+//  Delta_PatchFinal
+//===========================================================================================================================
+
+OSStatus Delta_PatchFinal( delta_patcher_t *inPatcher )
+{
+    if( inPatcher->controlLen || inPatcher->diffLeft || inPatcher->extraLeft ) return( kUnderrunErr );
+    if( inPatcher->newPos != inPatcher->newLength ) return( kUnderrunErr );
+    return( kNoErr );
+}
+
+//===========================================================================================================================
+//  Delta_Diff
+//
+//  The scan is the one of bsdiff: an exact match found in the old image is stretched forwards and backwards as long as
+//  more than half of the bytes agree, the bytes that differ go out as small diff bytes, and what is left in between
+//  goes out as extra bytes. Code that moved keeps most of its bytes, so the diff bytes are mostly zero and pack well.
+//  Exact matches come from hash chains over four byte prefixes instead of a suffix array.
+//===========================================================================================================================
+
+static uint32_t _Delta_Hash( const uint8_t *inPtr )
+{
+    return( ( ReadLittle32( inPtr ) * 2654435761U ) >> ( 32 - kDeltaHashBits ) );
+}
+
+static int32_t _Delta_Search( const uint8_t *inOld, int32_t inOldLen, const int32_t *inHead, const int32_t *inPrev,
+                              const uint8_t *inNew, int32_t inNewLen, int32_t *outPos )
+{
+    int32_t         candidate, chain, len, maxLen;
+    int32_t         bestLen = 0;
+
+    if( inNewLen < kDeltaHashLen ) return( 0 );
+
+    candidate = inHead[ _Delta_Hash( inNew ) ];
+    for( chain = 0; chain < kDeltaMaxChain && candidate != kDeltaNoPosition; chain++ )
+    {
+        maxLen = Min( inOldLen - candidate, inNewLen );
+        if( maxLen > bestLen && inOld[ candidate + bestLen ] == inNew[ bestLen ] )
+        {
+            for( len = 0; len < maxLen && inOld[ candidate + len ] == inNew[ len ]; len++ ) {}
+            if( len > bestLen )
+            {
+                bestLen = len;
+                *outPos = candidate;
+                if( len == inNewLen ) break;
+            }
+        }
+        candidate = inPrev[ candidate ];
+    }
+    return( bestLen );
+}
+
+static uint8_t * _Delta_Reserve( delta_buffer_t *inBuffer, size_t inLen )
+{
+    uint8_t *       data;
+    size_t          size;
+
+    if( inLen > inBuffer->size - inBuffer->len )
+    {
+        size = Max( inBuffer->size * 2, inBuffer->len + inLen + 4096 );
+        data = (uint8_t *) realloc( inBuffer->data, size );
+        if( !data ) return( NULL );
+        inBuffer->data = data;
+        inBuffer->size = size;
+    }
+    data = &inBuffer->data[ inBuffer->len ];
+    inBuffer->len += inLen;
+    return( data );
+}
+
+static OSStatus _Delta_AddRecord( delta_buffer_t *inBuffer, const uint8_t *inOld, int32_t inOldPos, const uint8_t *inNew,
+                                  int32_t inNewPos, int32_t inDiffLen, int32_t inExtraLen, int32_t inSeek )
+{
+    uint8_t *       dst;
+    int32_t         i;
+
+    dst = _Delta_Reserve( inBuffer, kDeltaControlSize + inDiffLen + inExtraLen );
+    if( !dst ) return( kNoMemoryErr );
+
+    WriteLittle32( &dst[ 0 ], (uint32_t) inDiffLen );
+    WriteLittle32( &dst[ 4 ], (uint32_t) inExtraLen );
+    WriteLittle32( &dst[ 8 ], (uint32_t) inSeek );
+    dst += kDeltaControlSize;
+    for( i = 0; i < inDiffLen; i++ )
+        *dst++ = (uint8_t)( inNew[ inNewPos + i ] - inOld[ inOldPos + i ] );
+    memcpy( dst, &inNew[ inNewPos + inDiffLen ], inExtraLen );
+    return( kNoErr );
+}
+
+OSStatus Delta_Diff( const void *inOld, size_t inOldLen, const void *inNew, size_t inNewLen, uint8_t **outBody,
+                     size_t *outBodyLen )
+{
+    OSStatus            err      = kNoErr;
+    const uint8_t *     oldImage = (const uint8_t *) inOld;
+    const uint8_t *     newImage = (const uint8_t *) inNew;
+    int32_t             oldLen   = (int32_t) inOldLen;
+    int32_t             newLen   = (int32_t) inNewLen;
+    int32_t *           head     = NULL;
+    int32_t *           prev     = NULL;
+    delta_buffer_t      body     = { NULL, 0, 0 };
+    int32_t             scan = 0, len = 0, pos = 0, lastScan = 0, lastPos = 0, lastOffset = 0;
+    int32_t             oldScore, scsc, s, sf, lenf, sb, lenb, ss, lens, overlap, i;
+    uint32_t            hash;
+
+    if( inOldLen >= 0x7FFFFFFF || inNewLen >= 0x7FFFFFFF ) { err = kSizeErr; goto exit; }
+    head = (int32_t *) malloc( kDeltaHashSize * sizeof( int32_t ) );
+    prev = (int32_t *) malloc( ( inOldLen + 1 ) * sizeof( int32_t ) );
+    if( !head || !prev ) { err = kNoMemoryErr; goto exit; }
+    for( i = 0; i < kDeltaHashSize; i++ ) head[ i ] = kDeltaNoPosition;
+    for( i = 0; i + kDeltaHashLen <= oldLen; i++ )
+    {
+        hash      = _Delta_Hash( &oldImage[ i ] );
+        prev[ i ] = head[ hash ];
+        head[ hash ] = i;
+    }
+
+    while( scan < newLen )
+    {
+        // Look for a match that beats the old image at the current offset by more than 8 bytes.
+
+        oldScore = 0;
+        for( scsc = scan += len; scan < newLen; scan++ )
+        {
+            len = _Delta_Search( oldImage, oldLen, head, prev, &newImage[ scan ], newLen - scan, &pos );
+            for( ; scsc < scan + len; scsc++ )
+                if( scsc + lastOffset < oldLen && oldImage[ scsc + lastOffset ] == newImage[ scsc ] ) oldScore++;
+            if( ( len == oldScore && len != 0 ) || len > oldScore + 8 ) break;
+            if( scan + lastOffset < oldLen && oldImage[ scan + lastOffset ] == newImage[ scan ] ) oldScore--;
+        }
+        if( len == oldScore && scan != newLen ) continue;
+
+        // Stretch the last match forwards and the new one backwards.
+
+        s = 0; sf = 0; lenf = 0;
+        for( i = 0; lastScan + i < scan && lastPos + i < oldLen; )
+        {
+            if( oldImage[ lastPos + i ] == newImage[ lastScan + i ] ) s++;
+            i++;
+            if( s * 2 - i > sf * 2 - lenf ) { sf = s; lenf = i; }
+        }
+
+        lenb = 0;
+        if( scan < newLen )
+        {
+            s = 0; sb = 0;
+            for( i = 1; scan >= lastScan + i && pos >= i; i++ )
+            {
+                if( oldImage[ pos - i ] == newImage[ scan - i ] ) s++;
+                if( s * 2 - i > sb * 2 - lenb ) { sb = s; lenb = i; }
+            }
+        }
+
+        // Split an overlap where the two agree best.
+
+        if( lastScan + lenf > scan - lenb )
+        {
+            overlap = ( lastScan + lenf ) - ( scan - lenb );
+            s = 0; ss = 0; lens = 0;
+            for( i = 0; i < overlap; i++ )
+            {
+                if( newImage[ lastScan + lenf - overlap + i ] == oldImage[ lastPos + lenf - overlap + i ] ) s++;
+                if( newImage[ scan - lenb + i ] == oldImage[ pos - lenb + i ] ) s--;
+                if( s > ss ) { ss = s; lens = i + 1; }
+            }
+            lenf += lens - overlap;
+            lenb -= lens;
+        }
+
+        err = _Delta_AddRecord( &body, oldImage, lastPos, newImage, lastScan, lenf, ( scan - lenb ) - ( lastScan + lenf ),
+                                ( pos - lenb ) - ( lastPos + lenf ) );
+        if( err ) goto exit;
+
+        lastScan   = scan - lenb;
+        lastPos    = pos - lenb;
+        lastOffset = pos - scan;
+    }
+
+    *outBody    = body.data;
+    *outBodyLen = body.len;
+    body.data   = NULL;
+
+exit:
+    if( head ) free( head );
+    if( prev ) free( prev );
+    if( body.data ) free( body.data );
+    return( err );
+}
+
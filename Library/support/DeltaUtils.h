@@ -0,0 +1,101 @@
+/**
+******************************************************************************
+* @file    DeltaUtils.h
+* @author  William Xu
+* @version V1.0.0
+* @date    29-Oct-2014
+* @brief   Binary delta Utilities, used for OTA patches against the running image
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+
+#ifndef __DeltaUtils_h_
+#define __DeltaUtils_h_
+
+#include "Common.h"
+
+//===========================================================================================================================
+//  Delta patch
+//
+//  A patch is a delta_patch_header_t followed by the body packed as LZ tokens (see LZUtils.h). The body is a list of
+//  records, each one starts with three little endian 32 bit words:
+//
+//      diff length     Bytes made by adding the diff bytes to the old image, from the current old position
+//      extra length    Bytes copied as they are
+//      seek            Signed step of the old position once the diff bytes are used
+//
+//  followed by the diff bytes and the extra bytes. The old position starts at 0.
+//===========================================================================================================================
+
+#define kDeltaPatchMagic        0x3150444D  // "MDP1"
+#define kDeltaControlSize       12
+
+typedef struct
+{
+    uint32_t        magic;          // kDeltaPatchMagic
+    uint32_t        oldLength;      // Length of the image the patch applies to
+    uint32_t        oldCRC;         // CRC32_Update() of that image
+    uint32_t        newLength;      // Length of the image the patch makes
+    uint32_t        newCRC;         // CRC32_Update() of that image
+    uint32_t        packedLength;   // Length of the LZ tokens after this header
+} delta_patch_header_t;
+
+//===========================================================================================================================
+//  Patcher
+//===========================================================================================================================
+
+/* Reads the old image, the range is always inside oldLength */
+typedef OSStatus ( *delta_read_t )( void *inContext, uint32_t inOffset, uint8_t *outData, size_t inLen );
+
+/* Receives the new image in order */
+typedef OSStatus ( *delta_output_t )( void *inContext, const uint8_t *inData, size_t inLen );
+
+typedef struct
+{
+    uint32_t        oldLength;
+    uint32_t        newLength;
+    uint32_t        oldPos;
+    uint32_t        newPos;
+    uint32_t        diffLeft;
+    uint32_t        extraLeft;
+    int32_t         seek;           // Applied when the next record starts
+    uint8_t         control[ kDeltaControlSize ];
+    uint8_t         controlLen;
+    uint8_t *       buffer;         // Old bytes are read and patched here
+    size_t          bufferSize;
+    delta_read_t    read;
+    delta_output_t  output;
+    void *          context;
+} delta_patcher_t;
+
+void     Delta_PatchInit  ( delta_patcher_t *inPatcher, uint32_t inOldLength, uint32_t inNewLength, uint8_t *inBuffer,
+                            size_t inBufferSize, delta_read_t inRead, delta_output_t inOutput, void *inContext );
+
+/* Takes the body as it is decoded, records can be split anywhere between calls */
+OSStatus Delta_PatchUpdate( delta_patcher_t *inPatcher, const void *inData, size_t inLen );
+
+/* Fails if the body stops inside a record or does not make newLength bytes */
+OSStatus Delta_PatchFinal ( delta_patcher_t *inPatcher );
+
+//===========================================================================================================================
+//  Diff
+//===========================================================================================================================
+
+/* Makes the body from two whole images, *outBody is malloc'ed and freed by the caller. Needs about 4 times the old
+   length plus the body of heap. */
+OSStatus Delta_Diff( const void *inOld, size_t inOldLen, const void *inNew, size_t inNewLen, uint8_t **outBody,
+                     size_t *outBodyLen );
+
+#endif // __DeltaUtils_h_
+
@@ -29,6 +29,7 @@
 #include <stdarg.h>
 
 #include "StringUtils.h"
+#include "OTAUtils.h"
 
 #define kCRLFNewLine     "\r\n"
 #define kCRLFLineEnding  "\r\n\r\n"
@@ -36,7 +37,66 @@
 #define http_utils_log(M, ...) custom_log("HTTPUtils", M, ##__VA_ARGS__)
 
 #ifdef MICO_FLASH_FOR_UPDATE
-static volatile uint32_t flashStorageAddress = UPDATE_START_ADDRESS;
+static ota_session_t httpOTASession;
+static md5_context   httpOTAHash;
+
+/* The image ID is its MD5 in 32 hex digits, quoted or not */
+static bool _HTTPGetOTAImageID( HTTPHeader_t *inHeader, const char *inName, uint8_t *outID )
+{
+  const char *    value;
+  size_t          valueSize;
+
+  if( HTTPGetHeaderField( inHeader->buf, inHeader->len, inName, NULL, NULL, &value, &valueSize, NULL ) != kNoErr )
+    return false;
+  if( valueSize >= 2 && value[0] == '"' && value[valueSize-1] == '"' ){
+    value++;
+    valueSize -= 2;
+  }
+  if( valueSize != 32 ) return false;
+  return TextToHardwareAddress( value, valueSize, 16, outID ) == kNoErr;
+}
+
+/* A message with "Content-Range: bytes first-last/total" continues the session of the image named by ETag or
+   If-Match at first, any other one starts a new session. */
+static OSStatus _HTTPOTASessionOpen( HTTPHeader_t *inHeader )
+{
+  OSStatus        err;
+  uint32_t        first, last, total;
+  uint8_t         id[ 16 ];
+  bool            hasID;
+
+  if( HTTPScanFHeaderValue( inHeader->buf, inHeader->len, "Content-Range", "bytes %u-%u/%u", &first, &last, &total ) == 3 ){
+    require_action( first <= last && last < total && last - first + 1 == inHeader->contentLength, exit, err = kRangeErr );
+  }else{
+    first = 0;
+    total = (uint32_t)inHeader->contentLength;
+  }
+
+  hasID = _HTTPGetOTAImageID( inHeader, "ETag", id ) || _HTTPGetOTAImageID( inHeader, "If-Match", id );
+  err = OTASessionOpen( &httpOTASession, total, hasID? id : NULL, first > 0, &httpOTAHash );
+  require_noerr( err, exit );
+  require_action( httpOTASession.offset == first, exit, err = kRangeErr );
+
+exit:
+  return err;
+}
+
+static OSStatus _HTTPOTASessionWrite( const uint8_t *inData, size_t inLen )
+{
+  OSStatus err;
+
+  err = OTASessionWrite( &httpOTASession, inData, inLen );
+  require_noerr( err, exit );
+  Md5Update( &httpOTAHash, (unsigned char *)inData, inLen );
+
+  if( httpOTASession.offset == httpOTASession.length )
+    err = OTASessionFinish( &httpOTASession, &httpOTAHash );
+  else if( httpOTASession.offset >= httpOTASession.nextCheckpoint )
+    err = OTASessionCheckpoint( &httpOTASession, &httpOTAHash );
+
+exit:
+  return err;
+}
 #endif
 
 int SocketReadHTTPHeader( int inSock, HTTPHeader_t *inHeader )
@@ -85,10 +145,13 @@ int SocketReadHTTPHeader( int inSock, HTTPHeader_t *inHeader )
   if(err == kNoErr && strnicmpx( value, valueSize, kMIMEType_MXCHIP_OTA ) == 0){
 #ifdef MICO_FLASH_FOR_UPDATE  
     http_utils_log("Receive OTA data!");        
-    err = MicoFlashInitialize( MICO_FLASH_FOR_UPDATE );
-    require_noerr(err, exit);
-    err = MicoFlashWrite(MICO_FLASH_FOR_UPDATE, &flashStorageAddress, (uint8_t *)end, inHeader->extraDataLen);
+    err = _HTTPOTASessionOpen( inHeader );
     require_noerr(err, exit);
+    if(inHeader->extraDataLen > inHeader->contentLength) inHeader->extraDataLen = (size_t)inHeader->contentLength;
+    if(inHeader->extraDataLen){
+      err = _HTTPOTASessionWrite( (uint8_t *)end, inHeader->extraDataLen );
+      require_noerr(err, exit);
+    }
 #else
     http_utils_log("OTA flash memory is not existed!");
     err = kUnsupportedErr;
@@ -308,7 +371,7 @@ OSStatus SocketReadHTTPBody( int inSock, HTTPHeader_t *inHeader )
       if( readResult  > 0 ) inHeader->extraDataLen += readResult;
       else { err = kConnectionErr; goto exit; }
       
-      err = MicoFlashWrite(MICO_FLASH_FOR_UPDATE, &flashStorageAddress, (uint8_t *)inHeader->otaDataPtr, readResult);
+      err = _HTTPOTASessionWrite( (uint8_t *)inHeader->otaDataPtr, readResult );
       require_noerr(err, exit);
       
       free(inHeader->otaDataPtr);
@@ -731,6 +794,38 @@ exit:
 
 
 
+OSStatus CreateHTTPOTAStatusMessage( uint8_t **outMessage, size_t *outMessageSize )
+{
+  OSStatus err = kNoMemoryErr;
+  char *dst;
+#ifdef MICO_FLASH_FOR_UPDATE
+  uint32_t length, offset;
+  uint8_t id[16];
+  int i;
+#endif
+
+  *outMessage = malloc( 200 );
+  require( *outMessage, exit );
+  dst = (char*)*outMessage;
+
+  dst += sprintf( dst, "%s %s %s%s", "HTTP/1.1", "200", "OK", kCRLFNewLine );
+#ifdef MICO_FLASH_FOR_UPDATE
+  if( OTASessionQuery( &length, id, &offset ) == kNoErr ){
+    dst += sprintf( dst, "ETag: \"" );
+    for( i = 0; i < 16; i++ ) dst += sprintf( dst, "%02x", id[i] );
+    dst += sprintf( dst, "\"%s", kCRLFNewLine );
+    if( offset ) dst += sprintf( dst, "Range: bytes=0-%u%s", (unsigned int)( offset - 1 ), kCRLFNewLine );
+  }
+#endif
+  sprintf( dst, "%s %d%s", "Content-Length:", 0, kCRLFLineEnding );
+  *outMessageSize = strlen( (char*)*outMessage );
+
+  err = kNoErr;
+
+exit:
+  return err;
+}
+
 OSStatus CreateSimpleHTTPMessage( const char *contentType, uint8_t *inData, size_t inDataLen, uint8_t **outMessage, size_t *outMessageSize )
 {
   uint8_t *endOfHTTPHeader;  
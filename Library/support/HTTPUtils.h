@@ -150,6 +150,9 @@ void HTTPHeaderClear( HTTPHeader_t *inHeader );
 
 int CreateSimpleHTTPOKMessage( uint8_t **outMessage, size_t *outMessageSize );
 
+/* 200 OK with the OTA session in flash: ETag is the MD5 of the image, Range the bytes already received */
+OSStatus CreateHTTPOTAStatusMessage( uint8_t **outMessage, size_t *outMessageSize );
+
 OSStatus CreateSimpleHTTPMessage      ( const char *contentType, uint8_t *inData, size_t inDataLen, uint8_t **outMessage, size_t *outMessageSize );
 OSStatus CreateSimpleHTTPMessageNoCopy( const char *contentType, size_t inDataLen, uint8_t **outMessage, size_t *outMessageSize );
 
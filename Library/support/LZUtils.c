@@ -0,0 +1,290 @@
+/**
+******************************************************************************
+* @file    LZUtils.c
+* @author  William Xu
+* @version V1.0.0
+* @date    27-Oct-2014
+* @brief   This file contains the LZ stream encoder and decoder. The decoder
+*          works in a fixed window, so the bootloader can decompress an OTA
+*          image while it programs it.
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+#include "LZUtils.h"
+
+//===========================================================================================================================
+//  LZ internals
+//===========================================================================================================================
+
+#define kLZWindowMask           ( kLZWindowSize - 1 )
+#define kLZMaxDistance          ( kLZWindowSize - 1 )
+#define kLZExtendCode           15
+
+#define kLZHashBits             13
+#define kLZHashSize             ( 1 << kLZHashBits )
+#define kLZMaxChain             128
+#define kLZNoPosition           0xFFFFFFFFU
+
+enum
+{
+    kLZStateFlags,
+    kLZStateToken,
+    kLZStateMatch,
+    kLZStateExtend
+};
+
+//===========================================================================================================================
+//  LZ_DecodeInit
+//===========================================================================================================================
+
+void LZ_DecodeInit( lz_decoder_t *inDecoder, uint8_t *inWindow, lz_output_t inOutput, void *inContext )
+{
+    memset( inDecoder, 0, sizeof( lz_decoder_t ) );
+    inDecoder->window  = inWindow;
+    inDecoder->output  = inOutput;
+    inDecoder->context = inContext;
+    inDecoder->state   = kLZStateFlags;
+}
+
+//===========================================================================================================================
+//  _LZ_DecodeCopy
+//
+//  Appends a match byte by byte, the source may overlap what is being written. The window is handed out whenever it is
+//  full, the bytes a match can still reach stay in it until they are overwritten.
+//===========================================================================================================================
+
+static OSStatus _LZ_DecodeCopy( lz_decoder_t *inDecoder, uint32_t inLen )
+{
+    OSStatus        err;
+    uint8_t *       window  = inDecoder->window;
+    uint32_t        pos     = inDecoder->outLength;
+    uint32_t        src     = pos - inDecoder->distance;
+
+    if( inDecoder->distance == 0 || inDecoder->distance > pos ) return( kMalformedErr );
+
+    while( inLen-- > 0 )
+    {
+        window[ pos & kLZWindowMask ] = window[ src++ & kLZWindowMask ];
+        if( ( ++pos & kLZWindowMask ) == 0 )
+        {
+            err = inDecoder->output( inDecoder->context, window, kLZWindowSize );
+            if( err ) return( err );
+        }
+    }
+    inDecoder->outLength = pos;
+    return( kNoErr );
+}
+
+//===========================================================================================================================
+//  LZ_DecodeUpdate
+//===========================================================================================================================
+
+OSStatus LZ_DecodeUpdate( lz_decoder_t *inDecoder, const void *inData, size_t inLen )
+{
+    OSStatus            err;
+    const uint8_t *     src = (const uint8_t *) inData;
+    const uint8_t *     end = src + inLen;
+    uint8_t             c;
+
+    while( src < end )
+    {
+        c = *src++;
+        switch( inDecoder->state )
+        {
+            case kLZStateFlags:
+                inDecoder->flags = 0x100 | c;
+                inDecoder->state = kLZStateToken;
+                continue;
+
+            case kLZStateToken:
+                if( ( inDecoder->flags & 1 ) == 0 )
+                {
+                    inDecoder->distance = c;
+                    inDecoder->state    = kLZStateMatch;
+                    continue;
+                }
+                inDecoder->window[ inDecoder->outLength & kLZWindowMask ] = c;
+                if( ( ++inDecoder->outLength & kLZWindowMask ) == 0 )
+                {
+                    err = inDecoder->output( inDecoder->context, inDecoder->window, kLZWindowSize );
+                    if( err ) return( err );
+                }
+                break;
+
+            case kLZStateMatch:
+                inDecoder->distance |= (uint16_t)( c >> 4 ) << 8;
+                if( ( c & 0x0F ) == kLZExtendCode )
+                {
+                    inDecoder->state = kLZStateExtend;
+                    continue;
+                }
+                err = _LZ_DecodeCopy( inDecoder, ( c & 0x0F ) + kLZMinMatch );
+                if( err ) return( err );
+                break;
+
+            case kLZStateExtend:
+                err = _LZ_DecodeCopy( inDecoder, kLZExtendCode + kLZMinMatch + c );
+                if( err ) return( err );
+                break;
+
+            default:
+                return( kStateErr );
+        }
+
+        // Next token, or the next flag byte when all eight are used.
+
+        inDecoder->flags >>= 1;
+        inDecoder->state = ( inDecoder->flags == 1 ) ? kLZStateFlags : kLZStateToken;
+    }
+    return( kNoErr );
+}
+
+//===========================================================================================================================
+//  LZ_DecodeFinal
+//===========================================================================================================================
+
+OSStatus LZ_DecodeFinal( lz_decoder_t *inDecoder )
+{
+    uint32_t        rest = inDecoder->outLength & kLZWindowMask;
+
+    if( inDecoder->state == kLZStateMatch || inDecoder->state == kLZStateExtend ) return( kUnderrunErr );
+    if( rest == 0 ) return( kNoErr );
+    return( inDecoder->output( inDecoder->context, inDecoder->window, rest ) );
+}
+
+//===========================================================================================================================
+//  LZ_Compress
+//
+//  Greedy parse over hash chains of three byte prefixes. When the match at the next byte is longer, the current byte
+//  goes out as a literal instead.
+//===========================================================================================================================
+
+static uint32_t _LZ_Hash( const uint8_t *inPtr )
+{
+    return( ( ( (uint32_t) inPtr[ 0 ] << 16 ) | ( (uint32_t) inPtr[ 1 ] << 8 ) | inPtr[ 2 ] ) * 2654435761U >> ( 32 - kLZHashBits ) );
+}
+
+static uint32_t _LZ_FindMatch( const uint8_t *inData, size_t inLen, uint32_t inPos, const uint32_t *inHead,
+                               const uint32_t *inPrev, uint32_t *outDistance )
+{
+    uint32_t        candidate, chain, len;
+    uint32_t        bestLen = 0;
+    uint32_t        maxLen  = (uint32_t) Min( inLen - inPos, kLZMaxMatch );
+
+    if( maxLen < kLZMinMatch ) return( 0 );
+
+    candidate = inHead[ _LZ_Hash( &inData[ inPos ] ) ];
+    for( chain = 0; chain < kLZMaxChain && candidate != kLZNoPosition; chain++ )
+    {
+        if( inPos - candidate > kLZMaxDistance ) break;
+        if( inData[ candidate + bestLen ] == inData[ inPos + bestLen ] )
+        {
+            for( len = 0; len < maxLen && inData[ candidate + len ] == inData[ inPos + len ]; len++ ) {}
+            if( len > bestLen )
+            {
+                bestLen      = len;
+                *outDistance = inPos - candidate;
+                if( len == maxLen ) break;
+            }
+        }
+        candidate = inPrev[ candidate & kLZWindowMask ];
+    }
+    return( ( bestLen >= kLZMinMatch ) ? bestLen : 0 );
+}
+
+static void _LZ_Insert( const uint8_t *inData, size_t inLen, uint32_t inPos, uint32_t *inHead, uint32_t *inPrev )
+{
+    uint32_t        hash;
+
+    if( inLen - inPos < kLZMinMatch ) return;
+    hash = _LZ_Hash( &inData[ inPos ] );
+    inPrev[ inPos & kLZWindowMask ] = inHead[ hash ];
+    inHead[ hash ] = inPos;
+}
+
+OSStatus LZ_Compress( const void *inData, size_t inLen, void *outBuf, size_t inBufSize, size_t *outLen )
+{
+    OSStatus            err     = kNoErr;
+    const uint8_t *     src     = (const uint8_t *) inData;
+    uint8_t *           dst     = (uint8_t *) outBuf;
+    uint8_t *           flagPtr = NULL;
+    uint8_t             flagBit = 0;
+    size_t              out     = 0;
+    uint32_t            pos     = 0;
+    uint32_t            len, nextLen, distance, nextDistance, i;
+    uint32_t *          head    = NULL;
+    uint32_t *          prev    = NULL;
+
+    head = (uint32_t *) malloc( kLZHashSize * sizeof( uint32_t ) );
+    prev = (uint32_t *) malloc( kLZWindowSize * sizeof( uint32_t ) );
+    if( !head || !prev ) { err = kNoMemoryErr; goto exit; }
+    memset( head, 0xFF, kLZHashSize * sizeof( uint32_t ) );
+
+    while( pos < inLen )
+    {
+        // Every eighth token starts with a flag byte, the worst token is three bytes.
+
+        if( flagBit == 0 )
+        {
+            if( out + 1 + 8 * 3 > inBufSize ) { err = kNoSpaceErr; goto exit; }
+            flagPtr  = &dst[ out++ ];
+            *flagPtr = 0;
+            flagBit  = 1;
+        }
+
+        distance = 0;
+        len = _LZ_FindMatch( src, inLen, pos, head, prev, &distance );
+        if( len > 0 && len < kLZMaxMatch )
+        {
+            _LZ_Insert( src, inLen, pos, head, prev );
+            nextLen = _LZ_FindMatch( src, inLen, pos + 1, head, prev, &nextDistance );
+            if( nextLen > len + 1 ) len = 0;
+        }
+        else
+        {
+            _LZ_Insert( src, inLen, pos, head, prev );
+        }
+
+        if( len == 0 )
+        {
+            *flagPtr |= flagBit;
+            dst[ out++ ] = src[ pos++ ];
+        }
+        else
+        {
+            if( len - kLZMinMatch < kLZExtendCode )
+            {
+                dst[ out++ ] = (uint8_t)( distance & 0xFF );
+                dst[ out++ ] = (uint8_t)( ( ( distance >> 8 ) << 4 ) | ( len - kLZMinMatch ) );
+            }
+            else
+            {
+                dst[ out++ ] = (uint8_t)( distance & 0xFF );
+                dst[ out++ ] = (uint8_t)( ( ( distance >> 8 ) << 4 ) | kLZExtendCode );
+                dst[ out++ ] = (uint8_t)( len - kLZExtendCode - kLZMinMatch );
+            }
+            for( i = 1; i < len; i++ )
+                _LZ_Insert( src, inLen, pos + i, head, prev );
+            pos += len;
+        }
+        flagBit <<= 1;
+    }
+    *outLen = out;
+
+exit:
+    if( head ) free( head );
+    if( prev ) free( prev );
+    return( err );
+}
+
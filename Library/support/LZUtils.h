@@ -0,0 +1,88 @@
+/**
+******************************************************************************
+* @file    LZUtils.h
+* @author  William Xu
+* @version V1.0.0
+* @date    27-Oct-2014
+* @brief   LZ compression Utilities, used for compressed OTA images
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+
+#ifndef __LZUtils_h_
+#define __LZUtils_h_
+
+#include "Common.h"
+
+//===========================================================================================================================
+//  LZ stream
+//
+//  An LZ stream is an lz_stream_header_t followed by tokens. The tokens come in groups of eight behind a flag byte, bit 0
+//  of the flag byte describes the first token. A set bit is a literal byte. A clear bit is a match of two bytes:
+//
+//      byte 0: distance bits 0-7
+//      byte 1: distance bits 8-11 in the high nibble, length - 3 in the low nibble
+//
+//  The distance is 1 to 4095 bytes back. A length nibble of 15 is followed by one more byte, the match is then 18 plus
+//  that byte long. The decoder only keeps the last kLZWindowSize bytes of output.
+//===========================================================================================================================
+
+#define kLZStreamMagic          0x315A4C4D  // "MLZ1"
+#define kLZWindowSize           4096
+#define kLZMinMatch             3
+#define kLZMaxMatch             ( 18 + 255 )
+
+typedef struct
+{
+    uint32_t        magic;          // kLZStreamMagic
+    uint32_t        length;         // Length of the data once decompressed
+    uint32_t        crc;            // CRC32_Update() of the data once decompressed
+    uint32_t        packedLength;   // Length of the tokens after this header
+} lz_stream_header_t;
+
+//===========================================================================================================================
+//  Decoder
+//===========================================================================================================================
+
+/* Receives the output every time the window is full, and the rest from LZ_DecodeFinal */
+typedef OSStatus ( *lz_output_t )( void *inContext, const uint8_t *inData, size_t inLen );
+
+typedef struct
+{
+    uint8_t *       window;         // kLZWindowSize bytes, also the output buffer
+    uint32_t        outLength;      // Bytes decoded so far
+    uint16_t        flags;          // Flag bits left, above a guard bit
+    uint16_t        distance;
+    uint8_t         state;
+    lz_output_t     output;
+    void *          context;
+} lz_decoder_t;
+
+void     LZ_DecodeInit  ( lz_decoder_t *inDecoder, uint8_t *inWindow, lz_output_t inOutput, void *inContext );
+
+/* Tokens can be split anywhere between calls */
+OSStatus LZ_DecodeUpdate( lz_decoder_t *inDecoder, const void *inData, size_t inLen );
+
+/* Hands the last part of the window to the output, fails if the stream stops inside a token */
+OSStatus LZ_DecodeFinal ( lz_decoder_t *inDecoder );
+
+//===========================================================================================================================
+//  Encoder
+//===========================================================================================================================
+
+/* Compresses a whole buffer into tokens, without the header. Needs about 48 KB of heap. */
+OSStatus LZ_Compress( const void *inData, size_t inLen, void *outBuf, size_t inBufSize, size_t *outLen );
+
+#endif // __LZUtils_h_
+
@@ -31,7 +31,11 @@ typedef struct
   char* service_name;
   char* txt_att;
   uint16_t	port;
-  char	instance_name_suffix[4]; // This variable should only be modified by the DNS-SD library
+  uint32_t hostname_hash;       // dns_hash_string() of the names, names in queries are hashed the same way
+  uint32_t instance_name_hash;
+  uint32_t service_name_hash;
+  uint8_t  host_index;          // First service with the same host name, the A record is its one
+  uint8_t  type_index;          // First service with the same service name, the service list PTR is its one
 } dns_sd_service_record_t;
 
 static WiFi_Interface _interface;
@@ -63,24 +67,80 @@ static int _bonjour_announce = 0;
 #define mdns_utils_log_trace() custom_log_trace("mDNS Utils")
 //#endif
 
-static dns_sd_service_record_t*   available_services	= NULL;
+#define MDNS_MAX_SERVICES                  6
+
+static dns_sd_service_record_t   available_services[MDNS_MAX_SERVICES];
 static uint8_t	available_service_count;
+static uint32_t service_query_hash;
+
+/* Every record is one bit, five for each service. A response is the set of its answers and the set of its
+   additional records. */
+#define MDNS_RECORD_SERVICE_LIST_PTR(b)    ( 0x00000001UL << ( 5 * (b) ) )
+#define MDNS_RECORD_SERVICE_PTR(b)         ( 0x00000002UL << ( 5 * (b) ) )
+#define MDNS_RECORD_SERVICE_TXT(b)         ( 0x00000004UL << ( 5 * (b) ) )
+#define MDNS_RECORD_SERVICE_SRV(b)         ( 0x00000008UL << ( 5 * (b) ) )
+#define MDNS_RECORD_HOST_A(b)              ( 0x00000010UL << ( 5 * (b) ) )
+#define MDNS_RECORD_COUNT                  ( 5 * MDNS_MAX_SERVICES )
+#define MDNS_SHARED_RECORDS                0x06318C63   // The PTR records, other responders may have some of the same
+#define MDNS_HOST_RECORDS                  0x21084210
+
+/* The A record of the host name of service b */
+#define MDNS_RECORD_HOST(b)                MDNS_RECORD_HOST_A( available_services[b].host_index )
+
+#define DNS_NAME_HASH_INIT                 2166136261UL
+#define DNS_MAX_NAME_LENGTH                255
+
+#define MDNS_MESSAGE_SIZE                  1460
+#define MDNS_CACHED_MESSAGE_COUNT          4
+#define MDNS_SERVICE_TTL                   1500
+#define MDNS_HOST_TTL                      300
+
+/* RFC 6762 section 6 */
+#define MDNS_SHARED_DELAY_MIN              20
+#define MDNS_SHARED_DELAY_RANGE            100
+#define MDNS_RATE_LIMIT                    1000
+
+typedef struct
+{
+  uint32_t answers;
+  uint32_t additionals;
+  dns_message_iterator_t message;
+} mdns_cached_message_t;
+
+/* Responses are encoded once and sent as they are, until a record or the IP address changes */
+static mdns_cached_message_t cached_messages[MDNS_CACHED_MESSAGE_COUNT];
+static uint8_t cached_message_next;   // Replaced when a response that is not cached is needed
+static uint32_t cached_ip;            // 0 until it is read again
+
+/* Answers to shared records wait a random time, answers to other queries in it go in the same response */
+static uint32_t pending_answers;
+static uint32_t pending_additionals;
+static uint32_t pending_time;
+static uint32_t record_sent_time[MDNS_RECORD_COUNT];   // 0 if the record was not multicast since it changed
+static bonjour_statistics_t statistics;
 
 static int dns_get_next_question( dns_message_iterator_t* iter, dns_question_t* q, dns_name_t* name );
-static int dns_compare_name_to_string( dns_name_t* name, const char* string, const char* fun, const int line );
+static int dns_compare_name_to_string( dns_name_t* name, const char* string );
+static uint32_t dns_hash_name( dns_name_t* name );
 static int dns_create_message( dns_message_iterator_t* message, uint16_t size );
 static void dns_write_header( dns_message_iterator_t* iter, uint16_t id, uint16_t flags, uint16_t question_count, uint16_t answer_count, uint16_t authorative_count );
-static void dns_write_record( dns_message_iterator_t* iter, const char* name, uint16_t record_class, uint16_t record_type, uint32_t ttl, uint8_t* rdata );
+static int dns_write_record( dns_message_iterator_t* iter, const char* name, uint16_t record_class, uint16_t record_type, uint32_t ttl, uint8_t* rdata );
 static void mdns_send_message(int fd, dns_message_iterator_t* message );
 static void dns_free_message( dns_message_iterator_t* message );
-static void mdns_process_query(int fd, dns_name_t* name, dns_question_t* question, dns_message_iterator_t* source );
-static void dns_write_record( dns_message_iterator_t* iter, const char* name, uint16_t record_class, uint16_t record_type, uint32_t ttl, uint8_t* rdata );
+static uint32_t mdns_answer_question( dns_name_t* name, dns_question_t* question );
 static void dns_write_uint16( dns_message_iterator_t* iter, uint16_t data );
 static void dns_write_uint32( dns_message_iterator_t* iter, uint32_t data );
 static void dns_write_bytes( dns_message_iterator_t* iter, uint8_t* data, uint16_t length );
 static uint16_t dns_read_uint16( dns_message_iterator_t* iter );
 static void dns_skip_name( dns_message_iterator_t* iter );
 static void dns_write_name( dns_message_iterator_t* iter, const char* src );
+static void dns_trim_message( dns_message_iterator_t* message );
+static int mdns_write_message( dns_message_iterator_t* message, uint32_t answers, uint32_t additionals, bool goodbye );
+static dns_message_iterator_t* mdns_get_message( uint32_t answers, uint32_t additionals );
+static void mdns_clear_cached_messages( void );
+static uint32_t mdns_get_ip( void );
+static uint32_t mdns_read_record( dns_message_iterator_t* iter, uint32_t* ttl );
+static void mdns_send_records( int fd, uint32_t answers, uint32_t additionals, uint16_t id );
 
 static mico_mutex_t bonjour_mutex = NULL;
 static mico_thread_t mfi_bonjour_thread_handler;
@@ -94,9 +154,6 @@ static char *__strdup(char *src)
   if (src == NULL)
     return NULL;
   
-  if (src[0] == 0)
-    return NULL;
-  
   len = strlen(src) + 1;
   dst = (char*)malloc(len);
   if (dst) 
@@ -108,108 +165,156 @@ void process_dns_questions(int fd, dns_message_iterator_t* iter )
 {
   dns_name_t name;
   dns_question_t question;
-  dns_message_iterator_t response;
-  IPStatusTypedef para;
+  uint32_t answers = 0;
+  uint32_t additionals = 0;
+  uint32_t known = 0;
+  uint32_t record, ttl;
   int a = 0;
-  int question_processed;
-  uint32_t myip;
+  int b = 0;
+  uint8_t delay;
   
-  micoWlanGetIPStatus(&para, _interface);
-  myip = htonl(inet_addr(para.ip));
-  if(myip == 0) {
+  if ( available_service_count == 0 )
+    return;
+  if ( mdns_get_ip( ) == 0 ){
     _debug_out("UDP multicast test: IP error.\r\n");
     return;
   }
   
-  memset( &response, 0, sizeof(dns_message_iterator_t) );
-  
   for ( a = 0; a < htons(iter->header->question_count); ++a )
   {
     if (iter->iter > iter->end)
       break;
     if(dns_get_next_question( iter, &question, &name )==0)
+      return;
+    answers |= mdns_answer_question( &name, &question );
+  }
+  
+  if ( answers == 0 ){
+    _debug_out("UDP multicast test: Request not for us.\r\n");
+    return;
+  }
+  
+  // The answer section lists what the querier knows already, see RFC 6762 section 7.1
+  for ( a = 0; a < htons(iter->header->answer_count); ++a )
+  {
+    record = mdns_read_record( iter, &ttl );
+    if (iter->iter > iter->end)
       break;
-    question_processed = 0;
-    switch ( question.question_type ){
-    case RR_TYPE_PTR:
-      if ( available_services != NULL ){
-        // Check if its a query for all available services  
-        if ( dns_compare_name_to_string( &name, MFi_SERVICE_QUERY_NAME, __FUNCTION__, __LINE__ ) ){
-          int b = 0;
-          _debug_out("UDP multicast test: Recv a SERVICE QUERY request.\r\n");
-          if(dns_create_message( &response, 512 )) {
-            dns_write_header(&response, iter->header->id, 0x8400, 0, available_service_count, 0 );          
-            for ( b = 0; b < available_service_count; ++b ){
-              dns_write_record( &response, MFi_SERVICE_QUERY_NAME, RR_CLASS_IN, RR_TYPE_PTR, 1500, (uint8_t*) available_services[b].service_name );
-            }
-            mdns_send_message(fd, &response );
-            dns_free_message( &response );
-            question_processed = 1;
-          }
-        }
-        // else check if its one of our records
-        else {
-          int b = 0;
-          for ( b = 0; b < available_service_count; ++b ){
-            //printf("UDP multicast test: Recv a SERVICE Detail request: %s.\r\n", name);
-            if ( dns_compare_name_to_string( &name, available_services[b].service_name, __FUNCTION__, __LINE__ )){
-              // Send the PTR, TXT, SRV and A records
-              if(dns_create_message( &response, 512 )){
-                dns_write_header( &response, iter->header->id, 0x8400, 0, 4, 0 );
-                //dns_write_record( &response, MFi_SERVICE_QUERY_NAME, RR_CLASS_IN, RR_TYPE_PTR, 1500, (u8*) available_services[b].service_name );
-                dns_write_record( &response, available_services[b].service_name, RR_CLASS_IN, RR_TYPE_PTR, 1500, (uint8_t*) available_services[b].instance_name );
-                dns_write_record( &response, available_services[b].instance_name, RR_CACHE_FLUSH|RR_CLASS_IN, RR_TYPE_TXT, 1500, (uint8_t*) available_services[b].txt_att );
-                dns_write_record( &response, available_services[b].instance_name, RR_CACHE_FLUSH|RR_CLASS_IN, RR_TYPE_SRV, 1500, (uint8_t*) &available_services[b]);
-                dns_write_record( &response, available_services[b].hostname, RR_CACHE_FLUSH|RR_CLASS_IN, RR_TYPE_A, 1500, (uint8_t*) &myip);
-                mdns_send_message(fd, &response );
-                dns_free_message( &response );
-                question_processed = 1;
-              }
-              else{
-                _debug_out("UDP multicast test: Send error.\r\n");
-              }
-            }
-          }
-        }
-      }
+    if ( ttl >= ( ( record & MDNS_HOST_RECORDS ) ? MDNS_HOST_TTL : MDNS_SERVICE_TTL ) / 2 )
+      known |= record;
+  }
+  for ( record = answers & known; record != 0; record &= record - 1 )
+    statistics.known_answers_suppressed++;
+  answers &= ~known;
+  
+  // Add what a resolver asks for next, see RFC 6763 section 12
+  for ( b = 0; b < available_service_count; ++b ){
+    if ( answers & MDNS_RECORD_SERVICE_PTR(b) )
+      additionals |= MDNS_RECORD_SERVICE_TXT(b) | MDNS_RECORD_SERVICE_SRV(b) | MDNS_RECORD_HOST(b);
+    if ( answers & MDNS_RECORD_SERVICE_SRV(b) )
+      additionals |= MDNS_RECORD_HOST(b);
+  }
+  additionals &= ~( answers | known );
+  
+  // Only we have the other records, they are answered at once
+  if ( ( answers & MDNS_SHARED_RECORDS ) == 0 ){
+    mdns_send_records( fd, answers, additionals, ntohs(iter->header->id) );
+    return;
+  }
+  
+  if ( pending_answers == 0 ){
+    MicoRandomNumberRead( &delay, 1 );
+    pending_time = mico_get_time( ) + MDNS_SHARED_DELAY_MIN + delay % ( MDNS_SHARED_DELAY_RANGE + 1 );
+  }
+  pending_answers |= answers;
+  pending_additionals |= additionals;
+}
+
+/* A response of another responder, the delayed answers it has are not sent again. See RFC 6762 section 7.4 */
+static void process_dns_answers( dns_message_iterator_t* iter )
+{
+  dns_name_t name;
+  dns_question_t question;
+  uint32_t record, ttl;
+  int a = 0;
+  
+  if ( pending_answers == 0 )
+    return;
+  
+  for ( a = 0; a < htons(iter->header->question_count); ++a )
+  {
+    if(dns_get_next_question( iter, &question, &name )==0)
+      return;
+  }
+  
+  for ( a = 0; a < htons(iter->header->answer_count); ++a )
+  {
+    record = mdns_read_record( iter, &ttl );
+    if (iter->iter > iter->end)
       break;
-    }
-    if (!question_processed ){
-      _debug_out("UDP multicast test: Recv a mDNS request.\r\n");
-      mdns_process_query(fd, &name, &question, iter);
+    if ( ( pending_answers & record ) && ttl >= ( ( record & MDNS_HOST_RECORDS ) ? MDNS_HOST_TTL : MDNS_SERVICE_TTL ) / 2 ){
+      pending_answers &= ~record;
+      statistics.duplicate_answers_suppressed++;
     }
   }
 }
 
-static void mdns_process_query(int fd, dns_name_t* name, 
-                               dns_question_t* question, dns_message_iterator_t* source )
+/* Sends the delayed answers once their time has come, returns the ms until then */
+static uint32_t mdns_send_pending( int fd )
 {
-  dns_message_iterator_t response;
-  IPStatusTypedef para;
-  uint32_t myip;
+  int32_t wait;
   
-  micoWlanGetIPStatus(&para, _interface);
-  myip = htonl(inet_addr(para.ip));
+  if ( pending_answers == 0 )
+    return MDNS_RATE_LIMIT;
   
-  memset( &response, 0, sizeof(dns_message_iterator_t) );
+  wait = (int32_t)( pending_time - mico_get_time( ) );
+  if ( wait > 0 )
+    return wait;
   
-  switch ( question->question_type )
-  {
-  case RR_QTYPE_ANY:
-  case RR_TYPE_A:
-    if ( dns_compare_name_to_string( name, available_services->hostname, __FUNCTION__, __LINE__) ){				
-      _debug_out("UDP multicast test: Recv RR_TYPE_A.\r\n");
-      if(dns_create_message( &response, 256 )){
-        dns_write_header( &response, source->header->id, 0x8400, 0, 1, 0 );
-        dns_write_record( &response, available_services->hostname, RR_CLASS_IN | RR_CACHE_FLUSH, RR_TYPE_A, 300, (uint8_t *)&myip);
-        mdns_send_message(fd, &response );
-        dns_free_message( &response );
-        return;
+  mdns_send_records( fd, pending_answers, pending_additionals & ~pending_answers, 0 );
+  pending_answers = 0;
+  pending_additionals = 0;
+  return MDNS_RATE_LIMIT;
+}
+
+/* Returns the records that answer the question */
+static uint32_t mdns_answer_question( dns_name_t* name, dns_question_t* question )
+{
+  dns_sd_service_record_t* service;
+  uint16_t type = question->question_type;
+  uint32_t hash = dns_hash_name( name );
+  uint32_t answers = 0;
+  int service_query = ( hash == service_query_hash && dns_compare_name_to_string( name, MFi_SERVICE_QUERY_NAME ) );
+  int b = 0;
+  
+  for ( b = 0; b < available_service_count; ++b ){
+    service = &available_services[b];
+    if ( type == RR_TYPE_PTR || type == RR_QTYPE_ANY ){
+      // Check if its a query for all available services, the first service of each type answers it
+      if ( service_query && service->type_index == b ){
+        _debug_out("UDP multicast test: Recv a SERVICE QUERY request.\r\n");
+        answers |= MDNS_RECORD_SERVICE_LIST_PTR(b);
       }
-    }    
-  default:
-    _debug_out("UDP multicast test: Request not support type: %d.---------------------\r\n", question->question_type);
+      else if ( hash == service->service_name_hash && dns_compare_name_to_string( name, service->service_name ) ){
+        answers |= MDNS_RECORD_SERVICE_PTR(b);
+      }
+    }
+    if ( type == RR_TYPE_TXT || type == RR_TYPE_SRV || type == RR_QTYPE_ANY ){
+      if ( hash == service->instance_name_hash && dns_compare_name_to_string( name, service->instance_name ) ){
+        if ( type != RR_TYPE_SRV )
+          answers |= MDNS_RECORD_SERVICE_TXT(b);
+        if ( type != RR_TYPE_TXT )
+          answers |= MDNS_RECORD_SERVICE_SRV(b);
+      }
+    }
+    if ( type == RR_TYPE_A || type == RR_QTYPE_ANY ){
+      if ( service->host_index == b && hash == service->hostname_hash && dns_compare_name_to_string( name, service->hostname ) ){
+        _debug_out("UDP multicast test: Recv RR_TYPE_A.\r\n");
+        answers |= MDNS_RECORD_HOST_A(b);
+      }
+    }
   }
+  return answers;
 }
 
 
@@ -218,6 +323,7 @@ static int dns_get_next_question( dns_message_iterator_t* iter, dns_question_t*
   // Set the name pointers and then skip it
   name->start_of_name   = (uint8_t*) iter->iter;
   name->start_of_packet = (uint8_t*) iter->header;
+  name->end_of_packet   = iter->end;
   dns_skip_name( iter );
   if (iter->iter > iter->end)
     return 0;
@@ -228,55 +334,241 @@ static int dns_get_next_question( dns_message_iterator_t* iter, dns_question_t*
   return 1;
 }
 
-static int dns_compare_name_to_string( dns_name_t* name, const char* string, const char* fun, int line )
+/* Checks if the bytes are what dns_write_string writes for src */
+static int dns_compare_string( uint8_t* data, uint16_t length, const char* src )
 {
-  uint8_t section_length;
-  int finished = 0;
-  int result   = 1;
-  uint8_t* buffer 	  = name->start_of_name;
-  _debug_out("UDP multicast test: CMP called by %s@%d.\r\n", fun, line );
-  char *temp;
+  uint8_t* end = data + length;
+  uint8_t* segment_length_pointer;
+  uint8_t  segment_length;
   
-  while ( !finished )
+  while ( *src != 0 )
   {
-    // Check if the name is compressed. If so, find the uncompressed version
-    while ( *buffer & 0xC0 )
+    if ( data >= end )
+      return 0;
+    segment_length_pointer = data++;
+    segment_length = 0;
+    
+    while ( *src != '.' && *src != 0 )
     {
-      uint16_t offset = ( *buffer++ ) << 8;
-      offset += *buffer;
-      offset &= 0x3FFF;
-      buffer = name->start_of_packet + offset;
-      _debug_out("UDP multicast test: Recv a compressed name.\r\n");
+      if (*src == '/')
+        src++; // skip '/'
+      
+      if ( data >= end || *data++ != (uint8_t) *src++ )
+        return 0;
+      ++segment_length;
     }
     
-    // Compare section
-    section_length = *( buffer++ );
-    temp = malloc(section_length+1);
-    temp[section_length] = 0;
-    memcpy(temp, buffer, section_length );
-    _debug_out("UDP multicast test: Recv a name: %s.\r\n", temp);
-    free(temp);
-    if ( strncmp( (char*) buffer, string, section_length ) )
+    if ( *segment_length_pointer != segment_length )
+      return 0;
+    
+    if ( *src == '.' )
     {
-      result	 = 0;
-      finished = 1;
+      ++src;
     }
-    string += section_length + 1;
-    buffer += section_length;
+  }
+  
+  return ( data + 1 == end && *data == 0 );
+}
+
+/* Reads a resource record and returns which of ours it is, 0 if it is none or its data is not ours */
+static uint32_t mdns_read_record( dns_message_iterator_t* iter, uint32_t* ttl )
+{
+  dns_name_t name;
+  dns_name_t target;
+  dns_sd_service_record_t* service;
+  uint16_t record_type;
+  uint16_t rd_length;
+  uint8_t* rdata;
+  uint32_t hash, target_hash;
+  int b = 0;
+  
+  name.start_of_name   = (uint8_t*) iter->iter;
+  name.start_of_packet = (uint8_t*) iter->header;
+  name.end_of_packet   = iter->end;
+  dns_skip_name( iter );
+  if ( iter->iter + 10 > iter->end ){
+    iter->iter = iter->end + 1;
+    return 0;
+  }
+  
+  record_type = dns_read_uint16( iter );
+  dns_read_uint16( iter );
+  *ttl = (uint32_t) dns_read_uint16( iter ) << 16;
+  *ttl += dns_read_uint16( iter );
+  rd_length = dns_read_uint16( iter );
+  rdata = iter->iter;
+  iter->iter += rd_length;
+  if ( iter->iter > iter->end )
+    return 0;
+  
+  target.start_of_name   = rdata;
+  target.start_of_packet = (uint8_t*) iter->header;
+  target.end_of_packet   = iter->end;
+  if ( record_type == RR_TYPE_SRV ){
+    if ( rd_length < 7 )
+      return 0;
+    target.start_of_name = rdata + 6;
+  }
+  hash = dns_hash_name( &name );
+  target_hash = ( record_type == RR_TYPE_PTR || record_type == RR_TYPE_SRV ) ? dns_hash_name( &target ) : 0;
+  
+  for ( b = 0; b < available_service_count; ++b ){
+    service = &available_services[b];
+    switch ( record_type )
+    {
+    case RR_TYPE_PTR:
+      if ( service->type_index == b && hash == service_query_hash && target_hash == service->service_name_hash &&
+           dns_compare_name_to_string( &name, MFi_SERVICE_QUERY_NAME ) &&
+           dns_compare_name_to_string( &target, service->service_name ) )
+        return MDNS_RECORD_SERVICE_LIST_PTR(b);
+      if ( hash == service->service_name_hash && target_hash == service->instance_name_hash &&
+           dns_compare_name_to_string( &name, service->service_name ) &&
+           dns_compare_name_to_string( &target, service->instance_name ) )
+        return MDNS_RECORD_SERVICE_PTR(b);
+      break;
+      
+    case RR_TYPE_TXT:
+      if ( hash == service->instance_name_hash && dns_compare_name_to_string( &name, service->instance_name ) &&
+           dns_compare_string( rdata, rd_length, service->txt_att ) )
+        return MDNS_RECORD_SERVICE_TXT(b);
+      break;
+      
+    case RR_TYPE_SRV:
+      if ( ( ( rdata[4] << 8 ) | rdata[5] ) == service->port &&
+           hash == service->instance_name_hash && target_hash == service->hostname_hash &&
+           dns_compare_name_to_string( &name, service->instance_name ) &&
+           dns_compare_name_to_string( &target, service->hostname ) )
+        return MDNS_RECORD_SERVICE_SRV(b);
+      break;
+      
+    case RR_TYPE_A:
+      if ( service->host_index == b && rd_length == 4 && memcmp( rdata, &cached_ip, 4 ) == 0 &&
+           hash == service->hostname_hash && dns_compare_name_to_string( &name, service->hostname ) )
+        return MDNS_RECORD_HOST_A(b);
+      break;
+      
+    default:
+      return 0;
+    }
+  }
+  return 0;
+}
+
+static uint8_t dns_lower_case( uint8_t c )
+{
+  return ( c >= 'A' && c <= 'Z' ) ? c + ( 'a' - 'A' ) : c;
+}
+
+/* Follows the compression pointers, returns the next label or NULL if the name leaves the packet */
+static uint8_t* dns_next_label( dns_name_t* name, uint8_t* buffer, int* length )
+{
+  while ( buffer < name->end_of_packet && ( *buffer & 0xC0 ) == 0xC0 )
+  {
+    if ( buffer + 1 >= name->end_of_packet || ( *length += 2 ) > DNS_MAX_NAME_LENGTH )
+      return NULL;
+    buffer = name->start_of_packet + ( ( ( buffer[0] & 0x3F ) << 8 ) | buffer[1] );
+  }
+  if ( buffer >= name->end_of_packet || buffer + *buffer >= name->end_of_packet )
+    return NULL;
+  if ( ( *length += *buffer + 1 ) > DNS_MAX_NAME_LENGTH )
+    return NULL;
+  return buffer;
+}
+
+/* Hash of the labels, letters in lower case. A name in a packet hashes the same as the string, compression and the
+   dots of the string make no difference. */
+static uint32_t dns_hash_byte( uint32_t hash, uint8_t c )
+{
+  return ( hash ^ dns_lower_case( c ) ) * 16777619UL;
+}
+
+static uint32_t dns_hash_string( const char* src )
+{
+  uint32_t hash = DNS_NAME_HASH_INIT;
+  const char* end;
+  uint8_t segment_length;
+  
+  while ( *src != 0 )
+  {
+    /* Find the length of the segment, as dns_write_string writes it */
+    for ( end = src, segment_length = 0; *end != '.' && *end != 0; ++segment_length )
+    {
+      if ( *end == '/' )
+        end++; // skip '/'
+      end++;
+    }
+    hash = dns_hash_byte( hash, segment_length );
     
-    // Check if we've finished comparing
-    if ( *buffer == 0 || *string == 0 )
+    for ( ; src < end; src++ )
     {
-      finished = 1;
-      // Check if one of the strings has more data
-      if ( *buffer != 0 || *string != 0 )
-      {
-        result = 0;
-      }
+      if ( *src == '/' )
+        src++; // skip '/'
+      hash = dns_hash_byte( hash, *src );
+    }
+    
+    if ( *src == '.' )
+    {
+      ++src;
+    }
+  }
+  return dns_hash_byte( hash, 0 );
+}
+
+/* Returns 0 for a name that is not valid, the hash of a string is never checked against it */
+static uint32_t dns_hash_name( dns_name_t* name )
+{
+  uint32_t hash = DNS_NAME_HASH_INIT;
+  uint8_t* buffer = name->start_of_name;
+  int length = 0;
+  int a = 0;
+  
+  while ( 1 )
+  {
+    buffer = dns_next_label( name, buffer, &length );
+    if ( buffer == NULL )
+      return 0;
+    for ( a = 0; a <= *buffer; ++a )
+    {
+      hash = dns_hash_byte( hash, buffer[a] );
     }
+    if ( *buffer == 0 )
+      return hash;
+    buffer += *buffer + 1;
   }
+}
+
+/* Letters may differ in case. Called once the hashes are the same, so it is almost always a match. */
+static int dns_compare_name_to_string( dns_name_t* name, const char* string )
+{
+  uint8_t* buffer = name->start_of_name;
+  uint8_t section_length;
+  int length = 0;
   
-  return result;
+  while ( 1 )
+  {
+    buffer = dns_next_label( name, buffer, &length );
+    if ( buffer == NULL )
+      return 0;
+    
+    section_length = *( buffer++ );
+    if ( section_length == 0 )
+      return ( *string == 0 );
+    
+    while ( section_length-- )
+    {
+      if ( *string == '.' || *string == 0 )
+        return 0;
+      if ( *string == '/' )
+        string++; // skip '/'
+      if ( dns_lower_case( *buffer++ ) != dns_lower_case( *string++ ) )
+        return 0;
+    }
+    
+    if ( *string == '.' )
+      string++;
+    else if ( *string != 0 )
+      return 0;
+  }
 }
 
 static int dns_create_message( dns_message_iterator_t* message, uint16_t size )
@@ -288,6 +580,8 @@ static int dns_create_message( dns_message_iterator_t* message, uint16_t size )
   }
   
   message->iter = (uint8_t *) message->header + sizeof(dns_message_header_t);
+  message->end = (uint8_t *) message->header + size;
+  message->name_count = 0;
   return 1;
 }
 
@@ -297,19 +591,33 @@ static void dns_free_message( dns_message_iterator_t* message )
   message->header = NULL;
 }
 
+/* Gives back the unused end of a message that is kept */
+static void dns_trim_message( dns_message_iterator_t* message )
+{
+  uint16_t length = message->iter - (uint8_t*) message->header;
+  dns_message_header_t* header = (dns_message_header_t*) realloc( message->header, length );
+  
+  if ( header != NULL )
+  {
+    message->header = header;
+    message->iter = (uint8_t*) header + length;
+    message->end = message->iter;
+  }
+}
+
 static void dns_write_string( dns_message_iterator_t* iter, const char* src )
 {
   uint8_t* segment_length_pointer;
   uint8_t  segment_length;
   
-  while ( *src != 0 && *src != 0xC0)
+  while ( *src != 0 )
   {
     /* Remember where we need to store the segment length and reset the counter*/
     segment_length_pointer = iter->iter++;
     segment_length = 0;
     
     /* Copy bytes until '.' or end of string*/
-    while ( *src != '.' && *src != 0 && *src != 0xC0)
+    while ( *src != '.' && *src != 0 )
     {
       if (*src == '/')
         src++; // skip '/'
@@ -329,13 +637,8 @@ static void dns_write_string( dns_message_iterator_t* iter, const char* src )
     
   }
   
-  if (*src == 0xC0) { // compress name
-    *iter->iter++ = *src++;
-    *iter->iter++ = *src++;
-  } else {
-    /* Add the ending null */
-    *iter->iter++ = 0;
-  }
+  /* Add the ending null */
+  *iter->iter++ = 0;
 }
 
 
@@ -350,10 +653,31 @@ static void dns_write_header( dns_message_iterator_t* iter, uint16_t id, uint16_
 }
 
 
-static void dns_write_record( dns_message_iterator_t* iter, const char* name, uint16_t record_class, uint16_t record_type, uint32_t ttl, uint8_t* rdata )
+/* Returns 0 and writes nothing if the record might not fit */
+static int dns_write_record( dns_message_iterator_t* iter, const char* name, uint16_t record_class, uint16_t record_type, uint32_t ttl, uint8_t* rdata )
 {
   uint8_t* rd_length;
   uint8_t* temp_ptr;
+  uint16_t max_length = strlen( name ) + 2 + 10;
+  
+  /* Names and strings are never longer than the text plus two bytes */
+  switch ( record_type )
+  {
+  case RR_TYPE_A:
+    max_length += 4;
+    break;
+  case RR_TYPE_PTR:
+  case RR_TYPE_TXT:
+    max_length += strlen( (const char*) rdata ) + 2;
+    break;
+  case RR_TYPE_SRV:
+    max_length += 6 + strlen( ( (dns_sd_service_record_t*) rdata )->hostname ) + 2;
+    break;
+  default:
+    break;
+  }
+  if ( iter->iter + max_length > iter->end )
+    return 0;
   
   /* Write the name, type, class, TTL*/
   dns_write_name	( iter, name );
@@ -373,10 +697,13 @@ static void dns_write_record( dns_message_iterator_t* iter, const char* name, ui
     break;
     
   case RR_TYPE_PTR:
-  case RR_TYPE_TXT:
     dns_write_name( iter, (const char*) rdata );
     break;
     
+  case RR_TYPE_TXT:
+    dns_write_string( iter, (const char*) rdata );
+    break;
+    
   case RR_TYPE_SRV:
     /* Set priority and weight to 0*/
     dns_write_uint16( iter, 0 );
@@ -386,7 +713,7 @@ static void dns_write_record( dns_message_iterator_t* iter, const char* name, ui
     dns_write_uint16( iter, ( (dns_sd_service_record_t*) rdata )->port );
     
     /* Write the hostname*/
-    dns_write_string( iter, ( (dns_sd_service_record_t*) rdata )->hostname );
+    dns_write_name( iter, ( (dns_sd_service_record_t*) rdata )->hostname );
     break;
   default:
     break;
@@ -394,6 +721,238 @@ static void dns_write_record( dns_message_iterator_t* iter, const char* name, ui
   // Write the rdata length
   rd_length[0] = ( iter->iter - temp_ptr ) >> 8;
   rd_length[1] = ( iter->iter - temp_ptr ) & 0xFF;
+  return 1;
+}
+
+/* Writes the records of the set that fit, in the order that lets the names compress best. Returns how many. */
+static uint16_t mdns_write_records( dns_message_iterator_t* iter, uint32_t records, bool goodbye )
+{
+  uint32_t service_ttl = goodbye ? 0 : MDNS_SERVICE_TTL;
+  uint32_t host_ttl = goodbye ? 0 : MDNS_HOST_TTL;
+  uint16_t count = 0;
+  int b = 0;
+  
+  for ( b = 0; b < available_service_count; ++b ){
+    if ( records & MDNS_RECORD_SERVICE_LIST_PTR(b) )
+      count += dns_write_record( iter, MFi_SERVICE_QUERY_NAME, RR_CLASS_IN, RR_TYPE_PTR, service_ttl, (uint8_t*) available_services[b].service_name );
+  }
+  for ( b = 0; b < available_service_count; ++b ){
+    if ( records & MDNS_RECORD_SERVICE_PTR(b) )
+      count += dns_write_record( iter, available_services[b].service_name, RR_CLASS_IN, RR_TYPE_PTR, service_ttl, (uint8_t*) available_services[b].instance_name );
+    if ( records & MDNS_RECORD_SERVICE_TXT(b) )
+      count += dns_write_record( iter, available_services[b].instance_name, RR_CACHE_FLUSH|RR_CLASS_IN, RR_TYPE_TXT, service_ttl, (uint8_t*) available_services[b].txt_att );
+    if ( records & MDNS_RECORD_SERVICE_SRV(b) )
+      count += dns_write_record( iter, available_services[b].instance_name, RR_CACHE_FLUSH|RR_CLASS_IN, RR_TYPE_SRV, service_ttl, (uint8_t*) &available_services[b] );
+  }
+  for ( b = 0; b < available_service_count; ++b ){
+    if ( records & MDNS_RECORD_HOST_A(b) )
+      count += dns_write_record( iter, available_services[b].hostname, RR_CACHE_FLUSH|RR_CLASS_IN, RR_TYPE_A, host_ttl, (uint8_t*) &cached_ip );
+  }
+  return count;
+}
+
+static uint32_t mdns_all_records( void )
+{
+  uint32_t records = 0;
+  int b = 0;
+  
+  for ( b = 0; b < available_service_count; ++b ){
+    records |= MDNS_RECORD_SERVICE_PTR(b) | MDNS_RECORD_SERVICE_TXT(b) | MDNS_RECORD_SERVICE_SRV(b);
+    if ( available_services[b].type_index == b )
+      records |= MDNS_RECORD_SERVICE_LIST_PTR(b);
+    if ( available_services[b].host_index == b )
+      records |= MDNS_RECORD_HOST_A(b);
+  }
+  return records;
+}
+
+/* The records that go away with service b, the service list PTR and the A record stay if another service has them */
+static uint32_t mdns_service_records( int b )
+{
+  uint32_t records = MDNS_RECORD_SERVICE_PTR(b) | MDNS_RECORD_SERVICE_TXT(b) | MDNS_RECORD_SERVICE_SRV(b) |
+                     MDNS_RECORD_SERVICE_LIST_PTR(b) | MDNS_RECORD_HOST_A(b);
+  int a = 0;
+  
+  for ( a = 0; a < available_service_count; ++a ){
+    if ( a == b )
+      continue;
+    if ( available_services[a].type_index == available_services[b].type_index )
+      records &= ~MDNS_RECORD_SERVICE_LIST_PTR(b);
+    if ( available_services[a].host_index == available_services[b].host_index )
+      records &= ~MDNS_RECORD_HOST_A(b);
+  }
+  return records;
+}
+
+/* Finds the first service with the same names, it has their service list PTR and A record */
+static void mdns_index_services( void )
+{
+  dns_sd_service_record_t* service;
+  int a = 0;
+  int b = 0;
+  
+  for ( b = 0; b < available_service_count; ++b ){
+    service = &available_services[b];
+    service->type_index = b;
+    service->host_index = b;
+    for ( a = b - 1; a >= 0; --a ){
+      if ( available_services[a].service_name_hash == service->service_name_hash &&
+           strcmp( available_services[a].service_name, service->service_name ) == 0 )
+        service->type_index = a;
+      if ( available_services[a].hostname_hash == service->hostname_hash &&
+           strcmp( available_services[a].hostname, service->hostname ) == 0 )
+        service->host_index = a;
+    }
+  }
+}
+
+static int mdns_find_service( const char* service_name, const char* instance_name )
+{
+  int len = strlen( instance_name );
+  int b = 0;
+  
+  for ( b = 0; b < available_service_count; ++b ){
+    if ( strcmp( available_services[b].service_name, service_name ) == 0 &&
+         strncmp( available_services[b].instance_name, instance_name, len ) == 0 &&
+         available_services[b].instance_name[len] == '.' )
+      return b;
+  }
+  return -1;
+}
+
+static void mdns_free_service( dns_sd_service_record_t* service )
+{
+  if(service->service_name)  free(service->service_name);
+  if(service->hostname)  free(service->hostname);
+  if(service->instance_name)  free(service->instance_name);
+  if(service->txt_att)  free(service->txt_att);
+  memset(service, 0x0, sizeof(dns_sd_service_record_t));
+}
+
+/* The records changed, the encoded responses and the delayed answers are for the old ones */
+static void mdns_services_changed( void )
+{
+  mdns_index_services( );
+  mdns_clear_cached_messages( );
+  pending_answers = 0;
+  pending_additionals = 0;
+  _bonjour_announce = 1;
+  _bonjour_announce_time = 0;
+}
+
+static void mdns_send_goodbye( int fd, uint32_t records )
+{
+  dns_message_iterator_t response;
+  
+  if ( fd == -1 || records == 0 )
+    return;
+  
+  mdns_get_ip( );
+  if ( mdns_write_message( &response, records, 0, true ) ){
+    mdns_send_message(fd, &response );
+    mico_thread_msleep(20);
+    mdns_send_message(fd, &response );
+    dns_free_message( &response );
+  }
+}
+
+/* Reads the IP address the A record holds, if it is not known yet */
+static uint32_t mdns_get_ip( void )
+{
+  IPStatusTypedef para;
+  
+  if ( cached_ip == 0 ){
+    micoWlanGetIPStatus(&para, _interface);
+    cached_ip = htonl(inet_addr(para.ip));
+  }
+  return cached_ip;
+}
+
+static int mdns_write_message( dns_message_iterator_t* message, uint32_t answers, uint32_t additionals, bool goodbye )
+{
+  uint16_t count;
+  
+  if ( !dns_create_message( message, MDNS_MESSAGE_SIZE ) )
+    return 0;
+  dns_write_header( message, 0x0, 0x8400, 0, 0, 0 );
+  count = mdns_write_records( message, answers, goodbye );
+  message->header->answer_count = htons( count );
+  count = mdns_write_records( message, additionals, goodbye );
+  message->header->additional_record_count = htons( count );
+  dns_trim_message( message );
+  return 1;
+}
+
+static void mdns_clear_cached_messages( void )
+{
+  int a = 0;
+  
+  for ( a = 0; a < MDNS_CACHED_MESSAGE_COUNT; ++a ){
+    dns_free_message( &cached_messages[a].message );
+  }
+  cached_ip = 0;
+  memset( record_sent_time, 0, sizeof(record_sent_time) );
+}
+
+/* Returns the response with these records, it is encoded the first time. NULL if there is no IP address. */
+static dns_message_iterator_t* mdns_get_message( uint32_t answers, uint32_t additionals )
+{
+  mdns_cached_message_t* cached;
+  int a = 0;
+  
+  if ( mdns_get_ip( ) == 0 )
+    return NULL;
+  
+  for ( a = 0; a < MDNS_CACHED_MESSAGE_COUNT; ++a ){
+    cached = &cached_messages[a];
+    if ( cached->message.header != NULL && cached->answers == answers && cached->additionals == additionals )
+      return &cached->message;
+  }
+  
+  cached = &cached_messages[cached_message_next];
+  cached_message_next = ( cached_message_next + 1 ) % MDNS_CACHED_MESSAGE_COUNT;
+  dns_free_message( &cached->message );
+  if ( !mdns_write_message( &cached->message, answers, additionals, false ) )
+    return NULL;
+  cached->answers = answers;
+  cached->additionals = additionals;
+  return &cached->message;
+}
+
+/* Multicasts the records that were not in the last second, nothing if no answer is left */
+static void mdns_send_records( int fd, uint32_t answers, uint32_t additionals, uint16_t id )
+{
+  dns_message_iterator_t* message;
+  uint32_t now = mico_get_time( );
+  uint32_t record;
+  int a = 0;
+  
+  for ( a = 0; a < MDNS_RECORD_COUNT; ++a ){
+    record = 1UL << a;
+    if ( ( ( answers | additionals ) & record ) && record_sent_time[a] != 0 && now - record_sent_time[a] < MDNS_RATE_LIMIT ){
+      answers &= ~record;
+      additionals &= ~record;
+      statistics.rate_limited++;
+    }
+  }
+  if ( answers == 0 )
+    return;
+  
+  message = mdns_get_message( answers, additionals );
+  if ( message == NULL )
+    return;
+  message->header->id = htons( id );
+  mdns_send_message(fd, message );
+  
+  if(_suspend_MFi_bonjour == true)
+    return;
+  for ( a = 0; a < MDNS_RECORD_COUNT; ++a ){
+    record = 1UL << a;
+    if ( ( answers | additionals ) & record )
+      record_sent_time[a] = now ? now : 1;
+  }
+  statistics.answers_sent += ntohs( message->header->answer_count );
+  statistics.additionals_sent += ntohs( message->header->additional_record_count );
 }
 
 static void mdns_send_message(int fd, dns_message_iterator_t* message )
@@ -467,69 +1026,223 @@ static void dns_skip_name( dns_message_iterator_t* iter )
   ++iter->iter;
 }
 
+/* Checks if the labels at name are the ones at known, which is in the message and may be compressed */
+static int dns_compare_labels( dns_message_iterator_t* iter, uint8_t* name, uint8_t* known )
+{
+  while ( 1 )
+  {
+    while ( ( *known & 0xC0 ) == 0xC0 )
+    {
+      known = (uint8_t*) iter->header + ( ( ( known[0] & 0x3F ) << 8 ) | known[1] );
+    }
+    if ( *name != *known || memcmp( name + 1, known + 1, *name ) != 0 )
+      return 0;
+    if ( *name == 0 )
+      return 1;
+    name  += *name + 1;
+    known += *known + 1;
+  }
+}
+
+/* The longest ending of the name that is already in the message is replaced by a pointer to it */
 static void dns_write_name( dns_message_iterator_t* iter, const char* src )
 {
+  uint8_t* name = iter->iter;
+  uint8_t* label;
+  uint16_t offset;
+  int a = 0;
+  
   dns_write_string( iter, src );
+  
+  for ( label = name; *label != 0; label += *label + 1 )
+  {
+    for ( a = 0; a < iter->name_count; ++a )
+    {
+      if ( dns_compare_labels( iter, label, (uint8_t*) iter->header + iter->names[a] ) )
+        break;
+    }
+    if ( a < iter->name_count )
+    {
+      label[0] = 0xC0 | ( iter->names[a] >> 8 );
+      label[1] = iter->names[a] & 0xFF;
+      iter->iter = label + 2;
+      break;
+    }
+  }
+  
+  /* Remember the labels before the pointer, the next names can point to them */
+  for ( ; name < label && iter->name_count < DNS_NAME_DICTIONARY_SIZE; name += *name + 1 )
+  {
+    offset = name - (uint8_t*) iter->header;
+    if ( offset > 0x3FFF )
+      break;
+    iter->names[iter->name_count++] = offset;
+  }
 }
 
 
 void bonjour_service_init(bonjour_init_t init)
 {
-  int len;
-  IPStatusTypedef para;
-
-  _interface = init.interface;
+  int b = 0;
 
   if(bonjour_mutex == NULL)
     mico_rtos_init_mutex( &bonjour_mutex );
 
-
   mico_rtos_lock_mutex( &bonjour_mutex );
-  if(available_services) {
-    //suspend_bonjour_service(ENABLE);
-    if(available_services->service_name)  free(available_services->service_name);
-    if(available_services->hostname)  free(available_services->hostname);
-    if(available_services->instance_name)  free(available_services->instance_name);
-    if(available_services->txt_att)  free(available_services->txt_att);
-    free(available_services);
+  for ( b = 0; b < available_service_count; ++b ){
+    mdns_free_service( &available_services[b] );
   }
+  available_service_count = 0;
+  mdns_services_changed( );
+  mico_rtos_unlock_mutex( &bonjour_mutex );
+
+  bonjour_add_service(init);
+}
 
-  micoWlanGetIPStatus(&para, _interface);
+OSStatus bonjour_add_service(bonjour_init_t init)
+{
+  OSStatus err = kNoErr;
+  dns_sd_service_record_t service;
+  int len;
+  int b = 0;
 
-  available_service_count = 1;
-  available_services = (void *)malloc(sizeof(dns_sd_service_record_t) * 1);
-  memset(available_services, 0x0, sizeof(dns_sd_service_record_t) * 1);
+  if(bonjour_mutex == NULL)
+    mico_rtos_init_mutex( &bonjour_mutex );
 
-  available_services->service_name = (char*)__strdup(init.service_name);
+  mico_rtos_lock_mutex( &bonjour_mutex );
+  memset(&service, 0x0, sizeof(dns_sd_service_record_t));
+  require_action( init.service_name && init.service_name[0] && init.host_name && init.host_name[0] &&
+                  init.instance_name && init.instance_name[0], exit, err = kParamErr );
+
+  b = mdns_find_service( init.service_name, init.instance_name );
+  if ( b == -1 ){
+    require_action( available_service_count < MDNS_MAX_SERVICES, exit, err = kNoResourcesErr );
+    b = available_service_count;
+  }
 
-  available_services->hostname = (char*)__strdup(init.host_name);
+  service.service_name = (char*)__strdup(init.service_name);
+  service.hostname = (char*)__strdup(init.host_name);
+  service.txt_att = (char*)__strdup(init.txt_record ? init.txt_record : "");
 
   len = strlen(init.instance_name);
-  available_services->instance_name = (char*)malloc(len+3);//// 0xc00c+\0
-  memcpy(available_services->instance_name, init.instance_name, len);
-  available_services->instance_name[len]= 0xc0;
-  available_services->instance_name[len+1]= 0x0c;
-  available_services->instance_name[len+2]= 0;
-  
-  available_services->txt_att = (char*)__strdup(init.txt_record);
+  service.instance_name = (char*)malloc(len+strlen(init.service_name)+2);// instance.service\0
+  require_action( service.service_name && service.hostname && service.txt_att && service.instance_name, exit,
+                  err = kNoMemoryErr );
+  memcpy(service.instance_name, init.instance_name, len);
+  service.instance_name[len]= '.';
+  strcpy(service.instance_name+len+1, init.service_name);
+
+  service.port = init.service_port;
+  service.service_name_hash = dns_hash_string(service.service_name);
+  service.instance_name_hash = dns_hash_string(service.instance_name);
+  service.hostname_hash = dns_hash_string(service.hostname);
+  service_query_hash = dns_hash_string(MFi_SERVICE_QUERY_NAME);
+
+  // Replaces the service if it is registered already
+  if ( b == available_service_count )
+    available_service_count++;
+  else
+    mdns_free_service( &available_services[b] );
+  available_services[b] = service;
+  memset(&service, 0x0, sizeof(dns_sd_service_record_t));
 
-  available_services->port = init.service_port;
+  _interface = init.interface;
+  mdns_services_changed( );
+
+exit:
+  mdns_free_service( &service );
   mico_rtos_unlock_mutex( &bonjour_mutex );
+  return err;
 }
 
-void bonjour_update_txt_record(char *txt_record)
+OSStatus bonjour_remove_service(const char *service_name, const char *instance_name)
 {
-  
+  OSStatus err = kNoErr;
+  int b = 0;
+
+  require_action( bonjour_mutex, exit_nolock, err = kNotFoundErr );
   mico_rtos_lock_mutex( &bonjour_mutex );
-  if(available_services->txt_att)  free(available_services->txt_att);
-  
-  available_services->txt_att = (char*)__strdup(txt_record);
+  require_action( service_name && instance_name, exit, err = kParamErr );
+
+  b = mdns_find_service( service_name, instance_name );
+  require_action( b != -1, exit, err = kNotFoundErr );
+
+  mdns_send_goodbye( mDNS_fd, mdns_service_records( b ) );
+
+  mdns_free_service( &available_services[b] );
+  memmove( &available_services[b], &available_services[b+1], sizeof(dns_sd_service_record_t) * ( available_service_count - b - 1 ) );
+  available_service_count--;
+  memset( &available_services[available_service_count], 0x0, sizeof(dns_sd_service_record_t) );
+  mdns_services_changed( );
+
+exit:
+  mico_rtos_unlock_mutex( &bonjour_mutex );
+exit_nolock:
+  return err;
+}
+
+OSStatus bonjour_update_service_txt_record(const char *service_name, const char *instance_name, char *txt_record)
+{
+  OSStatus err = kNoErr;
+  char *txt_att;
+  int b = 0;
 
+  require_action( bonjour_mutex, exit_nolock, err = kNotFoundErr );
+  mico_rtos_lock_mutex( &bonjour_mutex );
+
+  b = mdns_find_service( service_name, instance_name );
+  require_action( b != -1, exit, err = kNotFoundErr );
+  txt_att = (char*)__strdup(txt_record ? txt_record : "");
+  require_action( txt_att, exit, err = kNoMemoryErr );
+
+  mdns_clear_cached_messages( );
+  free(available_services[b].txt_att);
+  available_services[b].txt_att = txt_att;
   _bonjour_announce = 1;
+
+exit:
+  mico_rtos_unlock_mutex( &bonjour_mutex );
+exit_nolock:
+  return err;
+}
+
+void bonjour_update_txt_record(char *txt_record)
+{
+  char *txt_att;
+  
+  mico_rtos_lock_mutex( &bonjour_mutex );
+  txt_att = (char*)__strdup(txt_record ? txt_record : "");
+  if ( available_service_count > 0 && txt_att ){
+    mdns_clear_cached_messages( );
+    free(available_services[0].txt_att);
+    available_services[0].txt_att = txt_att;
+    _bonjour_announce = 1;
+  }
+  else if ( txt_att )
+    free(txt_att);
   mico_rtos_unlock_mutex( &bonjour_mutex );
 
 }
 
+void bonjour_get_statistics(bonjour_statistics_t *stats)
+{
+  if(bonjour_mutex != NULL)
+    mico_rtos_lock_mutex( &bonjour_mutex );
+  *stats = statistics;
+  if(bonjour_mutex != NULL)
+    mico_rtos_unlock_mutex( &bonjour_mutex );
+}
+
+void bonjour_update_ip_address(void)
+{
+  if(bonjour_mutex == NULL)
+    return;
+  
+  mico_rtos_lock_mutex( &bonjour_mutex );
+  mdns_clear_cached_messages( );
+  mico_rtos_unlock_mutex( &bonjour_mutex );
+}
+
 void mfi_mdns_handler(int fd, uint8_t* pkt, int pkt_len)
 {
 
@@ -542,6 +1255,7 @@ void mfi_mdns_handler(int fd, uint8_t* pkt, int pkt_len)
   // Check if the message is a response (otherwise its a query)
   if ( ntohs(iter.header->flags) & DNS_MESSAGE_IS_A_RESPONSE )
   {
+    process_dns_answers( &iter );
   }
   else
   {
@@ -551,59 +1265,16 @@ void mfi_mdns_handler(int fd, uint8_t* pkt, int pkt_len)
 
 void mfi_bonjour_send(int fd)
 {
-  dns_message_iterator_t response;
-  uint32_t myip;
-  IPStatusTypedef para;
-  micoWlanGetIPStatus(&para, _interface);
-  myip = htonl(inet_addr(para.ip));
-  if(myip == 0) return;
-  int b = 0;
-    
-  if(dns_create_message( &response, 512 )) {
-    dns_write_header(&response, 0x0, 0x8400, 0, available_service_count, 0 );          
-    for ( b = 0; b < available_service_count; ++b ){
-      dns_write_record( &response, MFi_SERVICE_QUERY_NAME, RR_CLASS_IN, RR_TYPE_PTR, 1500, (uint8_t*) available_services[b].service_name );
-    }
-    mdns_send_message(fd, &response );
-    dns_free_message( &response );
-  }
-
-  for ( b = 0; b < available_service_count; ++b ){
-      if(dns_create_message( &response, 512 )){
-        dns_write_header( &response, 0x0, 0x8400, 0, 4, 0 );
-        dns_write_record( &response, available_services[b].service_name, RR_CLASS_IN, RR_TYPE_PTR, 1500, (uint8_t*) available_services[b].instance_name );
-        dns_write_record( &response, available_services[b].instance_name, RR_CACHE_FLUSH|RR_CLASS_IN, RR_TYPE_TXT, 1500, (uint8_t*) available_services[b].txt_att );
-        dns_write_record( &response, available_services[b].instance_name, RR_CACHE_FLUSH|RR_CLASS_IN, RR_TYPE_SRV, 1500, (uint8_t*) &available_services[b]);
-        dns_write_record( &response, available_services[b].hostname, RR_CACHE_FLUSH|RR_CLASS_IN, RR_TYPE_A, 1500, (uint8_t*) &myip);
-        mdns_send_message(fd, &response );
-        dns_free_message( &response );
-      }
-  }
+  if ( available_service_count == 0 || mdns_get_ip( ) == 0 )
+    return;
+  
+  mdns_send_records( fd, mdns_all_records( ), 0, 0 );
 }
 
 
 void mfi_bonjour_remove_record(int fd)
 {
-  dns_message_iterator_t response;
-  uint32_t myip;
-  IPStatusTypedef para;
-  micoWlanGetIPStatus(&para, _interface);
-  myip = htonl(inet_addr(para.ip));
-  int b = 0;
-
-  for ( b = 0; b < available_service_count; ++b ){
-    if(dns_create_message( &response, 512 )){
-      dns_write_header( &response, 0x0, 0x8400, 0, 4, 0 );
-      dns_write_record( &response, available_services[b].service_name, RR_CLASS_IN, RR_TYPE_PTR, 0, (uint8_t*) available_services[b].instance_name );
-      dns_write_record( &response, available_services[b].instance_name, RR_CACHE_FLUSH|RR_CLASS_IN, RR_TYPE_TXT, 0, (uint8_t*) available_services[b].txt_att );
-      dns_write_record( &response, available_services[b].instance_name, RR_CACHE_FLUSH|RR_CLASS_IN, RR_TYPE_SRV, 0, (uint8_t*) &available_services[b]);
-      dns_write_record( &response, available_services[b].hostname, RR_CACHE_FLUSH|RR_CLASS_IN, RR_TYPE_A, 0, (uint8_t*) &myip);
-      mdns_send_message(fd, &response );
-      mico_thread_msleep(20);
-      mdns_send_message(fd, &response );
-      dns_free_message( &response );
-    }
-  }
+  mdns_send_goodbye( fd, mdns_all_records( ) );
 }
 
 int start_bonjour_service(void)
@@ -634,14 +1305,13 @@ void _bonjour_thread(void *arg)
   struct sockaddr_t addr;
   socklen_t addrLen;
   uint32_t opt;
+  uint32_t wait;
+  uint32_t announce_time = mico_get_time() - MDNS_RATE_LIMIT;
   (void)arg;
   OSStatus err;
   
   buf = malloc(1500);
   
-  t.tv_sec = 1;
-  t.tv_usec = 0;
-  
   mDNS_fd = socket(AF_INET, SOCK_DGRM, IPPROTO_UDP);
   require_action(IsValidSocket( mDNS_fd ), exit, err = kNoResourcesErr );
   opt = 0xE00000FB; //"224.0.0.251"
@@ -654,8 +1324,9 @@ void _bonjour_thread(void *arg)
   _bonjour_announce = 1;
   
   while(1) {
-    /*Send bonjour info when wifi is connected */
-    if(_bonjour_announce){
+    /*Send bonjour info when wifi is connected, a second apart */
+    if(_bonjour_announce && mico_get_time() - announce_time >= MDNS_RATE_LIMIT){
+      announce_time = mico_get_time();
       mico_rtos_lock_mutex( &bonjour_mutex );
       mfi_bonjour_send(mDNS_fd);
      
@@ -667,6 +1338,13 @@ void _bonjour_thread(void *arg)
       mico_rtos_unlock_mutex( &bonjour_mutex );
     }
 
+    /*Send the delayed answers that are due, wait for a query until the next ones */
+    mico_rtos_lock_mutex( &bonjour_mutex );
+    wait = mdns_send_pending(mDNS_fd);
+    mico_rtos_unlock_mutex( &bonjour_mutex );
+    t.tv_sec = wait / 1000;
+    t.tv_usec = ( wait % 1000 ) * 1000;
+
     /*Check status on erery sockets on bonjour query */
     FD_ZERO(&readfds);
     FD_SET(mDNS_fd, &readfds);
@@ -93,6 +93,7 @@ typedef struct
 {
   uint8_t* start_of_name;
   uint8_t* start_of_packet; // Used for compressed names;
+  uint8_t* end_of_packet;   // Names are never read past it
 } dns_name_t;
 
 typedef struct
@@ -105,11 +106,15 @@ typedef struct
   uint16_t additional_record_count;
 } dns_message_header_t;
 
+#define DNS_NAME_DICTIONARY_SIZE    16
+
 typedef struct
 {
     dns_message_header_t* header; // Also used as start of packet for compressed names
     uint8_t* iter;
     uint8_t* end;
+    uint16_t names[DNS_NAME_DICTIONARY_SIZE]; // Offsets of the labels written, later names that end the same point there
+    uint8_t  name_count;
 } dns_message_iterator_t;
 
 typedef struct
@@ -139,10 +144,36 @@ typedef struct
   WiFi_Interface interface;
 } bonjour_init_t;
 
+/* Removes every service and adds this one */
 void bonjour_service_init(bonjour_init_t init);
 
+/* Up to 6 services, each with its own host name or sharing one. A service with the same service and instance name
+   is replaced. The new records are announced. */
+OSStatus bonjour_add_service(bonjour_init_t init);
+
+/* Sends goodbye records of the service, instance_name is the one it was added with */
+OSStatus bonjour_remove_service(const char *service_name, const char *instance_name);
+
+OSStatus bonjour_update_service_txt_record(const char *service_name, const char *instance_name, char *txt_record);
+
+/* Updates the first service */
 void bonjour_update_txt_record(char *txt_record);
 
+/* Call when the IP address changes, e.g. on DHCP complete, the cached responses hold the old one */
+void bonjour_update_ip_address(void);
+
+/* Records are counted, not messages */
+typedef struct
+{
+  uint32_t answers_sent;
+  uint32_t additionals_sent;
+  uint32_t known_answers_suppressed;      // The query listed them with at least half our TTL left
+  uint32_t duplicate_answers_suppressed;  // Another responder sent them while ours was delayed
+  uint32_t rate_limited;                  // Multicast less than a second before
+} bonjour_statistics_t;
+
+void bonjour_get_statistics(bonjour_statistics_t *stats);
+
 int start_bonjour_service(void);
 
 void suspend_bonjour_service(bool state);
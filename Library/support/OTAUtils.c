@@ -0,0 +1,323 @@
+/**
+******************************************************************************
+* @file    OTAUtils.c
+* @author  William Xu
+* @version V1.0.0
+* @date    31-Oct-2014
+* @brief   This file contains the resumable OTA session, it writes the image to
+*          the update partition and keeps checkpoints of the download there.
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+#include "OTAUtils.h"
+#include "CheckSumUtils.h"
+#include "MicoPlatform.h"
+#include "LZUtils.h"
+#include "DeltaUtils.h"
+#include "Debug.h"
+
+#define ota_utils_log(M, ...) custom_log("OTAUtils", M, ##__VA_ARGS__)
+
+#ifdef MICO_FLASH_FOR_UPDATE
+
+#define kOTACheckpointMinInterval   0x2000
+#define kOTABlankCheckSize          256
+
+/* The CRC covers every field before it */
+#define _OTARecordCRC( record )     CRC32_Update( 0, (record), sizeof( ota_checkpoint_t ) - sizeof( uint32_t ) )
+
+static bool _OTAIDIsSet( const uint8_t *inID )
+{
+  int i;
+
+  if( inID == NULL ) return false;
+  for( i = 0; i < 16; i++ )
+    if( inID[i] ) return true;
+  return false;
+}
+
+static bool _OTAIsBlank( const uint8_t *inData, size_t inLen )
+{
+  while( inLen-- )
+    if( *inData++ != 0xFF ) return false;
+  return true;
+}
+
+static OSStatus _OTAReadRecord( uint32_t inAddress, ota_checkpoint_t *outRecord )
+{
+  OSStatus err;
+
+  err = MicoFlashRead( MICO_FLASH_FOR_UPDATE, &inAddress, (uint8_t *)outRecord, sizeof( ota_checkpoint_t ) );
+  require_noerr( err, exit );
+  if( _OTARecordCRC( outRecord ) != outRecord->crc ) err = kChecksumErr;
+
+exit:
+  return err;
+}
+
+static OSStatus _OTAWriteRecord( uint32_t inAddress, uint32_t inMagic, uint32_t inLength, const uint8_t *inID,
+                                 const md5_context *inHash )
+{
+  ota_checkpoint_t record;
+
+  memset( &record, 0, sizeof( record ) );
+  record.magic = inMagic;
+  record.length = inLength;
+  if( inID ) memcpy( record.id, inID, 16 );
+  if( inHash ) record.hash = *inHash;
+  record.crc = _OTARecordCRC( &record );
+  return MicoFlashWrite( MICO_FLASH_FOR_UPDATE, &inAddress, (uint8_t *)&record, sizeof( record ) );
+}
+
+static OSStatus _OTAReadMarker( uint32_t *outMarker )
+{
+  uint32_t address = OTA_ERASED_MARKER_ADDRESS;
+
+  return MicoFlashRead( MICO_FLASH_FOR_UPDATE, &address, (uint8_t *)outMarker, sizeof( uint32_t ) );
+}
+
+/* Erasing takes seconds on SPI flash, the bootloader has usually done it already. Writers that do not know the
+   erased marker leave it set, so the first sector, where every image starts, is still checked then. */
+static OSStatus _OTAErasePartition( void )
+{
+  OSStatus err = kNoErr;
+  uint8_t *buf = NULL;
+  uint32_t address = UPDATE_START_ADDRESS;
+  uint32_t checkEnd = UPDATE_END_ADDRESS;
+  uint32_t sectorStart;
+  uint32_t marker;
+
+  err = _OTAReadMarker( &marker );
+  require_noerr( err, exit );
+  if( marker == kOTAErasedMagic ){
+    err = MicoFlashGetSector( MICO_FLASH_FOR_UPDATE, UPDATE_START_ADDRESS, &sectorStart, &checkEnd );
+    require_noerr( err, exit );
+  }
+
+  buf = malloc( kOTABlankCheckSize );
+  require_action( buf, exit, err = kNoMemoryErr );
+
+  while( address <= checkEnd ){
+    err = MicoFlashRead( MICO_FLASH_FOR_UPDATE, &address, buf, kOTABlankCheckSize );
+    require_noerr( err, exit );
+    if( _OTAIsBlank( buf, kOTABlankCheckSize ) == false ) break;
+  }
+
+  if( address <= checkEnd ){
+    ota_utils_log( "Erase update partition" );
+    err = MicoFlashErase( MICO_FLASH_FOR_UPDATE, UPDATE_START_ADDRESS, UPDATE_END_ADDRESS );
+    require_noerr( err, exit );
+  }else if( marker == kOTAErasedMagic ){
+    err = OTAClearErasedMarker();
+    require_noerr( err, exit );
+  }
+
+exit:
+  if( buf ) free( buf );
+  return err;
+}
+
+/* Scans the checkpoints behind the session record. A torn slot is skipped, the next free one is the first blank slot. */
+static void _OTALoadCheckpoints( ota_session_t *ioSession, md5_context *outHash )
+{
+  ota_checkpoint_t record;
+  uint32_t address;
+
+  for( address = OTA_CHECKPOINT_START_ADDRESS + kOTACheckpointSlotSize;
+       address + kOTACheckpointSlotSize - 1 <= OTA_CHECKPOINT_END_ADDRESS;
+       address += kOTACheckpointSlotSize ){
+    if( _OTAReadRecord( address, &record ) != kNoErr ){
+      if( _OTAIsBlank( (uint8_t *)&record, sizeof( record ) ) ) break;
+      continue;
+    }
+    if( record.magic != kOTACheckpointMagic || record.length > ioSession->length ) continue;
+    if( record.length >= ioSession->offset ){
+      ioSession->offset = record.length;
+      *outHash = record.hash;
+    }
+  }
+  ioSession->checkpointAddress = address;
+}
+
+OSStatus OTASessionOpen( ota_session_t *outSession, uint32_t inLength, const uint8_t *inID, bool inResume,
+                         md5_context *outHash )
+{
+  OSStatus err;
+  ota_checkpoint_t record;
+
+  require_action( outSession && outHash, exit, err = kParamErr );
+  require_action( inLength > 0 && inLength <= OTA_IMAGE_MAX_SIZE, exit, err = kSizeErr );
+
+  memset( outSession, 0, sizeof( ota_session_t ) );
+  outSession->length = inLength;
+  outSession->checkpointAddress = OTA_CHECKPOINT_START_ADDRESS + kOTACheckpointSlotSize;
+  if( _OTAIDIsSet( inID ) ){
+    memcpy( outSession->id, inID, 16 );
+    /* Leave one slot for OTASessionFinish */
+    outSession->interval = ( inLength + OTA_CHECKPOINT_NUM - 2 ) / ( OTA_CHECKPOINT_NUM - 1 );
+    outSession->interval = Max( outSession->interval, kOTACheckpointMinInterval );
+  }
+  InitMd5( outHash );
+
+  err = MicoFlashInitialize( MICO_FLASH_FOR_UPDATE );
+  require_noerr( err, exit );
+
+  if( inResume && outSession->interval
+   && _OTAReadRecord( OTA_CHECKPOINT_START_ADDRESS, &record ) == kNoErr
+   && record.magic == kOTASessionMagic && record.length == inLength
+   && memcmp( record.id, outSession->id, 16 ) == 0 ){
+    _OTALoadCheckpoints( outSession, outHash );
+    outSession->nextCheckpoint = outSession->offset + outSession->interval;
+    ota_utils_log( "Resume OTA at %d of %d bytes", outSession->offset, inLength );
+    goto exit;
+  }
+
+  err = _OTAErasePartition();
+  require_noerr( err, exit );
+  err = _OTAWriteRecord( OTA_CHECKPOINT_START_ADDRESS, kOTASessionMagic, inLength, outSession->id, NULL );
+  require_noerr( err, exit );
+  outSession->nextCheckpoint = outSession->interval;
+
+exit:
+  return err;
+}
+
+OSStatus OTASessionWrite( ota_session_t *inSession, const uint8_t *inData, size_t inLen )
+{
+  OSStatus err;
+  uint32_t address;
+
+  require_action( inSession->offset + inLen <= inSession->length, exit, err = kSizeErr );
+
+  address = UPDATE_START_ADDRESS + inSession->offset;
+  err = MicoFlashWrite( MICO_FLASH_FOR_UPDATE, &address, (uint8_t *)inData, inLen );
+  require_noerr( err, exit );
+  inSession->offset += inLen;
+
+exit:
+  return err;
+}
+
+OSStatus OTASessionCheckpoint( ota_session_t *inSession, const md5_context *inHash )
+{
+  OSStatus err = kNoErr;
+
+  require_quiet( inSession->interval, exit );
+  require_quiet( inSession->checkpointAddress + 2 * kOTACheckpointSlotSize - 1 <= OTA_CHECKPOINT_END_ADDRESS, exit );
+
+  err = _OTAWriteRecord( inSession->checkpointAddress, kOTACheckpointMagic, inSession->offset, NULL, inHash );
+  require_noerr( err, exit );
+  inSession->checkpointAddress += kOTACheckpointSlotSize;
+  inSession->nextCheckpoint = inSession->offset + inSession->interval;
+
+exit:
+  return err;
+}
+
+OSStatus OTASessionFinish( ota_session_t *inSession, const md5_context *inHash )
+{
+  OSStatus err;
+  md5_context hash;
+  uint8_t digest[ 16 ];
+
+  require_action( inSession->offset == inSession->length, exit, err = kUnderrunErr );
+
+  if( _OTAIDIsSet( inSession->id ) ){
+    hash = *inHash;
+    Md5Final( &hash, digest );
+    require_action( memcmp( digest, inSession->id, 16 ) == 0, exit, err = kChecksumErr );
+  }
+
+  require_action( inSession->checkpointAddress + kOTACheckpointSlotSize - 1 <= OTA_CHECKPOINT_END_ADDRESS, exit,
+                  err = kNoSpaceErr );
+  err = _OTAWriteRecord( inSession->checkpointAddress, kOTACheckpointMagic, inSession->offset, NULL, inHash );
+  require_noerr( err, exit );
+  inSession->checkpointAddress += kOTACheckpointSlotSize;
+  ota_utils_log( "OTA image of %d bytes is complete", inSession->length );
+
+exit:
+  return err;
+}
+
+OSStatus OTASessionQuery( uint32_t *outLength, uint8_t *outID, uint32_t *outOffset )
+{
+  OSStatus err;
+  ota_checkpoint_t record;
+  ota_session_t session;
+  md5_context hash;
+
+  err = MicoFlashInitialize( MICO_FLASH_FOR_UPDATE );
+  require_noerr( err, exit );
+
+  err = _OTAReadRecord( OTA_CHECKPOINT_START_ADDRESS, &record );
+  require_action_quiet( err == kNoErr && record.magic == kOTASessionMagic, exit, err = kNotFoundErr );
+
+  memset( &session, 0, sizeof( session ) );
+  session.length = record.length;
+  _OTALoadCheckpoints( &session, &hash );
+
+  if( outLength ) *outLength = session.length;
+  if( outID )     memcpy( outID, record.id, 16 );
+  if( outOffset ) *outOffset = session.offset;
+
+exit:
+  return err;
+}
+
+OSStatus OTAClearErasedMarker( void )
+{
+  OSStatus err;
+  uint32_t marker, address = OTA_ERASED_MARKER_ADDRESS;
+
+  err = MicoFlashInitialize( MICO_FLASH_FOR_UPDATE );
+  require_noerr( err, exit );
+  err = _OTAReadMarker( &marker );
+  require_noerr( err, exit );
+
+  /* Programming 0 over it needs no erase */
+  if( marker == kOTAErasedMagic ){
+    marker = 0;
+    err = MicoFlashWrite( MICO_FLASH_FOR_UPDATE, &address, (uint8_t *)&marker, sizeof( uint32_t ) );
+  }
+
+exit:
+  return err;
+}
+
+#endif
+
+uint8_t OTAGetUpgradeType( void )
+{
+  uint8_t type = 'U';
+#ifdef MICO_FLASH_FOR_UPDATE
+  OSStatus err;
+  uint32_t address = UPDATE_START_ADDRESS;
+  uint32_t magic = 0;
+
+  err = MicoFlashInitialize( MICO_FLASH_FOR_UPDATE );
+  require_noerr( err, exit );
+  err = MicoFlashRead( MICO_FLASH_FOR_UPDATE, &address, (uint8_t *)&magic, sizeof( uint32_t ) );
+  MicoFlashFinalize( MICO_FLASH_FOR_UPDATE );
+  require_noerr( err, exit );
+
+  if( magic == kLZStreamMagic )
+    type = 'Z';
+  else if( magic == kDeltaPatchMagic )
+    type = 'P';
+
+exit:
+#endif
+  return type;
+}
+
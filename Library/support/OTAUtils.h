@@ -0,0 +1,113 @@
+/**
+******************************************************************************
+* @file    OTAUtils.h
+* @author  William Xu
+* @version V1.0.0
+* @date    31-Oct-2014
+* @brief   This header contains function prototypes of the resumable OTA
+*          session, which keeps checkpoints of a download in the update
+*          partition.
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+
+#ifndef __OTAUtils_h__
+#define __OTAUtils_h__
+
+#include "Common.h"
+#include "MicoAlgorithm.h"
+#include "platform_common_config.h"
+
+//===========================================================================================================================
+//  Checkpoint log
+//
+//  The last OTA_CHECKPOINT_SIZE bytes of the update partition hold the session record in the first slot, followed by
+//  one checkpoint per slot. A checkpoint is the number of image bytes already in flash and the MD5 state of them, so
+//  a download continues from there without reading the image back. The log is only programmed, never erased, while
+//  the session lasts. A new session erases the update partition, and so does the bootloader once it used the image.
+//
+//  The last slot holds kOTAErasedMagic when the bootloader erased the partition, so it does not check every boot
+//  that the partition is blank. Whoever writes the partition first programs the marker to 0. Writers that do not, like
+//  older images, are caught by a blank check of the first sector, which is done even when the marker is set.
+//===========================================================================================================================
+
+#define kOTASessionMagic        0x4E53544F  // "OTSN"
+#define kOTACheckpointMagic     0x5043544F  // "OTCP"
+#define kOTAErasedMagic         0x5245544F  // "OTER"
+#define kOTACheckpointSlotSize  128
+
+#ifdef MICO_FLASH_FOR_UPDATE
+#define OTA_CHECKPOINT_SIZE             0x1000
+#define OTA_CHECKPOINT_START_ADDRESS    ( UPDATE_END_ADDRESS + 1 - OTA_CHECKPOINT_SIZE )
+#define OTA_ERASED_MARKER_ADDRESS       ( UPDATE_END_ADDRESS + 1 - kOTACheckpointSlotSize )
+#define OTA_CHECKPOINT_END_ADDRESS      ( OTA_ERASED_MARKER_ADDRESS - 1 )
+#define OTA_IMAGE_MAX_SIZE              ( UPDATE_FLASH_SIZE - OTA_CHECKPOINT_SIZE )
+#define OTA_CHECKPOINT_NUM              ( OTA_CHECKPOINT_SIZE / kOTACheckpointSlotSize - 2 )
+#endif
+
+typedef struct
+{
+    uint32_t        magic;          // kOTASessionMagic or kOTACheckpointMagic
+    uint32_t        length;         // Session: length of the image. Checkpoint: bytes in flash.
+    uint8_t         id[ 16 ];       // Session: MD5 of the image, all zero if it is not known
+    md5_context     hash;           // Checkpoint: MD5 state of the bytes in flash
+    uint32_t        crc;            // CRC32_Update() of the fields above
+} ota_checkpoint_t;
+
+typedef struct
+{
+    uint32_t        length;
+    uint8_t         id[ 16 ];
+    uint32_t        offset;             // Bytes of the image in flash
+    uint32_t        interval;           // Bytes between checkpoints, 0 if the session cannot be resumed
+    uint32_t        nextCheckpoint;     // Offset of the next checkpoint
+    uint32_t        checkpointAddress;  // Next free slot
+} ota_session_t;
+
+//===========================================================================================================================
+//  Session
+//===========================================================================================================================
+
+/* Continues the session of the same image if inResume is true and there is one, otherwise erases the update
+   partition and starts from 0. outSession->offset is where the image continues, outHash the MD5 state of the bytes
+   before it. A session without inID is never resumed. */
+OSStatus OTASessionOpen      ( ota_session_t *outSession, uint32_t inLength, const uint8_t *inID, bool inResume,
+                               md5_context *outHash );
+
+/* Programs the next bytes of the image */
+OSStatus OTASessionWrite     ( ota_session_t *inSession, const uint8_t *inData, size_t inLen );
+
+/* Records the current offset, inHash is the MD5 state of the bytes before it. Does nothing if the log is full or
+   the session cannot be resumed. */
+OSStatus OTASessionCheckpoint( ota_session_t *inSession, const md5_context *inHash );
+
+/* Checks the MD5 when the whole image is in flash and records it as complete */
+OSStatus OTASessionFinish    ( ota_session_t *inSession, const md5_context *inHash );
+
+/* Reads the session in the log, outOffset is the last checkpoint. Returns kNotFoundErr if there is none. */
+OSStatus OTASessionQuery     ( uint32_t *outLength, uint8_t *outID, uint32_t *outOffset );
+
+/* Must be called before the update partition is written without a session */
+OSStatus OTAClearErasedMarker( void );
+
+//===========================================================================================================================
+//  Image format
+//===========================================================================================================================
+
+/* upgrade_type of the boot table for the image in the update partition: 'Z' for an LZ stream, which the bootloader
+   decompresses, 'P' for a delta patch, which it applies to the current image, and 'U' for a plain image */
+uint8_t  OTAGetUpgradeType   ( void );
+
+#endif // __OTAUtils_h__
+
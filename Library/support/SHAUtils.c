@@ -33,7 +33,6 @@
 
 #define SHA1_BLOCK_SIZE     64
 
-static void _SHA1_Compress( SHA_CTX_compat *ctx, const uint8_t *inPtr );
 
 //===========================================================================================================================
 //  SHA1_Init_compat
@@ -64,7 +63,7 @@ int SHA1_Update_compat( SHA_CTX_compat *ctx, const void *inData, size_t inLen )
     {
         if( ( ctx->curlen == 0 ) && ( inLen >= SHA1_BLOCK_SIZE ) )
         {
-            _SHA1_Compress( ctx, src );
+            SHA1_Compress_compat( ctx->state, src );
             ctx->length += ( SHA1_BLOCK_SIZE * 8 );
             src         += SHA1_BLOCK_SIZE;
             inLen       -= SHA1_BLOCK_SIZE;
@@ -78,7 +77,7 @@ int SHA1_Update_compat( SHA_CTX_compat *ctx, const void *inData, size_t inLen )
             inLen       -= n;
             if( ctx->curlen == SHA1_BLOCK_SIZE )
             {
-                _SHA1_Compress( ctx, ctx->buf );
+                SHA1_Compress_compat( ctx->state, ctx->buf );
                 ctx->length += ( SHA1_BLOCK_SIZE * 8 );
                 ctx->curlen = 0;
             }
@@ -102,7 +101,7 @@ int SHA1_Final_compat( unsigned char *outDigest, SHA_CTX_compat *ctx )
     if( ctx->curlen > 56 )
     {
         while( ctx->curlen < 64 ) ctx->buf[ ctx->curlen++ ] = 0;
-        _SHA1_Compress( ctx, ctx->buf );
+        SHA1_Compress_compat( ctx->state, ctx->buf );
         ctx->curlen = 0;
     }
 
@@ -111,7 +110,7 @@ int SHA1_Final_compat( unsigned char *outDigest, SHA_CTX_compat *ctx )
     
     // Store length.
     WriteBig64( ctx->buf + 56, ctx->length );
-    _SHA1_Compress( ctx, ctx->buf );
+    SHA1_Compress_compat( ctx->state, ctx->buf );
 
     // Copy output.
     for( i = 0; i < 5; ++i )
@@ -137,90 +136,79 @@ unsigned char * SHA1_compat( const void *inData, size_t inLen, unsigned char *ou
 }
 
 //===========================================================================================================================
-//  _SHA1_Compress
+//  SHA1_Compress_compat
 //===========================================================================================================================
 
 #define SHA1_F0( x, y, z )              (z ^ ( x & ( y ^ z ) ) )
 #define SHA1_F1( x, y, z )              (x ^ y ^ z )
 #define SHA1_F2( x, y, z )              ( ( x & y ) | ( z & ( x | y ) ) )
 #define SHA1_F3( x, y, z )              (x ^ y ^ z )
-#define SHA1_FF0( a, b, c, d, e, i )    e = ( ROTL32( a, 5 ) + SHA1_F0( b, c, d ) + e + W[ i ] + UINT32_C( 0x5a827999 ) ); b = ROTL32( b, 30);
-#define SHA1_FF1( a, b, c, d, e, i )    e = ( ROTL32( a, 5 ) + SHA1_F1( b, c, d ) + e + W[ i ] + UINT32_C( 0x6ed9eba1 ) ); b = ROTL32( b, 30);
-#define SHA1_FF2( a, b, c, d, e, i )    e = ( ROTL32( a, 5 ) + SHA1_F2( b, c, d ) + e + W[ i ] + UINT32_C( 0x8f1bbcdc ) ); b = ROTL32( b, 30);
-#define SHA1_FF3( a, b, c, d, e, i )    e = ( ROTL32( a, 5 ) + SHA1_F3( b, c, d ) + e + W[ i ] + UINT32_C( 0xca62c1d6 ) ); b = ROTL32( b, 30);
-
-static void _SHA1_Compress( SHA_CTX_compat *ctx, const uint8_t *inPtr )
+#define SHA1_FF0( a, b, c, d, e, w )    e = ( ROTL32( a, 5 ) + SHA1_F0( b, c, d ) + e + (w) + UINT32_C( 0x5a827999 ) ); b = ROTL32( b, 30);
+#define SHA1_FF1( a, b, c, d, e, w )    e = ( ROTL32( a, 5 ) + SHA1_F1( b, c, d ) + e + (w) + UINT32_C( 0x6ed9eba1 ) ); b = ROTL32( b, 30);
+#define SHA1_FF2( a, b, c, d, e, w )    e = ( ROTL32( a, 5 ) + SHA1_F2( b, c, d ) + e + (w) + UINT32_C( 0x8f1bbcdc ) ); b = ROTL32( b, 30);
+#define SHA1_FF3( a, b, c, d, e, w )    e = ( ROTL32( a, 5 ) + SHA1_F3( b, c, d ) + e + (w) + UINT32_C( 0xca62c1d6 ) ); b = ROTL32( b, 30);
+
+// The message schedule is kept in a 16 word window, W[ i ] is computed in place when round i needs it.
+#define SHA1_W( i )                     W[ ( i ) & 15 ]
+#define SHA1_X( i )                     ( SHA1_W( i ) = ROTL32( SHA1_W( (i)-3 ) ^ SHA1_W( (i)-8 ) ^ SHA1_W( (i)-14 ) ^ SHA1_W( i ), 1 ) )
+#define SHA1_FF5( FF, i, X ) \
+    FF( a, b, c, d, e, X( (i)+0 ) ) \
+    FF( e, a, b, c, d, X( (i)+1 ) ) \
+    FF( d, e, a, b, c, X( (i)+2 ) ) \
+    FF( c, d, e, a, b, X( (i)+3 ) ) \
+    FF( b, c, d, e, a, X( (i)+4 ) )
+
+void SHA1_Compress_compat( uint32_t ioState[ 5 ], const uint8_t *inPtr )
 {
-    uint32_t        a, b, c, d, e, W[ 80 ], i, tmp;
+    uint32_t        a, b, c, d, e, W[ 16 ];
+    int             i;
     
-    // Copy the state into 512-bits into W[0..15].
     for( i = 0; i < 16; ++i )
     {
         W[ i ] = ReadBig32( inPtr );
         inPtr += 4;
     }
     
-    // Copy state
-    a = ctx->state[ 0 ];
-    b = ctx->state[ 1 ];
-    c = ctx->state[ 2 ];
-    d = ctx->state[ 3 ];
-    e = ctx->state[ 4 ];
-    
-    // Expand it
-    for( i = 16; i < 80; ++i )
-    {
-        tmp = W[ i-3 ] ^ W[ i-8 ] ^ W[ i-14 ] ^ W[ i-16 ];
-        W[ i ] = ROTL32( tmp, 1 ); 
-    }
+    a = ioState[ 0 ];
+    b = ioState[ 1 ];
+    c = ioState[ 2 ];
+    d = ioState[ 3 ];
+    e = ioState[ 4 ];
     
-    // Compress
     // Round 1
-    for( i = 0; i < 20; )
-    {
-        SHA1_FF0( a, b, c, d, e, i++ );
-        SHA1_FF0( e, a, b, c, d, i++ );
-        SHA1_FF0( d, e, a, b, c, i++ );
-        SHA1_FF0( c, d, e, a, b, i++ );
-        SHA1_FF0( b, c, d, e, a, i++ );
-    }
+    SHA1_FF5( SHA1_FF0,  0, SHA1_W )
+    SHA1_FF5( SHA1_FF0,  5, SHA1_W )
+    SHA1_FF5( SHA1_FF0, 10, SHA1_W )
+    SHA1_FF0( a, b, c, d, e, SHA1_W( 15 ) )
+    SHA1_FF0( e, a, b, c, d, SHA1_X( 16 ) )
+    SHA1_FF0( d, e, a, b, c, SHA1_X( 17 ) )
+    SHA1_FF0( c, d, e, a, b, SHA1_X( 18 ) )
+    SHA1_FF0( b, c, d, e, a, SHA1_X( 19 ) )
     
     // Round 2
-    for( ; i < 40; )
-    { 
-        SHA1_FF1( a, b, c, d, e, i++ );
-        SHA1_FF1( e, a, b, c, d, i++ );
-        SHA1_FF1( d, e, a, b, c, i++ );
-        SHA1_FF1( c, d, e, a, b, i++ );
-        SHA1_FF1( b, c, d, e, a, i++ );
-    }
+    SHA1_FF5( SHA1_FF1, 20, SHA1_X )
+    SHA1_FF5( SHA1_FF1, 25, SHA1_X )
+    SHA1_FF5( SHA1_FF1, 30, SHA1_X )
+    SHA1_FF5( SHA1_FF1, 35, SHA1_X )
     
     // Round 3
-    for( ; i < 60; )
-    { 
-        SHA1_FF2( a, b, c, d, e, i++ );
-        SHA1_FF2( e, a, b, c, d, i++ );
-        SHA1_FF2( d, e, a, b, c, i++ );
-        SHA1_FF2( c, d, e, a, b, i++ );
-        SHA1_FF2( b, c, d, e, a, i++ );
-    }
+    SHA1_FF5( SHA1_FF2, 40, SHA1_X )
+    SHA1_FF5( SHA1_FF2, 45, SHA1_X )
+    SHA1_FF5( SHA1_FF2, 50, SHA1_X )
+    SHA1_FF5( SHA1_FF2, 55, SHA1_X )
     
     // Round 4
-    for( ; i < 80; )
-    { 
-        SHA1_FF3( a, b, c, d, e, i++ );
-        SHA1_FF3( e, a, b, c, d, i++ );
-        SHA1_FF3( d, e, a, b, c, i++ );
-        SHA1_FF3( c, d, e, a, b, i++ );
-        SHA1_FF3( b, c, d, e, a, i++ );
-    }
+    SHA1_FF5( SHA1_FF3, 60, SHA1_X )
+    SHA1_FF5( SHA1_FF3, 65, SHA1_X )
+    SHA1_FF5( SHA1_FF3, 70, SHA1_X )
+    SHA1_FF5( SHA1_FF3, 75, SHA1_X )
     
     // Store
-    ctx->state[ 0 ] = ctx->state[ 0 ] + a;
-    ctx->state[ 1 ] = ctx->state[ 1 ] + b;
-    ctx->state[ 2 ] = ctx->state[ 2 ] + c;
-    ctx->state[ 3 ] = ctx->state[ 3 ] + d;
-    ctx->state[ 4 ] = ctx->state[ 4 ] + e;
+    ioState[ 0 ] += a;
+    ioState[ 1 ] += b;
+    ioState[ 2 ] += c;
+    ioState[ 3 ] += d;
+    ioState[ 4 ] += e;
 }
 
 //===========================================================================================================================
@@ -253,7 +241,6 @@ static const uint64_t       K[ 80 ] =
     UINT64_C( 0x4cc5d4becb3e42b6 ), UINT64_C( 0x597f299cfc657e2a ), UINT64_C( 0x5fcb6fab3ad6faec ), UINT64_C( 0x6c44198c4a475817 )
 };
 
-static void _SHA512_Compress( SHA512_CTX_compat *ctx, const uint8_t *inPtr );
 
 //===========================================================================================================================
 //  SHA512_Init_compat
@@ -287,7 +274,7 @@ int SHA512_Update_compat( SHA512_CTX_compat *ctx, const void *inData, size_t inL
     {
         if( ( ctx->curlen == 0 ) && ( inLen >= SHA512_BLOCK_SIZE ) )
         {
-            _SHA512_Compress( ctx, src );
+            SHA512_Compress_compat( ctx->state, src );
             ctx->length += ( SHA512_BLOCK_SIZE * 8 );
             src         += SHA512_BLOCK_SIZE;
             inLen       -= SHA512_BLOCK_SIZE;
@@ -301,7 +288,7 @@ int SHA512_Update_compat( SHA512_CTX_compat *ctx, const void *inData, size_t inL
             inLen       -= n;
             if( ctx->curlen == SHA512_BLOCK_SIZE )
             {
-                _SHA512_Compress( ctx, ctx->buf );
+                SHA512_Compress_compat( ctx->state, ctx->buf );
                 ctx->length += ( SHA512_BLOCK_SIZE * 8 );
                 ctx->curlen = 0;
             }
@@ -325,7 +312,7 @@ int SHA512_Final_compat( unsigned char *outDigest, SHA512_CTX_compat *ctx )
     if( ctx->curlen > 112 )
     {
         while( ctx->curlen < 128 ) ctx->buf[ ctx->curlen++ ] = 0;
-        _SHA512_Compress( ctx, ctx->buf );
+        SHA512_Compress_compat( ctx->state, ctx->buf );
         ctx->curlen = 0;
     }
     
@@ -335,7 +322,7 @@ int SHA512_Final_compat( unsigned char *outDigest, SHA512_CTX_compat *ctx )
     
     // Store length
     WriteBig64( ctx->buf + 120, ctx->length );
-    _SHA512_Compress( ctx, ctx->buf );
+    SHA512_Compress_compat( ctx->state, ctx->buf );
     
     // Copy output
     for( i = 0; i < 8; ++i )
@@ -361,7 +348,7 @@ unsigned char * SHA512_compat( const void *inData, size_t inLen, unsigned char *
 }
 
 //===========================================================================================================================
-//  _SHA512_Compress
+//  SHA512_Compress_compat
 //===========================================================================================================================
 
 #define SHA512_Ch(x,y,z)        (z ^ (x & (y ^ z)))
@@ -372,54 +359,62 @@ unsigned char * SHA512_compat( const void *inData, size_t inLen, unsigned char *
 #define SHA512_Sigma1(x)        (SHA512_S(x, 14) ^ SHA512_S(x, 18) ^ SHA512_S(x, 41))
 #define SHA512_Gamma0(x)        (SHA512_S(x,  1) ^ SHA512_S(x,  8) ^ SHA512_R(x,  7))
 #define SHA512_Gamma1(x)        (SHA512_S(x, 19) ^ SHA512_S(x, 61) ^ SHA512_R(x,  6))
-#define SHA512_RND( a, b, c, d, e, f, g, h, i ) \
-     t0 = h + SHA512_Sigma1( e ) + SHA512_Ch( e, f, g ) + K[ i ] + W[ i ]; \
+#define SHA512_RND( a, b, c, d, e, f, g, h, i, w ) \
+     t0 = h + SHA512_Sigma1( e ) + SHA512_Ch( e, f, g ) + K[ i ] + (w); \
      t1 = SHA512_Sigma0( a ) + SHA512_Maj( a, b, c); \
      d += t0; \
      h  = t0 + t1;
 
-static void _SHA512_Compress( SHA512_CTX_compat *ctx, const uint8_t *inPtr )
+// The message schedule is kept in a 16 word window, W[ i ] is computed in place when round i needs it.
+#define SHA512_W( i )           W[ ( i ) & 15 ]
+#define SHA512_X( i )           ( SHA512_W( i ) += SHA512_Gamma1( SHA512_W( (i)-2 ) ) + SHA512_W( (i)-7 ) + SHA512_Gamma0( SHA512_W( (i)-15 ) ) )
+#define SHA512_RND8( i, X ) \
+     SHA512_RND( a, b, c, d, e, f, g, h, (i)+0, X( (i)+0 ) ) \
+     SHA512_RND( h, a, b, c, d, e, f, g, (i)+1, X( (i)+1 ) ) \
+     SHA512_RND( g, h, a, b, c, d, e, f, (i)+2, X( (i)+2 ) ) \
+     SHA512_RND( f, g, h, a, b, c, d, e, (i)+3, X( (i)+3 ) ) \
+     SHA512_RND( e, f, g, h, a, b, c, d, (i)+4, X( (i)+4 ) ) \
+     SHA512_RND( d, e, f, g, h, a, b, c, (i)+5, X( (i)+5 ) ) \
+     SHA512_RND( c, d, e, f, g, h, a, b, (i)+6, X( (i)+6 ) ) \
+     SHA512_RND( b, c, d, e, f, g, h, a, (i)+7, X( (i)+7 ) )
+
+void SHA512_Compress_compat( uint64_t ioState[ 8 ], const uint8_t *inPtr )
 {
-    uint64_t        S[ 8] , W[ 80 ], t0, t1;
+    uint64_t        a, b, c, d, e, f, g, h, W[ 16 ], t0, t1;
     int             i;
     
-    // Copy state into S
-    for( i = 0; i < 8; ++i )
-    {
-        S[ i ] = ctx->state[ i ];
-    }
-    
-    // Copy the state into 1024-bits into W[0..15]
     for( i = 0; i < 16; ++i )
     {
         W[ i ] = ReadBig64( inPtr );
         inPtr += 8;
     }
     
-    // Fill W[16..79]
-    for( i = 16; i < 80; ++i )
+    a = ioState[ 0 ];
+    b = ioState[ 1 ];
+    c = ioState[ 2 ];
+    d = ioState[ 3 ];
+    e = ioState[ 4 ];
+    f = ioState[ 5 ];
+    g = ioState[ 6 ];
+    h = ioState[ 7 ];
+    
+    // Compress, eight rounds per group so the state stays in registers
+    SHA512_RND8(  0, SHA512_W )
+    SHA512_RND8(  8, SHA512_W )
+    for( i = 16; i < 80; i += 8 )
     {
-        W[ i ] = SHA512_Gamma1( W[ i-2 ] ) + W[ i-7 ] + SHA512_Gamma0( W[ i-15 ] )  + W[ i-16 ];
-    }       
-    
-    // Compress
-    for( i = 0; i < 80; i += 8 )
-    {
-         SHA512_RND( S[ 0 ], S[ 1 ], S[ 2 ], S[ 3 ], S[ 4 ], S[ 5 ], S[ 6 ], S[ 7 ], i+0 );
-         SHA512_RND( S[ 7 ], S[ 0 ], S[ 1 ], S[ 2 ], S[ 3 ], S[ 4 ], S[ 5 ], S[ 6 ], i+1 );
-         SHA512_RND( S[ 6 ], S[ 7 ], S[ 0 ], S[ 1 ], S[ 2 ], S[ 3 ], S[ 4 ], S[ 5 ], i+2 );
-         SHA512_RND( S[ 5 ], S[ 6 ], S[ 7 ], S[ 0 ], S[ 1 ], S[ 2 ], S[ 3 ], S[ 4 ], i+3 );
-         SHA512_RND( S[ 4 ], S[ 5 ], S[ 6 ], S[ 7 ], S[ 0 ], S[ 1 ], S[ 2 ], S[ 3 ], i+4 );
-         SHA512_RND( S[ 3 ], S[ 4 ], S[ 5 ], S[ 6 ], S[ 7 ], S[ 0 ], S[ 1 ], S[ 2 ], i+5 );
-         SHA512_RND( S[ 2 ], S[ 3 ], S[ 4 ], S[ 5 ], S[ 6 ], S[ 7 ], S[ 0 ], S[ 1 ], i+6 );
-         SHA512_RND( S[ 1 ], S[ 2 ], S[ 3 ], S[ 4 ], S[ 5 ], S[ 6 ], S[ 7 ], S[ 0 ], i+7 );
+        SHA512_RND8( i, SHA512_X )
     }
     
     // Feedback
-    for( i = 0; i < 8; ++i )
-    {
-        ctx->state[ i ] += S[ i ];
-    }
+    ioState[ 0 ] += a;
+    ioState[ 1 ] += b;
+    ioState[ 2 ] += c;
+    ioState[ 3 ] += d;
+    ioState[ 4 ] += e;
+    ioState[ 5 ] += f;
+    ioState[ 6 ] += g;
+    ioState[ 7 ] += h;
 }
 
 //===========================================================================================================================
@@ -44,6 +44,9 @@ int SHA1_Update_compat( SHA_CTX_compat *ctx, const void *inData, size_t inLen );
 int SHA1_Final_compat( unsigned char *outDigest, SHA_CTX_compat *ctx );
 unsigned char * SHA1_compat( const void *inData, size_t inLen, unsigned char *outDigest );
 
+// Compress one 64 byte block into the state, also used by the RFC 6234 SHA-1 in HMAC_HKDF.
+void SHA1_Compress_compat( uint32_t ioState[ 5 ], const uint8_t *inPtr );
+
 //===========================================================================================================================
 //  SHA-512
 //===========================================================================================================================
@@ -62,6 +65,9 @@ int SHA512_Update_compat( SHA512_CTX_compat *ctx, const void *inData, size_t inL
 int SHA512_Final_compat( unsigned char *outDigest, SHA512_CTX_compat *ctx );
 unsigned char * SHA512_compat( const void *inData, size_t inLen, unsigned char *outDigest );
 
+// Compress one 128 byte block into the state, also used by the RFC 6234 SHA-512 in HMAC_HKDF.
+void SHA512_Compress_compat( uint64_t ioState[ 8 ], const uint8_t *inPtr );
+
 //===========================================================================================================================
 //  SHA-3 (Keccak)
 //===========================================================================================================================
@@ -55,3 +55,117 @@ OSStatus TLVGetNext( const uint8_t *    inSrc,
     return( kNoErr );
 }
 
+void TLVReaderInit( TLVReader_t *inReader, const uint8_t *inSrc, size_t inLen )
+{
+    inReader->ptr = inSrc;
+    inReader->end = inSrc + inLen;
+}
+
+OSStatus TLVReaderNext( TLVReader_t *inReader, TLVItem_t *outItem )
+{
+    const uint8_t *     src = inReader->ptr;
+    const uint8_t *     end = inReader->end;
+    size_t              fragmentLen;
+
+    if( (size_t)( end - src ) < 2 )
+        return( kNotFoundErr );
+
+    outItem->type       = src[ 0 ];
+    outItem->item       = src;
+    outItem->data       = src + 2;
+    outItem->len        = 0;
+    outItem->fragmented = false;
+
+    for( ;; )
+    {
+        fragmentLen = src[ 1 ];
+        if( (size_t)( end - src ) < 2 + fragmentLen )
+            return( kUnderrunErr );
+        outItem->len += fragmentLen;
+        src += 2 + fragmentLen;
+
+        // A full fragment followed by an item of the same type continues the value.
+        if( ( fragmentLen != kTLV8_MaxFragmentSize ) || ( (size_t)( end - src ) < 2 ) || ( src[ 0 ] != outItem->type ) )
+            break;
+        outItem->fragmented = true;
+    }
+
+    inReader->ptr = src;
+    return( kNoErr );
+}
+
+OSStatus TLVItemCopy( const TLVItem_t *inItem, uint8_t *outBuf, size_t inMaxLen )
+{
+    const uint8_t *     src = inItem->item;
+    size_t              remain = inItem->len;
+    size_t              fragmentLen;
+
+    if( remain > inMaxLen )
+        return( kSizeErr );
+
+    while( remain > 0 )
+    {
+        fragmentLen = src[ 1 ];
+        memcpy( outBuf, src + 2, fragmentLen );
+        outBuf += fragmentLen;
+        remain -= fragmentLen;
+        src += 2 + fragmentLen;
+    }
+    return( kNoErr );
+}
+
+const uint8_t * TLVItemGetData( const TLVItem_t *inItem, uint8_t *inBuf, size_t inBufLen )
+{
+    if( !inItem->fragmented )
+        return( inItem->data );
+    if( TLVItemCopy( inItem, inBuf, inBufLen ) != kNoErr )
+        return( NULL );
+    return( inBuf );
+}
+
+size_t TLVEncodedSize( size_t inLen )
+{
+    if( inLen == 0 )
+        return( 2 );
+    return( inLen + 2 * ( ( inLen + kTLV8_MaxFragmentSize - 1 ) / kTLV8_MaxFragmentSize ) );
+}
+
+void TLVWriterInit( TLVWriter_t *inWriter, uint8_t *inBuf, size_t inMaxLen )
+{
+    inWriter->buf = inBuf;
+    inWriter->ptr = inBuf;
+    inWriter->end = inBuf + inMaxLen;
+}
+
+OSStatus TLVWriterAppend( TLVWriter_t *inWriter, uint8_t inType, const void *inData, size_t inLen )
+{
+    const uint8_t *     src = (const uint8_t *) inData;
+    size_t              fragmentLen;
+
+    if( (size_t)( inWriter->end - inWriter->ptr ) < TLVEncodedSize( inLen ) )
+        return( kNoSpaceErr );
+
+    do
+    {
+        fragmentLen = ( inLen > kTLV8_MaxFragmentSize ) ? kTLV8_MaxFragmentSize : inLen;
+        *inWriter->ptr++ = inType;
+        *inWriter->ptr++ = (uint8_t) fragmentLen;
+        if( fragmentLen )
+            memcpy( inWriter->ptr, src, fragmentLen );
+        inWriter->ptr += fragmentLen;
+        src += fragmentLen;
+        inLen -= fragmentLen;
+    } while( inLen > 0 );
+
+    return( kNoErr );
+}
+
+OSStatus TLVWriterAppendUInt8( TLVWriter_t *inWriter, uint8_t inType, uint8_t inValue )
+{
+    return( TLVWriterAppend( inWriter, inType, &inValue, sizeof( uint8_t ) ) );
+}
+
+size_t TLVWriterLength( const TLVWriter_t *inWriter )
+{
+    return( (size_t)( inWriter->ptr - inWriter->buf ) );
+}
@@ -35,5 +35,52 @@ OSStatus TLVGetNext(
         size_t *            outLen, 
         const uint8_t **    outNext );
 
+#define kTLV8_MaxFragmentSize           255
+
+//! Values longer than 255 bytes are split into consecutive items of the same type.
+//! The reader merges them into one item, data is a view into the source buffer
+//! and only fragmented values have to be copied out by TLVItemCopy.
+typedef struct
+{
+    const uint8_t *     ptr;
+    const uint8_t *     end;
+} TLVReader_t;
+
+typedef struct
+{
+    uint8_t             type;
+    const uint8_t *     data;           //! First fragment, the whole value if not fragmented.
+    size_t              len;            //! Length of the whole value.
+    bool                fragmented;
+    const uint8_t *     item;           //! Start of the first fragment, used by TLVItemCopy.
+} TLVItem_t;
+
+void TLVReaderInit( TLVReader_t *inReader, const uint8_t *inSrc, size_t inLen );
+
+OSStatus TLVReaderNext( TLVReader_t *inReader, TLVItem_t *outItem );
+
+OSStatus TLVItemCopy( const TLVItem_t *inItem, uint8_t *outBuf, size_t inMaxLen );
+
+//! Returns the value in place, or reassembled in inBuf if it is fragmented. NULL if inBuf is too small.
+const uint8_t * TLVItemGetData( const TLVItem_t *inItem, uint8_t *inBuf, size_t inBufLen );
+
+//! The writer emits items into a caller allocated buffer, use TLVEncodedSize to size it.
+typedef struct
+{
+    uint8_t *           buf;
+    uint8_t *           ptr;
+    uint8_t *           end;
+} TLVWriter_t;
+
+size_t TLVEncodedSize( size_t inLen );
+
+void TLVWriterInit( TLVWriter_t *inWriter, uint8_t *inBuf, size_t inMaxLen );
+
+OSStatus TLVWriterAppend( TLVWriter_t *inWriter, uint8_t inType, const void *inData, size_t inLen );
+
+OSStatus TLVWriterAppendUInt8( TLVWriter_t *inWriter, uint8_t inType, uint8_t inValue );
+
+size_t TLVWriterLength( const TLVWriter_t *inWriter );
+
 #endif // __TLVUtils_h__
 
@@ -37,6 +37,7 @@
 #include "platform_common_config.h"
 #include "StringUtils.h"
 #include "HTTPUtils.h"
+#include "OTAUtils.h"
 #include "SocketUtils.h"
 
 #include "EasyLink.h"
@@ -554,6 +555,9 @@ OSStatus _FTCRespondInComingMessage(int fd, HTTPHeader_t* inHeader, mico_Context
     OSStatus err = kUnknownErr;
     const char *        value;
     size_t              valueSize;
+#ifdef MICO_FLASH_FOR_UPDATE
+    uint32_t            otaLength, otaOffset;
+#endif
 
     easylink_log_trace();
 
@@ -578,12 +582,15 @@ OSStatus _FTCRespondInComingMessage(int fd, HTTPHeader_t* inHeader, mico_Context
 #ifdef MICO_FLASH_FOR_UPDATE
         else if(strnicmpx( value, valueSize, kMIMEType_MXCHIP_OTA ) == 0){
           easylink_log("Receive OTA data!");
+          err = OTASessionQuery(&otaLength, NULL, &otaOffset);
+          require_noerr(err, exit);
+          require_action(otaOffset == otaLength, exit, err = kUnderrunErr);
           mico_rtos_lock_mutex(&inContext->flashContentInRam_mutex);
           memset(&inContext->flashContentInRam.bootTable, 0, sizeof(boot_table_t));
-          inContext->flashContentInRam.bootTable.length = inHeader->contentLength;
+          inContext->flashContentInRam.bootTable.length = otaLength;
           inContext->flashContentInRam.bootTable.start_address = UPDATE_START_ADDRESS;
           inContext->flashContentInRam.bootTable.type = 'A';
-          inContext->flashContentInRam.bootTable.upgrade_type = 'U';
+          inContext->flashContentInRam.bootTable.upgrade_type = OTAGetUpgradeType();
           inContext->flashContentInRam.micoSystemConfig.easyLinkEnable = false;
           MICOUpdateConfiguration(inContext);
           mico_rtos_unlock_mutex(&inContext->flashContentInRam_mutex);
@@ -35,6 +35,7 @@
 #include "Platform.h"
 #include "Platform_common_config.h"
 #include "HTTPUtils.h"
+#include "OTAUtils.h"
 
 
 #define config_log(M, ...) custom_log("CONFIG SERVER", M, ##__VA_ARGS__)
@@ -193,6 +194,9 @@ OSStatus _LocalConfigRespondInComingMessage(int fd, HTTPHeader_t* inHeader, mico
   uint8_t *httpResponse = NULL;
   size_t httpResponseLen = 0;
   json_object* report = NULL;
+#ifdef MICO_FLASH_FOR_UPDATE
+  uint32_t otaLength, otaOffset;
+#endif
   config_log_trace();
 
 #if 1
@@ -243,14 +247,20 @@ OSStatus _LocalConfigRespondInComingMessage(int fd, HTTPHeader_t* inHeader, mico
   }
 #ifdef MICO_FLASH_FOR_UPDATE
   else if(HTTPHeaderMatchURL( inHeader, kCONFIGURLOTA ) == kNoErr){
-    if(inHeader->contentLength > 0){
+    /* Reply the session progress to a query or a part of the image, the client continues from there */
+    if(inHeader->contentLength == 0 || OTASessionQuery(&otaLength, NULL, &otaOffset) != kNoErr || otaOffset != otaLength){
+      err = CreateHTTPOTAStatusMessage( &httpResponse, &httpResponseLen );
+      require_noerr( err, exit );
+      err = SocketSend( fd, httpResponse, httpResponseLen );
+      require_noerr( err, exit );
+    }else{
       config_log("Receive OTA data!");
       mico_rtos_lock_mutex(&inContext->flashContentInRam_mutex);
       memset(&inContext->flashContentInRam.bootTable, 0, sizeof(boot_table_t));
-      inContext->flashContentInRam.bootTable.length = inHeader->contentLength;
+      inContext->flashContentInRam.bootTable.length = otaLength;
       inContext->flashContentInRam.bootTable.start_address = UPDATE_START_ADDRESS;
       inContext->flashContentInRam.bootTable.type = 'A';
-      inContext->flashContentInRam.bootTable.upgrade_type = 'U';
+      inContext->flashContentInRam.bootTable.upgrade_type = OTAGetUpgradeType();
       MICOUpdateConfiguration(inContext);
       mico_rtos_unlock_mutex(&inContext->flashContentInRam_mutex);
       SocketClose(&fd);
@@ -100,7 +100,7 @@ typedef struct  _boot_table_t {
   uint32_t length; // file real length
   uint8_t version[8];
   uint8_t type; // B:bootloader, P:boot_table, A:application, D: 8782 driver
-  uint8_t upgrade_type; //u:upgrade, 
+  uint8_t upgrade_type; //U:upgrade, Z:upgrade from an LZ stream, P:patch the current image
   uint8_t reserved[6];
 }boot_table_t;
 
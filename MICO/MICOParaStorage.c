@@ -35,22 +35,208 @@
 #include "platform_common_config.h"
 #include "MicoPlatform.h"
 
+/* Parameter flash layout: a complete flash_content_t at PARA_START_ADDRESS, where
+   the bootloader reads and clears the boot table, followed by a log of records.
+   A record patches a byte range of flash_content_t after the boot table, so an
+   update only programs the bytes that changed. The region is erased and the
+   current content written as the new base only when the log is full, the boot
+   table changes or a torn record is found. */
+#define kParaRecordMagic        0x4150      /* "PA" */
+#define kParaRecordErased       0xFFFF
+#define kParaLogStart           (PARA_START_ADDRESS + ((sizeof(flash_content_t) + 3) & ~3UL))
+#define kParaDiffStart          sizeof(boot_table_t)  /* bootTable is the first member */
+
+typedef struct _para_record_t {
+  uint16_t          magic;
+  uint16_t          offset;
+  uint16_t          length;
+  uint16_t          crc;        /* CRC-16/CCITT over offset, length and data */
+} para_record_t;
+
+#define _ParaRecordSize( len )  ( ( sizeof(para_record_t) + (len) + 3 ) & ~3UL )
+
+static flash_content_t  paraFlashView;                /* Content that flash holds now */
+static bool             paraLogLoaded = false;
+static bool             paraLogDirty = false;         /* Bytes after paraLogEnd are not erased */
+static uint32_t         paraLogEnd = kParaLogStart;
+static mico_mutex_t     para_mutex = NULL;
+
+#define para_lock()     do{ if(para_mutex) mico_rtos_lock_mutex(&para_mutex); }while(0)
+#define para_unlock()   do{ if(para_mutex) mico_rtos_unlock_mutex(&para_mutex); }while(0)
+
 /* Update seed number every time*/
 static int32_t seedNum = 0;
 
-__weak void appRestoreDefault_callback(mico_Context_t *inContext)
+static uint16_t _ParaCRC16(uint16_t crc, const uint8_t *data, uint32_t len)
 {
+  int i;
 
+  while(len--){
+    crc ^= (uint16_t)(*data++) << 8;
+    for(i=0; i<8; i++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
 }
 
-OSStatus MICORestoreDefault(mico_Context_t *inContext)
-{ 
+static uint16_t _ParaRecordCRC(const para_record_t *record, const uint8_t *data)
+{
+  uint16_t crc;
+
+  crc = _ParaCRC16(0xFFFF, (const uint8_t *)&record->offset, sizeof(uint16_t));
+  crc = _ParaCRC16(crc, (const uint8_t *)&record->length, sizeof(uint16_t));
+  return _ParaCRC16(crc, data, record->length);
+}
+
+/* Read the base and replay every valid record into paraFlashView */
+static OSStatus _ParaLogLoad(void)
+{
+  OSStatus err = kNoErr;
+  para_record_t record;
+  uint32_t address = PARA_START_ADDRESS;
+  uint8_t *data = NULL;
+
+  err = MicoFlashRead(MICO_FLASH_FOR_PARA, &address, (uint8_t *)&paraFlashView, sizeof(flash_content_t));
+  require_noerr(err, exit);
+  data = malloc(sizeof(flash_content_t));
+  require_action(data, exit, err = kNoMemoryErr);
+
+  paraLogDirty = false;
+  for(paraLogEnd = kParaLogStart; paraLogEnd + sizeof(para_record_t) <= PARA_END_ADDRESS + 1; paraLogEnd += _ParaRecordSize(record.length)){
+    address = paraLogEnd;
+    err = MicoFlashRead(MICO_FLASH_FOR_PARA, &address, (uint8_t *)&record, sizeof(para_record_t));
+    require_noerr(err, exit);
+    if(record.magic == kParaRecordErased && record.offset == 0xFFFF && record.length == 0xFFFF && record.crc == 0xFFFF)
+      break;
+
+    if(record.magic != kParaRecordMagic || record.offset < kParaDiffStart ||
+       record.length == 0 || record.offset + record.length > sizeof(flash_content_t) ||
+       address + record.length > PARA_END_ADDRESS + 1){
+      paraLogDirty = true;
+      break;
+    }
+    err = MicoFlashRead(MICO_FLASH_FOR_PARA, &address, data, record.length);
+    require_noerr(err, exit);
+    if(_ParaRecordCRC(&record, data) != record.crc){
+      paraLogDirty = true;
+      break;
+    }
+    memcpy((uint8_t *)&paraFlashView + record.offset, data, record.length);
+  }
+  paraLogLoaded = true;
+
+exit:
+  if(data) free(data);
+  return err;
+}
+
+/* Erase the region and write paraFlashView as the new base, the log restarts empty */
+static OSStatus _ParaLogCompact(void)
+{
+  OSStatus err = kNoErr;
+  uint32_t address = PARA_START_ADDRESS;
+
+  paraLogDirty = true;
+  err = MicoFlashErase(MICO_FLASH_FOR_PARA, PARA_START_ADDRESS, PARA_END_ADDRESS);
+  require_noerr(err, exit);
+  err = MicoFlashWrite(MICO_FLASH_FOR_PARA, &address, (uint8_t *)&paraFlashView, sizeof(flash_content_t));
+  require_noerr(err, exit);
+  paraLogEnd = kParaLogStart;
+  paraLogDirty = false;
+
+exit:
+  return err;
+}
+
+static OSStatus _ParaLogAppend(const flash_content_t *content, uint32_t offset, uint32_t length)
+{
+  OSStatus err = kNoErr;
+  para_record_t record;
+  uint32_t address = paraLogEnd;
+
+  record.magic = kParaRecordMagic;
+  record.offset = offset;
+  record.length = length;
+  record.crc = _ParaRecordCRC(&record, (const uint8_t *)content + offset);
+
+  err = MicoFlashWrite(MICO_FLASH_FOR_PARA, &address, (uint8_t *)&record, sizeof(para_record_t));
+  require_noerr(err, exit);
+  err = MicoFlashWrite(MICO_FLASH_FOR_PARA, &address, (uint8_t *)content + offset, length);
+  require_noerr(err, exit);
+  memcpy((uint8_t *)&paraFlashView + offset, (const uint8_t *)content + offset, length);
+  paraLogEnd += _ParaRecordSize(length);
+
+exit:
+  if(err != kNoErr) paraLogDirty = true;
+  return err;
+}
+
+/* Next byte range from *offset where content differs from flash. Ranges closer
+   than a record header are merged, one record is cheaper than two. */
+static bool _ParaNextDiff(const flash_content_t *content, uint32_t *offset, uint32_t *length)
+{
+  const uint8_t *now = (const uint8_t *)content;
+  const uint8_t *old = (const uint8_t *)&paraFlashView;
+  uint32_t i = *offset, last, end;
+
+  while(i < sizeof(flash_content_t) && now[i] == old[i])
+    i++;
+  if(i == sizeof(flash_content_t))
+    return false;
+
+  last = i;
+  for(end = i + 1; end < sizeof(flash_content_t) && end - last <= sizeof(para_record_t); end++)
+    if(now[end] != old[end]) last = end;
+
+  *offset = i;
+  *length = last - i + 1;
+  return true;
+}
+
+static OSStatus _ParaSave(const flash_content_t *content)
+{
   OSStatus err = kNoErr;
-  uint32_t paraStartAddress, paraEndAddress;
- 
-  paraStartAddress = PARA_START_ADDRESS;
-  paraEndAddress = PARA_END_ADDRESS;
+  uint32_t offset, length, needed = 0;
+  bool compact;
 
+  para_lock();
+  if(paraLogLoaded == false){
+    err = _ParaLogLoad();
+    require_noerr(err, exit);
+  }
+
+  compact = paraLogDirty || memcmp(&content->bootTable, &paraFlashView.bootTable, sizeof(boot_table_t));
+  if(compact == false){
+    for(offset = kParaDiffStart; _ParaNextDiff(content, &offset, &length); offset += length)
+      needed += _ParaRecordSize(length);
+    compact = paraLogEnd + needed > PARA_END_ADDRESS + 1;
+  }
+
+  err = MicoFlashInitialize(MICO_FLASH_FOR_PARA);
+  require_noerr(err, exit);
+  if(compact){
+    memcpy(&paraFlashView, content, sizeof(flash_content_t));
+    err = _ParaLogCompact();
+  }else{
+    for(offset = kParaDiffStart; _ParaNextDiff(content, &offset, &length); offset += length){
+      err = _ParaLogAppend(content, offset, length);
+      if(err != kNoErr) break;
+    }
+  }
+  MicoFlashFinalize(MICO_FLASH_FOR_PARA);
+
+exit:
+  para_unlock();
+  return err;
+}
+
+__weak void appRestoreDefault_callback(mico_Context_t *inContext)
+{
+  (void)inContext;
+}
+
+OSStatus MICORestoreDefault(mico_Context_t *inContext)
+{ 
   /*wlan configration is not need to change to a default state, use easylink to do that*/
   sprintf(inContext->flashContentInRam.micoSystemConfig.name, DEFAULT_NAME);
   inContext->flashContentInRam.micoSystemConfig.configured = unConfigured;
@@ -63,25 +249,25 @@ OSStatus MICORestoreDefault(mico_Context_t *inContext)
   /*Application's default configuration*/
   appRestoreDefault_callback(inContext);
 
-  err = MicoFlashInitialize(MICO_FLASH_FOR_PARA);
-  require_noerr(err, exit);
-  err = MicoFlashErase(MICO_FLASH_FOR_PARA, paraStartAddress, paraEndAddress);
-  require_noerr(err, exit);
-  err = MicoFlashWrite(MICO_FLASH_FOR_PARA, &paraStartAddress, (void *)inContext, sizeof(flash_content_t));
-  require_noerr(err, exit);
-  err = MicoFlashFinalize(MICO_FLASH_FOR_PARA);
-  require_noerr(err, exit);
-
-exit:
-  return err;
+  return _ParaSave(&inContext->flashContentInRam);
 }
 
 OSStatus MICOReadConfiguration(mico_Context_t *inContext)
 {
-  uint32_t configInFlash;
   OSStatus err = kNoErr;
-  configInFlash = PARA_START_ADDRESS;
-  err = MicoFlashRead(MICO_FLASH_FOR_PARA, &configInFlash, (uint8_t *)&inContext->flashContentInRam, sizeof(flash_content_t));
+
+  /*Read at boot before any save, so the mutex exists before it is first taken*/
+  if(para_mutex == NULL){
+    err = mico_rtos_init_mutex(&para_mutex);
+    require_noerr(err, exit);
+  }
+
+  para_lock();
+  err = _ParaLogLoad();
+  memcpy(&inContext->flashContentInRam, &paraFlashView, sizeof(flash_content_t));
+  para_unlock();
+  require_noerr(err, exit);
+
   seedNum = inContext->flashContentInRam.micoSystemConfig.seed;
   if(seedNum == -1) seedNum = 0;
 
@@ -104,24 +290,6 @@ exit:
 
 OSStatus MICOUpdateConfiguration(mico_Context_t *inContext)
 {
-  OSStatus err = kNoErr;
-  uint32_t paraStartAddress, paraEndAddress;
- 
-  paraStartAddress = PARA_START_ADDRESS;
-  paraEndAddress = PARA_END_ADDRESS;
-
   inContext->flashContentInRam.micoSystemConfig.seed = ++seedNum;
-  err = MicoFlashInitialize(MICO_FLASH_FOR_PARA);
-  require_noerr(err, exit);
-  err = MicoFlashErase(MICO_FLASH_FOR_PARA, paraStartAddress, paraEndAddress);
-  require_noerr(err, exit);
-  err = MicoFlashWrite(MICO_FLASH_FOR_PARA, &paraStartAddress, (uint8_t *)&inContext->flashContentInRam, sizeof(flash_content_t));
-  require_noerr(err, exit);
-  err = MicoFlashFinalize(MICO_FLASH_FOR_PARA);
-  require_noerr(err, exit);
-
-exit:
-  return err;
+  return _ParaSave(&inContext->flashContentInRam);
 }
-
-
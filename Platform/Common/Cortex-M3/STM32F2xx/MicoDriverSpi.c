@@ -44,6 +44,9 @@
 ******************************************************/
 #define MAX_NUM_SPI_PRESCALERS     (8)
 #define SPI_DMA_TIMEOUT_LOOPS      (10000)
+#define SPI_DMA_TIMEOUT_LOOPS_PER_BYTE (100)
+#define SPI_DMA_MIN_LENGTH         (16)     /* Shorter segments are faster without the DMA setup */
+#define SPI_DMA_MAX_LENGTH         (0xFFFF) /* DMA_BufferSize is 16 bits */
 
 /******************************************************
 *                   Enumerations
@@ -94,12 +97,16 @@ static const spi_baudrate_division_mapping_t spi_baudrate_prescalers[MAX_NUM_SPI
 
 static mico_spi_device_t* current_spi_device = NULL;
 
+/* Source of the dummy bytes and sink of the dropped ones, the DMA still runs after spi_dma_config returns */
+static uint8_t spi_dma_dummy_tx = 0xFF;
+static uint8_t spi_dma_dummy_rx;
+
 /******************************************************
 *               Function Declarations
 ******************************************************/
 
 static OSStatus wiced_spi_configure_baudrate( uint32_t speed, uint16_t* prescaler );
-static OSStatus spi_dma_transfer            ( const mico_spi_device_t* spi );
+static OSStatus spi_dma_transfer            ( const mico_spi_device_t* spi, uint32_t length );
 static void           spi_dma_config              ( const mico_spi_device_t* spi, mico_spi_message_segment_t* message );
 
 /******************************************************
@@ -124,9 +131,10 @@ static OSStatus wiced_spi_configure_baudrate( uint32_t speed, uint16_t* prescale
   return kGeneralErr;
 }
 
-static OSStatus spi_dma_transfer( const mico_spi_device_t* spi )
+static OSStatus spi_dma_transfer( const mico_spi_device_t* spi, uint32_t length )
 {
   uint32_t loop_count;
+  OSStatus result = kNoErr;
   
   /* Enable dma channels that have just been configured */
   DMA_Cmd(spi_mapping[spi->port].rx_dma_stream, ENABLE);
@@ -139,21 +147,21 @@ static OSStatus spi_dma_transfer( const mico_spi_device_t* spi )
   {
     loop_count++;
     /* Check if we've run out of time */
-    if ( loop_count >= (uint32_t) SPI_DMA_TIMEOUT_LOOPS )
+    if ( loop_count >= (uint32_t) SPI_DMA_TIMEOUT_LOOPS + length * SPI_DMA_TIMEOUT_LOOPS_PER_BYTE )
     {
-      MicoGpioOutputHigh(spi->chip_select);
-      return kTimeoutErr;
+      result = kTimeoutErr;
+      break;
     }
   }
   
-  MicoGpioOutputHigh(spi->chip_select);
-  return kNoErr;
+  /* Chip select stays active, MicoSpiTransfer releases it after the last segment */
+  SPI_I2S_DMACmd( spi_mapping[spi->port].spi_regs, SPI_I2S_DMAReq_Tx | SPI_I2S_DMAReq_Rx, DISABLE );
+  return result;
 }
 
 static void spi_dma_config( const mico_spi_device_t* spi, mico_spi_message_segment_t* message )
 {
   DMA_InitTypeDef dma_init;
-  uint8_t         dummy = 0xFF;
   
   check_string( (spi != NULL) && (message != NULL), "Bad args");
   
@@ -182,7 +190,7 @@ static void spi_dma_config( const mico_spi_device_t* spi, mico_spi_message_segme
   }
   else
   {
-    dma_init.DMA_Memory0BaseAddr = ( uint32_t )(&dummy);
+    dma_init.DMA_Memory0BaseAddr = ( uint32_t )(&spi_dma_dummy_tx);
     dma_init.DMA_MemoryInc       = DMA_MemoryInc_Disable;
   }
   
@@ -215,7 +223,7 @@ static void spi_dma_config( const mico_spi_device_t* spi, mico_spi_message_segme
   }
   else
   {
-    dma_init.DMA_Memory0BaseAddr = (uint32_t)&dummy;
+    dma_init.DMA_Memory0BaseAddr = (uint32_t)&spi_dma_dummy_rx;
     dma_init.DMA_MemoryInc = DMA_MemoryInc_Disable;
   }
   
@@ -240,6 +248,7 @@ OSStatus MicoSpiInitialize( const mico_spi_device_t* spi )
   gpio_init_structure.GPIO_Mode  = GPIO_Mode_AF;
   gpio_init_structure.GPIO_OType = GPIO_OType_PP;
   gpio_init_structure.GPIO_Speed = GPIO_Speed_100MHz;
+  gpio_init_structure.GPIO_PuPd  = GPIO_PuPd_NOPULL;
   gpio_init_structure.GPIO_Pin   = ((uint32_t) (1 << spi_mapping[spi->port].pin_clock->number)) |
     ((uint32_t) (1 << spi_mapping[spi->port].pin_miso->number )) |
       ((uint32_t) (1 << spi_mapping[spi->port].pin_mosi->number ));
@@ -349,14 +358,30 @@ OSStatus MicoSpiTransfer( const mico_spi_device_t* spi, mico_spi_message_segment
   
   for ( i = 0; i < number_of_segments; i++ )
   {
-    /* Check if we are using DMA */
-    if ( spi->mode & SPI_USE_DMA )
+    /* Check if we are using DMA, long segments are sent in pieces the DMA can count */
+    if ( ( spi->mode & SPI_USE_DMA ) && ( segments[i].length >= SPI_DMA_MIN_LENGTH ) )
     {
-      spi_dma_config( spi, &segments[i] );
-      result = spi_dma_transfer( spi );
-      if ( result != kNoErr )
+      mico_spi_message_segment_t piece = segments[i];
+      
+      count = segments[i].length;
+      while ( count != 0 )
       {
-        goto cleanup_transfer;
+        piece.length = ( count > SPI_DMA_MAX_LENGTH )? SPI_DMA_MAX_LENGTH : count;
+        spi_dma_config( spi, &piece );
+        result = spi_dma_transfer( spi, piece.length );
+        if ( result != kNoErr )
+        {
+          goto cleanup_transfer;
+        }
+        if ( piece.tx_buffer != NULL )
+        {
+          piece.tx_buffer = (const uint8_t*)piece.tx_buffer + piece.length;
+        }
+        if ( piece.rx_buffer != NULL )
+        {
+          piece.rx_buffer = (uint8_t*)piece.rx_buffer + piece.length;
+        }
+        count -= piece.length;
       }
     }
     else
@@ -122,6 +122,37 @@ OSStatus MicoFlashErase( mico_flash_t flash, uint32_t StartAddress, uint32_t End
     return kUnsupportedErr;
 }
 
+OSStatus MicoFlashGetSector( mico_flash_t flash, uint32_t Address, uint32_t *StartAddress, uint32_t *EndAddress )
+{
+  static const uint32_t sectorAddress[] = {
+    ADDR_FLASH_SECTOR_0, ADDR_FLASH_SECTOR_1, ADDR_FLASH_SECTOR_2, ADDR_FLASH_SECTOR_3,
+    ADDR_FLASH_SECTOR_4, ADDR_FLASH_SECTOR_5, ADDR_FLASH_SECTOR_6, ADDR_FLASH_SECTOR_7,
+    ADDR_FLASH_SECTOR_8, ADDR_FLASH_SECTOR_9, ADDR_FLASH_SECTOR_10, ADDR_FLASH_SECTOR_11,
+    FLASH_END_ADDRESS + 1
+  };
+  uint32_t sector;
+
+  if(flash == MICO_INTERNAL_FLASH){
+    if(Address<INTERNAL_FLASH_START_ADDRESS || Address > INTERNAL_FLASH_END_ADDRESS)
+      return kParamErr;
+    sector = _GetSector(Address)/FLASH_Sector_1;
+    *StartAddress = sectorAddress[sector];
+    *EndAddress = sectorAddress[sector+1] - 1;
+    return kNoErr;
+  }
+#ifdef USE_MICO_SPI_FLASH
+  else if(flash == MICO_SPI_FLASH){
+    if(Address > SPI_FLASH_END_ADDRESS)
+      return kParamErr;
+    *StartAddress = Address & ~0xFFFUL;
+    *EndAddress = *StartAddress + 0xFFF;
+    return kNoErr;
+  }
+#endif
+  else
+    return kUnsupportedErr;
+}
+
 OSStatus MicoFlashWrite(mico_flash_t flash, volatile uint32_t* FlashAddress, uint8_t* Data ,uint32_t DataLength)
 {
   if(flash == MICO_INTERNAL_FLASH){
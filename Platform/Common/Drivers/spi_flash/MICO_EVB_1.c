@@ -9,6 +9,8 @@
  */
 #include "spi_flash_platform_interface.h"
 #include "stm32f2xx.h"
+#include "MICOPlatform.h"
+#include "MICORTOS.h"
 
 #define SFLASH_SPI                           SPI1
 #define SFLASH_SPI_CLK                       RCC_APB2Periph_SPI1
@@ -36,6 +38,17 @@
 #define SFLASH_CS_PORT                       GPIOA
 #define SFLASH_CS_CLK                        RCC_AHB1Periph_GPIOA
 
+#define SFLASH_DMA_CLK                       RCC_AHB1Periph_DMA2
+
+/* Bulk transfers go through the MICO SPI driver, on the same pins and mode */
+mico_spi_device_t mico_spi_flash =
+{
+    .port        = MICO_SPI_1,
+    .chip_select = MICO_GPIO_10,
+    .speed       = 30000000,
+    .mode        = ( SPI_CLOCK_RISING_EDGE | SPI_CLOCK_IDLE_HIGH | SPI_USE_DMA | SPI_MSB_FIRST ),
+    .bits        = 8
+};
 
 int sflash_platform_init( int peripheral_id, void** platform_peripheral_out )
 {
@@ -48,7 +61,7 @@ int sflash_platform_init( int peripheral_id, void** platform_peripheral_out )
     SFLASH_SPI_CLK_INIT( SFLASH_SPI_CLK, ENABLE );
 
     RCC_AHB1PeriphClockCmd( SFLASH_SPI_SCK_GPIO_CLK  | SFLASH_SPI_MISO_GPIO_CLK |
-                            SFLASH_SPI_MOSI_GPIO_CLK | SFLASH_CS_CLK, ENABLE      );
+                            SFLASH_SPI_MOSI_GPIO_CLK | SFLASH_CS_CLK | SFLASH_DMA_CLK, ENABLE );
 
 
     /* Use Alternate Functions for SPI pins */
@@ -123,7 +136,10 @@ int sflash_platform_send_recv_byte( void* platform_peripheral, unsigned char MOS
     /* read the received data */
     char x  = SPI_I2S_ReceiveData( SFLASH_SPI );
 
-    *( (char*) MISO_addr ) = x;
+    if ( MISO_addr != NULL )
+    {
+        *( (char*) MISO_addr ) = x;
+    }
     return 0;
 }
 
@@ -139,3 +155,27 @@ int sflash_platform_chip_deselect( void* platform_peripheral )
     return 0;
 }
 
+int sflash_platform_send_recv( void* platform_peripheral, sflash_platform_message_segment_t* segments, unsigned int number_of_segments )
+{
+    (void) platform_peripheral;
+
+    /* The segment layout is the one of mico_spi_message_segment_t */
+    if ( MicoSpiTransfer( &mico_spi_flash, (mico_spi_message_segment_t*) segments, (uint16_t) number_of_segments ) != kNoErr )
+    {
+        return -1;
+    }
+    return 0;
+}
+
+void sflash_platform_yield( void* platform_peripheral, unsigned int milliseconds )
+{
+    (void) platform_peripheral;
+
+#ifdef BOOTLOADER
+    /* Nothing else to run in the bootloader, keep polling */
+    (void) milliseconds;
+#else
+    mico_thread_msleep( milliseconds );
+#endif
+}
+
@@ -12,10 +12,22 @@
 #include "spi_flash.h"
 #include "spi_flash_internal.h"
 #include "spi_flash_platform_interface.h"
-#include <string.h> /* for NULL */
+#include <string.h> /* for NULL and memcpy */
 
 #define sFLASH_SPI_PAGESIZE       0x100
 
+/* Command, three address bytes and the dummy byte of FAST_READ */
+#define SFLASH_MAX_HEADER_SIZE    ( 5 )
+
+/* A status read takes about 2.5us at 30MHz. Page programs take about 0.7ms
+ * typical and 3ms at most, so their wait spins that long and never waits for
+ * a scheduler tick. Erases take tens of milliseconds, after a short spin their
+ * wait gives the CPU away in steps that grow up to the given maximum. */
+#define SFLASH_PROGRAM_SPIN_COUNT     ( 1200 )
+#define SFLASH_ERASE_SPIN_COUNT       ( 16 )
+#define SFLASH_PROGRAM_MAX_DELAY_MS   ( 1 )
+#define SFLASH_ERASE_MAX_DELAY_MS     ( 8 )
+
 int sflash_read_ID( const sflash_handle_t* const handle, void* const data_addr )
 {
     return generic_sflash_command( handle, SFLASH_READ_JEDEC_ID, 0, NULL, 3, NULL, data_addr );
@@ -99,11 +111,13 @@ int sflash_read_status_register( const sflash_handle_t* const handle, void* cons
 
 int sflash_read( const sflash_handle_t* const handle, unsigned long device_address, void* const data_addr, unsigned int size )
 {
-    char device_address_array[3] =  { ( ( device_address & 0x00FF0000 ) >> 16 ),
+    /* FAST_READ is followed by one dummy byte before the data */
+    char device_address_array[4] =  { ( ( device_address & 0x00FF0000 ) >> 16 ),
                                       ( ( device_address & 0x0000FF00 ) >>  8 ),
-                                      ( ( device_address & 0x000000FF ) >>  0 ) };
+                                      ( ( device_address & 0x000000FF ) >>  0 ),
+                                      SFLASH_DUMMY_BYTE };
 
-    return generic_sflash_command( handle, SFLASH_READ, 3, device_address_array, size, NULL, data_addr );
+    return generic_sflash_command( handle, SFLASH_FAST_READ, 4, device_address_array, size, NULL, data_addr );
 }
 
 
@@ -164,7 +178,7 @@ int sflash_write_page( const sflash_handle_t* const handle, unsigned long device
 #ifdef SFLASH_SUPPORT_WINBOND_PARTS
     if ( SFLASH_MANUFACTURER( handle->device_id ) == SFLASH_MANUFACTURER_WINBOND )
     {
-        max_write_size = 256;  /* TODO: this should be 256, but that causes write errors */
+        max_write_size = 256;
         enable_before_every_write = 1;
     }
 #endif /* ifdef SFLASH_SUPPORT_MACRONIX_PARTS */
@@ -362,12 +376,42 @@ int init_sflash( sflash_handle_t* const handle, int peripheral_id, sflash_write_
 
 
 
+static int sflash_wait_while_busy( const sflash_handle_t* const handle, unsigned int spin_count, unsigned int max_delay_ms )
+{
+    int status;
+    unsigned int polls = 0;
+    unsigned int delay_ms = 1;
+    unsigned char status_register;
+
+    while ( 1 )
+    {
+        if ( 0 != ( status = sflash_read_status_register( handle, &status_register ) ) )
+        {
+            return status;
+        }
+        if ( ( status_register & SFLASH_STATUS_REGISTER_BUSY ) == 0 )
+        {
+            return 0;
+        }
+        if ( ++polls < spin_count )
+        {
+            continue;
+        }
+
+        sflash_platform_yield( handle->platform_peripheral, delay_ms );
+        if ( delay_ms < max_delay_ms )
+        {
+            delay_ms <<= 1;
+        }
+    }
+}
+
 int generic_sflash_command( const sflash_handle_t* const handle, sflash_command_t cmd, unsigned int num_initial_parameter_bytes, const void* const parameter_bytes, int num_data_bytes, const void* const data_MOSI, void* const data_MISO )
 {
     int status;
-    unsigned char* data_MISO_ptr = (unsigned char*) data_MISO;
-    unsigned char* data_MOSI_ptr = (unsigned char*) data_MOSI;
-    unsigned char* parameter_bytes_ptr = (unsigned char*) parameter_bytes;
+    unsigned char header[SFLASH_MAX_HEADER_SIZE];
+    sflash_platform_message_segment_t segments[2];
+    unsigned int number_of_segments = 1;
     char is_write_command = ( ( cmd == SFLASH_WRITE ) ||
             ( cmd == SFLASH_CHIP_ERASE1 ) ||
             ( cmd == SFLASH_CHIP_ERASE2 ) ||
@@ -375,61 +419,47 @@ int generic_sflash_command( const sflash_handle_t* const handle, sflash_command_
             ( cmd == SFLASH_BLOCK_ERASE_MID ) ||
             ( cmd == SFLASH_BLOCK_ERASE_LARGE ) );
 
-    sflash_platform_chip_select( handle->platform_peripheral );
-
-    if ( 0 != ( status = sflash_platform_send_recv_byte( handle->platform_peripheral, cmd, NULL ) ) )
+    if ( parameter_bytes == NULL )
     {
-        return status;
+        num_initial_parameter_bytes = 0;
     }
-
-    while ( ( parameter_bytes != NULL ) &&
-            ( num_initial_parameter_bytes > 0 ) )
+    if ( num_initial_parameter_bytes > SFLASH_MAX_HEADER_SIZE - 1 )
     {
-        if ( 0 != ( status = sflash_platform_send_recv_byte( handle->platform_peripheral, *parameter_bytes_ptr, NULL ) ) )
-        {
-            return status;
-        }
-        parameter_bytes_ptr++;
-        num_initial_parameter_bytes--;
+        return -1;
     }
 
-
-    while ( num_data_bytes > 0 )
+    /* The command and its parameters go out in one segment, the data in a second one */
+    header[0] = (unsigned char) cmd;
+    if ( num_initial_parameter_bytes > 0 )
     {
-        unsigned char dummy_dest;
-        if ( 0 != ( status = sflash_platform_send_recv_byte( handle->platform_peripheral, ( data_MOSI == NULL )? SFLASH_DUMMY_BYTE : *data_MOSI_ptr, ( data_MISO == NULL )? &dummy_dest : data_MISO_ptr ) ) )
-        {
-            return status;
-        }
-        if ( data_MOSI != NULL )
-        {
-            data_MOSI_ptr++;
-        }
-        if ( data_MISO != NULL )
-        {
-            data_MISO_ptr++;
-        }
-        num_data_bytes--;
+        memcpy( &header[1], parameter_bytes, num_initial_parameter_bytes );
     }
+    segments[0].tx_buffer = header;
+    segments[0].rx_buffer = NULL;
+    segments[0].length    = 1 + num_initial_parameter_bytes;
 
+    if ( num_data_bytes > 0 )
+    {
+        segments[1].tx_buffer = data_MOSI;
+        segments[1].rx_buffer = data_MISO;
+        segments[1].length    = (uint32_t) num_data_bytes;
+        number_of_segments++;
+    }
 
-    sflash_platform_chip_deselect( handle->platform_peripheral );
+    if ( 0 != ( status = sflash_platform_send_recv( handle->platform_peripheral, segments, number_of_segments ) ) )
+    {
+        return status;
+    }
 
     if ( is_write_command )
     {
-        unsigned char status_register;
         /* write commands require waiting until chip is finished writing */
-
-        do
+        if ( cmd == SFLASH_WRITE )
         {
-            if ( 0 != ( status = sflash_read_status_register( handle, &status_register ) ) )
-            {
-                return status;
-            }
-        } while( ( status_register & SFLASH_STATUS_REGISTER_BUSY ) != 0 );
-
+            return sflash_wait_while_busy( handle, SFLASH_PROGRAM_SPIN_COUNT, SFLASH_PROGRAM_MAX_DELAY_MS );
+        }
+        return sflash_wait_while_busy( handle, SFLASH_ERASE_SPIN_COUNT, SFLASH_ERASE_MAX_DELAY_MS );
     }
 
     return 0;
 }
-
@@ -0,0 +1,391 @@
+/**
+******************************************************************************
+* @file    spi_flash_host.c
+* @author  William Xu
+* @version V1.0.0
+* @date    24-Oct-2014
+* @brief   This file provides the sflash platform hooks on a workstation. The
+*          hooks drive a model of a SPI NOR flash that decodes the commands
+*          sent by spi_flash.c and counts the bus time they would take.
+******************************************************************************
+*
+*  The MIT License
+*  Copyright (c) 2014 MXCHIP Inc.
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is furnished
+*  to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in
+*  all copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+*  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+*  IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "spi_flash_internal.h"
+#include "spi_flash_platform_interface.h"
+#include "spi_flash_host.h"
+
+#define SFLASH_HOST_SIZE            ( 0x100000 )
+#define SFLASH_HOST_PAGE_SIZE       ( 256 )
+#define SFLASH_HOST_SECTOR_SIZE     ( 0x1000 )
+#define SFLASH_HOST_BLOCK_SIZE      ( 0x10000 )
+
+/* Bus timing of a STM32F2xx at 120MHz driving SPI1 at 30MHz */
+#define SFLASH_HOST_BYTE_NS         ( 267 )     /* 8 clocks                                 */
+#define SFLASH_HOST_POLLED_BYTE_NS  ( 500 )     /* TXE/RXNE handshake of a byte sent by CPU */
+#define SFLASH_HOST_SELECT_NS       ( 1000 )    /* Chip select cycle                        */
+#define SFLASH_HOST_DMA_SETUP_NS    ( 4000 )    /* Both DMA streams of one segment          */
+#define SFLASH_HOST_DMA_MIN_LENGTH  ( 16 )      /* Same limit as MicoSpiTransfer            */
+
+/* Typical durations of a 4K sector SPI NOR flash, the same as the host flash emulator */
+#define SFLASH_HOST_BYTE_PROGRAM_NS ( 8000ULL )
+#define SFLASH_HOST_PAGE_PROGRAM_NS ( 700000ULL )
+#define SFLASH_HOST_SECTOR_ERASE_NS ( 45000000ULL )
+#define SFLASH_HOST_BLOCK_ERASE_NS  ( 150000000ULL )
+#define SFLASH_HOST_CHIP_ERASE_NS   ( 3000000000ULL )
+
+typedef struct
+{
+    unsigned char*  memory;
+    unsigned char   page[SFLASH_HOST_PAGE_SIZE];
+    unsigned char   write_enabled;
+    unsigned char   protect_bits;
+    uint64_t        busy_until_ns;
+
+    /* Command being clocked while the chip is selected */
+    int             selected;
+    unsigned char   command;
+    unsigned long   position;       /* Bytes clocked since chip select */
+    unsigned long   address;
+    unsigned long   page_length;
+
+    sflash_host_stats_t stats;
+} sflash_host_t;
+
+static sflash_host_t sflash_host;
+
+static void sflash_host_advance( uint64_t ns )
+{
+    sflash_host.stats.elapsed_ns += ns;
+    sflash_host.stats.cpu_ns     += ns;
+}
+
+static int sflash_host_busy( void )
+{
+    return sflash_host.stats.elapsed_ns < sflash_host.busy_until_ns;
+}
+
+static unsigned long sflash_host_address_bytes( unsigned char command )
+{
+    switch ( command )
+    {
+        case SFLASH_READ:
+        case SFLASH_WRITE:
+        case SFLASH_SECTOR_ERASE:
+        case SFLASH_BLOCK_ERASE_MID:
+        case SFLASH_BLOCK_ERASE_LARGE:
+            return 3;
+        case SFLASH_FAST_READ:
+            return 4; /* Address and the dummy byte */
+        default:
+            return 0;
+    }
+}
+
+static void sflash_host_select( void )
+{
+    sflash_host.selected    = 1;
+    sflash_host.position    = 0;
+    sflash_host.address     = 0;
+    sflash_host.page_length = 0;
+    sflash_host.stats.transfers++;
+}
+
+static unsigned char sflash_host_clock( unsigned char MOSI_val )
+{
+    unsigned char MISO_val = 0xFF;
+    unsigned long position = sflash_host.position++;
+    unsigned long address_bytes;
+
+    sflash_host.stats.bus_bytes++;
+
+    if ( position == 0 )
+    {
+        sflash_host.command = MOSI_val;
+        if ( MOSI_val == SFLASH_READ_STATUS_REGISTER )
+        {
+            sflash_host.stats.status_polls++;
+        }
+        return MISO_val;
+    }
+
+    /* A busy chip only answers status reads */
+    if ( sflash_host_busy( ) && sflash_host.command != SFLASH_READ_STATUS_REGISTER )
+    {
+        return MISO_val;
+    }
+
+    address_bytes = sflash_host_address_bytes( sflash_host.command );
+    if ( position <= address_bytes )
+    {
+        if ( position <= 3 )
+        {
+            sflash_host.address = ( ( sflash_host.address << 8 ) | MOSI_val ) % SFLASH_HOST_SIZE;
+        }
+        return MISO_val;
+    }
+
+    switch ( sflash_host.command )
+    {
+        case SFLASH_READ_JEDEC_ID:
+            if ( position <= 3 )
+            {
+                MISO_val = (unsigned char) ( SFLASH_ID_W25X80AVSIG >> ( 8 * ( 3 - position ) ) );
+            }
+            break;
+
+        case SFLASH_READ_STATUS_REGISTER:
+            MISO_val = sflash_host.protect_bits;
+            if ( sflash_host.write_enabled )
+            {
+                MISO_val |= SFLASH_STATUS_REGISTER_WRITE_ENABLED;
+            }
+            if ( sflash_host_busy( ) )
+            {
+                MISO_val |= SFLASH_STATUS_REGISTER_BUSY;
+            }
+            break;
+
+        case SFLASH_WRITE_STATUS_REGISTER:
+            if ( position == 1 )
+            {
+                sflash_host.protect_bits = MOSI_val & ( SFLASH_STATUS_REGISTER_BLOCK_PROTECTED_0 |
+                                                        SFLASH_STATUS_REGISTER_BLOCK_PROTECTED_1 |
+                                                        SFLASH_STATUS_REGISTER_BLOCK_PROTECTED_2 );
+                sflash_host.write_enabled = 0;
+            }
+            break;
+
+        case SFLASH_READ:
+        case SFLASH_FAST_READ:
+            MISO_val = sflash_host.memory[sflash_host.address];
+            sflash_host.address = ( sflash_host.address + 1 ) % SFLASH_HOST_SIZE;
+            break;
+
+        case SFLASH_WRITE:
+            /* The page buffer wraps around, like on the chip */
+            sflash_host.page[( sflash_host.address + position - 4 ) % SFLASH_HOST_PAGE_SIZE] = MOSI_val;
+            if ( sflash_host.page_length < SFLASH_HOST_PAGE_SIZE )
+            {
+                sflash_host.page_length++;
+            }
+            break;
+
+        default:
+            break;
+    }
+    return MISO_val;
+}
+
+/* Program and erase commands start when the chip is deselected */
+static void sflash_host_deselect( void )
+{
+    unsigned long start;
+    unsigned long length = 0;
+    unsigned long i;
+    uint64_t busy_ns = 0;
+
+    if ( !sflash_host.selected )
+    {
+        return;
+    }
+    sflash_host.selected = 0;
+
+    if ( sflash_host.position == 0 || sflash_host_busy( ) )
+    {
+        return;
+    }
+
+    switch ( sflash_host.command )
+    {
+        case SFLASH_WRITE_ENABLE:
+            sflash_host.write_enabled = 1;
+            return;
+
+        case SFLASH_WRITE_DISABLE:
+            sflash_host.write_enabled = 0;
+            return;
+
+        case SFLASH_WRITE:
+            if ( !sflash_host.write_enabled || sflash_host.position < 5 || sflash_host.protect_bits != 0 )
+            {
+                break;
+            }
+            /* Programming only clears bits */
+            start = sflash_host.address & ~( SFLASH_HOST_PAGE_SIZE - 1 );
+            for ( i = 0; i < sflash_host.page_length; i++ )
+            {
+                unsigned long column = ( sflash_host.address + i ) % SFLASH_HOST_PAGE_SIZE;
+                sflash_host.memory[start + column] &= sflash_host.page[column];
+            }
+            busy_ns = SFLASH_HOST_BYTE_PROGRAM_NS + ( SFLASH_HOST_PAGE_PROGRAM_NS - SFLASH_HOST_BYTE_PROGRAM_NS ) * sflash_host.page_length / SFLASH_HOST_PAGE_SIZE;
+            sflash_host.stats.page_programs++;
+            break;
+
+        case SFLASH_SECTOR_ERASE:
+            length  = SFLASH_HOST_SECTOR_SIZE;
+            busy_ns = SFLASH_HOST_SECTOR_ERASE_NS;
+            break;
+
+        case SFLASH_BLOCK_ERASE_MID:
+        case SFLASH_BLOCK_ERASE_LARGE:
+            length  = SFLASH_HOST_BLOCK_SIZE;
+            busy_ns = SFLASH_HOST_BLOCK_ERASE_NS;
+            break;
+
+        case SFLASH_CHIP_ERASE1:
+        case SFLASH_CHIP_ERASE2:
+            length  = SFLASH_HOST_SIZE;
+            busy_ns = SFLASH_HOST_CHIP_ERASE_NS;
+            break;
+
+        default:
+            return;
+    }
+
+    if ( length != 0 )
+    {
+        if ( !sflash_host.write_enabled || sflash_host.protect_bits != 0 )
+        {
+            return;
+        }
+        start = sflash_host.address & ~( length - 1 );
+        memset( &sflash_host.memory[start], 0xFF, length );
+        sflash_host.stats.erases++;
+    }
+
+    sflash_host.write_enabled = 0;
+    sflash_host.busy_until_ns = sflash_host.stats.elapsed_ns + busy_ns;
+}
+
+int sflash_platform_init( int peripheral_id, void** platform_peripheral_out )
+{
+    (void) peripheral_id; /* Unused due to single SPI Flash */
+
+    if ( sflash_host.memory == NULL )
+    {
+        sflash_host.memory = malloc( SFLASH_HOST_SIZE );
+        if ( sflash_host.memory == NULL )
+        {
+            return -1;
+        }
+        memset( sflash_host.memory, 0xFF, SFLASH_HOST_SIZE );
+        sflash_host.protect_bits = SFLASH_STATUS_REGISTER_BLOCK_PROTECTED_0 |
+                                   SFLASH_STATUS_REGISTER_BLOCK_PROTECTED_1 |
+                                   SFLASH_STATUS_REGISTER_BLOCK_PROTECTED_2;
+    }
+
+    *platform_peripheral_out = &sflash_host;
+    return 0;
+}
+
+int sflash_platform_send_recv_byte( void* platform_peripheral, unsigned char MOSI_val, void* MISO_addr )
+{
+    unsigned char MISO_val = sflash_host_clock( MOSI_val );
+
+    (void) platform_peripheral;
+    sflash_host_advance( SFLASH_HOST_BYTE_NS + SFLASH_HOST_POLLED_BYTE_NS );
+    if ( MISO_addr != NULL )
+    {
+        *( (unsigned char*) MISO_addr ) = MISO_val;
+    }
+    return 0;
+}
+
+int sflash_platform_chip_select( void* platform_peripheral )
+{
+    (void) platform_peripheral;
+    sflash_host_select( );
+    sflash_host_advance( SFLASH_HOST_SELECT_NS / 2 );
+    return 0;
+}
+
+int sflash_platform_chip_deselect( void* platform_peripheral )
+{
+    (void) platform_peripheral;
+    sflash_host_advance( SFLASH_HOST_SELECT_NS / 2 );
+    sflash_host_deselect( );
+    return 0;
+}
+
+int sflash_platform_send_recv( void* platform_peripheral, sflash_platform_message_segment_t* segments, unsigned int number_of_segments )
+{
+    unsigned int i;
+    uint32_t j;
+    uint64_t ns = SFLASH_HOST_SELECT_NS;
+
+    (void) platform_peripheral;
+    sflash_host_select( );
+
+    for ( i = 0; i < number_of_segments; i++ )
+    {
+        const unsigned char* tx = (const unsigned char*) segments[i].tx_buffer;
+        unsigned char*       rx = (unsigned char*) segments[i].rx_buffer;
+
+        for ( j = 0; j < segments[i].length; j++ )
+        {
+            unsigned char MISO_val = sflash_host_clock( ( tx != NULL )? tx[j] : 0xFF );
+            if ( rx != NULL )
+            {
+                rx[j] = MISO_val;
+            }
+        }
+
+        if ( segments[i].length >= SFLASH_HOST_DMA_MIN_LENGTH )
+        {
+            ns += SFLASH_HOST_DMA_SETUP_NS + (uint64_t) segments[i].length * SFLASH_HOST_BYTE_NS;
+        }
+        else
+        {
+            ns += (uint64_t) segments[i].length * ( SFLASH_HOST_BYTE_NS + SFLASH_HOST_POLLED_BYTE_NS );
+        }
+    }
+
+    sflash_host_advance( ns );
+    sflash_host_deselect( );
+    return 0;
+}
+
+void sflash_platform_yield( void* platform_peripheral, unsigned int milliseconds )
+{
+    (void) platform_peripheral;
+    sflash_host.stats.yields++;
+    sflash_host.stats.elapsed_ns += (uint64_t) milliseconds * 1000000;
+}
+
+void sflash_host_get_stats( sflash_host_stats_t* stats )
+{
+    *stats = sflash_host.stats;
+}
+
+void sflash_host_reset_stats( void )
+{
+    /* The clock keeps running so that a pending program or erase still completes */
+    uint64_t elapsed_ns = sflash_host.stats.elapsed_ns;
+
+    memset( &sflash_host.stats, 0, sizeof( sflash_host.stats ) );
+    sflash_host.busy_until_ns -= ( sflash_host.busy_until_ns > elapsed_ns )? elapsed_ns : sflash_host.busy_until_ns;
+}
@@ -0,0 +1,66 @@
+/**
+******************************************************************************
+* @file    spi_flash_host.h
+* @author  William Xu
+* @version V1.0.0
+* @date    24-Oct-2014
+* @brief   This file provides the statistics interface of the host SPI flash
+*          model, which implements the sflash platform hooks on a workstation.
+******************************************************************************
+*
+*  The MIT License
+*  Copyright (c) 2014 MXCHIP Inc.
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is furnished
+*  to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in
+*  all copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+*  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+*  IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************
+*/
+
+#ifndef INCLUDED_SPI_FLASH_HOST_H
+#define INCLUDED_SPI_FLASH_HOST_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* The model is a 1MByte W25X80 on a 30MHz bus. It keeps a clock of its own:
+ * every transfer advances it by the bus time, and sflash_platform_yield()
+ * by the requested milliseconds. Program and erase commands keep the BUSY
+ * bit set until the clock passes their typical duration. */
+
+typedef struct
+{
+    uint32_t transfers;      /* Chip select cycles                              */
+    uint32_t bus_bytes;      /* Bytes clocked on the bus                        */
+    uint32_t status_polls;   /* Read status register commands                   */
+    uint32_t yields;
+    uint32_t page_programs;
+    uint32_t erases;
+    uint64_t elapsed_ns;     /* Modelled time                                   */
+    uint64_t cpu_ns;         /* Part of it spent driving the bus, not yielded   */
+} sflash_host_stats_t;
+
+void sflash_host_get_stats  ( sflash_host_stats_t* stats );
+void sflash_host_reset_stats( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INCLUDED_SPI_FLASH_HOST_H */
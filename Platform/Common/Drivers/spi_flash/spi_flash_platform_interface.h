@@ -14,11 +14,28 @@
  extern "C" {
 #endif
 
+#include <stdint.h>
+
+/* One part of a command, laid out like mico_spi_message_segment_t.
+ * A NULL tx_buffer sends dummy bytes, a NULL rx_buffer drops what is received. */
+typedef struct
+{
+    const void*   tx_buffer;
+    void*         rx_buffer;
+    uint32_t      length;
+} sflash_platform_message_segment_t;
+
 extern int sflash_platform_init          ( int peripheral_id, void** platform_peripheral_out );
 extern int sflash_platform_send_recv_byte( void* platform_peripheral, unsigned char MOSI_val, void* MISO_addr );
 extern int sflash_platform_chip_select   ( void* platform_peripheral );
 extern int sflash_platform_chip_deselect ( void* platform_peripheral );
 
+/* Clocks all segments while the chip stays selected, so a command is one bulk transfer */
+extern int sflash_platform_send_recv     ( void* platform_peripheral, sflash_platform_message_segment_t* segments, unsigned int number_of_segments );
+
+/* Called while the flash is busy, gives the CPU to other threads for about milliseconds */
+extern void sflash_platform_yield        ( void* platform_peripheral, unsigned int milliseconds );
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,341 @@
+/**
+******************************************************************************
+* @file    MicoDriverFlash.c
+* @author  William Xu
+* @version V1.0.0
+* @date    24-Oct-2014
+* @brief   This file provides flash operation functions on a Linux host. Each
+*          flash is emulated by an mmap'd file with NOR flash semantics and
+*          the sector map of the platform selected by platform_common_config.h.
+******************************************************************************
+*
+*  The MIT License
+*  Copyright (c) 2014 MXCHIP Inc.
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is furnished
+*  to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in
+*  all copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+*  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+*  IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************
+*/
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+/* MICORTOS.h maps mico_thread_sleep to a sleep() of its own */
+#define sleep posix_sleep
+#include <unistd.h>
+#undef sleep
+
+#include "Common.h"
+#include "Debug.h"
+#include "platform.h"
+#include "platform_common_config.h"
+#include "MicoDriverFlash.h"
+#include "MicoFlashEmu.h"
+
+#define flash_emu_log(M, ...) fprintf(stderr, "[FlashEmu] " M "\r\n", ##__VA_ARGS__)
+
+/* Private constants --------------------------------------------------------*/
+/* STM32F2xx/F4xx internal flash: 4 x 16K, 1 x 64K, then 128K sectors */
+static const uint32_t internalSectorSize[] = {
+  0x4000, 0x4000, 0x4000, 0x4000, 0x10000,
+  0x20000, 0x20000, 0x20000, 0x20000, 0x20000, 0x20000, 0x20000
+};
+
+/* Typical values: STM32F2xx x32 parallelism and a 4K sector SPI NOR flash */
+#define kInternalEraseUs16K     250000
+#define kInternalEraseUs64K     550000
+#define kInternalEraseUs128K    1000000
+#define kInternalProgramUs      16          /* One word or one unaligned byte */
+#define kSPIFlashSectorSize     0x1000
+#define kSPIFlashPageSize       256
+#define kSPIFlashEraseUs        45000
+#define kSPIFlashProgramUs      700         /* One page program */
+#define kSPIFlashReadNsPerByte  400         /* 20MHz SPI clock */
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct _flash_emu_t {
+  const char *            fileName;
+  uint32_t                startAddress;
+  uint32_t                endAddress;
+  const uint32_t *        sectorSize;       /* NULL: uniform sectors of uniformSectorSize */
+  uint32_t                uniformSectorSize;
+  bool                    programAnd;       /* SPI NOR ANDs a program over non erased cells */
+  uint8_t *               mem;
+  uint32_t                sectorCount;
+  uint32_t *              sectorEraseCount;
+  mico_flash_emu_stats_t  stats;
+} flash_emu_t;
+
+/* Private variables ---------------------------------------------------------*/
+static flash_emu_t flashEmu[MICO_FLASH_MAX] =
+{
+#ifdef USE_MICO_SPI_FLASH
+  [MICO_SPI_FLASH] = {
+    "mico_spi.flash", SPI_FLASH_START_ADDRESS, SPI_FLASH_END_ADDRESS,
+    NULL, kSPIFlashSectorSize, true,
+  },
+#endif
+  [MICO_INTERNAL_FLASH] = {
+    "mico_internal.flash", INTERNAL_FLASH_START_ADDRESS, INTERNAL_FLASH_END_ADDRESS,
+    internalSectorSize, 0, false,
+  },
+};
+
+const char* flash_name[] =
+{
+#ifdef USE_MICO_SPI_FLASH
+  [MICO_SPI_FLASH] = "SPI",
+#endif
+  [MICO_INTERNAL_FLASH] = "Internal",
+};
+
+/* Private functions ---------------------------------------------------------*/
+static uint32_t _SectorStart(flash_emu_t *emu, uint32_t sector)
+{
+  uint32_t i, address = emu->startAddress;
+
+  if(emu->sectorSize == NULL)
+    return address + sector * emu->uniformSectorSize;
+  for(i = 0; i < sector; i++)
+    address += emu->sectorSize[i];
+  return address;
+}
+
+static uint32_t _GetSector(flash_emu_t *emu, uint32_t address)
+{
+  uint32_t sector;
+
+  if(emu->sectorSize == NULL)
+    return (address - emu->startAddress) / emu->uniformSectorSize;
+  for(sector = 0; sector + 1 < emu->sectorCount; sector++)
+    if(address < _SectorStart(emu, sector + 1))
+      break;
+  return sector;
+}
+
+static uint32_t _SectorLength(flash_emu_t *emu, uint32_t sector)
+{
+  return emu->sectorSize ? emu->sectorSize[sector] : emu->uniformSectorSize;
+}
+
+static void _Busy(flash_emu_t *emu, uint64_t us)
+{
+  emu->stats.busyTimeUs += us;
+  if(us && getenv("MICO_FLASH_EMU_REALTIME"))
+    usleep(us);
+}
+
+/* Map the backing file on first use, the mapping is kept until exit so
+   pointers into internal flash stay valid. */
+static flash_emu_t * _FlashEmuGet(mico_flash_t flash)
+{
+  flash_emu_t *emu;
+  const char *dir;
+  char path[256];
+  struct stat st;
+  uint32_t size, covered;
+  void *hint = NULL;
+  int fd;
+
+  if(flash >= MICO_FLASH_MAX || flashEmu[flash].fileName == NULL)
+    return NULL;
+  emu = &flashEmu[flash];
+  if(emu->mem)
+    return emu;
+
+  size = emu->endAddress - emu->startAddress + 1;
+  if(emu->sectorSize == NULL){
+    emu->sectorCount = (size + emu->uniformSectorSize - 1) / emu->uniformSectorSize;
+  }else{
+    for(covered = 0; covered < size && emu->sectorCount < sizeof(internalSectorSize)/sizeof(uint32_t); emu->sectorCount++)
+      covered += emu->sectorSize[emu->sectorCount];
+  }
+  emu->sectorEraseCount = calloc(emu->sectorCount, sizeof(uint32_t));
+  require(emu->sectorEraseCount, exit);
+
+  dir = getenv("MICO_FLASH_EMU_DIR");
+  snprintf(path, sizeof(path), "%s/%s", dir ? dir : ".", emu->fileName);
+  fd = open(path, O_RDWR | O_CREAT, 0644);
+  require_action(fd >= 0, exit, flash_emu_log("Cannot open %s", path));
+  require_action(fstat(fd, &st) == 0, exit_close, flash_emu_log("Cannot stat %s", path));
+
+  /* Try to map internal flash at its real address, code that reads it through pointers then works */
+  if(flash == MICO_INTERNAL_FLASH)
+    hint = (void *)(uintptr_t)emu->startAddress;
+  if(st.st_size != size)
+    require_action(ftruncate(fd, size) == 0, exit_close, flash_emu_log("Cannot resize %s", path));
+  emu->mem = mmap(hint, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(emu->mem == MAP_FAILED){
+    emu->mem = NULL;
+    flash_emu_log("Cannot map %s", path);
+    goto exit_close;
+  }
+  if(st.st_size != size)
+    memset(emu->mem, 0xFF, size);
+  flash_emu_log("%s flash 0x%08x-0x%08x on %s%s", flash_name[flash], (unsigned int)emu->startAddress,
+                (unsigned int)emu->endAddress, path, (hint && (void *)emu->mem != hint) ? ", not at its address" : "");
+
+exit_close:
+  close(fd);
+exit:
+  return emu->mem ? emu : NULL;
+}
+
+/* Public functions ----------------------------------------------------------*/
+OSStatus MicoFlashInitialize( mico_flash_t flash )
+{
+  return _FlashEmuGet(flash) ? kNoErr : kUnsupportedErr;
+}
+
+OSStatus MicoFlashErase( mico_flash_t flash, uint32_t StartAddress, uint32_t EndAddress )
+{
+  flash_emu_t *emu = _FlashEmuGet(flash);
+  uint32_t sector, endSector, size;
+
+  if(emu == NULL)
+    return kUnsupportedErr;
+  if(StartAddress < emu->startAddress || EndAddress > emu->endAddress || StartAddress > EndAddress)
+    return kParamErr;
+
+  /* Like the hardware, every sector touched by the range is erased completely */
+  endSector = _GetSector(emu, EndAddress);
+  for(sector = _GetSector(emu, StartAddress); sector <= endSector; sector++){
+    size = _SectorLength(emu, sector);
+    memset(emu->mem + _SectorStart(emu, sector) - emu->startAddress, 0xFF, size);
+    emu->sectorEraseCount[sector]++;
+    emu->stats.eraseCount++;
+    if(emu->sectorSize == NULL)
+      _Busy(emu, kSPIFlashEraseUs);
+    else
+      _Busy(emu, size <= 0x4000 ? kInternalEraseUs16K : size <= 0x10000 ? kInternalEraseUs64K : kInternalEraseUs128K);
+  }
+  return kNoErr;
+}
+
+OSStatus MicoFlashGetSector( mico_flash_t flash, uint32_t Address, uint32_t *StartAddress, uint32_t *EndAddress )
+{
+  flash_emu_t *emu = _FlashEmuGet(flash);
+  uint32_t sector;
+
+  if(emu == NULL)
+    return kUnsupportedErr;
+  if(Address < emu->startAddress || Address > emu->endAddress)
+    return kParamErr;
+
+  sector = _GetSector(emu, Address);
+  *StartAddress = _SectorStart(emu, sector);
+  *EndAddress = *StartAddress + _SectorLength(emu, sector) - 1;
+  return kNoErr;
+}
+
+OSStatus MicoFlashWrite(mico_flash_t flash, volatile uint32_t* FlashAddress, uint8_t* Data ,uint32_t DataLength)
+{
+  flash_emu_t *emu = _FlashEmuGet(flash);
+  uint8_t *cell;
+  uint32_t i, ops;
+
+  if(emu == NULL)
+    return kUnsupportedErr;
+  if(*FlashAddress < emu->startAddress || *FlashAddress + DataLength > emu->endAddress + 1)
+    return kParamErr;
+  if(DataLength == 0)
+    return kNoErr;
+
+  if(emu->programAnd){
+    ops = (*FlashAddress + DataLength - 1) / kSPIFlashPageSize - *FlashAddress / kSPIFlashPageSize + 1;
+    _Busy(emu, (uint64_t)ops * kSPIFlashProgramUs);
+  }else{
+    ops = DataLength / 4 + DataLength % 4;
+    _Busy(emu, (uint64_t)ops * kInternalProgramUs);
+  }
+  emu->stats.programCount += ops;
+
+  /* Programming only clears bits. The STM32 driver reads every cell back and
+     fails, an SPI NOR flash silently keeps the AND of old and new data. */
+  for(i = 0; i < DataLength; i++){
+    cell = emu->mem + *FlashAddress - emu->startAddress;
+    if((*cell & Data[i]) != Data[i] && emu->programAnd == false){
+      flash_emu_log("%s flash 0x%08x is not erased", flash_name[flash], (unsigned int)*FlashAddress);
+      return kWriteErr;
+    }
+    *cell &= Data[i];
+    *FlashAddress += 1;
+    emu->stats.programBytes++;
+  }
+  return kNoErr;
+}
+
+OSStatus MicoFlashRead(mico_flash_t flash, volatile uint32_t* FlashAddress, uint8_t* Data ,uint32_t DataLength)
+{
+  flash_emu_t *emu = _FlashEmuGet(flash);
+
+  if(emu == NULL)
+    return kUnsupportedErr;
+  if(*FlashAddress < emu->startAddress || *FlashAddress + DataLength > emu->endAddress + 1)
+    return kParamErr;
+
+  memcpy(Data, emu->mem + *FlashAddress - emu->startAddress, DataLength);
+  *FlashAddress += DataLength;
+  emu->stats.readBytes += DataLength;
+  if(emu->programAnd)
+    _Busy(emu, (uint64_t)DataLength * kSPIFlashReadNsPerByte / 1000);
+  return kNoErr;
+}
+
+OSStatus MicoFlashFinalize( mico_flash_t flash )
+{
+  flash_emu_t *emu = _FlashEmuGet(flash);
+
+  if(emu == NULL)
+    return kUnsupportedErr;
+  msync(emu->mem, emu->endAddress - emu->startAddress + 1, MS_ASYNC);
+  return kNoErr;
+}
+
+void MicoFlashEmuGetStats( mico_flash_t inFlash, mico_flash_emu_stats_t *outStats )
+{
+  flash_emu_t *emu = _FlashEmuGet(inFlash);
+
+  if(emu)
+    *outStats = emu->stats;
+  else
+    memset(outStats, 0, sizeof(mico_flash_emu_stats_t));
+}
+
+uint32_t MicoFlashEmuSectorEraseCount( mico_flash_t inFlash, uint32_t inAddress )
+{
+  flash_emu_t *emu = _FlashEmuGet(inFlash);
+
+  if(emu == NULL || inAddress < emu->startAddress || inAddress > emu->endAddress)
+    return 0;
+  return emu->sectorEraseCount[_GetSector(emu, inAddress)];
+}
+
+void MicoFlashEmuResetStats( mico_flash_t inFlash )
+{
+  flash_emu_t *emu = _FlashEmuGet(inFlash);
+
+  if(emu == NULL)
+    return;
+  memset(&emu->stats, 0, sizeof(mico_flash_emu_stats_t));
+  memset(emu->sectorEraseCount, 0, emu->sectorCount * sizeof(uint32_t));
+}
+
@@ -0,0 +1,62 @@
+/**
+******************************************************************************
+* @file    MicoFlashEmu.h
+* @author  William Xu
+* @version V1.0.0
+* @date    24-Oct-2014
+* @brief   This file provides the statistics interface of the host flash
+*          emulator, which implements the MICO flash driver on a workstation.
+******************************************************************************
+*
+*  The MIT License
+*  Copyright (c) 2014 MXCHIP Inc.
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is furnished
+*  to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in
+*  all copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+*  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
+*  IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************
+*/
+
+#ifndef __MICOFLASHEMU_H__
+#define __MICOFLASHEMU_H__
+
+#include "Common.h"
+#include "platform.h"
+
+/* Every flash is a file named after the flash, in the directory from the
+   MICO_FLASH_EMU_DIR environment variable or the current directory. A new
+   file is created erased. When MICO_FLASH_EMU_REALTIME is set, every
+   operation also sleeps for its modelled time. */
+
+typedef struct _mico_flash_emu_stats_t {
+  uint32_t          eraseCount;     /* Sector erases */
+  uint32_t          programCount;   /* Program operations, words on internal flash, pages on SPI flash */
+  uint32_t          programBytes;
+  uint32_t          readBytes;
+  uint64_t          busyTimeUs;     /* Modelled erase, program and read time */
+} mico_flash_emu_stats_t;
+
+/** Get the counters of a flash since start or the last reset */
+void MicoFlashEmuGetStats( mico_flash_t inFlash, mico_flash_emu_stats_t *outStats );
+
+/** Get how many times the sector that holds inAddress has been erased */
+uint32_t MicoFlashEmuSectorEraseCount( mico_flash_t inFlash, uint32_t inAddress );
+
+/** Clear the counters of a flash, including the erase count of every sector */
+void MicoFlashEmuResetStats( mico_flash_t inFlash );
+
+#endif
+
@@ -0,0 +1,256 @@
+/**
+******************************************************************************
+* @file    HashBench.c
+* @author  William Xu
+* @version V1.0.0
+* @date    30-Oct-2014
+* @brief   Host benchmark of the two SHA stacks in the SDK, SHAUtils and the
+*          RFC 6234 code under External/HMAC_HKDF.
+*
+*          Build on the workstation from the top of the SDK:
+*            gcc -O2 -D_SYS_SELECT_H -I Library/support -I External/HMAC_HKDF
+*                -I include -I include/MicoDrivers -I Demos/COM.Apple.HomeKit
+*                -I Platform -I Platform/include -I Platform/EMW3162
+*                -I Platform/Common/Cortex-M3 -I Platform/Common/Cortex-M3/STM32F2xx
+*                -I Platform/Common/Cortex-M3/STM32F2xx/STM32F2xx_Drv
+*                -I Platform/Common/Cortex-M3/STM32F2xx/STM32F2xx_Drv/STM32F2xx_StdPeriph_Driver/inc
+*                -I Platform/Common/Cortex-M3/STM32F2xx/STM32F2xx_Drv/STM32F2xx_StdPeriph_Driver/CMSIS
+*                -o HashBench Tools/HashBench/HashBench.c
+*                Library/support/SHAUtils.c External/HMAC_HKDF/sha1.c
+*                External/HMAC_HKDF/sha224-256.c External/HMAC_HKDF/sha384-512.c
+*                External/HMAC_HKDF/usha.c External/HMAC_HKDF/hmac.c
+*                External/HMAC_HKDF/hkdf.c
+*
+*          HashBench [message size]
+*            Checks both stacks against known digests and against each
+*            other for every length from 0 to 2093 bytes, and HKDF against
+*            RFC 5869. Then hashes a message of 4096 bytes by default over
+*            and over with each function, and prints the best throughput
+*            of 15 runs. HMAC and HKDF are measured on the short inputs of
+*            a HomeKit pair setup. Exits non zero when a check fails.
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "SHAUtils.h"
+#include "sha.h"
+
+#define kBenchRuns            15
+#define kBenchRunNs           20000000    /* Each run repeats the function for about 20 ms */
+#define kCrossCheckMaxLen     2093
+
+typedef void ( *bench_function_t )( const uint8_t *inData, size_t inLen, uint8_t *outDigest );
+
+typedef struct
+{
+  const char *        name;
+  bench_function_t    function;
+  size_t              length;             /* 0: the message size */
+} bench_t;
+
+static int benchFailures;
+
+static uint64_t _NowNs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void _SHAUtils_SHA1(const uint8_t *inData, size_t inLen, uint8_t *outDigest)
+{
+  SHA1_compat(inData, inLen, outDigest);
+}
+
+static void _SHAUtils_SHA512(const uint8_t *inData, size_t inLen, uint8_t *outDigest)
+{
+  SHA512_compat(inData, inLen, outDigest);
+}
+
+static void _SHAUtils_SHA3(const uint8_t *inData, size_t inLen, uint8_t *outDigest)
+{
+  SHA3_compat(inData, inLen, outDigest);
+}
+
+static void _RFC6234_SHA1(const uint8_t *inData, size_t inLen, uint8_t *outDigest)
+{
+  SHA1Context context;
+
+  SHA1Reset(&context);
+  SHA1Input(&context, inData, inLen);
+  SHA1Result(&context, outDigest);
+}
+
+static void _RFC6234_SHA256(const uint8_t *inData, size_t inLen, uint8_t *outDigest)
+{
+  SHA256Context context;
+
+  SHA256Reset(&context);
+  SHA256Input(&context, inData, inLen);
+  SHA256Result(&context, outDigest);
+}
+
+static void _RFC6234_SHA512(const uint8_t *inData, size_t inLen, uint8_t *outDigest)
+{
+  SHA512Context context;
+
+  SHA512Reset(&context);
+  SHA512Input(&context, inData, inLen);
+  SHA512Result(&context, outDigest);
+}
+
+/* A 32 byte key, as the session keys of a pair setup */
+static void _HMAC_SHA512(const uint8_t *inData, size_t inLen, uint8_t *outDigest)
+{
+  hmac(SHA512, inData, 32, inData, inLen, outDigest);
+}
+
+/* A 32 byte key from a shared secret, with a salt and an info string of a pair setup */
+static void _HKDF_SHA512(const uint8_t *inData, size_t inLen, uint8_t *outDigest)
+{
+  static const char salt[] = "Pair-Setup-Encrypt-Salt";
+  static const char info[] = "Pair-Setup-Encrypt-Info";
+
+  hkdf(SHA512, (const unsigned char *)salt, sizeof(salt) - 1, inData, inLen, (const unsigned char *)info,
+       sizeof(info) - 1, outDigest, 32);
+}
+
+static void _Check(const char *name, bool passed)
+{
+  printf("%s: %s\n", name, passed ? "OK" : "FAILED");
+  if(!passed)
+    benchFailures++;
+}
+
+static bool _IsHex(const uint8_t *digest, size_t len, const char *hex)
+{
+  char text[2 * USHAMaxHashSize + 1];
+  size_t i;
+
+  for(i = 0; i < len; i++)
+    sprintf(text + 2 * i, "%02x", digest[i]);
+  return strcmp(text, hex) == 0;
+}
+
+static void _CheckDigests(const uint8_t *message)
+{
+  static const uint8_t ikm[22] = { 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b,
+                                   0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b };
+  static const uint8_t salt[13] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c };
+  static const uint8_t info[10] = { 0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9 };
+  uint8_t a[USHAMaxHashSize], b[USHAMaxHashSize];
+  bool same1 = true, same512 = true;
+  size_t len;
+
+  _SHAUtils_SHA1((const uint8_t *)"abc", 3, a);
+  _RFC6234_SHA1((const uint8_t *)"abc", 3, b);
+  _Check("SHA-1 \"abc\"", _IsHex(a, SHA1HashSize, "a9993e364706816aba3e25717850c26c9cd0d89d")
+         && memcmp(a, b, SHA1HashSize) == 0);
+
+  _SHAUtils_SHA512((const uint8_t *)"abc", 3, a);
+  _RFC6234_SHA512((const uint8_t *)"abc", 3, b);
+  _Check("SHA-512 \"abc\"", _IsHex(a, SHA512HashSize, "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+         "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f") && memcmp(a, b, SHA512HashSize) == 0);
+
+  for(len = 0; len <= kCrossCheckMaxLen; len++){
+    _SHAUtils_SHA1(message, len, a);
+    _RFC6234_SHA1(message, len, b);
+    if(memcmp(a, b, SHA1HashSize) != 0)
+      same1 = false;
+    _SHAUtils_SHA512(message, len, a);
+    _RFC6234_SHA512(message, len, b);
+    if(memcmp(a, b, SHA512HashSize) != 0)
+      same512 = false;
+  }
+  _Check("SHA-1 SHAUtils and RFC 6234, 0 to 2093 bytes", same1);
+  _Check("SHA-512 SHAUtils and RFC 6234, 0 to 2093 bytes", same512);
+
+  /* RFC 5869 A.1 */
+  hkdf(SHA256, salt, sizeof(salt), ikm, sizeof(ikm), info, sizeof(info), a, 42);
+  _Check("HKDF-SHA256 RFC 5869 A.1", _IsHex(a, 42, "3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5bf"
+         "34007208d5b887185865"));
+}
+
+static void _Bench(const bench_t *bench, const uint8_t *message, size_t messageLen)
+{
+  uint8_t digest[USHAMaxHashSize];
+  size_t len = bench->length ? bench->length : messageLen;
+  uint64_t start, elapsed, best = 0;
+  uint32_t count, bestCount = 0;
+  int run;
+
+  for(run = 0; run < kBenchRuns; run++){
+    start = _NowNs();
+    count = 0;
+    do{
+      bench->function(message, len, digest);
+      count++;
+      elapsed = _NowNs() - start;
+    }while(elapsed < kBenchRunNs);
+    if(best == 0 || elapsed * bestCount < best * count){
+      best = elapsed;
+      bestCount = count;
+    }
+  }
+  printf("  %-20s %5u bytes  %10.0f /s  %8.1f MB/s\n", bench->name, (unsigned)len, bestCount * 1e9 / best,
+         (double)len * bestCount * 1e3 / best);
+}
+
+int main(int argc, char *argv[])
+{
+  static const bench_t benches[] =
+  {
+    { "SHAUtils SHA-1",     _SHAUtils_SHA1,     0 },
+    { "RFC6234 SHA-1",      _RFC6234_SHA1,      0 },
+    { "RFC6234 SHA-256",    _RFC6234_SHA256,    0 },
+    { "SHAUtils SHA-512",   _SHAUtils_SHA512,   0 },
+    { "RFC6234 SHA-512",    _RFC6234_SHA512,    0 },
+    { "SHAUtils SHA-3",     _SHAUtils_SHA3,     0 },
+    { "HMAC-SHA512",        _HMAC_SHA512,       64 },
+    { "HKDF-SHA512",        _HKDF_SHA512,       32 },
+  };
+  size_t messageLen = 4096, i;
+  uint8_t *message;
+  uint32_t seed = 0x2014;
+
+  if(argc > 1)
+    messageLen = strtoul(argv[1], NULL, 0);
+  if(messageLen < kCrossCheckMaxLen + 1)
+    i = kCrossCheckMaxLen + 1;
+  else
+    i = messageLen;
+  message = malloc(i);
+  if(message == NULL || messageLen == 0){
+    fprintf(stderr, "Usage: HashBench [message size]\n");
+    return 2;
+  }
+  while(i--){
+    seed = seed * 1103515245 + 12345;
+    message[i] = seed >> 16;
+  }
+
+  _CheckDigests(message);
+  for(i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+    _Bench(&benches[i], message, messageLen);
+
+  printf("%s\n", benchFailures ? "FAILED" : "ALL OK");
+  free(message);
+  return benchFailures ? 1 : 0;
+}
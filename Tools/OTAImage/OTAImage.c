@@ -0,0 +1,343 @@
+/**
+******************************************************************************
+* @file    OTAImage.c
+* @author  William Xu
+* @version V1.0.0
+* @date    27-Oct-2014
+* @brief   Host tool that makes OTA images for the MICO bootloader.
+*
+*          Build on the workstation from the top of the SDK:
+*            gcc -O2 -I Library/support -o OTAImage Tools/OTAImage/OTAImage.c
+*                Library/support/LZUtils.c Library/support/DeltaUtils.c
+*                Library/support/CheckSumUtils.c
+*
+*          OTAImage compress   <application.bin> <image.lz>
+*            Makes an LZ stream from a raw image. The OTA receivers mark an
+*            image that starts with the LZ stream header as compressed, and
+*            the bootloader decompresses it into the destination flash.
+*            An image the stream would not make smaller is written as it is,
+*            the receivers then mark it as a plain image.
+*          OTAImage decompress <image.lz> <application.bin>
+*            Checks an LZ stream the way the bootloader reads it.
+*          OTAImage diff       <running.bin> <application.bin> <image.patch>
+*            Makes a delta patch that turns the running image into the new
+*            one. The bootloader applies it against the application flash.
+*          OTAImage patch      <running.bin> <image.patch> <application.bin>
+*            Applies a delta patch the way the bootloader does.
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+#include "Common.h"
+#include "LZUtils.h"
+#include "DeltaUtils.h"
+#include "CheckSumUtils.h"
+
+#define ota_image_log(M, ...) fprintf(stderr, "OTAImage: " M "\n", ##__VA_ARGS__)
+
+typedef struct
+{
+  FILE *    file;
+  uint32_t  crc;
+  uint32_t  length;
+} output_context_t;
+
+typedef struct
+{
+  output_context_t  output;
+  delta_patcher_t   patcher;
+  const uint8_t *   old;
+} patch_context_t;
+
+static uint8_t * _ReadFile(const char *path, size_t *outLen)
+{
+  FILE *file = fopen(path, "rb");
+  uint8_t *buf = NULL;
+  long len;
+
+  if(file == NULL){
+    ota_image_log("Cannot open %s", path);
+    return NULL;
+  }
+  if(fseek(file, 0, SEEK_END) == 0 && (len = ftell(file)) >= 0 && fseek(file, 0, SEEK_SET) == 0){
+    buf = malloc(len ? len : 1);
+    if(buf && fread(buf, 1, len, file) != (size_t)len){
+      free(buf);
+      buf = NULL;
+    }
+    *outLen = len;
+  }
+  if(buf == NULL)
+    ota_image_log("Cannot read %s", path);
+  fclose(file);
+  return buf;
+}
+
+static OSStatus _WriteFile(const char *path, const void *header, size_t headerLen, const void *data, size_t dataLen)
+{
+  FILE *file = fopen(path, "wb");
+  OSStatus err = kNoErr;
+
+  if(file == NULL){
+    ota_image_log("Cannot create %s", path);
+    return kOpenErr;
+  }
+  if(fwrite(header, 1, headerLen, file) != headerLen || fwrite(data, 1, dataLen, file) != dataLen)
+    err = kWriteErr;
+  if(fclose(file) != 0)
+    err = kWriteErr;
+  if(err != kNoErr)
+    ota_image_log("Cannot write %s", path);
+  return err;
+}
+
+static int _Compress(const char *inPath, const char *outPath)
+{
+  lz_stream_header_t header;
+  uint8_t *image, *packed = NULL;
+  size_t imageLen, packedLen, bufSize;
+  OSStatus err = kNoMemoryErr;
+
+  image = _ReadFile(inPath, &imageLen);
+  if(image == NULL)
+    return 1;
+
+  /* Nine bytes per eight literals is the worst case */
+  bufSize = imageLen + imageLen / 8 + 32;
+  packed = malloc(bufSize);
+  if(packed)
+    err = LZ_Compress(image, imageLen, packed, bufSize, &packedLen);
+  if(err == kNoErr && sizeof(header) + packedLen >= imageLen){
+    /* A plain image that starts with a magic would be taken for a stream or a patch */
+    if(imageLen >= sizeof(uint32_t) && (ReadLittle32(image) == kLZStreamMagic || ReadLittle32(image) == kDeltaPatchMagic))
+      err = kFormatErr;
+    else
+      err = _WriteFile(outPath, image, 0, image, imageLen);
+    if(err == kNoErr)
+      printf("%s: %u bytes, not smaller as a stream (%u bytes), written as a plain image\n", outPath,
+             (unsigned)imageLen, (unsigned)(sizeof(header) + packedLen));
+    else
+      ota_image_log("Compress failed, err = %d", (int)err);
+    goto exit;
+  }
+  if(err == kNoErr){
+    header.magic = kLZStreamMagic;
+    header.length = imageLen;
+    header.crc = CRC32_Update(0, image, imageLen);
+    header.packedLength = packedLen;
+    err = _WriteFile(outPath, &header, sizeof(header), packed, packedLen);
+  }
+  if(err == kNoErr)
+    printf("%s: %u -> %u bytes (%.1f%%), crc 0x%08x\n", outPath, (unsigned)imageLen,
+           (unsigned)(sizeof(header) + packedLen), 100.0 * (sizeof(header) + packedLen) / (imageLen ? imageLen : 1),
+           (unsigned)header.crc);
+  else
+    ota_image_log("Compress failed, err = %d", (int)err);
+
+exit:
+  free(image);
+  if(packed) free(packed);
+  return err == kNoErr ? 0 : 1;
+}
+
+static OSStatus _DecompressOutput(void *inContext, const uint8_t *inData, size_t inLen)
+{
+  output_context_t *output = inContext;
+
+  output->crc = CRC32_Update(output->crc, inData, inLen);
+  output->length += inLen;
+  return fwrite(inData, 1, inLen, output->file) == inLen ? kNoErr : kWriteErr;
+}
+
+static int _Decompress(const char *inPath, const char *outPath)
+{
+  lz_stream_header_t header;
+  lz_decoder_t decoder;
+  output_context_t output = { NULL, 0, 0 };
+  uint8_t window[kLZWindowSize];
+  uint8_t *stream;
+  size_t streamLen;
+  OSStatus err = kFormatErr;
+
+  stream = _ReadFile(inPath, &streamLen);
+  if(stream == NULL)
+    return 1;
+  if(streamLen < sizeof(header))
+    goto exit;
+  memcpy(&header, stream, sizeof(header));
+  if(header.magic != kLZStreamMagic || header.packedLength != streamLen - sizeof(header))
+    goto exit;
+
+  output.file = fopen(outPath, "wb");
+  if(output.file == NULL){
+    err = kOpenErr;
+    goto exit;
+  }
+  LZ_DecodeInit(&decoder, window, _DecompressOutput, &output);
+  err = LZ_DecodeUpdate(&decoder, stream + sizeof(header), header.packedLength);
+  if(err == kNoErr)
+    err = LZ_DecodeFinal(&decoder);
+  if(fclose(output.file) != 0 && err == kNoErr)
+    err = kWriteErr;
+  if(err == kNoErr && (output.length != header.length || output.crc != header.crc))
+    err = kChecksumErr;
+  if(err == kNoErr)
+    printf("%s: %u bytes, crc 0x%08x\n", outPath, (unsigned)output.length, (unsigned)output.crc);
+
+exit:
+  if(err != kNoErr)
+    ota_image_log("Decompress failed, err = %d", (int)err);
+  free(stream);
+  return err == kNoErr ? 0 : 1;
+}
+
+static int _Diff(const char *oldPath, const char *newPath, const char *outPath)
+{
+  delta_patch_header_t header;
+  uint8_t *old, *image = NULL, *body = NULL, *packed = NULL;
+  size_t oldLen, imageLen, bodyLen = 0, packedLen, bufSize;
+  OSStatus err = kNoMemoryErr;
+
+  old = _ReadFile(oldPath, &oldLen);
+  if(old == NULL)
+    return 1;
+  image = _ReadFile(newPath, &imageLen);
+  if(image == NULL)
+    goto exit;
+
+  err = Delta_Diff(old, oldLen, image, imageLen, &body, &bodyLen);
+  if(err == kNoErr){
+    bufSize = bodyLen + bodyLen / 8 + 32;
+    packed = malloc(bufSize);
+    err = packed ? LZ_Compress(body, bodyLen, packed, bufSize, &packedLen) : kNoMemoryErr;
+  }
+  if(err == kNoErr){
+    header.magic = kDeltaPatchMagic;
+    header.oldLength = oldLen;
+    header.oldCRC = CRC32_Update(0, old, oldLen);
+    header.newLength = imageLen;
+    header.newCRC = CRC32_Update(0, image, imageLen);
+    header.packedLength = packedLen;
+    err = _WriteFile(outPath, &header, sizeof(header), packed, packedLen);
+  }
+  if(err == kNoErr)
+    printf("%s: %u -> %u bytes against %u bytes (%.1f%% of the image), crc 0x%08x\n", outPath, (unsigned)imageLen,
+           (unsigned)(sizeof(header) + packedLen), (unsigned)oldLen,
+           100.0 * (sizeof(header) + packedLen) / (imageLen ? imageLen : 1), (unsigned)header.newCRC);
+
+exit:
+  if(err != kNoErr)
+    ota_image_log("Diff failed, err = %d", (int)err);
+  free(old);
+  if(image) free(image);
+  if(body) free(body);
+  if(packed) free(packed);
+  return err == kNoErr ? 0 : 1;
+}
+
+static OSStatus _PatchRead(void *inContext, uint32_t inOffset, uint8_t *outData, size_t inLen)
+{
+  patch_context_t *patch = inContext;
+
+  memcpy(outData, patch->old + inOffset, inLen);
+  return kNoErr;
+}
+
+static OSStatus _PatchOutput(void *inContext, const uint8_t *inData, size_t inLen)
+{
+  patch_context_t *patch = inContext;
+
+  return _DecompressOutput(&patch->output, inData, inLen);
+}
+
+static OSStatus _PatchInput(void *inContext, const uint8_t *inData, size_t inLen)
+{
+  patch_context_t *patch = inContext;
+
+  return Delta_PatchUpdate(&patch->patcher, inData, inLen);
+}
+
+static int _Patch(const char *oldPath, const char *inPath, const char *outPath)
+{
+  delta_patch_header_t header;
+  lz_decoder_t decoder;
+  patch_context_t patch;
+  uint8_t window[kLZWindowSize];
+  uint8_t buffer[256];
+  uint8_t *old, *stream = NULL;
+  size_t oldLen, streamLen;
+  OSStatus err = kFormatErr;
+
+  memset(&patch, 0, sizeof(patch));
+  old = _ReadFile(oldPath, &oldLen);
+  if(old == NULL)
+    return 1;
+  stream = _ReadFile(inPath, &streamLen);
+  if(stream == NULL)
+    goto exit;
+  if(streamLen < sizeof(header))
+    goto exit;
+  memcpy(&header, stream, sizeof(header));
+  if(header.magic != kDeltaPatchMagic || header.packedLength != streamLen - sizeof(header))
+    goto exit;
+  if(header.oldLength != oldLen || header.oldCRC != CRC32_Update(0, old, oldLen)){
+    err = kMismatchErr;
+    goto exit;
+  }
+
+  patch.old = old;
+  patch.output.file = fopen(outPath, "wb");
+  if(patch.output.file == NULL){
+    err = kOpenErr;
+    goto exit;
+  }
+  Delta_PatchInit(&patch.patcher, header.oldLength, header.newLength, buffer, sizeof(buffer), _PatchRead,
+                  _PatchOutput, &patch);
+  LZ_DecodeInit(&decoder, window, _PatchInput, &patch);
+  err = LZ_DecodeUpdate(&decoder, stream + sizeof(header), header.packedLength);
+  if(err == kNoErr)
+    err = LZ_DecodeFinal(&decoder);
+  if(err == kNoErr)
+    err = Delta_PatchFinal(&patch.patcher);
+  if(fclose(patch.output.file) != 0 && err == kNoErr)
+    err = kWriteErr;
+  if(err == kNoErr && (patch.output.length != header.newLength || patch.output.crc != header.newCRC))
+    err = kChecksumErr;
+  if(err == kNoErr)
+    printf("%s: %u bytes, crc 0x%08x\n", outPath, (unsigned)patch.output.length, (unsigned)patch.output.crc);
+
+exit:
+  if(err != kNoErr)
+    ota_image_log("Patch failed, err = %d", (int)err);
+  free(old);
+  if(stream) free(stream);
+  return err == kNoErr ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+  if(argc == 4 && strcmp(argv[1], "compress") == 0)
+    return _Compress(argv[2], argv[3]);
+  if(argc == 4 && strcmp(argv[1], "decompress") == 0)
+    return _Decompress(argv[2], argv[3]);
+  if(argc == 5 && strcmp(argv[1], "diff") == 0)
+    return _Diff(argv[2], argv[3], argv[4]);
+  if(argc == 5 && strcmp(argv[1], "patch") == 0)
+    return _Patch(argv[2], argv[3], argv[4]);
+
+  fprintf(stderr, "Usage: OTAImage compress   <application.bin> <image.lz>\n"
+                  "       OTAImage decompress <image.lz> <application.bin>\n"
+                  "       OTAImage diff       <running.bin> <application.bin> <image.patch>\n"
+                  "       OTAImage patch      <running.bin> <image.patch> <application.bin>\n");
+  return 2;
+}
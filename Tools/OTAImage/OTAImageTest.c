@@ -0,0 +1,379 @@
+/**
+******************************************************************************
+* @file    OTAImageTest.c
+* @author  William Xu
+* @version V1.0.0
+* @date    30-Oct-2014
+* @brief   Host test that runs OTA images through the bootloader update() on
+*          the flash emulator.
+*
+*          Build on the workstation from the top of the SDK:
+*            gcc -O2 -D_SYS_SELECT_H -I Bootloader -I Library/support
+*                -I include -I include/MicoDrivers -I Platform -I Platform/include
+*                -I Platform/MICO_EVB_1 -I Platform/Common/Host
+*                -I Platform/Common/Drivers/spi_flash
+*                -I Platform/Common/Cortex-M3 -I Platform/Common/Cortex-M3/STM32F2xx
+*                -I Platform/Common/Cortex-M3/STM32F2xx/STM32F2xx_Drv
+*                -I Platform/Common/Cortex-M3/STM32F2xx/STM32F2xx_Drv/STM32F2xx_StdPeriph_Driver/inc
+*                -I Platform/Common/Cortex-M3/STM32F2xx/STM32F2xx_Drv/STM32F2xx_StdPeriph_Driver/CMSIS
+*                -o OTAImageTest Tools/OTAImage/OTAImageTest.c
+*                Platform/Common/Host/MicoDriverFlash.c Library/support/LZUtils.c
+*                Library/support/DeltaUtils.c Library/support/CheckSumUtils.c
+*
+*          OTAImageTest [application.bin]
+*            Uses the image, or a generated one that packs like ARM code. It
+*            is compressed the way OTAImage does, written to the update
+*            partition with its boot table record, and update() must then
+*            program it into the application partition byte for byte. A
+*            plain image, an image that does not compress and a corrupted
+*            stream are run too.
+*            A new version of the image is then made by inserting and
+*            changing code. The diff between the two is packed the way
+*            OTAImage diff does, and update() must patch the application
+*            partition from the old image to the new one. A patch for
+*            another image must be dropped, a corrupted one rejected, and a
+*            copy cut by a power loss finished on the next boot.
+*            The flash files are made in the directory from
+*            MICO_FLASH_EMU_DIR or the current one. Exits non zero when a
+*            case fails.
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Update_for_OTA.c"
+#include "MicoFlashEmu.h"
+
+#define ota_test_log(M, ...) fprintf(stderr, "OTAImageTest: " M "\n", ##__VA_ARGS__)
+
+#define kTestImageLength      0x30000
+
+static uint32_t testSeed = 0x2014;
+static int testFailures;
+
+uint32_t mico_get_time_no_os(void)
+{
+  return 0;
+}
+
+static uint32_t _Random(void)
+{
+  testSeed = testSeed * 1103515245 + 12345;
+  return testSeed >> 8;
+}
+
+/* Code-like data: sequences of instructions that recur with other operands,
+   and a literal pool of flash addresses every 256 bytes */
+static void _MakeImage(uint8_t *image, uint32_t length)
+{
+  uint8_t snippets[128][32];
+  uint32_t i, n, word;
+
+  for(i = 0; i < sizeof(snippets); i++)
+    snippets[i / 32][i % 32] = _Random();
+  for(i = 0; i + 4 <= length; ){
+    if(i % 256 >= 240){
+      word = APPLICATION_START_ADDRESS + (_Random() % length & ~1u);
+      WriteLittle32(image + i, word);
+      i += 4;
+    }else{
+      n = Min(8 + 2 * (_Random() % 12), length - i);
+      memcpy(image + i, snippets[_Random() % 128], n);
+      if(_Random() % 2)
+        image[i + (_Random() % n)] = _Random();
+      i += n;
+    }
+  }
+  for(; i < length; i++)
+    image[i] = 0xFF;
+}
+
+static uint8_t * _Compress(const uint8_t *image, uint32_t length, uint32_t *outLength)
+{
+  lz_stream_header_t header;
+  size_t bufSize = length + length / 8 + 32;
+  size_t packedLen;
+  uint8_t *stream;
+
+  stream = malloc(sizeof(header) + bufSize);
+  if(stream == NULL || LZ_Compress(image, length, stream + sizeof(header), bufSize, &packedLen) != kNoErr){
+    free(stream);
+    return NULL;
+  }
+  header.magic = kLZStreamMagic;
+  header.length = length;
+  header.crc = CRC32_Update(0, image, length);
+  header.packedLength = packedLen;
+  memcpy(stream, &header, sizeof(header));
+  *outLength = sizeof(header) + packedLen;
+  return stream;
+}
+
+static uint8_t * _Diff(const uint8_t *old, uint32_t oldLength, const uint8_t *image, uint32_t length,
+                        uint32_t *outLength)
+{
+  delta_patch_header_t header;
+  uint8_t *body = NULL, *patch = NULL;
+  size_t bodyLen, bufSize, packedLen;
+
+  if(Delta_Diff(old, oldLength, image, length, &body, &bodyLen) != kNoErr)
+    goto exit;
+  bufSize = bodyLen + bodyLen / 8 + 32;
+  patch = malloc(sizeof(header) + bufSize);
+  if(patch == NULL || LZ_Compress(body, bodyLen, patch + sizeof(header), bufSize, &packedLen) != kNoErr){
+    free(patch);
+    patch = NULL;
+    goto exit;
+  }
+  header.magic = kDeltaPatchMagic;
+  header.oldLength = oldLength;
+  header.oldCRC = CRC32_Update(0, old, oldLength);
+  header.newLength = length;
+  header.newCRC = CRC32_Update(0, image, length);
+  header.packedLength = packedLen;
+  memcpy(patch, &header, sizeof(header));
+  *outLength = sizeof(header) + packedLen;
+
+exit:
+  free(body);
+  return patch;
+}
+
+/* The next release: a function added in the first third, which moves the
+   code behind it, and a few bytes changed further on */
+static uint8_t * _MakeNewVersion(const uint8_t *old, uint32_t oldLength, uint32_t *outLength)
+{
+  uint32_t insertAt = oldLength / 3 & ~3u, inserted = 1200, i;
+  uint8_t *image;
+
+  *outLength = Min(oldLength + inserted, APPLICATION_FLASH_SIZE);
+  image = malloc(*outLength);
+  if(image == NULL)
+    return NULL;
+  memcpy(image, old, insertAt);
+  for(i = 0; i < inserted; i++)
+    image[insertAt + i] = _Random();
+  memcpy(image + insertAt + inserted, old + insertAt, *outLength - insertAt - inserted);
+  for(i = 0; i < 16; i++)
+    image[insertAt + inserted + _Random() % (*outLength - insertAt - inserted)] = _Random();
+  return image;
+}
+
+static void _WriteApplication(const uint8_t *image, uint32_t length)
+{
+  uint32_t address = APPLICATION_START_ADDRESS;
+
+  MicoFlashInitialize(MICO_FLASH_FOR_APPLICATION);
+  MicoFlashErase(MICO_FLASH_FOR_APPLICATION, APPLICATION_START_ADDRESS, APPLICATION_END_ADDRESS);
+  if(length)
+    MicoFlashWrite(MICO_FLASH_FOR_APPLICATION, &address, (uint8_t *)image, length);
+}
+
+/* What a receiver leaves behind: the image in the update partition and its record */
+static void _WriteUpdate(const uint8_t *image, uint32_t length, uint8_t upgradeType)
+{
+  boot_table_t record;
+  uint32_t address;
+
+  memset(&record, 0, sizeof(record));
+  record.start_address = UPDATE_START_ADDRESS;
+  record.length = length;
+  record.type = 'A';
+  record.upgrade_type = upgradeType;
+
+  MicoFlashInitialize(MICO_FLASH_FOR_UPDATE);
+  MicoFlashErase(MICO_FLASH_FOR_UPDATE, UPDATE_START_ADDRESS, UPDATE_END_ADDRESS);
+  address = UPDATE_START_ADDRESS;
+  MicoFlashWrite(MICO_FLASH_FOR_UPDATE, &address, (uint8_t *)image, length);
+  MicoFlashErase(MICO_FLASH_FOR_PARA, PARA_START_ADDRESS, PARA_END_ADDRESS);
+  address = PARA_START_ADDRESS;
+  MicoFlashWrite(MICO_FLASH_FOR_PARA, &address, (uint8_t *)&record, sizeof(record));
+}
+
+static bool _ApplicationIs(const uint8_t *image, uint32_t length)
+{
+  uint8_t *flash = malloc(length);
+  uint32_t address = APPLICATION_START_ADDRESS;
+  bool same;
+
+  MicoFlashRead(MICO_FLASH_FOR_APPLICATION, &address, flash, length);
+  same = memcmp(flash, image, length) == 0;
+  free(flash);
+  return same;
+}
+
+static bool _RecordCleared(void)
+{
+  boot_table_t record;
+  uint32_t address = PARA_START_ADDRESS;
+
+  MicoFlashRead(MICO_FLASH_FOR_PARA, &address, (uint8_t *)&record, sizeof(record));
+  return record.upgrade_type == 0xFF;
+}
+
+static OSStatus _Update(void)
+{
+  mico_flash_emu_stats_t updateStats, destStats;
+  OSStatus err;
+
+  MicoFlashEmuResetStats(MICO_FLASH_FOR_UPDATE);
+  MicoFlashEmuResetStats(MICO_FLASH_FOR_APPLICATION);
+  err = update();
+  MicoFlashEmuGetStats(MICO_FLASH_FOR_UPDATE, &updateStats);
+  MicoFlashEmuGetStats(MICO_FLASH_FOR_APPLICATION, &destStats);
+  printf("  err %d, update partition read %u bytes, application programmed %u bytes, flash busy %.2f s\n", (int)err,
+         (unsigned)updateStats.readBytes, (unsigned)destStats.programBytes,
+         (updateStats.busyTimeUs + destStats.busyTimeUs) / 1e6);
+  return err;
+}
+
+static void _Check(const char *name, bool passed)
+{
+  printf("%s: %s\n", name, passed ? "OK" : "FAILED");
+  if(!passed)
+    testFailures++;
+}
+
+static void _TestLZ(const uint8_t *image, uint32_t length)
+{
+  uint8_t *stream, *noise;
+  uint32_t streamLength, i;
+  OSStatus err;
+
+  stream = _Compress(image, length, &streamLength);
+  if(stream == NULL){
+    _Check("LZ image", false);
+    return;
+  }
+  printf("LZ image: %u -> %u bytes (%.1f%%)\n", (unsigned)length, (unsigned)streamLength,
+         100.0 * streamLength / length);
+
+  _WriteApplication(NULL, 0);
+  _WriteUpdate(stream, streamLength, 'Z');
+  err = _Update();
+  _Check("LZ image", err == kNoErr && _ApplicationIs(image, length) && _RecordCleared());
+
+  _WriteApplication(NULL, 0);
+  _WriteUpdate(image, length, 'U');
+  err = _Update();
+  _Check("Plain image", err == kNoErr && _ApplicationIs(image, length) && _RecordCleared());
+
+  /* The stream is rejected before the record is cleared, the next boot tries again */
+  _WriteApplication(NULL, 0);
+  stream[streamLength / 2] ^= 0x5A;
+  _WriteUpdate(stream, streamLength, 'Z');
+  err = _Update();
+  _Check("Corrupted LZ image", err != kNoErr && !_RecordCleared());
+  free(stream);
+
+  /* OTAImage ships such an image plain, the stream would grow by an eighth */
+  noise = malloc(length);
+  for(i = 0; i < length; i++)
+    noise[i] = _Random();
+  stream = _Compress(noise, length, &streamLength);
+  printf("Random image: %u -> %u bytes as a stream\n", (unsigned)length, stream ? (unsigned)streamLength : 0);
+  _WriteApplication(NULL, 0);
+  _WriteUpdate(noise, length, 'U');
+  err = _Update();
+  _Check("Random image", stream != NULL && streamLength >= length && err == kNoErr && _ApplicationIs(noise, length));
+  free(stream);
+  free(noise);
+}
+
+static void _TestPatch(const uint8_t *old, uint32_t oldLength)
+{
+  boot_table_t record;
+  uint8_t *image, *patch;
+  uint32_t length, patchLength, stage, address;
+  OSStatus err;
+
+  image = _MakeNewVersion(old, oldLength, &length);
+  patch = image ? _Diff(old, oldLength, image, length, &patchLength) : NULL;
+  if(patch == NULL){
+    _Check("Patch", false);
+    free(image);
+    return;
+  }
+  printf("Patch: %u -> %u bytes against %u bytes (%.1f%% of the image)\n", (unsigned)length, (unsigned)patchLength,
+         (unsigned)oldLength, 100.0 * patchLength / length);
+
+  _WriteApplication(old, oldLength);
+  _WriteUpdate(patch, patchLength, 'P');
+  err = _Update();
+  _Check("Patch", err == kNoErr && _ApplicationIs(image, length) && _RecordCleared());
+
+  /* The application is already the new one */
+  _WriteUpdate(patch, patchLength, 'P');
+  err = _Update();
+  _Check("Patch for another image", err == kNoErr && _ApplicationIs(image, length) && _RecordCleared());
+
+  _WriteApplication(old, oldLength);
+  patch[patchLength / 2] ^= 0x5A;
+  _WriteUpdate(patch, patchLength, 'P');
+  patch[patchLength / 2] ^= 0x5A;
+  err = _Update();
+  _Check("Corrupted patch", err != kNoErr && _ApplicationIs(old, oldLength) && !_RecordCleared());
+
+  /* Power lost halfway through the copy of the new image over the old one */
+  _WriteApplication(old, oldLength);
+  _WriteUpdate(patch, patchLength, 'P');
+  address = PARA_START_ADDRESS;
+  MicoFlashRead(MICO_FLASH_FOR_PARA, &address, (uint8_t *)&record, sizeof(record));
+  err = updateLogCheck(&record) == Log_NeedUpdate ? updateStageFromPatch(&record, &stage) : kGeneralErr;
+  _WriteApplication(image, length / 2);
+  if(err == kNoErr)
+    err = _Update();
+  _Check("Copy cut by a power loss", err == kNoErr && _ApplicationIs(image, length) && _RecordCleared());
+
+  free(image);
+  free(patch);
+}
+
+int main(int argc, char *argv[])
+{
+  uint8_t *image;
+  uint32_t length = kTestImageLength;
+  FILE *file;
+  long len;
+
+  if(argc > 1){
+    file = fopen(argv[1], "rb");
+    if(file == NULL || fseek(file, 0, SEEK_END) != 0 || (len = ftell(file)) <= 0 || len > APPLICATION_FLASH_SIZE){
+      ota_test_log("Cannot use %s", argv[1]);
+      return 2;
+    }
+    length = len;
+    image = malloc(length);
+    fseek(file, 0, SEEK_SET);
+    if(image == NULL || fread(image, 1, length, file) != length){
+      ota_test_log("Cannot read %s", argv[1]);
+      return 2;
+    }
+    fclose(file);
+  }else{
+    image = malloc(length);
+    if(image == NULL)
+      return 2;
+    _MakeImage(image, length);
+  }
+
+  _TestLZ(image, length);
+  _TestPatch(image, length);
+
+  printf("%s\n", testFailures ? "FAILED" : "ALL OK");
+  free(image);
+  return testFailures ? 1 : 0;
+}
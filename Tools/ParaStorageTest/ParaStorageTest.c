@@ -0,0 +1,214 @@
+/**
+******************************************************************************
+* @file    ParaStorageTest.c
+* @author  William Xu
+* @version V1.0.0
+* @date    30-Oct-2014
+* @brief   Host test that counts the flash erases of the parameter storage
+*          on the flash emulator.
+*
+*          Build on the workstation from the top of the SDK, with the
+*          platform and the application the parameters belong to:
+*            gcc -O2 -D_SYS_SELECT_H -I MICO -I External -I Library/support
+*                -I include -I include/MicoDrivers -I Platform -I Platform/include
+*                -I Platform/EMW3162 -I Demos/COM.MXCHIP.SPP -I Platform/Common/Host
+*                -I Platform/Common/Drivers/spi_flash
+*                -I Platform/Common/Cortex-M3 -I Platform/Common/Cortex-M3/STM32F2xx
+*                -I Platform/Common/Cortex-M3/STM32F2xx/STM32F2xx_Drv
+*                -I Platform/Common/Cortex-M3/STM32F2xx/STM32F2xx_Drv/STM32F2xx_StdPeriph_Driver/inc
+*                -I Platform/Common/Cortex-M3/STM32F2xx/STM32F2xx_Drv/STM32F2xx_StdPeriph_Driver/CMSIS
+*                -o ParaStorageTest Tools/ParaStorageTest/ParaStorageTest.c
+*                Platform/Common/Host/MicoDriverFlash.c
+*
+*          ParaStorageTest [updates]
+*            Starts from an erased parameter region and saves the
+*            configuration 1000 times by default, one small change each
+*            time. After every save the region is read back the way a boot
+*            does, and must give the content in RAM. A boot table change,
+*            the bootloader clearing the boot table, a torn record and a
+*            restore to default are run too. The erase count of the region
+*            is printed for each step. The flash files are made in the
+*            directory from MICO_FLASH_EMU_DIR or the current one. Exits non
+*            zero when a case fails.
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* An IAR keyword, GCC spells it as an attribute */
+#ifndef __weak
+#define __weak __attribute__((weak))
+#endif
+
+#include "MICOParaStorage.c"
+#include "MicoFlashEmu.h"
+
+#define para_test_log(M, ...) fprintf(stderr, "ParaStorageTest: " M "\n", ##__VA_ARGS__)
+
+#define kTestUpdates          1000
+
+static mico_Context_t testContext;
+static int testFailures;
+static int testReboots;
+static int testLockDepth;
+static bool testLockBalanced = true;
+
+/* Host stubs of the RTOS and system calls the storage uses */
+OSStatus mico_rtos_init_mutex(mico_mutex_t *mutex)
+{
+  *mutex = (mico_mutex_t)&testContext;
+  return kNoErr;
+}
+
+/* Every unlock must release a lock taken before */
+OSStatus mico_rtos_lock_mutex(mico_mutex_t *mutex)
+{
+  if(*mutex == NULL || testLockDepth++ != 0)
+    testLockBalanced = false;
+  return kNoErr;
+}
+
+OSStatus mico_rtos_unlock_mutex(mico_mutex_t *mutex)
+{
+  if(*mutex == NULL || --testLockDepth != 0)
+    testLockBalanced = false;
+  return kNoErr;
+}
+
+void MicoSystemReboot(void)
+{
+  testReboots++;
+}
+
+static void _Check(const char *name, bool passed)
+{
+  printf("%s: %s\n", name, passed ? "OK" : "FAILED");
+  if(!passed)
+    testFailures++;
+}
+
+static uint32_t _Erases(void)
+{
+  mico_flash_emu_stats_t stats;
+
+  MicoFlashEmuGetStats(MICO_FLASH_FOR_PARA, &stats);
+  MicoFlashEmuResetStats(MICO_FLASH_FOR_PARA);
+  return stats.eraseCount;
+}
+
+/* Read the region again as a boot does and compare it with the RAM content */
+static bool _Reloads(void)
+{
+  static mico_Context_t reloaded;
+
+  paraLogLoaded = false;
+  memset(&reloaded, 0, sizeof(reloaded));
+  if(MICOReadConfiguration(&reloaded) != kNoErr)
+    return false;
+  return memcmp(&reloaded.flashContentInRam, &testContext.flashContentInRam, sizeof(flash_content_t)) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+  mico_flash_emu_stats_t stats;
+  uint32_t updates = kTestUpdates, i, erases, address;
+  para_record_t torn;
+  bool reloads = true;
+
+  if(argc > 1)
+    updates = strtoul(argv[1], NULL, 0);
+  printf("Parameter region 0x%08x-0x%08x, %u bytes of content\n", (unsigned)PARA_START_ADDRESS,
+         (unsigned)PARA_END_ADDRESS, (unsigned)sizeof(flash_content_t));
+
+  /* An erased region is restored to default with records, the device then reboots */
+  MicoFlashInitialize(MICO_FLASH_FOR_PARA);
+  MicoFlashErase(MICO_FLASH_FOR_PARA, PARA_START_ADDRESS, PARA_END_ADDRESS);
+  _Erases();
+  MICOReadConfiguration(&testContext);
+  erases = _Erases();
+  printf("  %u erases\n", (unsigned)erases);
+  _Check("Restore default on an erased region", testReboots == 1 && erases == 0 && _Reloads());
+  /* Set by appRestoreDefault_callback() in an application */
+  testContext.flashContentInRam.appConfig.configDataVer = CONFIGURATION_VERSION;
+  MICOUpdateConfiguration(&testContext);
+
+  _Erases();
+  for(i = 0; i < updates; i++){
+    testContext.flashContentInRam.micoSystemConfig.name[i % 8] = 'a' + i % 26;
+    if(MICOUpdateConfiguration(&testContext) != kNoErr || !_Reloads())
+      reloads = false;
+  }
+  MicoFlashEmuGetStats(MICO_FLASH_FOR_PARA, &stats);
+  printf("  %u updates: %u erases, %u of them on the first sector, %u bytes programmed, flash busy %.2f s\n",
+         (unsigned)updates, (unsigned)stats.eraseCount,
+         (unsigned)MicoFlashEmuSectorEraseCount(MICO_FLASH_FOR_PARA, PARA_START_ADDRESS),
+         (unsigned)stats.programBytes, stats.busyTimeUs / 1e6);
+  erases = _Erases();
+  _Check("Small updates", reloads && erases * 10 <= updates);
+
+  /* The bootloader reads the boot table in place, a change is a new base */
+  testContext.flashContentInRam.bootTable.length = 0x1000;
+  testContext.flashContentInRam.bootTable.upgrade_type = 'U';
+  MICOUpdateConfiguration(&testContext);
+  erases = _Erases();
+  printf("  %u erases\n", (unsigned)erases);
+  _Check("Boot table change", erases == 1 && _Reloads());
+
+  /* As the bootloader does after an update: erase, then write the region back without the boot table */
+  {
+    static uint8_t region[PARA_FLASH_SIZE];
+
+    address = PARA_START_ADDRESS;
+    MicoFlashRead(MICO_FLASH_FOR_PARA, &address, region, PARA_FLASH_SIZE);
+    memset(region, 0xFF, sizeof(boot_table_t));
+    MicoFlashErase(MICO_FLASH_FOR_PARA, PARA_START_ADDRESS, PARA_END_ADDRESS);
+    address = PARA_START_ADDRESS;
+    MicoFlashWrite(MICO_FLASH_FOR_PARA, &address, region, PARA_FLASH_SIZE);
+  }
+  _Erases();
+  /* Then the application boots */
+  paraLogLoaded = false;
+  MICOReadConfiguration(&testContext);
+  testContext.flashContentInRam.micoSystemConfig.name[0] = 'X';
+  MICOUpdateConfiguration(&testContext);
+  erases = _Erases();
+  printf("  %u erases\n", (unsigned)erases);
+  _Check("Boot table cleared by the bootloader", erases == 0 && _Reloads());
+
+  /* Power lost after the header of a record: the record is ignored, the next save compacts */
+  torn.magic = kParaRecordMagic;
+  torn.offset = kParaDiffStart;
+  torn.length = 4;
+  torn.crc = 0;
+  address = paraLogEnd;
+  MicoFlashWrite(MICO_FLASH_FOR_PARA, &address, (uint8_t *)&torn, sizeof(torn));
+  reloads = _Reloads();
+  testContext.flashContentInRam.micoSystemConfig.name[1] = 'Y';
+  MICOUpdateConfiguration(&testContext);
+  erases = _Erases();
+  printf("  %u erases\n", (unsigned)erases);
+  _Check("Torn record", reloads && erases == 1 && _Reloads());
+
+  MICORestoreDefault(&testContext);
+  erases = _Erases();
+  printf("  %u erases\n", (unsigned)erases);
+  _Check("Restore default", erases <= 1 && _Reloads());
+
+  _Check("Lock taken before every unlock", testLockBalanced && testLockDepth == 0);
+
+  printf("%s\n", testFailures ? "FAILED" : "ALL OK");
+  return testFailures ? 1 : 0;
+}
@@ -0,0 +1,325 @@
+/**
+******************************************************************************
+* @file    YmodemLoopback.c
+* @author  William Xu
+* @version V1.0.0
+* @date    30-Oct-2014
+* @brief   Host harness that sends a file to the bootloader YMODEM receiver
+*          over a modelled UART and measures the throughput.
+*
+*          Build on the workstation from the top of the SDK:
+*            gcc -O2 -pthread -D_SYS_SELECT_H -I Bootloader -I Library/support
+*                -I include -I include/MicoDrivers -I Platform -I Platform/include
+*                -I Platform/MICO_EVB_1 -I Platform/Common/Host
+*                -I Platform/Common/Drivers/spi_flash
+*                -I Platform/Common/Cortex-M3 -I Platform/Common/Cortex-M3/STM32F2xx
+*                -I Platform/Common/Cortex-M3/STM32F2xx/STM32F2xx_Drv
+*                -I Platform/Common/Cortex-M3/STM32F2xx/STM32F2xx_Drv/STM32F2xx_StdPeriph_Driver/inc
+*                -I Platform/Common/Cortex-M3/STM32F2xx/STM32F2xx_Drv/STM32F2xx_StdPeriph_Driver/CMSIS
+*                -o YmodemLoopback Tools/YmodemLoopback/YmodemLoopback.c
+*                Platform/Common/Host/MicoDriverFlash.c Library/support/StringUtils.c
+*
+*          YmodemLoopback [-g] [baud rate] [file size]
+*            Sends a pseudo random file of 64K bytes at 115200 baud by
+*            default to Ymodem_Receive, which writes it to the update
+*            partition of the flash emulator in real time. -g selects
+*            YMODEM-G. The bytes reach the receiver at the pace of the line,
+*            the CRC of every packet is made bit by bit here. Exits non zero
+*            when the transfer fails or the flash content differs.
+******************************************************************************
+* @attention
+*
+* THE PRESENT FIRMWARE WHICH IS FOR GUIDANCE ONLY AIMS AT PROVIDING CUSTOMERS
+* WITH CODING INFORMATION REGARDING THEIR PRODUCTS IN ORDER FOR THEM TO SAVE
+* TIME. AS A RESULT, MXCHIP Inc. SHALL NOT BE HELD LIABLE FOR ANY
+* DIRECT, INDIRECT OR CONSEQUENTIAL DAMAGES WITH RESPECT TO ANY CLAIMS ARISING
+* FROM THE CONTENT OF SUCH FIRMWARE AND/OR THE USE MADE BY CUSTOMERS OF THE
+* CODING INFORMATION CONTAINED HEREIN IN CONNECTION WITH THEIR PRODUCTS.
+*
+* <h2><center>&copy; COPYRIGHT 2014 MXCHIP Inc.</center></h2>
+******************************************************************************
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+/* MICORTOS.h maps mico_thread_sleep to a sleep() of its own */
+#define sleep posix_sleep
+#include <unistd.h>
+#undef sleep
+
+/* The receiver scales the packet timeout with the baud rate of the line */
+static uint32_t baudRate = 115200;
+#define YMODEM_BAUD_RATE      baudRate
+
+#include "ymodem.c"
+#include "Debug.h"
+#include "MicoFlashEmu.h"
+
+#define loopback_log(M, ...) fprintf(stderr, "YmodemLoopback: " M "\n", ##__VA_ARGS__)
+
+#define kLoopbackChunk        16      /* Bytes handed to the receiver at once, a DMA half transfer */
+#define kLoopbackWaitMs       3000
+#define kLoopbackRetries      10
+
+uint8_t FileName[FILE_NAME_LENGTH];
+
+static uint8_t packetBuffer[PACKET_1K_SIZE];
+static int hostToDevice[2], deviceToHost[2];
+static uint64_t lineFreeUs;
+
+typedef struct
+{
+  const uint8_t * file;
+  uint32_t        length;
+  bool            streaming;
+  OSStatus        err;
+  uint64_t        startUs;
+} sender_context_t;
+
+static uint64_t _NowUs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* The UART of the bootloader, it waits for the whole size until the timeout */
+OSStatus MicoUartRecv( mico_uart_t uart, void* data, uint32_t size, uint32_t timeout )
+{
+  uint64_t deadline = _NowUs() + (uint64_t)timeout * 1000;
+  uint64_t now;
+  uint8_t *p = data;
+  struct pollfd pfd;
+  ssize_t n;
+
+  (void)uart;
+  while(size){
+    now = _NowUs();
+    pfd.fd = hostToDevice[0];
+    pfd.events = POLLIN;
+    if(poll(&pfd, 1, now < deadline ? (int)((deadline - now + 999) / 1000) : 0) <= 0)
+      return kTimeoutErr;
+    n = read(hostToDevice[0], p, size);
+    if(n <= 0)
+      return kReadErr;
+    p += n;
+    size -= n;
+  }
+  return kNoErr;
+}
+
+static uint16_t _CRC16Bitwise(const uint8_t *data, size_t len)
+{
+  uint16_t crc = 0;
+  int i;
+
+  while(len--){
+    crc ^= (uint16_t)(*data++) << 8;
+    for(i = 0; i < 8; i++)
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+  }
+  return crc;
+}
+
+/* Hand the bytes over when they have passed the line, ten bits each */
+static OSStatus _SendPaced(const uint8_t *data, size_t len)
+{
+  size_t chunk;
+  uint64_t now;
+
+  now = _NowUs();
+  if(lineFreeUs < now)
+    lineFreeUs = now;
+  while(len){
+    chunk = len < kLoopbackChunk ? len : kLoopbackChunk;
+    lineFreeUs += (uint64_t)chunk * 10 * 1000000 / baudRate;
+    now = _NowUs();
+    if(lineFreeUs > now)
+      usleep(lineFreeUs - now);
+    if(write(hostToDevice[1], data, chunk) != (ssize_t)chunk)
+      return kWriteErr;
+    data += chunk;
+    len -= chunk;
+  }
+  return kNoErr;
+}
+
+static OSStatus _RecvByte(uint8_t *c, int timeout)
+{
+  struct pollfd pfd = { deviceToHost[0], POLLIN, 0 };
+
+  if(poll(&pfd, 1, timeout) <= 0)
+    return kTimeoutErr;
+  return read(deviceToHost[0], c, 1) == 1 ? kNoErr : kReadErr;
+}
+
+/* Skip the requests the receiver repeats while it waits */
+static OSStatus _WaitFor(uint8_t expected, uint8_t request)
+{
+  OSStatus err;
+  uint8_t c;
+
+  do{
+    err = _RecvByte(&c, kLoopbackWaitMs);
+    require_noerr(err, exit);
+    require_action(c != CA, exit, err = kConnectionErr);
+    require_action(c != NAK, exit, err = kChecksumErr);
+  }while(c != expected && (c == request || c == CRC16 || c == CRC16_G));
+  require_action(c == expected, exit, err = kResponseErr);
+
+exit:
+  return err;
+}
+
+static OSStatus _SendPacket(uint8_t seqno, const uint8_t *data, size_t len, size_t size, bool acked, uint8_t request)
+{
+  uint8_t packet[PACKET_1K_SIZE + PACKET_OVERHEAD];
+  uint16_t crc;
+  OSStatus err;
+  int tries = 0;
+
+  packet[0] = size == PACKET_1K_SIZE ? STX : SOH;
+  packet[PACKET_SEQNO_INDEX] = seqno;
+  packet[PACKET_SEQNO_COMP_INDEX] = ~seqno;
+  memset(packet + PACKET_HEADER, seqno ? 0x1A : 0, size);
+  memcpy(packet + PACKET_HEADER, data, len);
+  crc = _CRC16Bitwise(packet + PACKET_HEADER, size);
+  packet[PACKET_HEADER + size] = crc >> 8;
+  packet[PACKET_HEADER + size + 1] = crc & 0xFF;
+
+  do{
+    err = _SendPaced(packet, size + PACKET_OVERHEAD);
+    require_noerr(err, exit);
+    if(!acked)
+      break;
+    err = _WaitFor(ACK, request);
+  }while(err == kChecksumErr && ++tries < kLoopbackRetries);
+
+exit:
+  return err;
+}
+
+static void *_SenderThread(void *arg)
+{
+  sender_context_t *sender = arg;
+  uint8_t request = sender->streaming ? CRC16_G : CRC16;
+  uint8_t header[PACKET_SIZE];
+  uint32_t offset, len;
+  uint8_t seqno = 1, c;
+  OSStatus err;
+
+  /* The receiver asks for the first packet every NAK_TIMEOUT */
+  err = _WaitFor(request, request);
+  require_noerr(err, exit);
+  sender->startUs = _NowUs();
+
+  memset(header, 0, sizeof(header));
+  len = sprintf((char *)header, "loopback.bin") + 1;
+  sprintf((char *)header + len, "%u ", (unsigned)sender->length);
+  err = _SendPacket(0, header, sizeof(header), PACKET_SIZE, true, request);
+  require_noerr(err, exit);
+  err = _WaitFor(request, request);
+  require_noerr(err, exit);
+
+  for(offset = 0; offset < sender->length; offset += len, seqno++){
+    len = sender->length - offset < PACKET_1K_SIZE ? sender->length - offset : PACKET_1K_SIZE;
+    err = _SendPacket(seqno, sender->file + offset, len, PACKET_1K_SIZE, !sender->streaming, request);
+    require_noerr(err, exit);
+  }
+
+  c = EOT;
+  err = _SendPaced(&c, 1);
+  require_noerr(err, exit);
+  err = _WaitFor(ACK, request);
+  require_noerr(err, exit);
+  err = _WaitFor(request, request);
+  require_noerr(err, exit);
+
+  /* An empty file name ends the session */
+  memset(header, 0, sizeof(header));
+  err = _SendPacket(0, header, sizeof(header), PACKET_SIZE, true, request);
+
+exit:
+  sender->err = err;
+  if(err != kNoErr)
+    loopback_log("Sender failed, err = %d", (int)err);
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  sender_context_t sender;
+  mico_flash_emu_stats_t stats;
+  pthread_t thread;
+  uint8_t *file, *readBack;
+  uint32_t i, address, seed = 0x2014;
+  int32_t received;
+  double seconds;
+  bool ok;
+
+  memset(&sender, 0, sizeof(sender));
+  sender.length = 0x10000;
+  if(argc > 1 && strcmp(argv[1], "-g") == 0){
+    sender.streaming = true;
+    argc--;
+    argv++;
+  }
+  if(argc > 1)
+    baudRate = strtoul(argv[1], NULL, 0);
+  if(argc > 2)
+    sender.length = strtoul(argv[2], NULL, 0);
+  if(baudRate == 0 || sender.length == 0 || sender.length > UPDATE_FLASH_SIZE){
+    fprintf(stderr, "Usage: YmodemLoopback [-g] [baud rate] [file size, up to %u]\n", (unsigned)UPDATE_FLASH_SIZE);
+    return 2;
+  }
+
+  file = malloc(sender.length);
+  readBack = malloc(sender.length);
+  if(file == NULL || readBack == NULL)
+    return 1;
+  for(i = 0; i < sender.length; i++){
+    seed = seed * 1103515245 + 12345;
+    file[i] = seed >> 16;
+  }
+  sender.file = file;
+
+  /* Flash erase and program take their modelled time, as on the module */
+  setenv("MICO_FLASH_EMU_REALTIME", "1", 0);
+  if(pipe(hostToDevice) != 0 || pipe(deviceToHost) != 0)
+    return 1;
+  /* Send_Byte() writes to stdout, it is the line back to the sender */
+  fflush(stdout);
+  if(dup2(deviceToHost[1], STDOUT_FILENO) < 0)
+    return 1;
+  setvbuf(stdout, NULL, _IONBF, 0);
+
+  MicoFlashInitialize(MICO_FLASH_FOR_UPDATE);
+  MicoFlashEmuResetStats(MICO_FLASH_FOR_UPDATE);
+  if(pthread_create(&thread, NULL, _SenderThread, &sender) != 0)
+    return 1;
+  received = Ymodem_Receive(packetBuffer, MICO_FLASH_FOR_UPDATE, UPDATE_START_ADDRESS, UPDATE_FLASH_SIZE,
+                            sender.streaming);
+  seconds = sender.startUs ? (_NowUs() - sender.startUs) / 1e6 : 0;
+  pthread_join(thread, NULL);
+  MicoFlashEmuGetStats(MICO_FLASH_FOR_UPDATE, &stats);
+
+  address = UPDATE_START_ADDRESS;
+  MicoFlashRead(MICO_FLASH_FOR_UPDATE, &address, readBack, sender.length);
+  ok = sender.err == kNoErr && received == (int32_t)sender.length && memcmp(file, readBack, sender.length) == 0
+       && strcmp((char *)FileName, "loopback.bin") == 0;
+
+  fprintf(stderr, "%s: %u bytes at %u baud: received %d, %.2f s, %.1f KB/s, %.0f%% of the line rate, "
+          "%u erases, flash busy %.2f s, %s\n", sender.streaming ? "YMODEM-G" : "YMODEM", (unsigned)sender.length,
+          (unsigned)baudRate, (int)received, seconds, seconds > 0 ? sender.length / seconds / 1024 : 0,
+          seconds > 0 ? 100.0 * sender.length / seconds / (baudRate / 10.0) : 0, (unsigned)stats.eraseCount,
+          stats.busyTimeUs / 1e6, ok ? "OK" : "FAILED");
+  free(file);
+  free(readBack);
+  return ok ? 0 : 1;
+}
@@ -94,6 +94,21 @@ OSStatus MicoFlashInitialize( mico_flash_t inFlash );
  */
 OSStatus MicoFlashErase(mico_flash_t inFlash, uint32_t inStartAddress, uint32_t inEndAddress);
 
+/** Get the erase sector that an address is belonged to
+ *
+ * @note Erase on any address in the sector erases the whole range, so a caller
+ *       can erase sectors one by one as it writes.
+ *
+ * @param  inFlash          : The target flash
+ * @param  inAddress        : An address on the flash
+ * @param  outStartAddress  : First address of the sector
+ * @param  outEndAddress    : Last address of the sector
+ *
+ * @return    kNoErr        : On success.
+ * @return    kParamErr     : If the address is not on the flash
+ */
+OSStatus MicoFlashGetSector(mico_flash_t inFlash, uint32_t inAddress, uint32_t *outStartAddress, uint32_t *outEndAddress);
+
 /** Write data to an area on a Flash
  *
  * @param  inFlash     	  : The target flash which should be written